@@ -112,6 +112,20 @@ void While::accept(Visitor* visitor) const {
     visitor->visit(this);
 }
 
+For::For(const std::string& name, std::shared_ptr<Expression> iterable, std::shared_ptr<Expression> body)
+    : name(name), iterable(iterable), body(body) {}
+
+void For::accept(Visitor* visitor) const {
+    visitor->visit(this);
+}
+
+Yield::Yield(std::shared_ptr<Expression> expr)
+    : expr(expr) {}
+
+void Yield::accept(Visitor* visitor) const {
+    visitor->visit(this);
+}
+
 Assign::Assign(const std::string& name, std::shared_ptr<Expression> expr)
     : name(name), expr(expr) {}
 
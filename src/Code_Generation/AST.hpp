@@ -1,6 +1,7 @@
 #ifndef AST_HPP
 #define AST_HPP
 
+#include "SourceMap.hpp"
 #include <string>
 #include <vector>
 #include <memory>
@@ -21,6 +22,8 @@ class New;
 class Let;
 class If;
 class While;
+class For;
+class Yield;
 class Assign;
 class Literal;
 class StringLiteral;
@@ -50,6 +53,8 @@ public:
     virtual void visit(const Let* node) = 0;
     virtual void visit(const If* node) = 0;
     virtual void visit(const While* node) = 0;
+    virtual void visit(const For* node) = 0;
+    virtual void visit(const Yield* node) = 0;
     virtual void visit(const Assign* node) = 0;
     
     // Literals and identifiers
@@ -67,6 +72,11 @@ public:
 // Base node class
 class ASTNode {
 public:
+    // Source position, as a byte offset into the class's file (set by the
+    // parser for classes, fields, methods, calls, new, for and yield,
+    // UNKNOWN_OFFSET if unknown; see SourceMap.hpp)
+    uint32_t offset = UNKNOWN_OFFSET;
+    
     virtual ~ASTNode() = default;
     virtual void accept(Visitor* visitor) const = 0;
 };
@@ -76,6 +86,9 @@ class Program : public ASTNode {
 public:
     std::vector<std::shared_ptr<Class>> classes;
     
+    // Compiled as a library (vsopc --emit-interface): no Main class needed
+    bool library = false;
+    
     Program() = default;
     void accept(Visitor* visitor) const override;
 };
@@ -88,6 +101,13 @@ public:
     std::vector<std::shared_ptr<Field>> fields;
     std::vector<std::shared_ptr<Method>> methods;
     
+    // Declared by an interface file: fields have no initializer and methods
+    // no body, the code lives in the library's precompiled object
+    bool imported = false;
+    
+    // Source file declaring the class
+    std::string file;
+    
     Class(const std::string& name, const std::string& parent = "Object");
     void accept(Visitor* visitor) const override;
 };
@@ -111,6 +131,15 @@ public:
     std::string return_type;
     std::shared_ptr<Block> body;
     
+    // Generator: the body yields values of the return type, which a for loop
+    // iterates over (set by the semantic analysis, or by the interface for an
+    // imported method)
+    bool generator = false;
+    
+    // Memoized: the results are cached per self and arguments (see
+    // TypeChecker::checkMemoMethods() for the methods that may be)
+    bool memo = false;
+    
     Method(const std::string& name, std::vector<std::shared_ptr<Formal>> formals, 
            const std::string& return_type, std::shared_ptr<Block> body);
     void accept(Visitor* visitor) const override;
@@ -220,6 +249,26 @@ public:
     void accept(Visitor* visitor) const override;
 };
 
+// For loop over the values yielded by a generator call
+class For : public Expression {
+public:
+    std::string name;
+    std::shared_ptr<Expression> iterable;
+    std::shared_ptr<Expression> body;
+    
+    For(const std::string& name, std::shared_ptr<Expression> iterable, std::shared_ptr<Expression> body);
+    void accept(Visitor* visitor) const override;
+};
+
+// Yield a value from a generator method
+class Yield : public Expression {
+public:
+    std::shared_ptr<Expression> expr;
+    
+    Yield(std::shared_ptr<Expression> expr);
+    void accept(Visitor* visitor) const override;
+};
+
 // Assignment
 class Assign : public Expression {
 public:
@@ -1,19 +1,35 @@
 #include "CodeGenerator.hpp"
+#include "Evaluator.hpp"
+#include "SourceMap.hpp"
+#include "VIRGenerator.hpp"
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/GlobalIFunc.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/FunctionComparator.h>
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/APInt.h>
 #include <llvm/ADT/StringRef.h>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <map>
 #include <sstream>
+#include <tuple>
 
 namespace VSOP {
 
@@ -58,6 +74,19 @@ bool CodeGenerator::generate(std::shared_ptr<Program> prog, bool include_runtime
         return false;
     }
     
+    // Remarks are located through the class and method each function
+    // compiles (customized copies are added by generateMethodBodies())
+    if (options.remarks) {
+        for (const auto& cls : program->classes) {
+            if (!cls || cls->imported) continue;
+            remark_sources[cls->name + "___new"] = {cls.get(), nullptr};
+            remark_sources[cls->name + "___init"] = {cls.get(), nullptr};
+            for (const auto& method : cls->methods) {
+                if (method) remark_sources[cls->name + "__" + method->name] = {cls.get(), method.get()};
+            }
+        }
+    }
+    
     try {
         // Include runtime code if requested
         if (include_runtime) {
@@ -66,10 +95,21 @@ bool CodeGenerator::generate(std::shared_ptr<Program> prog, bool include_runtime
         
         // Generate code in multiple passes
         generateClassTypes();
-        generateClassVTables();
         generateClassMethods();
+        generateClassVTables();
+        checkInterfaces();
+        generateClassConstructors();
+        if (options.lower_from_vir) {
+            generateVIR();
+        }
         generateMethodBodies();
         generateMainEntryPoint();
+        if (!options.multiversion_targets.empty()) {
+            multiversionMethods();
+        }
+        if (options.fold_identical_code && options.optimization_level > 0) {
+            foldIdenticalCode();
+        }
         
         // Verify the generated code
         std::string verify_error;
@@ -79,6 +119,10 @@ bool CodeGenerator::generate(std::shared_ptr<Program> prog, bool include_runtime
             return false;
         }
         
+        if (options.optimization_level > 0 || module->getFunction("llvm.coro.id")) {
+            optimizeModule();
+        }
+        
         return errors.empty();
     }
     catch (const std::exception& e) {
@@ -102,8 +146,8 @@ void CodeGenerator::includeRuntimeCode() {
     // Object vtable struct type (forward declaration)
     llvm::StructType* objectVTableType = llvm::StructType::create(*context, "ObjectVTable");
     
-    // Define Object struct: { ObjectVTable* }
-    objectType->setBody(llvm::PointerType::get(objectVTableType, 0));
+    // Define Object struct: { ObjectVTable*, refcount }
+    objectType->setBody({llvm::PointerType::get(objectVTableType, 0), llvm::Type::getInt32Ty(*context)});
     
     // Define Object vtable struct: function pointers for all methods
     std::vector<llvm::Type*> vtable_methods;
@@ -162,8 +206,18 @@ void CodeGenerator::includeRuntimeCode() {
                 false),
             0));
     
+    // _drop(Object* self) -> void
+    vtable_methods.push_back(
+        llvm::PointerType::get(
+            llvm::FunctionType::get(
+                llvm::Type::getVoidTy(*context),
+                {llvm::PointerType::get(objectType, 0)},
+                false),
+            0));
+    
     // Set the body of the vtable type
     objectVTableType->setBody(vtable_methods);
+    vtable_types["Object"] = objectVTableType;
     
     // Declare the methods from the runtime (matching the declarations in object.h)
     declareRuntimeMethod("Object__print", 
@@ -199,6 +253,62 @@ void CodeGenerator::includeRuntimeCode() {
         llvm::PointerType::get(objectType, 0), 
         {llvm::PointerType::get(objectType, 0)});
     
+    // Reference counting (refcount.c)
+    declareRuntimeMethod("Object___drop", 
+        llvm::Type::getVoidTy(*context), 
+        {llvm::PointerType::get(objectType, 0)});
+    
+    declareRuntimeMethod("Object___retain", 
+        llvm::Type::getVoidTy(*context), 
+        {llvm::PointerType::get(objectType, 0)});
+    
+    declareRuntimeMethod("Object___release", 
+        llvm::Type::getVoidTy(*context), 
+        {llvm::PointerType::get(objectType, 0)});
+    
+    declareRuntimeMethod("Object___alloc", 
+        llvm::Type::getInt8PtrTy(*context), 
+        {llvm::Type::getInt64Ty(*context)});
+    
+    declareRuntimeMethod("Object___free", 
+        llvm::Type::getVoidTy(*context), 
+        {llvm::PointerType::get(objectType, 0), llvm::Type::getInt64Ty(*context)});
+    
+    // SiteRegion: next and end of the site's current chunk, and its free list
+    declareRuntimeMethod("Object___site_alloc", 
+        llvm::Type::getInt8PtrTy(*context), 
+        {llvm::PointerType::get(llvm::StructType::get(llvm::Type::getInt8PtrTy(*context),
+                                                      llvm::Type::getInt8PtrTy(*context),
+                                                      llvm::Type::getInt8PtrTy(*context)), 0),
+         llvm::Type::getInt64Ty(*context)});
+    
+    declareRuntimeMethod("Object___site_free", 
+        llvm::Type::getVoidTy(*context), 
+        {llvm::PointerType::get(objectType, 0), llvm::Type::getInt64Ty(*context)});
+    
+    new llvm::GlobalVariable(
+        *module, 
+        llvm::Type::getInt1Ty(*context), 
+        false, 
+        llvm::GlobalValue::ExternalLinkage, 
+        nullptr, 
+        "Object___relative_vtables");
+    
+    // Runtime metrics (metrics.c)
+    if (options.metrics) {
+        declareRuntimeMethod("Object___register_calls",
+            llvm::Type::getVoidTy(*context),
+            {llvm::PointerType::get(llvm::Type::getInt8PtrTy(*context), 0), llvm::Type::getInt32Ty(*context)});
+        
+        new llvm::GlobalVariable(
+            *module,
+            llvm::Type::getInt64PtrTy(*context),
+            false,
+            llvm::GlobalValue::ExternalLinkage,
+            nullptr,
+            "Object___call_counts");
+    }
+    
     // The global vtable instance is also defined in the runtime
     new llvm::GlobalVariable(
         *module, 
@@ -207,6 +317,78 @@ void CodeGenerator::includeRuntimeCode() {
         llvm::GlobalValue::ExternalLinkage, 
         nullptr, 
         "Object___vtable");
+    
+    // Object's slots must match the runtime's ObjectVTable
+    builtin_methods["Object"] = {
+        "print", "printBool", "printInt32", "inputLine", "inputBool", "inputInt32", "_drop"
+    };
+    
+    // Other built-in classes (stringmap.h, file.h). Their own methods follow Object's
+    // ones in their runtime vtable.
+    declareRuntimeClass("StringMap", {"get", "put", "contains", "remove", "size"});
+    declareRuntimeClass("File", {"open", "nextLine", "nextInt32", "atEnd"});
+}
+
+// Declare a built-in class implemented by the runtime: its struct (only the
+// vtable pointer and the reference count are accessed from generated code),
+// its vtable type, methods, constructor, initializer, drop and vtable instance. The method types come from the
+// analyzer's signatures.
+void CodeGenerator::declareRuntimeClass(const std::string& class_name, const std::vector<std::string>& own_methods) {
+    const ClassDef& class_def = analyzer.getClassDefinitions().at(class_name);
+    llvm::StructType* class_type = llvm::StructType::create(*context, class_name);
+    llvm::StructType* vtable_type = llvm::StructType::create(*context, class_name + "VTable");
+    class_types[class_name] = class_type;
+    vtable_types[class_name] = vtable_type;
+    builtin_methods[class_name] = own_methods;
+    
+    class_type->setBody({llvm::PointerType::get(vtable_type, 0), llvm::Type::getInt32Ty(*context)});
+    llvm::PointerType* class_ptr = llvm::PointerType::get(class_type, 0);
+    
+    // Inherited entries keep the types of Object's vtable
+    std::vector<llvm::Type*> vtable_methods(vtable_types["Object"]->element_begin(),
+                                            vtable_types["Object"]->element_end());
+    for (const auto& method_name : own_methods) {
+        const MethodSignature& method_sig = class_def.methods.at(method_name);
+        std::vector<llvm::Type*> param_types = {class_ptr};
+        appendParamTypes(param_types, method_sig);
+        llvm::Type* return_type = getLLVMType(method_sig.returnType.toString());
+        declareRuntimeMethod(class_name + "__" + method_name, return_type, param_types);
+        vtable_methods.push_back(methods[class_name + "__" + method_name]->getType());
+    }
+    vtable_type->setBody(vtable_methods);
+    
+    declareRuntimeMethod(class_name + "___new", class_ptr, {});
+    declareRuntimeMethod(class_name + "___init", class_ptr, {class_ptr});
+    declareRuntimeMethod(class_name + "___drop", llvm::Type::getVoidTy(*context),
+                         {llvm::PointerType::get(class_types["Object"], 0)});
+    
+    new llvm::GlobalVariable(*module, vtable_type, true, llvm::GlobalValue::ExternalLinkage,
+                             nullptr, class_name + "___vtable");
+}
+
+// Runtime function implementing a method of the string type
+// (string_methods.h), taking the string as first argument. Declared on first
+// use, so that programs not using them do not mention them.
+llvm::Function* CodeGenerator::getStringMethod(const std::string& method_name) {
+    std::string func_name = "String__" + method_name;
+    auto method_it = methods.find(func_name);
+    if (method_it != methods.end()) return method_it->second;
+    
+    const MethodSignature& method_sig = analyzer.getStringMethods().at(method_name);
+    std::vector<llvm::Type*> param_types = {llvm::Type::getInt8PtrTy(*context)};
+    appendParamTypes(param_types, method_sig);
+    declareRuntimeMethod(func_name, getLLVMType(method_sig.returnType.toString()), param_types);
+    return methods[func_name];
+}
+
+// Append the LLVM types of the parameters of a method to the given ones.
+// Unit parameters are left out: a unit argument has a single possible value,
+// so that it carries nothing (see generateCall()).
+void CodeGenerator::appendParamTypes(std::vector<llvm::Type*>& param_types, const MethodSignature& method_sig) {
+    for (const auto& param : method_sig.parameters) {
+        if (param.type.toString() == "unit") continue;
+        param_types.push_back(getLLVMType(param.type.toString()));
+    }
 }
 
 // Helper method to declare runtime methods
@@ -222,34 +404,65 @@ void CodeGenerator::declareRuntimeMethod(const std::string& name, llvm::Type* re
 void CodeGenerator::generateClassTypes() {
     const auto& class_defs = analyzer.getClassDefinitions();
     
-    // First pass: create struct types (without body)
-    for (const auto& [class_name, _] : class_defs) {
-        if (class_name == "Object") continue; // Object already defined in includeRuntimeCode()
-        
-        if (class_name != "int32" && class_name != "bool" && 
-            class_name != "string" && class_name != "unit") {
-            class_types[class_name] = llvm::StructType::create(*context, class_name);
-        }
+    // The analyzer's field tables are unordered, but the object layout must
+    // follow declaration order, so keep the AST nodes at hand
+    class_nodes.clear();
+    for (const auto& cls : program->classes) {
+        if (cls) class_nodes[cls->name] = cls.get();
+    }
+    
+    // The analyzer orders the classes so that every parent comes before its
+    // children
+    class_order = analyzer.getClassOrder();
+    
+    if (options.inline_objects && options.optimization_level > 0) {
+        findInlineFields();
+    }
+    
+    // First pass: create struct types and vtable types (without body)
+    for (const auto& class_name : class_order) {
+        if (analyzer.isBuiltinClass(class_name)) continue; // Already defined in includeRuntimeCode()
+        class_types[class_name] = llvm::StructType::create(*context, class_name);
+        vtable_types[class_name] = llvm::StructType::create(*context, class_name + "_VTable");
     }
     
-    // Second pass: define struct bodies with fields
-    for (const auto& [class_name, class_def] : class_defs) {
-        if (class_name == "Object" || class_name == "int32" || class_name == "bool" || 
-            class_name == "string" || class_name == "unit") {
+    // Second pass: define struct bodies. An object is its vtable pointer and
+    // its reference count (as in the runtime's Object), followed by the fields
+    // of its ancestors (so that a pointer to a subclass can be used as a
+    // pointer to its parent) and then its own fields.
+    for (const auto& class_name : class_order) {
+        if (analyzer.isBuiltinClass(class_name)) {
+            class_fields[class_name] = {}; // No field visible from VSOP
             continue;
         }
         
-        std::vector<llvm::Type*> field_types;
+        const ClassDef& class_def = class_defs.at(class_name);
+        std::string parent_name = class_def.parent.empty() ? "Object" : class_def.parent;
         
-        // First field is always a pointer to the parent class
-        std::string parent_name = class_def.parent;
-        if (parent_name.empty()) parent_name = "Object";
+        class_fields[class_name] = class_fields[parent_name];
+        for (const auto& field : class_nodes.at(class_name)->fields) {
+            if (field && class_def.fields.count(field->name)) {
+                class_fields[class_name].push_back({field->name, field->type});
+            }
+        }
         
-        field_types.push_back(llvm::PointerType::get(class_types[parent_name], 0));
+        // Objects laid out inline are inherited along with their fields
+        auto& own_inline_fields = inline_fields[class_name];
+        for (const auto& [field_name, inline_class] : inline_fields[parent_name]) {
+            own_inline_fields[field_name] = inline_class;
+        }
         
-        // Add fields from the class definition
-        for (const auto& [field_name, field_type] : class_def.fields) {
-            field_types.push_back(getLLVMType(field_type.toString()));
+        std::vector<llvm::Type*> field_types;
+        field_types.push_back(llvm::PointerType::get(vtable_types[class_name], 0));
+        field_types.push_back(llvm::Type::getInt32Ty(*context));
+        for (const auto& [field_name, field_type] : class_fields[class_name]) {
+            // A unit field has a single value, which needs no storage
+            if (field_type == "unit") continue;
+            field_indices[class_name][field_name] = field_types.size();
+            auto inline_it = own_inline_fields.find(field_name);
+            field_types.push_back(inline_it != own_inline_fields.end()
+                ? class_types[inline_it->second]
+                : getLLVMType(field_type));
         }
         
         // Set the body of the struct type
@@ -260,403 +473,424 @@ void CodeGenerator::generateClassTypes() {
 void CodeGenerator::generateClassVTables() {
     const auto& class_defs = analyzer.getClassDefinitions();
     
-    // Step 1: First collect all methods across the class hierarchy for each class
-    std::unordered_map<std::string, std::vector<std::string>> class_vtable_methods;
-    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> class_method_implementations;
-    
-    // Initialize with Object methods
-    std::vector<std::string> object_methods = {
-        "print", "printInt32", "printBool", "inputInt32", "inputString", "inputBool", "inputLine"
-    };
-    
-    class_vtable_methods["Object"] = object_methods;
-    for (const auto& method_name : object_methods) {
-        class_method_implementations["Object"][method_name] = "Object__" + method_name;
-    }
+    // Step 1: collect the vtable slots of each class. A class starts with its
+    // parent's slots (same indices), overrides replace the implementation in
+    // place and new methods are appended in declaration order.
     
-    // Determine vtable methods for all classes
-    for (const auto& [class_name, class_def] : class_defs) {
-        // Skip Object (already processed) and primitive types
-        if (class_name == "Object" || class_name == "int32" || class_name == "bool" || 
-            class_name == "string" || class_name == "unit") {
-            continue;
-        }
+    // Built-in classes follow their runtime vtable (see includeRuntimeCode())
+    for (const auto& class_name : class_order) {
+        const ClassDef& class_def = class_defs.at(class_name);
+        std::string parent_name = class_def.parent.empty() ? "Object" : class_def.parent;
         
-        // Start with parent's methods
-        std::string parent_name = class_def.parent;
-        if (parent_name.empty()) parent_name = "Object";
+        // Inherit parent's vtable layout and implementations
+        if (class_name != "Object") {
+            vtables[class_name] = vtables[parent_name];
+            vtable_impls[class_name] = vtable_impls[parent_name];
+        }
         
-        // Inherit parent's vtable layout
-        if (class_vtable_methods.find(parent_name) != class_vtable_methods.end()) {
-            class_vtable_methods[class_name] = class_vtable_methods[parent_name];
-            
-            // Inherit parent's method implementations
-            for (const auto& [method_name, impl_name] : class_method_implementations[parent_name]) {
-                class_method_implementations[class_name][method_name] = impl_name;
+        if (analyzer.isBuiltinClass(class_name)) {
+            for (const auto& method_name : builtin_methods[class_name]) {
+                vtables[class_name].push_back(method_name);
+                vtable_impls[class_name][method_name] = class_name + "__" + method_name;
             }
-        } else {
-            reportError("Parent class not found in vtable creation: " + parent_name);
+            vtable_impls[class_name]["_drop"] = class_name + "___drop";
             continue;
         }
         
-        // Add/override methods from this class
-        for (const auto& [method_name, method_sig] : class_def.methods) {
-            // Check if this method is already in the vtable (override)
-            bool found = false;
-            for (size_t i = 0; i < class_vtable_methods[class_name].size(); ++i) {
-                if (class_vtable_methods[class_name][i] == method_name) {
-                    // Override the implementation
-                    class_method_implementations[class_name][method_name] = class_name + "__" + method_name;
-                    found = true;
-                    break;
-                }
-            }
-            
-            // If not found, add it as a new virtual method
-            if (!found) {
-                class_vtable_methods[class_name].push_back(method_name);
-                class_method_implementations[class_name][method_name] = class_name + "__" + method_name;
-            }
+        // Every class drops its own fields (see generateClassConstructors()).
+        // Without reference counting, objects are never dropped and keep
+        // Object's entry.
+        if (options.reference_counting) {
+            vtable_impls[class_name]["_drop"] = class_name + "___drop";
         }
-    }
-    
-    // Step 2: Create vtable type for each class
-    std::unordered_map<std::string, llvm::StructType*> vtable_types;
-    
-    // Create Object vtable type if not already created
-    if (!vtable_types.count("Object")) {
-        std::string vtable_name = "Object_VTable";
-        vtable_types["Object"] = llvm::StructType::create(*context, vtable_name);
         
-        // Create the function pointer types for the vtable
-        std::vector<llvm::Type*> vtable_elements;
-        for (const auto& method_name : class_vtable_methods["Object"]) {
-            // Get the function itself
-            std::string func_name = "Object__" + method_name;
-            llvm::Function* func = methods[func_name];
+        // Add/override methods from this class
+        for (const auto& method : class_nodes.at(class_name)->methods) {
+            if (!method || !class_def.methods.count(method->name)) continue;
             
-            if (!func) {
-                reportError("Function not found for vtable: " + func_name);
-                // Skip this method
-                continue;
+            auto& slots = vtables[class_name];
+            if (std::find(slots.begin(), slots.end(), method->name) == slots.end()) {
+                slots.push_back(method->name);
             }
-            
-            // Get the function type and create a function pointer
-            llvm::FunctionType* func_type = func->getFunctionType();
-            llvm::PointerType* func_ptr_type = llvm::PointerType::get(func_type, 0);
-            vtable_elements.push_back(func_ptr_type);
+            vtable_impls[class_name][method->name] = class_name + "__" + method->name;
         }
         
-        // Set the body of the vtable type
-        vtable_types["Object"]->setBody(vtable_elements);
+        // Inherited methods customized for this class
+        for (const auto& [method_name, method] : customized_methods[class_name]) {
+            vtable_impls[class_name][method_name] = class_name + "__" + method_name;
+        }
     }
     
-    // Create vtable types for all other classes
-    for (const auto& [class_name, vtable_methods] : class_vtable_methods) {
-        if (class_name == "Object" || class_name == "int32" || class_name == "bool" || 
-            class_name == "string" || class_name == "unit") {
-            continue;
+    // Step 2: create the vtable types and the global vtable instances
+    if (options.relative_vtables) {
+        // Each slot holds the 32-bit offset from the vtable to the function:
+        // the table is position independent, so it needs no relocation at load
+        // time and stays in shared read-only pages. Built-in classes get their
+        // own relative tables too, as the runtime's ones hold absolute pointers.
+        llvm::Type* int32_type = llvm::Type::getInt32Ty(*context);
+        llvm::Type* int64_type = llvm::Type::getInt64Ty(*context);
+        for (const auto& class_name : analyzer.getBuiltinClasses()) {
+            vtable_types[class_name] = llvm::StructType::create(*context, class_name + "_VTable");
         }
         
-        std::string vtable_name = class_name + "_VTable";
-        vtable_types[class_name] = llvm::StructType::create(*context, vtable_name);
-        
-        // Create the function pointer types for the vtable
-        std::vector<llvm::Type*> vtable_elements;
-        for (const auto& method_name : vtable_methods) {
-            // Get the implementation class and function
-            std::string impl_class_method = class_method_implementations[class_name][method_name];
-            llvm::Function* func = methods[impl_class_method];
+        for (const auto& class_name : class_order) {
+            const auto& slots = vtables[class_name];
+            vtable_types[class_name]->setBody(std::vector<llvm::Type*>(slots.size(), int32_type));
             
-            if (!func) {
-                reportError("Function not found for vtable: " + impl_class_method);
-                // Create a dummy function pointer type to maintain vtable layout
-                llvm::FunctionType* dummy_type = llvm::FunctionType::get(
-                    llvm::Type::getVoidTy(*context), {}, false);
-                vtable_elements.push_back(llvm::PointerType::get(dummy_type, 0));
+            llvm::GlobalVariable* vtable_global = new llvm::GlobalVariable(
+                *module, vtable_types[class_name], true,
+                llvm::GlobalValue::ExternalLinkage, nullptr, class_name + "_VTable_Instance");
+            vtable_global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+            vtable_global->setDSOLocal(true);
+            vtable_globals[class_name] = vtable_global;
+            
+            // Every module has its own copy of the built-in tables: let the
+            // linker keep one. Imported tables are defined by their library.
+            if (analyzer.isBuiltinClass(class_name)) {
+                vtable_global->setLinkage(llvm::GlobalValue::LinkOnceODRLinkage);
+            }
+            else if (isImported(class_name)) {
                 continue;
             }
             
-            // Get the function type and create a function pointer
-            llvm::FunctionType* func_type = func->getFunctionType();
-            llvm::PointerType* func_ptr_type = llvm::PointerType::get(func_type, 0);
-            vtable_elements.push_back(func_ptr_type);
-        }
-        
-        // Set the body of the vtable type
-        vtable_types[class_name]->setBody(vtable_elements);
-    }
-    
-    // Step 3: Create global vtable instances for each class
-    std::unordered_map<std::string, llvm::GlobalVariable*> vtable_globals;
-    
-    // Create vtable instance for Object
-    {
-        std::string vtable_global_name = "Object_VTable_Instance";
-        
-        // Create the vtable constant
-        std::vector<llvm::Constant*> vtable_elements;
-        for (const auto& method_name : class_vtable_methods["Object"]) {
-            std::string func_name = "Object__" + method_name;
-            llvm::Function* func = methods[func_name];
-            
-            if (!func) {
-                reportError("Function not found for vtable instance: " + func_name);
-                // Use null pointer as fallback
-                vtable_elements.push_back(llvm::ConstantPointerNull::get(
-                    llvm::PointerType::get(llvm::Type::getVoidTy(*context), 0)));
-                continue;
+            llvm::Constant* base = llvm::ConstantExpr::getPtrToInt(vtable_global, int64_type);
+            std::vector<llvm::Constant*> vtable_elements;
+            for (const auto& method_name : slots) {
+                const std::string& impl_name = vtable_impls[class_name][method_name];
+                llvm::Function* func = methods[impl_name];
+                if (!func) {
+                    reportError("Function not found for vtable instance: " + impl_name);
+                    vtable_elements.push_back(llvm::ConstantInt::get(int32_type, 0));
+                    continue;
+                }
+                
+                // The runtime is linked statically into the executable, so
+                // every method resolves locally and the difference is a
+                // link-time constant (no PLT or GOT indirection)
+                func->setDSOLocal(true);
+                llvm::Constant* target = llvm::ConstantExpr::getPtrToInt(func, int64_type);
+                vtable_elements.push_back(llvm::ConstantExpr::getTrunc(
+                    llvm::ConstantExpr::getSub(target, base), int32_type));
             }
             
-            vtable_elements.push_back(func);
+            vtable_global->setInitializer(llvm::ConstantStruct::get(vtable_types[class_name], vtable_elements));
         }
-        
-        // Create the constant struct
-        llvm::Constant* vtable_struct = llvm::ConstantStruct::get(
-            vtable_types["Object"], vtable_elements);
-        
-        // Create the global variable
-        llvm::GlobalVariable* vtable_global = new llvm::GlobalVariable(
-            *module, vtable_types["Object"], true,
-            llvm::GlobalValue::ExternalLinkage, vtable_struct, vtable_global_name);
-        
-        vtable_globals["Object"] = vtable_global;
+        return;
     }
     
-    // Create vtable instances for all other classes
-    for (const auto& [class_name, vtable_methods] : class_vtable_methods) {
-        if (class_name == "Object" || class_name == "int32" || class_name == "bool" || 
-            class_name == "string" || class_name == "unit") {
+    // Absolute vtables: the built-in instances come from the runtime
+    for (const auto& class_name : class_order) {
+        if (analyzer.isBuiltinClass(class_name)) {
+            vtable_globals[class_name] = module->getGlobalVariable(class_name + "___vtable");
             continue;
         }
         
-        std::string vtable_global_name = class_name + "_VTable_Instance";
-        
-        // Create the vtable constant
+        // Create the function pointer types and the constant entries
+        std::vector<llvm::Type*> vtable_element_types;
         std::vector<llvm::Constant*> vtable_elements;
-        for (const auto& method_name : vtable_methods) {
-            // Get the implementation function
-            std::string impl_class_method = class_method_implementations[class_name][method_name];
-            llvm::Function* func = methods[impl_class_method];
+        for (const auto& method_name : vtables[class_name]) {
+            const std::string& impl_name = vtable_impls[class_name][method_name];
+            llvm::Function* func = methods[impl_name];
             
             if (!func) {
-                reportError("Function not found for vtable instance: " + impl_class_method);
-                // Use null pointer as fallback
-                vtable_elements.push_back(llvm::ConstantPointerNull::get(
-                    llvm::PointerType::get(llvm::Type::getVoidTy(*context), 0)));
+                reportError("Function not found for vtable instance: " + impl_name);
+                // Use null pointer as fallback to maintain vtable layout
+                llvm::PointerType* dummy_type = llvm::Type::getInt8PtrTy(*context);
+                vtable_element_types.push_back(dummy_type);
+                vtable_elements.push_back(llvm::ConstantPointerNull::get(dummy_type));
                 continue;
             }
             
+            vtable_element_types.push_back(func->getType());
             vtable_elements.push_back(func);
         }
         
-        // Create the constant struct
-        llvm::Constant* vtable_struct = llvm::ConstantStruct::get(
-            vtable_types[class_name], vtable_elements);
+        // Set the body of the vtable type
+        vtable_types[class_name]->setBody(vtable_element_types);
         
-        // Create the global variable
+        // Create the global variable (imported ones are defined by their library)
         llvm::GlobalVariable* vtable_global = new llvm::GlobalVariable(
             *module, vtable_types[class_name], true,
-            llvm::GlobalValue::ExternalLinkage, vtable_struct, vtable_global_name);
+            llvm::GlobalValue::ExternalLinkage,
+            isImported(class_name) ? nullptr : llvm::ConstantStruct::get(vtable_types[class_name], vtable_elements),
+            class_name + "_VTable_Instance");
         
         vtable_globals[class_name] = vtable_global;
     }
-    
-    // Store vtable information for later use
-    this->vtable_types = vtable_types;
-    this->vtable_globals = vtable_globals;
-    
-    // Update class types to include vtable pointer
-    for (const auto& [class_name, class_type] : class_types) {
-        if (class_name == "int32" || class_name == "bool" || 
-            class_name == "string" || class_name == "unit") {
-            continue;
+}
+
+// Check that the layout and vtables computed from the declarations of the
+// imported classes are the ones their library was compiled with (otherwise the
+// interface and the object file are out of sync)
+void CodeGenerator::checkInterfaces() {
+    for (const auto& interface : interfaces) {
+        if (interface.relative_vtables != options.relative_vtables) {
+            reportError(std::string("library ") + interface.object_file + " was compiled " +
+                        (interface.relative_vtables ? "with" : "without") + " --relative-vtables");
         }
-        
-        // Skip if vtable type not found
-        if (vtable_types.find(class_name) == vtable_types.end()) {
-            continue;
+        if (interface.reference_counting != options.reference_counting) {
+            reportError(std::string("library ") + interface.object_file + " was compiled with --memory=" +
+                        (interface.reference_counting ? "rc" : "none"));
         }
         
-        // Get existing body elements
-        std::vector<llvm::Type*> body_elements;
-        if (class_type->isStructTy() && !class_type->isOpaque()) {
-            llvm::StructType* struct_type = llvm::cast<llvm::StructType>(class_type);
-            for (unsigned i = 0; i < struct_type->getNumElements(); ++i) {
-                body_elements.push_back(struct_type->getElementType(i));
+        for (const auto& cls : interface.classes) {
+            auto layout_it = interface.layouts.find(cls->name);
+            if (layout_it != interface.layouts.end() && layout_it->second != class_fields[cls->name]) {
+                reportError("layout of imported class " + cls->name + " does not match its interface");
             }
-        }
-        
-        // If body is empty (opaque type), add the vtable pointer as first element
-        if (body_elements.empty()) {
-            body_elements.push_back(llvm::PointerType::get(vtable_types[class_name], 0));
             
-            // Now add parent class fields and this class's fields
-            std::string parent_name = class_defs.at(class_name).parent;
-            if (parent_name.empty()) parent_name = "Object";
+            auto vtable_it = interface.vtables.find(cls->name);
+            if (vtable_it == interface.vtables.end()) continue;
             
-            // Add parent class fields - would need recursive traversal in a real implementation
-            // This is simplified
-            
-            // Add this class's fields
-            for (const auto& [field_name, field_type] : class_defs.at(class_name).fields) {
-                body_elements.push_back(getLLVMType(field_type.toString()));
+            std::vector<std::pair<std::string, std::string>> slots;
+            for (const auto& method_name : vtables[cls->name]) {
+                slots.push_back({method_name, vtable_impls[cls->name][method_name]});
+            }
+            if (vtable_it->second != slots) {
+                reportError("vtable of imported class " + cls->name + " does not match its interface");
+            }
+        }
+    }
+}
+
+Interface CodeGenerator::getInterface(const std::string& object_file) const {
+    Interface interface;
+    interface.object_file = object_file;
+    interface.relative_vtables = options.relative_vtables;
+    interface.reference_counting = options.reference_counting;
+    
+    // Parents first, so that the interface reads like a program
+    for (const auto& class_name : class_order) {
+        auto node_it = class_nodes.find(class_name);
+        if (node_it == class_nodes.end() || node_it->second->imported) continue;
+        const Class* cls = node_it->second;
+        const ClassDef& class_def = analyzer.getClassDefinitions().at(class_name);
+        
+        // Declarations only: drop initializers and bodies
+        auto decl = std::make_shared<Class>(class_name, class_def.parent.empty() ? "Object" : class_def.parent);
+        decl->imported = true;
+        for (const auto& field : cls->fields) {
+            if (field && class_def.fields.count(field->name)) {
+                decl->fields.push_back(std::make_shared<Field>(field->name, field->type));
+            }
+        }
+        for (const auto& method : cls->methods) {
+            if (method && class_def.methods.count(method->name)) {
+                auto decl_method = std::make_shared<Method>(method->name, method->formals,
+                                                            method->return_type, nullptr);
+                decl_method->generator = method->generator;
+                decl->methods.push_back(decl_method);
             }
-            
-            // Set the body of the class type
-            llvm::cast<llvm::StructType>(class_type)->setBody(body_elements);
+        }
+        interface.classes.push_back(decl);
+        
+        interface.layouts[class_name] = class_fields.at(class_name);
+        for (const auto& method_name : vtables.at(class_name)) {
+            interface.vtables[class_name].push_back({method_name, vtable_impls.at(class_name).at(method_name)});
         }
     }
+    
+    return interface;
 }
 
 // Generate LLVM function declarations for all VSOP methods
 void CodeGenerator::generateClassMethods() {
     const auto& class_defs = analyzer.getClassDefinitions();
     
-    for (const auto& [class_name, class_def] : class_defs) {
-        if (class_name == "int32" || class_name == "bool" || 
-            class_name == "string" || class_name == "unit") {
-            continue; // Skip primitive types
+    if (options.customize_methods) {
+        findCustomizedMethods();
+    }
+    
+    for (const auto& class_name : class_order) {
+        // Built-in methods are declared in includeRuntimeCode()
+        if (analyzer.isBuiltinClass(class_name)) continue;
+        
+        const ClassDef& class_def = class_defs.at(class_name);
+        for (const auto& method : class_nodes.at(class_name)->methods) {
+            if (!method) continue;
+            auto sig_it = class_def.methods.find(method->name);
+            if (sig_it == class_def.methods.end()) continue;
+            declareMethod(class_name, method->name, sig_it->second);
         }
         
-        for (const auto& [method_name, method_sig] : class_def.methods) {
-            // Skip methods from Object that we've already declared
-            if (class_name == "Object" && 
-                (method_name == "print" || method_name == "printInt32" || method_name == "inputInt32")) {
-                continue;
-            }
-            
-            // Create the method signature
-            std::vector<llvm::Type*> param_types;
-            
-            // First parameter is always 'self' (pointer to the class)
-            param_types.push_back(llvm::PointerType::get(class_types[class_name], 0));
+        // Customized copies of inherited methods, with the signature seen
+        // from this class
+        for (const auto& [method_name, method] : customized_methods[class_name]) {
+            declareMethod(class_name, method_name, analyzer.findMethodSignature(class_name, method_name).value());
+        }
+        
+        // Drop, defined in generateClassConstructors(). It takes an Object,
+        // like the runtime's ones, as it is only called through the vtable.
+        if (options.reference_counting) {
+            std::string drop_name = class_name + "___drop";
+            methods[drop_name] = llvm::Function::Create(
+                llvm::FunctionType::get(llvm::Type::getVoidTy(*context),
+                                        {llvm::PointerType::get(class_types["Object"], 0)}, false),
+                llvm::Function::ExternalLinkage, drop_name, module.get());
+        }
+    }
+}
+
+// Declare the function implementing a method of the given class
+llvm::Function* CodeGenerator::declareMethod(const std::string& class_name, const std::string& method_name,
+                                             const MethodSignature& method_sig) {
+    // Create the method signature
+    std::vector<llvm::Type*> param_types;
+    
+    // First parameter is always 'self' (pointer to the class)
+    param_types.push_back(llvm::PointerType::get(class_types[class_name], 0));
+    
+    // Add the rest of the parameters
+    appendParamTypes(param_types, method_sig);
+    
+    // Get return type (a generator returns the handle of its coroutine, see
+    // beginGenerator())
+    llvm::Type* return_type = method_sig.generator
+        ? builder->getInt8PtrTy()
+        : getLLVMType(method_sig.returnType.toString());
+    
+    // Create the function type
+    llvm::FunctionType* func_type = llvm::FunctionType::get(return_type, param_types, false);
+    
+    // Create the function
+    std::string func_name = class_name + "__" + method_name;
+    llvm::Function* func = llvm::Function::Create(
+        func_type, llvm::Function::ExternalLinkage, func_name, module.get());
+    
+    // Set parameter names
+    auto arg_it = func->arg_begin();
+    arg_it->setName("self"); // First argument is always 'self'
+    
+    for (const auto& param : method_sig.parameters) {
+        if (param.type.toString() == "unit") continue;
+        ++arg_it;
+        arg_it->setName(param.name);
+    }
+    
+    // Store the function in our methods map
+    methods[func_name] = func;
+    return func;
+}
+
+// Generate the allocator (<Class>___new), initializer (<Class>___init) and,
+// with reference counting, drop (<Class>___drop) of every class
+void CodeGenerator::generateClassConstructors() {
+    const auto& class_defs = analyzer.getClassDefinitions();
+    
+    // Declare them all first, as field initializers may instantiate any class
+    for (const auto& class_name : class_order) {
+        if (analyzer.isBuiltinClass(class_name)) continue;
+        
+        llvm::PointerType* class_ptr = llvm::PointerType::get(class_types[class_name], 0);
+        methods[class_name + "___new"] = llvm::Function::Create(
+            llvm::FunctionType::get(class_ptr, false),
+            llvm::Function::ExternalLinkage, class_name + "___new", module.get());
+        methods[class_name + "___init"] = llvm::Function::Create(
+            llvm::FunctionType::get(class_ptr, {class_ptr}, false),
+            llvm::Function::ExternalLinkage, class_name + "___init", module.get());
+    }
+    
+    for (const auto& class_name : class_order) {
+        if (analyzer.isBuiltinClass(class_name) || isImported(class_name)) continue;
+        
+        const ClassDef& class_def = class_defs.at(class_name);
+        std::string parent_name = class_def.parent.empty() ? "Object" : class_def.parent;
+        llvm::StructType* class_type = class_types[class_name];
+        
+        // ___new: allocate, install the vtable and the reference count, then
+        // initialize the fields. With site heaps, the objects it creates have
+        // a site of their own, like those of new expressions, so that drops
+        // can give every object back to its site.
+        llvm::Function* new_func = methods[class_name + "___new"];
+        builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", new_func));
+        llvm::Value* obj = generateAllocation(class_name,
+            options.site_heaps ? createSiteRegion(class_name + "___site") : nullptr);
+        builder->CreateRet(builder->CreateCall(methods[class_name + "___init"], {obj}));
+        
+        // ___drop: release the fields (inherited ones included), then free
+        // the object
+        if (options.reference_counting) {
+            llvm::Function* drop_func = methods[class_name + "___drop"];
+            builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", drop_func));
+            llvm::Value* self = builder->CreateBitCast(drop_func->arg_begin(),
+                llvm::PointerType::get(class_type, 0), "self");
+            emitReleaseFields(class_name, self);
+            builder->CreateCall(methods[options.site_heaps ? "Object___site_free" : "Object___free"],
+                {drop_func->arg_begin(), llvm::ConstantExpr::getSizeOf(class_type)});
+            builder->CreateRetVoid();
+        }
+        
+        // ___init: initialize the parent's fields, then our own ones. The
+        // vtable is left alone: Object___init would only set Object's one.
+        current_class = class_name;
+        current_function = methods[class_name + "___init"];
+        current_vars.clear();
+        current_var_types.clear();
+        builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", current_function));
+        llvm::Value* self = current_function->arg_begin();
+        self->setName("self");
+        
+        if (parent_name != "Object") {
+            llvm::Function* parent_init = methods[parent_name + "___init"];
+            builder->CreateCall(parent_init, {castValue(self, parent_init->getArg(0)->getType())});
+        }
+        
+        for (const auto& field : class_nodes.at(class_name)->fields) {
+            if (!field || !class_def.fields.count(field->name)) continue;
             
-            // Add the rest of the parameters
-            for (const auto& param : method_sig.parameters) {
-                param_types.push_back(getLLVMType(param.type.toString()));
+            // An object laid out inline is initialized in place, with a
+            // reference count of 0 so that retain and release ignore it
+            auto inline_it = inline_fields[class_name].find(field->name);
+            if (inline_it != inline_fields[class_name].end()) {
+                llvm::Value* inline_object = getFieldPointer(field->name);
+                emitObjectHeader(inline_it->second, inline_object, false);
+                builder->CreateCall(methods[inline_it->second + "___init"], {inline_object});
+                continue;
             }
             
-            // Get return type
-            llvm::Type* return_type = getLLVMType(method_sig.returnType.toString());
-            
-            // Create the function type
-            llvm::FunctionType* func_type = llvm::FunctionType::get(return_type, param_types, false);
-            
-            // Create the function
-            std::string func_name = class_name + "__" + method_name;
-            llvm::Function* func = llvm::Function::Create(
-                func_type, llvm::Function::ExternalLinkage, func_name, module.get());
+            llvm::Value* value = field->init_expr
+                ? takeOwnership(field->init_expr.get(), generateExpression(field->init_expr.get()))
+                : defaultValue(field->type);
+            if (!value) continue;
             
-            // Set parameter names
-            auto arg_it = func->arg_begin();
-            arg_it->setName("self"); // First argument is always 'self'
-            
-            for (size_t i = 0; i < method_sig.parameters.size(); ++i) {
-                ++arg_it;
-                arg_it->setName(method_sig.parameters[i].name);
-            }
-            
-            // Store the function in our methods map
-            methods[func_name] = func;
+            llvm::Value* field_ptr = getFieldPointer(field->name);
+            llvm::Type* field_type = class_type->getElementType(field_indices[class_name][field->name]);
+            builder->CreateStore(castValue(value, field_type), field_ptr);
         }
+        builder->CreateRet(self);
     }
+    
+    current_function = nullptr;
+    current_class = "";
 }
 
 // Generate the bodies of all methods
 void CodeGenerator::generateMethodBodies() {
-    const auto& class_defs = analyzer.getClassDefinitions();
-    
     // For each class in the program
     for (const auto& cls : program->classes) {
-        if (!cls) continue;
+        // Imported methods are compiled in their library
+        if (!cls || cls->imported) continue;
         
         current_class = cls->name;
         
-        // Skip primitive types
-        if (current_class == "int32" || current_class == "bool" || 
-            current_class == "string" || current_class == "unit") {
-            continue;
-        }
-        
-        // Create a map of method names to AST method nodes for this class
-        std::unordered_map<std::string, const Method*> ast_methods;
         for (const auto& method : cls->methods) {
-            if (method) {
-                ast_methods[method->name] = method.get();
+            if (!method) continue;
+            std::string func_name = current_class + "__" + method->name;
+            auto vir_it = vir_functions.find(func_name);
+            if (vir_it != vir_functions.end() && canLowerFromVIR(method.get(), vir_it->second)) {
+                generateMethodBodyFromVIR(method.get(), vir_it->second);
+            } else {
+                generateMethodBody(method.get(), func_name);
             }
         }
         
-        // For each method in the class definition
-        const auto& class_def = class_defs.find(current_class);
-        if (class_def == class_defs.end()) {
-            reportError("Class definition not found for " + current_class);
-            continue;
-        }
-        
-        for (const auto& method_entry : class_def->second.methods) {
-            std::string method_name = method_entry.first;
+        // Customized copies of inherited methods: the same body, with self of
+        // this class
+        for (const auto& [method_name, method] : customized_methods[current_class]) {
             std::string func_name = current_class + "__" + method_name;
-            
-            // Get the LLVM function
-            current_function = methods[func_name];
-            if (!current_function) {
-                reportError("Function not found: " + func_name);
-                continue;
-            }
-            
-            // Find the method in the AST
-            auto ast_method_it = ast_methods.find(method_name);
-            if (ast_method_it == ast_methods.end()) {
-                // This could be an inherited method that's not overridden, so skip it
-                continue;
-            }
-            
-            const Method* method = ast_method_it->second;
-            
-            // Create entry block
-            llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", current_function);
-            builder->SetInsertPoint(entry);
-            
-            // Clear the current variable map
-            current_vars.clear();
-            
-            // Add function arguments to the current variable map
-            auto arg_it = current_function->arg_begin();
-            arg_it->setName("self"); // First argument is always 'self'
-            
-            // Store 'self' in current_vars
-            current_vars["self"] = arg_it;
-            
-            // Add the rest of the parameters with their names
-            for (size_t i = 0; i < method->formals.size(); ++i) {
-                ++arg_it;
-                if (i < method->formals.size() && method->formals[i]) {
-                    arg_it->setName(method->formals[i]->name);
-                    current_vars[method->formals[i]->name] = arg_it;
-                }
-            }
-            
-            // Generate code for the method body
-            llvm::Value* body_val = nullptr;
-            if (method->body) {
-                body_val = generateExpression(method->body.get());
-            }
-            
-            // Create return instruction
-            if (current_function->getReturnType()->isVoidTy()) {
-                // For unit return type
-                builder->CreateRetVoid();
-            } 
-            else if (body_val) {
-                // Return the computed value
-                builder->CreateRet(body_val);
-            } 
-            else {
-                // If body didn't generate a value (error or unit), return default
-                llvm::Value* default_val = llvm::Constant::getNullValue(current_function->getReturnType());
-                builder->CreateRet(default_val);
-            }
+            auto source_it = remark_sources.find(clone_origins[func_name]);
+            if (source_it != remark_sources.end()) remark_sources[func_name] = source_it->second;
+            generateMethodBody(method, func_name);
         }
         
         current_function = nullptr;
@@ -665,90 +899,966 @@ void CodeGenerator::generateMethodBodies() {
     current_class = "";
 }
 
-// Generate the main entry point
-void CodeGenerator::generateMainEntryPoint() {
-    // Check if Main class and main method exist
-    if (!class_types.count("Main")) {
-        reportError("Class Main not found");
+// Generate the body of a method, for current_class, in the function of the
+// given name
+void CodeGenerator::generateMethodBody(const Method* method, const std::string& func_name) {
+    // Get the LLVM function
+    current_function = methods[func_name];
+    if (!current_function) {
+        reportError("Function not found: " + func_name);
         return;
     }
     
-    std::string main_func_name = "Main__main";
-    if (!methods.count(main_func_name)) {
-        reportError("Method main not found in class Main");
-        return;
-    }
+    // Create entry block
+    llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", current_function);
+    builder->SetInsertPoint(entry);
     
-    // Create C-compatible main function
-    llvm::FunctionType* main_type = llvm::FunctionType::get(
-        llvm::Type::getInt32Ty(*context), false);
-    llvm::Function* main_func = llvm::Function::Create(
-        main_type, llvm::Function::ExternalLinkage, "main", module.get());
+    // Clear the current variable map
+    current_vars.clear();
+    current_var_types.clear();
+    owned_params.clear();
+    
+    if (options.metrics) {
+        emitCallCounter(func_name, method);
+    }
+    
+    // A generator's frame is set up before anything else
+    if (method->generator) {
+        beginGenerator(method->return_type);
+    }
+    
+    // Parameters live in stack slots so that they can be assigned to (mem2reg
+    // turns them back into registers). Arguments are borrowed from the
+    // caller, so a parameter that is assigned to takes a reference of its
+    // own, as its slot may end up holding another object. So does every
+    // parameter of a generator, which runs after its call has returned.
+    // A unit parameter has no argument (see appendParamTypes()), and is a
+    // unit variable.
+    auto arg_it = current_function->arg_begin();
+    for (size_t i = 0; i < method->formals.size(); ++i) {
+        const auto& formal = method->formals[i];
+        if (formal && formal->type == "unit") {
+            current_vars[formal->name] = nullptr;
+            current_var_types[formal->name] = formal->type;
+            continue;
+        }
+        ++arg_it;
+        if (!formal) continue;
+        
+        llvm::AllocaInst* slot = createEntryAlloca(arg_it->getType(), formal->name);
+        builder->CreateStore(arg_it, slot);
+        current_vars[formal->name] = slot;
+        current_var_types[formal->name] = formal->type;
+        if (isCounted(formal->type)
+            && (method->generator || (method->body && isAssignedIn(method->body.get(), formal->name)))) {
+            emitRetain(arg_it);
+            owned_params.push_back(slot);
+        }
+    }
     
-    llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", main_func);
-    builder->SetInsertPoint(entry);
+    // A generator keeps self too, then returns to its caller until the first
+    // value is asked for
+    if (method->generator) {
+        emitRetain(current_function->arg_begin());
+        emitSuspend(false);
+    }
     
-    // Create Main instance
-    llvm::Function* main_ctor = methods["Main___new"];
-    if (!main_ctor) {
-        main_ctor = methods["Object___new"]; // Fallback
+    // Generate code for the method body. The result is a new reference for
+    // the caller.
+    llvm::Value* body_val = nullptr;
+    if (method->body) {
+        body_val = method->memo ? generateMemoizedBody(method, func_name) : generateExpression(method->body.get());
+        if (method->generator) {
+            releaseTemporary(method->body.get(), body_val);
+        } else if (isCounted(method->return_type)) {
+            body_val = takeOwnership(method->body.get(), body_val);
+        } else {
+            releaseTemporary(method->body.get(), body_val);
+        }
+    }
+    for (llvm::AllocaInst* slot : owned_params) {
+        emitRelease(builder->CreateLoad(slot->getAllocatedType(), slot));
     }
     
-    llvm::Value* main_instance = nullptr;
-    if (main_ctor) {
-        main_instance = builder->CreateCall(main_ctor);
-    } else {
-        // Fallback: allocate Main manually
-        // 1. Get or declare malloc function
-        llvm::Function* mallocFunc = module->getFunction("malloc");
-        if (!mallocFunc) {
-            llvm::FunctionType* mallocType = llvm::FunctionType::get(
-                builder->getInt8PtrTy(),  
-                {builder->getInt64Ty()},  
-                false                     
-            );
-            mallocFunc = llvm::Function::Create(
-                mallocType,
-                llvm::Function::ExternalLinkage,
-                "malloc",
-                module.get()
-            );
-        }
-        
-        // 2. Calculate the size to allocate
-        llvm::Value* allocSize = llvm::ConstantExpr::getSizeOf(class_types["Main"]);
-        
-        // 3. Create the call to malloc
-        llvm::Value* main_alloc = builder->CreateCall(mallocFunc, {allocSize}, "main_instance");
-        
-        // 4. Cast the result to the appropriate type
-        main_instance = builder->CreateBitCast(
-            main_alloc, 
-            llvm::PointerType::get(class_types["Main"], 0)
-        );
-    }
-    
-    // Call Main.main()
-    llvm::Function* main_method = methods[main_func_name];
-    llvm::Value* result = builder->CreateCall(main_method, {main_instance});
+    if (method->generator) {
+        emitRelease(current_function->arg_begin());
+        endGenerator();
+        return;
+    }
     
-    // Return the result
-    builder->CreateRet(result);
+    // Create return instruction
+    if (current_function->getReturnType()->isVoidTy()) {
+        // For unit return type
+        builder->CreateRetVoid();
+    } 
+    else if (body_val) {
+        // Return the computed value
+        builder->CreateRet(castValue(body_val, current_function->getReturnType()));
+    } 
+    else {
+        // If body didn't generate a value (error or unit), return default
+        llvm::Value* default_val = llvm::Constant::getNullValue(current_function->getReturnType());
+        builder->CreateRet(default_val);
+    }
 }
 
-// Output the generated LLVM IR
-void CodeGenerator::dumpIR(std::ostream& os) {
-    std::string output;
-    llvm::raw_string_ostream llvm_stream(output);
-    module->print(llvm_stream, nullptr);
-    os << output;
-}
+// Memo methods ---------------------------------------------------------------
+//
+// A memo method (which TypeChecker::checkMemoMethods() checks is pure) looks
+// self and its arguments up in a cache of its own before running its body,
+// and records the result when it runs it (see runtime/runtime/memo.h). Keys
+// and results are widened to 64-bit words: memo methods only take and return
+// int32, bool and string values.
 
-bool CodeGenerator::writeNativeExecutable(const std::string& output_file) {
-    // First, output the LLVM IR to a temporary file
-    std::string temp_ir_file = output_file + ".ll";
-    std::error_code EC;
-    llvm::raw_fd_ostream ir_out(temp_ir_file, EC);
+llvm::Value* CodeGenerator::generateMemoizedBody(const Method* method, const std::string& func_name) {
+    llvm::Type* word_type = builder->getInt64Ty();
+    llvm::PointerType* table_type = builder->getInt8PtrTy();
+    if (!methods.count("Object___memo_lookup")) {
+        llvm::Type* table_ptr_type = llvm::PointerType::get(table_type, 0);
+        llvm::Type* key_ptr_type = llvm::PointerType::get(word_type, 0);
+        declareRuntimeMethod("Object___memo_lookup", builder->getInt1Ty(),
+                             {table_ptr_type, key_ptr_type, builder->getInt32Ty(), key_ptr_type});
+        declareRuntimeMethod("Object___memo_store", builder->getVoidTy(),
+                             {table_ptr_type, key_ptr_type, builder->getInt32Ty(), word_type});
+    }
+    llvm::GlobalVariable* table = new llvm::GlobalVariable(
+        *module, table_type, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantPointerNull::get(table_type), func_name + "___memo");
+    
+    auto toWord = [&](llvm::Value* value) -> llvm::Value* {
+        if (value->getType()->isPointerTy()) return builder->CreatePtrToInt(value, word_type);
+        if (value->getType()->isIntegerTy(1)) return builder->CreateZExt(value, word_type);
+        return builder->CreateSExt(value, word_type);
+    };
+    
+    // The key: self, then the arguments
+    std::vector<llvm::Value*> words;
+    for (llvm::Argument& arg : current_function->args()) {
+        words.push_back(toWord(&arg));
+    }
+    llvm::ArrayType* key_type = llvm::ArrayType::get(word_type, words.size());
+    llvm::AllocaInst* key = createEntryAlloca(key_type, "memo_key");
+    for (size_t i = 0; i < words.size(); ++i) {
+        builder->CreateStore(words[i], builder->CreateConstInBoundsGEP2_32(key_type, key, 0, i));
+    }
+    llvm::Value* key_ptr = builder->CreateConstInBoundsGEP2_32(key_type, key, 0, 0);
+    llvm::Value* key_size = builder->getInt32(words.size());
+    llvm::AllocaInst* cached_slot = createEntryAlloca(word_type, "memo_cached");
+    
+    llvm::BasicBlock* hit_bb = llvm::BasicBlock::Create(*context, "memo.hit", current_function);
+    llvm::BasicBlock* miss_bb = llvm::BasicBlock::Create(*context, "memo.miss", current_function);
+    llvm::BasicBlock* end_bb = llvm::BasicBlock::Create(*context, "memo.end", current_function);
+    llvm::Value* hit = builder->CreateCall(methods["Object___memo_lookup"], {table, key_ptr, key_size, cached_slot}, "hit");
+    builder->CreateCondBr(hit, hit_bb, miss_bb);
+    
+    // Cached result, narrowed back to the return type
+    llvm::Type* return_type = current_function->getReturnType();
+    builder->SetInsertPoint(hit_bb);
+    llvm::Value* cached = builder->CreateLoad(word_type, cached_slot, "cached");
+    cached = return_type->isPointerTy()
+        ? builder->CreateIntToPtr(cached, return_type)
+        : builder->CreateTrunc(cached, return_type);
+    builder->CreateBr(end_bb);
+    
+    // Computed result, recorded
+    builder->SetInsertPoint(miss_bb);
+    llvm::Value* computed = generateExpression(method->body.get());
+    if (!computed) return nullptr;
+    computed = castValue(computed, return_type);
+    builder->CreateCall(methods["Object___memo_store"], {table, key_ptr, key_size, toWord(computed)});
+    llvm::BasicBlock* computed_bb = builder->GetInsertBlock();
+    builder->CreateBr(end_bb);
+    
+    builder->SetInsertPoint(end_bb);
+    llvm::PHINode* result = builder->CreatePHI(return_type, 2, "memo_result");
+    result->addIncoming(cached, hit_bb);
+    result->addIncoming(computed, computed_bb);
+    
+    addRemark(Remark::Kind::PASSED, "vsop-memo", "Memoized", func_name, method,
+              "results cached per self and arguments");
+    return result;
+}
+
+// Lowering from VIR ----------------------------------------------------------
+//
+// With --from-vir, the program is also lowered to VIR (see VIRGenerator),
+// which the default VIR passes optimize from -O1 on, and the methods whose
+// code only depends on their VIR are generated from it rather than from the
+// typed AST. Each VIR value becomes one LLVM value (unit values none), and
+// each VIR block one LLVM block, so that VIR phis become LLVM phis. Stay with
+// the AST: generators and methods with for loops (coroutines), memo methods
+// (their cache), customized copies (self of another class), and every method
+// with reference counting, which needs to know which temporaries it owns.
+// Remarks are only made for the code generated from the AST.
+
+void CodeGenerator::generateVIR() {
+    VIRGenerator vir_generator;
+    vir_module = vir_generator.generate(program);
+    if (!vir_module) {
+        for (const auto& error : vir_generator.getErrors()) {
+            reportError(error);
+        }
+        return;
+    }
+    std::vector<std::string> vir_errors = verifyVIR(*vir_module);
+    if (vir_errors.empty() && options.optimization_level > 0) {
+        VIRPassManager pass_manager = VIRPassManager::createDefault();
+        if (!pass_manager.run(*vir_module)) vir_errors = pass_manager.getErrors();
+    }
+    if (!vir_errors.empty()) {
+        for (const auto& error : vir_errors) {
+            reportError("VIR verification failed: " + error);
+        }
+        vir_module.reset();
+        return;
+    }
+    for (const auto& function : vir_module->functions) {
+        vir_functions[function->name] = function.get();
+    }
+}
+
+bool CodeGenerator::canLowerFromVIR(const Method* method, const VIRFunction* vir_function) const {
+    if (method->generator || method->memo || options.reference_counting) return false;
+    for (const auto& block : vir_function->blocks) {
+        for (const auto& instruction : block->instructions) {
+            switch (instruction->op) {
+            case VIROp::RESUME:
+            case VIROp::CURRENT:
+            case VIROp::DESTROY:
+            case VIROp::YIELD:
+                return false;
+            default:
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+// Generate the body of a method of current_class from its VIR
+void CodeGenerator::generateMethodBodyFromVIR(const Method* method, const VIRFunction* vir_function) {
+    current_function = methods[vir_function->name];
+    if (!current_function) {
+        reportError("Function not found: " + vir_function->name);
+        return;
+    }
+    
+    // All the blocks first, as branches and phis may refer to later ones
+    std::unordered_map<const VIRBlock*, llvm::BasicBlock*> blocks;
+    for (const auto& block : vir_function->blocks) {
+        std::string name = blocks.empty() ? "entry" : "bb" + std::to_string(block->id);
+        blocks[block.get()] = llvm::BasicBlock::Create(*context, name, current_function);
+    }
+    builder->SetInsertPoint(blocks[vir_function->blocks.front().get()]);
+    
+    if (options.metrics) {
+        emitCallCounter(vir_function->name, method);
+    }
+    
+    // Self, then the arguments (a unit parameter has none, see
+    // appendParamTypes())
+    std::unordered_map<const VIRInstruction*, llvm::Value*> values;
+    auto arg_it = current_function->arg_begin();
+    for (const VIRInstruction* param : vir_function->params) {
+        values[param] = param->type == "unit" ? nullptr : &*arg_it++;
+    }
+    
+    // The incoming values of phis are added once all the blocks are
+    // generated, from the block each predecessor ends in
+    std::vector<const VIRInstruction*> phis;
+    std::unordered_map<const VIRBlock*, llvm::BasicBlock*> end_blocks;
+    for (const auto& block : vir_function->blocks) {
+        builder->SetInsertPoint(blocks[block.get()]);
+        for (const auto& instruction : block->instructions) {
+            if (instruction->op == VIROp::PARAM) continue;
+            if (instruction->op == VIROp::PHI) {
+                llvm::PHINode* phi = nullptr;
+                if (instruction->type != "unit") {
+                    phi = builder->CreatePHI(getLLVMType(instruction->type), instruction->operands.size());
+                    phis.push_back(instruction.get());
+                }
+                values[instruction.get()] = phi;
+                continue;
+            }
+            values[instruction.get()] = generateVIRInstruction(instruction.get(), values, blocks);
+        }
+        end_blocks[block.get()] = builder->GetInsertBlock();
+    }
+    for (const VIRInstruction* instruction : phis) {
+        llvm::PHINode* phi = llvm::cast<llvm::PHINode>(values[instruction]);
+        for (size_t i = 0; i < instruction->operands.size(); ++i) {
+            // Objects of a subclass are cast before leaving their block
+            llvm::BasicBlock* incoming = end_blocks[instruction->incoming[i]];
+            builder->SetInsertPoint(incoming->getTerminator());
+            phi->addIncoming(castValue(values[instruction->operands[i]], phi->getType()), incoming);
+        }
+    }
+}
+
+// Generate a VIR instruction other than a parameter or a phi. Returns its
+// value (nullptr for unit).
+llvm::Value* CodeGenerator::generateVIRInstruction(
+    const VIRInstruction* instruction, const std::unordered_map<const VIRInstruction*, llvm::Value*>& values,
+    const std::unordered_map<const VIRBlock*, llvm::BasicBlock*>& blocks) {
+    auto operand = [&](size_t i) { return values.at(instruction->operands[i]); };
+    const std::string& class_name = instruction->class_name;
+    const std::string& name = instruction->name;
+    
+    switch (instruction->op) {
+    case VIROp::CONST_INT:
+        return builder->getInt32(instruction->int_value);
+    case VIROp::CONST_BOOL:
+        return builder->getInt1(instruction->int_value);
+    case VIROp::CONST_STRING:
+        return createStringConstant(name);
+    case VIROp::CONST_UNIT:
+        return nullptr;
+    case VIROp::CONST_NULL:
+        return llvm::Constant::getNullValue(getLLVMType(instruction->type));
+    
+    case VIROp::ADD:
+        return builder->CreateAdd(operand(0), operand(1), "addtmp");
+    case VIROp::SUB:
+        return builder->CreateSub(operand(0), operand(1), "subtmp");
+    case VIROp::MUL:
+        return builder->CreateMul(operand(0), operand(1), "multmp");
+    case VIROp::DIV:
+        return builder->CreateSDiv(operand(0), operand(1), "divtmp");
+    case VIROp::POW:
+        return builder->CreateCall(getPowFunction(), {operand(0), operand(1)}, "powtmp");
+    case VIROp::NEG:
+        return builder->CreateNeg(operand(0), "negtmp");
+    case VIROp::NOT:
+        return builder->CreateNot(operand(0), "nottmp");
+    case VIROp::EQ:
+        // unit has a single value, so two units are always equal
+        if (instruction->operands[0]->type == "unit") return builder->getTrue();
+        return builder->CreateICmpEQ(operand(0), castValue(operand(1), operand(0)->getType()), "eqtmp");
+    case VIROp::LT:
+        return builder->CreateICmpSLT(operand(0), operand(1), "lttmp");
+    case VIROp::LE:
+        return builder->CreateICmpSLE(operand(0), operand(1), "letmp");
+    case VIROp::AND:
+        return builder->CreateAnd(operand(0), operand(1), "andtmp");
+    
+    case VIROp::NEW:
+        return generateNewObject(class_name, nullptr);
+    case VIROp::GETFIELD:
+    case VIROp::SETFIELD: {
+        // Unit fields are erased
+        const std::string& field_type = instruction->op == VIROp::GETFIELD ? instruction->type
+                                                                           : instruction->operands[1]->type;
+        if (field_type == "unit") return nullptr;
+        auto field_it = field_indices[class_name].find(name);
+        if (field_it == field_indices[class_name].end()) {
+            reportError("Field " + name + " not found in class " + class_name);
+            return nullptr;
+        }
+        llvm::StructType* class_type = class_types[class_name];
+        llvm::Value* field_ptr = builder->CreateStructGEP(class_type, operand(0), field_it->second, name);
+        if (instruction->op == VIROp::SETFIELD) {
+            builder->CreateStore(castValue(operand(1), class_type->getElementType(field_it->second)), field_ptr);
+            return nullptr;
+        }
+        // An object laid out inline is used where it is
+        if (inline_fields[class_name].count(name)) {
+            return castValue(field_ptr, getLLVMType(field_type));
+        }
+        return builder->CreateLoad(getLLVMType(field_type), field_ptr, name);
+    }
+    case VIROp::ISNULL: {
+        llvm::Value* object = operand(0);
+        llvm::Value* null_ptr = llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(object->getType()));
+        return builder->CreateICmpEQ(object, null_ptr, "isnulltmp");
+    }
+    case VIROp::VCALL:
+    case VIROp::SCALL: {
+        // Like generateCall(): the methods of strings and of built-in classes
+        // other than Object, and of objects laid out inline, are called
+        // directly, as are the implementations VIR bound the call to
+        const VIRInstruction* receiver = instruction->operands[0];
+        llvm::FunctionCallee callee;
+        std::string impl_name;
+        if (instruction->op == VIROp::SCALL && name.rfind("String__", 0) == 0) {
+            callee = getStringMethod(name.substr(8));
+        } else if (instruction->op == VIROp::SCALL) {
+            impl_name = name;
+        } else if (class_name != "Object" && analyzer.isBuiltinClass(class_name)) {
+            impl_name = vtable_impls[class_name][name];
+        } else if (receiver->op == VIROp::GETFIELD && inline_fields[receiver->class_name].count(receiver->name)) {
+            impl_name = vtable_impls[inline_fields[receiver->class_name][receiver->name]][name];
+        } else {
+            callee = generateDispatch(operand(0), class_name, name);
+        }
+        if (!impl_name.empty()) {
+            llvm::Function* impl = methods[impl_name];
+            if (!impl) {
+                reportError("Function not found: " + impl_name);
+                return nullptr;
+            }
+            callee = impl;
+        }
+        if (!callee) {
+            return nullptr; // Error already reported
+        }
+        
+        // Unit arguments are not passed
+        llvm::FunctionType* func_type = callee.getFunctionType();
+        std::vector<llvm::Value*> args = {castValue(operand(0), func_type->getParamType(0))};
+        for (size_t i = 1; i < instruction->operands.size(); ++i) {
+            if (instruction->operands[i]->type == "unit") continue;
+            args.push_back(castValue(operand(i), func_type->getParamType(args.size())));
+        }
+        std::string method_name = instruction->op == VIROp::SCALL ? name.substr(name.find("__") + 2) : name;
+        if (func_type->getReturnType()->isVoidTy()) {
+            builder->CreateCall(callee, args);
+            return nullptr;
+        }
+        return builder->CreateCall(callee, args, method_name + "_call");
+    }
+    
+    case VIROp::BR:
+        return builder->CreateBr(blocks.at(instruction->targets[0]));
+    case VIROp::CONDBR:
+        return builder->CreateCondBr(operand(0), blocks.at(instruction->targets[0]),
+                                     blocks.at(instruction->targets[1]));
+    case VIROp::RET: {
+        llvm::Type* return_type = current_function->getReturnType();
+        if (return_type->isVoidTy()) return builder->CreateRetVoid();
+        llvm::Value* result = operand(0);
+        return builder->CreateRet(result ? castValue(result, return_type) : llvm::Constant::getNullValue(return_type));
+    }
+    
+    default:
+        reportError("Unexpected VIR instruction in method " + current_function->getName().str());
+        return nullptr;
+    }
+}
+
+// Generate the main entry point
+void CodeGenerator::generateMainEntryPoint() {
+    // A library is linked into programs that have their own entry point
+    if (program->library) return;
+    
+    // Check if Main class and main method exist
+    if (!class_types.count("Main")) {
+        reportError("Class Main not found");
+        return;
+    }
+    
+    std::string main_func_name = "Main__main";
+    if (!methods.count(main_func_name)) {
+        reportError("Method main not found in class Main");
+        return;
+    }
+    
+    // Create C-compatible main function
+    llvm::FunctionType* main_type = llvm::FunctionType::get(
+        llvm::Type::getInt32Ty(*context), false);
+    llvm::Function* main_func = llvm::Function::Create(
+        main_type, llvm::Function::ExternalLinkage, "main", module.get());
+    
+    llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", main_func);
+    builder->SetInsertPoint(entry);
+    
+    // Object___release reads _drop from the vtables, so it must know their
+    // format
+    if (options.reference_counting && options.relative_vtables) {
+        builder->CreateStore(builder->getTrue(), module->getGlobalVariable("Object___relative_vtables"));
+    }
+    
+    if (options.metrics) {
+        emitRegisterCalls();
+    }
+    
+    // Create Main instance, or use the one built at compile time
+    llvm::Constant* snapshot = options.snapshot_main ? generateMainSnapshot() : nullptr;
+    llvm::Value* main_instance = snapshot
+        ? static_cast<llvm::Value*>(snapshot)
+        : builder->CreateCall(methods["Main___new"], {}, "main_instance");
+    
+    // Call Main.main() (the dynamic type is known, no need to dispatch)
+    llvm::Function* main_method = methods[main_func_name];
+    llvm::Value* result = builder->CreateCall(main_method, {main_instance});
+    emitRelease(main_instance);
+    
+    // Return the result
+    builder->CreateRet(result);
+}
+
+
+// Runtime metrics ------------------------------------------------------------
+//
+// With --metrics, each method counts its calls in the runtime metrics, which
+// a running program can publish in shared memory for vsopstat to read (see
+// runtime/runtime/metrics.h). main() registers the counters with the names of
+// the methods before anything else, and the runtime points
+// Object___call_counts to them. A method bumps its counter on entry, with a
+// relaxed atomic load and store as the program is the only writer. Only a
+// program's own methods are counted: a library has no main() to register its
+// counters.
+
+// Count a call of the method compiled in the given function (at its entry)
+void CodeGenerator::emitCallCounter(const std::string& func_name, const Method* method) {
+    if (program->library) return;
+    
+    llvm::Type* i64 = builder->getInt64Ty();
+    size_t index = counted_methods.size();
+    counted_methods.push_back(func_name.substr(0, func_name.size() - method->name.size() - 2) + "." + method->name);
+    
+    llvm::GlobalVariable* counts_global = module->getGlobalVariable("Object___call_counts");
+    llvm::Value* counts = builder->CreateLoad(counts_global->getValueType(), counts_global, "call_counts");
+    llvm::Value* counter = builder->CreateInBoundsGEP(i64, counts, builder->getInt64(index), "call_counter");
+    llvm::LoadInst* calls = builder->CreateAlignedLoad(i64, counter, llvm::Align(8), "calls");
+    calls->setAtomic(llvm::AtomicOrdering::Monotonic);
+    llvm::StoreInst* store = builder->CreateAlignedStore(
+        builder->CreateAdd(calls, builder->getInt64(1)), counter, llvm::Align(8));
+    store->setAtomic(llvm::AtomicOrdering::Monotonic);
+}
+
+// Register the call counters of the methods (at the start of main())
+void CodeGenerator::emitRegisterCalls() {
+    llvm::Type* i8_ptr = builder->getInt8PtrTy();
+    std::vector<llvm::Constant*> names;
+    for (const auto& name : counted_methods) {
+        names.push_back(llvm::cast<llvm::Constant>(createStringConstant(name)));
+    }
+    llvm::ArrayType* names_type = llvm::ArrayType::get(i8_ptr, names.size());
+    llvm::GlobalVariable* names_global = new llvm::GlobalVariable(
+        *module, names_type, true, llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantArray::get(names_type, names), "call_counter_names");
+    builder->CreateCall(methods["Object___register_calls"], {
+        builder->CreateConstInBoundsGEP2_64(names_type, names_global, 0, 0),
+        builder->getInt32(names.size())});
+}
+
+// Compile-time construction of Main ------------------------------------------
+//
+// Main's field initializers often build constant structures (tables, lists)
+// that every run would build again. With --snapshot, `new Main` is evaluated
+// at compile time (see Evaluator), and the objects it creates are emitted as
+// initialized, writable globals, with their vtable pointers and fields
+// filled in, so that main() starts from them directly. Their reference count
+// is 0, so that retain and release leave them alone. If the construction
+// cannot be evaluated (e.g. it prints, reads input or runs out of fuel), Main
+// is constructed at run time as usual.
+
+// Fuel of the evaluation, in expressions evaluated
+static const size_t SNAPSHOT_FUEL = 10000000;
+
+// Emit the objects built by `new Main` at compile time. Returns the Main
+// object, or nullptr if Main's construction cannot be evaluated.
+llvm::Constant* CodeGenerator::generateMainSnapshot() {
+    Evaluator evaluator(program, analyzer, SNAPSHOT_FUEL);
+    EvalValue main_value;
+    if (!evaluator.evaluateNew("Main", main_value)) return nullptr;
+    const std::vector<EvalObject>& heap = evaluator.getHeap();
+    
+    // Objects held by inline fields are part of their parent's constant, the
+    // others reachable from Main get a global each
+    std::map<int, llvm::GlobalVariable*> globals;
+    std::vector<int> to_visit = {main_value.object};
+    std::unordered_set<int> visited;
+    std::unordered_set<int> embedded;
+    while (!to_visit.empty()) {
+        int object = to_visit.back();
+        to_visit.pop_back();
+        if (object < 0 || !visited.insert(object).second) continue;
+        const EvalObject& eval_object = heap[object];
+        for (const auto& [field_name, value] : eval_object.fields) {
+            if (value.kind != EvalValue::Kind::OBJECT) continue;
+            if (inline_fields[eval_object.class_name].count(field_name)) embedded.insert(value.object);
+            to_visit.push_back(value.object);
+        }
+    }
+    for (int object : visited) {
+        if (embedded.count(object)) continue;
+        llvm::GlobalVariable* global = new llvm::GlobalVariable(
+            *module, class_types[heap[object].class_name], false, llvm::GlobalValue::InternalLinkage,
+            nullptr, heap[object].class_name + "___snapshot");
+        globals[object] = global;
+    }
+    
+    // Strings built during the construction get a global each, with an
+    // address of its own as at run time: writable, so that LLVM does not
+    // merge it with a literal of the same content (strings are never written)
+    std::map<int, llvm::Constant*> built_strings;
+    auto stringConstant = [&](const EvalValue& value) -> llvm::Constant* {
+        if (value.string_id < 0) return llvm::cast<llvm::Constant>(createStringConstant(value.string_value));
+        llvm::Constant*& constant = built_strings[value.string_id];
+        if (!constant) {
+            llvm::Constant* data = llvm::ConstantDataArray::getString(*context, value.string_value + '\0', false);
+            llvm::GlobalVariable* global = new llvm::GlobalVariable(
+                *module, data->getType(), false, llvm::GlobalValue::PrivateLinkage, data, ".str.snapshot");
+            constant = llvm::ConstantExpr::getInBoundsGetElementPtr(
+                data->getType(), global, llvm::ArrayRef<llvm::Constant*>{builder->getInt32(0), builder->getInt32(0)});
+        }
+        return constant;
+    };
+    
+    // The constant for an object: vtable, reference count, then its fields
+    // in layout order
+    std::function<llvm::Constant*(int)> objectConstant = [&](int object) -> llvm::Constant* {
+        const EvalObject& eval_object = heap[object];
+        const std::string& class_name = eval_object.class_name;
+        llvm::StructType* class_type = class_types[class_name];
+        
+        std::vector<llvm::Constant*> elements = {
+            llvm::ConstantExpr::getBitCast(vtable_globals[class_name], class_type->getElementType(0)),
+            builder->getInt32(0)
+        };
+        for (const auto& [field_name, field_type] : class_fields[class_name]) {
+            if (field_type == "unit") continue;
+            llvm::Type* element_type = class_type->getElementType(field_indices[class_name][field_name]);
+            const EvalValue& value = eval_object.fields.at(field_name);
+            switch (value.kind) {
+                case EvalValue::Kind::INT32:
+                    elements.push_back(builder->getInt32(value.int_value));
+                    break;
+                case EvalValue::Kind::BOOL:
+                    elements.push_back(builder->getInt1(value.int_value));
+                    break;
+                case EvalValue::Kind::STRING:
+                    elements.push_back(stringConstant(value));
+                    break;
+                case EvalValue::Kind::OBJECT:
+                    if (value.object < 0) {
+                        elements.push_back(llvm::Constant::getNullValue(element_type));
+                    } else if (embedded.count(value.object)) {
+                        elements.push_back(objectConstant(value.object));
+                    } else {
+                        elements.push_back(llvm::ConstantExpr::getBitCast(globals.at(value.object), element_type));
+                    }
+                    break;
+                default:
+                    elements.push_back(llvm::Constant::getNullValue(element_type));
+                    break;
+            }
+        }
+        return llvm::ConstantStruct::get(class_type, elements);
+    };
+    for (const auto& [object, global] : globals) {
+        global->setInitializer(objectConstant(object));
+    }
+    
+    return globals.at(main_value.object);
+}
+
+// Multiversioning ------------------------------------------------------------
+
+// x86-64 micro-architecture levels methods can be compiled for with
+// --multiversion, from the highest: each one has the features of the next
+// ones, and its level is the one Object___cpu_level() returns for processors
+// that have them (runtime/runtime/cpu.h)
+namespace {
+struct TargetLevel {
+    const char* cpu;
+    int level;
+    const char* features;
+};
+
+const TargetLevel target_levels[] = {
+    {"x86-64-v4", 4, "+avx512f,+avx512bw,+avx512cd,+avx512dq,+avx512vl,"
+                     "+avx,+avx2,+bmi,+bmi2,+f16c,+fma,+lzcnt,+movbe,+xsave,"
+                     "+cx16,+sahf,+popcnt,+sse3,+sse4.1,+sse4.2,+ssse3"},
+    {"x86-64-v3", 3, "+avx,+avx2,+bmi,+bmi2,+f16c,+fma,+lzcnt,+movbe,+xsave,"
+                     "+cx16,+sahf,+popcnt,+sse3,+sse4.1,+sse4.2,+ssse3"},
+    {"x86-64-v2", 2, "+cx16,+sahf,+popcnt,+sse3,+sse4.1,+sse4.2,+ssse3"},
+};
+}
+
+// Compile the methods containing loops again for each level of
+// options.multiversion_targets (the others gain little from wider vectors).
+// Generators are left alone: their coroutine is only split later.
+void CodeGenerator::multiversionMethods() {
+    declareRuntimeMethod("Object___cpu_level", builder->getInt32Ty(), {});
+    
+    for (const auto& cls : program->classes) {
+        if (!cls || cls->imported) continue;
+        for (const auto& method : cls->methods) {
+            if (!method || method->generator) continue;
+            llvm::Function* func = module->getFunction(cls->name + "__" + method->name);
+            if (!func || func->isDeclaration()) continue;
+            
+            llvm::DominatorTree dom_tree(*func);
+            llvm::LoopInfo loop_info(dom_tree);
+            if (loop_info.empty()) continue;
+            multiversionMethod(func, method.get());
+        }
+    }
+}
+
+// Replace a method by an ifunc choosing between a version of its function
+// per target level, optimized with the level's features (by the backend
+// compiling each function for its own target-features), and the original one
+// for older processors. Calls and vtable entries go through the ifunc,
+// except recursive calls, which stay in the version they are made from.
+void CodeGenerator::multiversionMethod(llvm::Function* func, const Method* method) {
+    std::string name = func->getName().str();
+    llvm::FunctionType* func_type = func->getFunctionType();
+    
+    // Versions, from the highest level
+    std::vector<std::pair<const TargetLevel*, llvm::Function*>> versions;
+    std::string cpus;
+    for (const TargetLevel& target : target_levels) {
+        const auto& targets = options.multiversion_targets;
+        if (std::find(targets.begin(), targets.end(), target.cpu) == targets.end()) continue;
+        
+        llvm::ValueToValueMapTy value_map;
+        llvm::Function* version = llvm::CloneFunction(func, value_map);
+        version->setName(name + "." + target.cpu);
+        version->setLinkage(llvm::GlobalValue::InternalLinkage);
+        version->addFnAttr("target-cpu", target.cpu);
+        version->addFnAttr("target-features", target.features);
+        versions.push_back({&target, version});
+        cpus += (cpus.empty() ? "" : ", ") + std::string(target.cpu);
+        if (options.remarks) {
+            remark_sources[version->getName().str()] = remark_sources[name];
+        }
+    }
+    func->setName(name + ".default");
+    func->setLinkage(llvm::GlobalValue::InternalLinkage);
+    
+    // The resolver runs while the program is relocated, and returns the
+    // version for the processor
+    llvm::Function* resolver = llvm::Function::Create(
+        llvm::FunctionType::get(func->getType(), false), llvm::Function::InternalLinkage,
+        name + ".resolver", module.get());
+    llvm::GlobalIFunc* ifunc = llvm::GlobalIFunc::create(
+        func_type, func->getAddressSpace(), llvm::GlobalValue::ExternalLinkage, name, resolver, module.get());
+    func->replaceAllUsesWith(ifunc);
+    
+    llvm::IRBuilder<> resolver_builder(llvm::BasicBlock::Create(*context, "entry", resolver));
+    llvm::Value* level = resolver_builder.CreateCall(methods["Object___cpu_level"], {}, "level");
+    for (const auto& [target, version] : versions) {
+        llvm::BasicBlock* older = llvm::BasicBlock::Create(*context, "older", resolver);
+        llvm::BasicBlock* supported = llvm::BasicBlock::Create(*context, target->cpu, resolver);
+        resolver_builder.CreateCondBr(
+            resolver_builder.CreateICmpSGE(level, resolver_builder.getInt32(target->level)), supported, older);
+        resolver_builder.SetInsertPoint(supported);
+        resolver_builder.CreateRet(version);
+        resolver_builder.SetInsertPoint(older);
+    }
+    resolver_builder.CreateRet(func);
+    
+    // Recursive calls
+    versions.push_back({nullptr, func});
+    for (const auto& [target, version] : versions) {
+        for (llvm::BasicBlock& block : *version) {
+            for (llvm::Instruction& inst : block) {
+                llvm::CallInst* call = llvm::dyn_cast<llvm::CallInst>(&inst);
+                if (call && call->getCalledOperand() == ifunc) {
+                    call->setCalledOperand(version);
+                }
+            }
+        }
+    }
+    
+    addRemark(Remark::Kind::PASSED, "vsop-multiversion", "Multiversioned", name, method,
+              "compiled for " + cpus + " besides the baseline, dispatched through an ifunc");
+}
+
+
+// Fold identical code. Classes generated from the same template end up with
+// methods, constructors and vtables that only differ by their name: keep one
+// copy of each and turn the others into aliases of it, so that every symbol
+// still exists (e.g. for linking against other modules). Folding functions can
+// make vtables identical and the other way around (through ___new), hence the
+// fixed point.
+void CodeGenerator::foldIdenticalCode() {
+    while (true) {
+        bool folded_functions = foldIdenticalFunctions();
+        bool folded_vtables = foldIdenticalVTables();
+        if (!folded_functions && !folded_vtables) break;
+    }
+}
+
+bool CodeGenerator::foldIdenticalFunctions() {
+    // Bucket the functions by the hash of their typed body. The hash and the
+    // comparison ignore pointee types, so A__get and B__get are identical as
+    // long as the fields they use sit at the same index with the same type.
+    std::map<llvm::FunctionComparator::FunctionHash, std::vector<llvm::Function*>> buckets;
+    for (llvm::Function& func : *module) {
+        if (func.isDeclaration() || func.getName() == "main") continue;
+        buckets[llvm::FunctionComparator::functionHash(func)].push_back(&func);
+    }
+    
+    llvm::GlobalNumberState global_numbers;
+    bool changed = false;
+    
+    for (auto& [hash, funcs] : buckets) {
+        if (funcs.size() < 2) continue;
+        
+        // Equal hashes do not imply equal bodies: compare against the
+        // implementations kept so far (the first one in module order wins)
+        std::vector<llvm::Function*> kept;
+        for (llvm::Function* func : funcs) {
+            llvm::Function* canonical = nullptr;
+            for (llvm::Function* candidate : kept) {
+                if (llvm::FunctionComparator(candidate, func, &global_numbers).compare() == 0) {
+                    canonical = candidate;
+                    break;
+                }
+            }
+            if (!canonical) {
+                kept.push_back(func);
+                continue;
+            }
+            
+            // Uses (calls, vtable entries) go straight to the kept function,
+            // the folded symbol becomes an alias of it
+            addRemark(Remark::Kind::PASSED, "vsop-fold", "FoldedFunction", func->getName().str(), nullptr,
+                      "identical to " + canonical->getName().str() + ", which it becomes an alias of");
+            llvm::Constant* replacement = llvm::ConstantExpr::getBitCast(canonical, func->getType());
+            func->replaceAllUsesWith(replacement);
+            llvm::GlobalAlias* alias = llvm::GlobalAlias::create(
+                func->getFunctionType(), func->getAddressSpace(),
+                func->getLinkage(), "", replacement, module.get());
+            alias->setDSOLocal(func->isDSOLocal());
+            alias->takeName(func);
+            
+            for (auto& [name, method] : methods) {
+                if (method == func) method = canonical;
+            }
+            func->eraseFromParent();
+            changed = true;
+        }
+    }
+    
+    return changed;
+}
+
+bool CodeGenerator::foldIdenticalVTables() {
+    // Two vtables are identical if they point to the same functions in the
+    // same order (this also covers relative vtables, whose constants differ
+    // since they are relative to the table's own address)
+    std::map<std::vector<llvm::Function*>, llvm::GlobalVariable*> kept;
+    bool changed = false;
+    
+    for (const auto& class_name : class_order) {
+        llvm::GlobalVariable* vtable_global = vtable_globals[class_name];
+        
+        // The runtime's built-in vtables and imported ones are not ours to
+        // fold, nor are the per-module copies of the built-in relative ones
+        if (!vtable_global || !vtable_global->hasInitializer() || vtable_global->hasLinkOnceLinkage()) continue;
+        
+        std::vector<llvm::Function*> entries;
+        for (const auto& method_name : vtables[class_name]) {
+            entries.push_back(methods[vtable_impls[class_name][method_name]]);
+        }
+        
+        auto kept_it = kept.find(entries);
+        if (kept_it == kept.end()) {
+            kept[entries] = vtable_global;
+            continue;
+        }
+        if (kept_it->second == vtable_global) continue;
+        
+        llvm::GlobalVariable* canonical = kept_it->second;
+        llvm::Constant* replacement = llvm::ConstantExpr::getBitCast(canonical, vtable_global->getType());
+        vtable_global->replaceAllUsesWith(replacement);
+        llvm::GlobalAlias* alias = llvm::GlobalAlias::create(
+            vtable_global->getValueType(), vtable_global->getAddressSpace(),
+            vtable_global->getLinkage(), "", replacement, module.get());
+        alias->setDSOLocal(vtable_global->isDSOLocal());
+        alias->takeName(vtable_global);
+        vtable_global->eraseFromParent();
+        
+        vtable_globals[class_name] = canonical;
+        changed = true;
+    }
+    
+    return changed;
+}
+
+// Collects the optimization remarks of LLVM's passes (applied, missed and
+// analyses) while the pipeline runs, leaving other diagnostics alone. The
+// instruction counts of size-info are about the passes, not the program.
+class RemarkCollector : public llvm::DiagnosticHandler {
+public:
+    std::vector<Remark> collected;
+    
+    bool isAnalysisRemarkEnabled(llvm::StringRef pass) const override { return pass != "size-info"; }
+    bool isMissedOptRemarkEnabled(llvm::StringRef pass) const override { return pass != "size-info"; }
+    bool isPassedOptRemarkEnabled(llvm::StringRef pass) const override { return pass != "size-info"; }
+    bool isAnyRemarkEnabled() const override { return true; }
+    
+    bool handleDiagnostics(const llvm::DiagnosticInfo& info) override {
+        const auto* optimization = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+        if (!optimization) return false;
+        Remark remark;
+        remark.kind = optimization->isPassed() ? Remark::Kind::PASSED
+                    : optimization->isMissed() ? Remark::Kind::MISSED : Remark::Kind::ANALYSIS;
+        remark.pass = optimization->getPassName().str();
+        remark.name = optimization->getRemarkName().str();
+        remark.function = optimization->getFunction().getName().str();
+        remark.message = optimization->getMsg();
+        collected.push_back(remark);
+        return true;
+    }
+};
+
+// Run LLVM's standard pipeline for the optimization level. Even at -O0, it
+// lowers the generators' coroutines (CoroEarly, CoroSplit and CoroCleanup),
+// as the backend cannot handle the coroutine intrinsics. With remarks, the
+// module has no debug information, so LLVM's remarks are located at the
+// method of the function they are about.
+void CodeGenerator::optimizeModule() {
+    llvm::LoopAnalysisManager loop_am;
+    llvm::FunctionAnalysisManager function_am;
+    llvm::CGSCCAnalysisManager cgscc_am;
+    llvm::ModuleAnalysisManager module_am;
+    
+    llvm::PassBuilder pass_builder;
+    pass_builder.registerModuleAnalyses(module_am);
+    pass_builder.registerCGSCCAnalyses(cgscc_am);
+    pass_builder.registerFunctionAnalyses(function_am);
+    pass_builder.registerLoopAnalyses(loop_am);
+    pass_builder.crossRegisterProxies(loop_am, function_am, cgscc_am, module_am);
+    
+    llvm::ModulePassManager pass_manager;
+    switch (options.optimization_level) {
+    case 0:
+        pass_manager = pass_builder.buildO0DefaultPipeline(llvm::OptimizationLevel::O0);
+        break;
+    case 1:
+        pass_manager = pass_builder.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O1);
+        break;
+    case 2:
+        pass_manager = pass_builder.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2);
+        break;
+    default:
+        pass_manager = pass_builder.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3);
+        break;
+    }
+    if (!options.remarks) {
+        pass_manager.run(*module, module_am);
+        return;
+    }
+    
+    auto collector = std::make_unique<RemarkCollector>();
+    RemarkCollector* llvm_remarks = collector.get();
+    context->setDiagnosticHandler(std::move(collector));
+    pass_manager.run(*module, module_am);
+    for (const Remark& remark : llvm_remarks->collected) {
+        addRemark(remark.kind, remark.pass, remark.name, remark.function, nullptr, remark.message);
+    }
+    context->setDiagnosticHandler(std::make_unique<llvm::DiagnosticHandler>());
+}
+
+// Output the generated LLVM IR
+void CodeGenerator::dumpIR(std::ostream& os) {
+    std::string output;
+    llvm::raw_string_ostream llvm_stream(output);
+    module->print(llvm_stream, nullptr);
+    os << output;
+}
+
+bool CodeGenerator::writeNativeExecutable(const std::string& output_file) {
+    // First, output the LLVM IR to a temporary file
+    std::string temp_ir_file = output_file + ".ll";
+    std::error_code EC;
+    llvm::raw_fd_ostream ir_out(temp_ir_file, EC);
     
     if (EC) {
         reportError("Could not open temporary file: " + EC.message());
@@ -785,6 +1895,43 @@ void CodeGenerator::reportError(const std::string& message) {
     }
 }
 
+// Record an optimization remark about the given function, at the given node
+// (or at the method the function compiles, if it has no position)
+void CodeGenerator::addRemark(Remark::Kind kind, const std::string& pass, const std::string& name,
+                              const std::string& function, const ASTNode* at, const std::string& message) {
+    if (!options.remarks) return;
+    
+    Remark remark;
+    remark.kind = kind;
+    remark.pass = pass;
+    remark.name = name;
+    remark.function = function;
+    remark.message = message;
+    
+    // The parts of a generator split by CoroSplit (Class__method.resume, ...)
+    // belong to its method
+    auto source_it = remark_sources.find(function.substr(0, function.find('.')));
+    if (source_it != remark_sources.end()) {
+        const auto& [cls, method] = source_it->second;
+        remark.file = cls->file;
+        if (method) {
+            // The class is the one the function is compiled for (a customized
+            // copy's), which the function name starts with
+            const std::string& func_name = source_it->first;
+            remark.method = func_name.substr(0, func_name.size() - method->name.size() - 2) + "." + method->name;
+        }
+        if (!at || at->offset == UNKNOWN_OFFSET) {
+            at = method ? static_cast<const ASTNode*>(method) : cls;
+        }
+    }
+    if (at && at->offset != UNKNOWN_OFFSET && !remark.file.empty()) {
+        SourcePosition position = resolvePosition(remark.file, at->offset);
+        remark.line = position.line;
+        remark.column = position.column;
+    }
+    remarks.push_back(remark);
+}
+
 // Get LLVM type for a VSOP type
 llvm::Type* CodeGenerator::getLLVMType(const std::string& vsop_type) {
     // Check primitive types first
@@ -793,34 +1940,1005 @@ llvm::Type* CodeGenerator::getLLVMType(const std::string& vsop_type) {
         return prim_it->second;
     }
     
-    // Then check class types
-    auto class_it = class_types.find(vsop_type);
-    if (class_it != class_types.end()) {
-        return llvm::PointerType::get(class_it->second, 0);
+    // Then check class types
+    auto class_it = class_types.find(vsop_type);
+    if (class_it != class_types.end()) {
+        return llvm::PointerType::get(class_it->second, 0);
+    }
+    
+    // If not found, report error and return i8* as fallback
+    reportError("Unknown type: " + vsop_type);
+    return llvm::Type::getInt8PtrTy(*context);
+}
+
+// Create a string constant
+llvm::Value* CodeGenerator::createStringConstant(const std::string& str) {
+    // Identical literals share one global, which also keeps the methods that
+    // use them foldable
+    llvm::GlobalVariable*& global_str = string_constants[str];
+    if (!global_str) {
+        // Add null terminator
+        std::string with_null = str + '\0';
+        
+        // Create a constant array with the string data
+        llvm::Constant* string_constant = llvm::ConstantDataArray::getString(*context, with_null, false);
+        
+        // Create a global variable to hold the string
+        global_str = new llvm::GlobalVariable(
+            *module, string_constant->getType(), true,
+            llvm::GlobalValue::PrivateLinkage, string_constant, ".str");
+        global_str->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    }
+    
+    // Get a pointer to the first character
+    llvm::Value* zero = llvm::ConstantInt::get(llvm::Type::getInt32Ty(*context), 0);
+    llvm::Value* indices[] = {zero, zero};
+    return builder->CreateInBoundsGEP(global_str->getValueType(), global_str, indices, "str");
+}
+
+// Convert a value to the given LLVM type. VSOP's only implicit conversion is
+// from a class to one of its ancestors, which is a pointer cast.
+llvm::Value* CodeGenerator::castValue(llvm::Value* value, llvm::Type* type) {
+    if (!value || value->getType() == type) return value;
+    if (value->getType()->isPointerTy() && type->isPointerTy()) {
+        return builder->CreatePointerCast(value, type);
+    }
+    return value;
+}
+
+// Default value of a variable or field without initializer
+llvm::Value* CodeGenerator::defaultValue(const std::string& vsop_type) {
+    if (vsop_type == "string") {
+        return createStringConstant("");
+    }
+    llvm::Type* type = getLLVMType(vsop_type);
+    if (type->isVoidTy()) {
+        return nullptr;
+    }
+    // 0, false and null
+    return llvm::Constant::getNullValue(type);
+}
+
+// Create a stack slot in the entry block of the current function
+llvm::AllocaInst* CodeGenerator::createEntryAlloca(llvm::Type* type, const std::string& name) {
+    llvm::BasicBlock& entry = current_function->getEntryBlock();
+    llvm::IRBuilder<> entry_builder(&entry, entry.begin());
+    return entry_builder.CreateAlloca(type, nullptr, name);
+}
+
+// Get a pointer to a field of self
+llvm::Value* CodeGenerator::getFieldPointer(const std::string& field_name) {
+    auto class_it = field_indices.find(current_class);
+    if (class_it == field_indices.end()) return nullptr;
+    auto field_it = class_it->second.find(field_name);
+    if (field_it == class_it->second.end()) return nullptr;
+    
+    llvm::Value* self = current_function->arg_begin();
+    return builder->CreateStructGEP(class_types[current_class], self, field_it->second, field_name);
+}
+
+// Look up a method in the vtable of an object whose static type is the given
+// class. Returns the function to call, whose first parameter is 'self'.
+llvm::FunctionCallee CodeGenerator::generateDispatch(llvm::Value* object, const std::string& class_name,
+                                                     const std::string& method_name) {
+    const auto& slots = vtables[class_name];
+    auto slot_it = std::find(slots.begin(), slots.end(), method_name);
+    if (slot_it == slots.end()) {
+        reportError("Method " + method_name + " has no vtable slot in class " + class_name);
+        return {};
+    }
+    unsigned slot = slot_it - slots.begin();
+    
+    // Every vtable entry for this slot has the type of the implementation
+    // seen by the static class
+    llvm::Function* impl = methods[vtable_impls[class_name][method_name]];
+    if (!impl) {
+        reportError("Function not found: " + vtable_impls[class_name][method_name]);
+        return {};
+    }
+    llvm::FunctionType* func_type = impl->getFunctionType();
+    
+    // The vtable pointer is the first field of every object
+    llvm::StructType* class_type = class_types[class_name];
+    llvm::Type* vtable_ptr_type = class_type->getElementType(0);
+    llvm::Value* vtable = builder->CreateLoad(vtable_ptr_type,
+        builder->CreateStructGEP(class_type, object, 0), "vtable");
+    
+    llvm::Value* func_ptr;
+    if (options.relative_vtables) {
+        // target = vtable + *(i32*)(vtable + 4 * slot)
+        llvm::Function* load_relative = llvm::Intrinsic::getDeclaration(
+            module.get(), llvm::Intrinsic::load_relative, {builder->getInt32Ty()});
+        llvm::Value* target = builder->CreateCall(load_relative,
+            {builder->CreateBitCast(vtable, builder->getInt8PtrTy()), builder->getInt32(slot * 4)},
+            method_name + "_rel");
+        func_ptr = builder->CreateBitCast(target, llvm::PointerType::get(func_type, 0), method_name + "_ptr");
+    } else {
+        llvm::StructType* vtable_type = llvm::cast<llvm::StructType>(
+            vtable_ptr_type->getPointerElementType());
+        llvm::Value* slot_ptr = builder->CreateStructGEP(vtable_type, vtable, slot);
+        func_ptr = builder->CreateLoad(vtable_type->getElementType(slot), slot_ptr, method_name + "_ptr");
+    }
+    
+    return llvm::FunctionCallee(func_type, func_ptr);
+}
+
+// The function implementing the given method for every object whose static
+// type is the given class, or nullptr if a subclass overrides it (customized
+// copies of the same method do not count). A library's classes may be
+// extended by the programs using it, so it always dispatches.
+llvm::Function* CodeGenerator::getUniqueImplementation(const std::string& class_name,
+                                                       const std::string& method_name) {
+    if (program->library) return nullptr;
+    
+    auto origin = [&](const std::string& impl) {
+        auto origin_it = clone_origins.find(impl);
+        return origin_it != clone_origins.end() ? origin_it->second : impl;
+    };
+    const std::string& impl_name = vtable_impls[class_name][method_name];
+    Type static_type = analyzer.resolveType(class_name);
+    for (const auto& other_name : class_order) {
+        auto impl_it = vtable_impls[other_name].find(method_name);
+        if (impl_it == vtable_impls[other_name].end() || origin(impl_it->second) == origin(impl_name)) continue;
+        if (analyzer.resolveType(other_name).conformsTo(static_type, analyzer.getClassDefinitions())) {
+            return nullptr;
+        }
+    }
+    return methods[impl_name];
+}
+
+bool CodeGenerator::isImported(const std::string& class_name) const {
+    auto node_it = class_nodes.find(class_name);
+    return node_it != class_nodes.end() && node_it->second->imported;
+}
+
+void CodeGenerator::setExprType(const Expression* expr, const std::string& type) {
+    if (expr) expr_types[expr] = type;
+}
+
+std::string CodeGenerator::getExprType(const Expression* expr) const {
+    auto it = expr_types.find(expr);
+    return (it != expr_types.end()) ? it->second : "__error__";
+}
+
+// Allocate an object of the given class and install its vtable and reference
+// count. With reference counting, objects come from the runtime's free lists
+// and start with one reference, owned by the expression that created them.
+// Given the SiteRegion global of a new expression or a constructor
+// (--site-heaps), they come from that site instead.
+llvm::Value* CodeGenerator::generateAllocation(const std::string& class_name, llvm::Value* site) {
+    llvm::StructType* class_type = class_types[class_name];
+    llvm::Value* size = llvm::ConstantExpr::getSizeOf(class_type);
+    llvm::Value* mem = site
+        ? builder->CreateCall(methods["Object___site_alloc"], {site, size}, "mem")
+        : options.reference_counting || options.metrics
+        ? builder->CreateCall(methods["Object___alloc"], {size}, "mem")
+        : builder->CreateCall(module->getOrInsertFunction("malloc",
+              llvm::Type::getInt8PtrTy(*context), llvm::Type::getInt64Ty(*context)), {size}, "mem");
+    llvm::Value* obj = builder->CreateBitCast(mem, llvm::PointerType::get(class_type, 0), "obj");
+    emitObjectHeader(class_name, obj, options.reference_counting);
+    return obj;
+}
+
+// An empty SiteRegion (see Object___site_alloc in runtime/runtime/object.h)
+llvm::GlobalVariable* CodeGenerator::createSiteRegion(const std::string& name) {
+    llvm::FunctionType* alloc_type = methods["Object___site_alloc"]->getFunctionType();
+    llvm::Type* site_type = alloc_type->getParamType(0)->getPointerElementType();
+    return new llvm::GlobalVariable(
+        *module, site_type, false, llvm::GlobalValue::InternalLinkage,
+        llvm::Constant::getNullValue(site_type), name);
+}
+
+// Install the vtable and the reference count (1 if counted, 0 otherwise) of
+// an object of the given class
+void CodeGenerator::emitObjectHeader(const std::string& class_name, llvm::Value* object, bool counted) {
+    llvm::StructType* class_type = class_types[class_name];
+    builder->CreateStore(castValue(vtable_globals[class_name], class_type->getElementType(0)),
+                         builder->CreateStructGEP(class_type, object, 0, "vtable_ptr"));
+    builder->CreateStore(builder->getInt32(counted ? 1 : 0),
+                         builder->CreateStructGEP(class_type, object, 1, "refcount_ptr"));
+}
+
+// Reference counting ---------------------------------------------------------
+//
+// Arguments (self included) are borrowed: the caller keeps its reference for
+// the duration of the call. Results of calls and new are owned: the user of
+// the expression must store or release them. Values read from variables and
+// fields are borrowed, and retained only when they are stored or returned.
+
+// Whether values of the given VSOP type are reference counted
+bool CodeGenerator::isCounted(const std::string& vsop_type) const {
+    return options.reference_counting && class_types.count(vsop_type);
+}
+
+void CodeGenerator::emitRetain(llvm::Value* object) {
+    if (!options.reference_counting || !object) return;
+    builder->CreateCall(methods["Object___retain"],
+        {castValue(object, llvm::PointerType::get(class_types["Object"], 0))});
+}
+
+void CodeGenerator::emitRelease(llvm::Value* object) {
+    if (!options.reference_counting || !object) return;
+    builder->CreateCall(methods["Object___release"],
+        {castValue(object, llvm::PointerType::get(class_types["Object"], 0))});
+}
+
+// Release the references held by the fields of the given object (inherited
+// ones included), and by the fields of the objects laid out inline in it
+void CodeGenerator::emitReleaseFields(const std::string& class_name, llvm::Value* object) {
+    llvm::StructType* class_type = class_types[class_name];
+    for (const auto& [field_name, field_type] : class_fields[class_name]) {
+        if (field_type == "unit") continue;
+        unsigned index = field_indices[class_name][field_name];
+        auto inline_it = inline_fields[class_name].find(field_name);
+        if (inline_it != inline_fields[class_name].end()) {
+            emitReleaseFields(inline_it->second, builder->CreateStructGEP(class_type, object, index, field_name));
+        } else if (isCounted(field_type)) {
+            emitRelease(builder->CreateLoad(class_type->getElementType(index),
+                builder->CreateStructGEP(class_type, object, index), field_name));
+        }
+    }
+}
+
+// Get a reference of our own to the value of the given expression, retaining
+// it unless it is already owned
+llvm::Value* CodeGenerator::takeOwnership(const Expression* expr, llvm::Value* value) {
+    if (value && isCounted(getExprType(expr)) && !owned_exprs.count(expr)) {
+        emitRetain(value);
+    }
+    return value;
+}
+
+// Release the value of the given expression once it has been used, if it is
+// owned
+void CodeGenerator::releaseTemporary(const Expression* expr, llvm::Value* value) {
+    if (value && isCounted(getExprType(expr)) && owned_exprs.count(expr)) {
+        emitRelease(value);
+    }
+}
+
+// Whether a borrowed value stays valid until the end of the expression using
+// it without being retained: self, and local variables (as long as they are
+// not assigned in the meantime, which the caller checks). A field may be
+// assigned by any call, releasing its previous value.
+bool CodeGenerator::isStableBorrow(const Expression* expr) const {
+    if (dynamic_cast<const Self*>(expr)) return true;
+    const Identifier* id = dynamic_cast<const Identifier*>(expr);
+    return id && current_vars.count(id->name);
+}
+
+// Whether the given expression contains an assignment to the variable with
+// the given name (ignoring the scopes where another variable shadows it)
+bool CodeGenerator::isAssignedIn(const Expression* expr, const std::string& name) {
+    if (!expr) return false;
+    
+    if (const Assign* assign = dynamic_cast<const Assign*>(expr)) {
+        return assign->name == name || isAssignedIn(assign->expr.get(), name);
+    }
+    if (const Let* let = dynamic_cast<const Let*>(expr)) {
+        return isAssignedIn(let->init_expr.get(), name)
+            || (let->name != name && isAssignedIn(let->scope_expr.get(), name));
+    }
+    if (const BinaryOp* binop = dynamic_cast<const BinaryOp*>(expr)) {
+        return isAssignedIn(binop->left.get(), name) || isAssignedIn(binop->right.get(), name);
+    }
+    if (const UnaryOp* unop = dynamic_cast<const UnaryOp*>(expr)) {
+        return isAssignedIn(unop->expr.get(), name);
+    }
+    if (const Call* call = dynamic_cast<const Call*>(expr)) {
+        if (isAssignedIn(call->object.get(), name)) return true;
+        for (const auto& arg : call->arguments) {
+            if (isAssignedIn(arg.get(), name)) return true;
+        }
+        return false;
+    }
+    if (const If* if_expr = dynamic_cast<const If*>(expr)) {
+        return isAssignedIn(if_expr->condition.get(), name) || isAssignedIn(if_expr->then_expr.get(), name)
+            || isAssignedIn(if_expr->else_expr.get(), name);
+    }
+    if (const While* while_expr = dynamic_cast<const While*>(expr)) {
+        return isAssignedIn(while_expr->condition.get(), name) || isAssignedIn(while_expr->body.get(), name);
+    }
+    if (const For* for_expr = dynamic_cast<const For*>(expr)) {
+        return isAssignedIn(for_expr->iterable.get(), name)
+            || (for_expr->name != name && isAssignedIn(for_expr->body.get(), name));
+    }
+    if (const Yield* yield = dynamic_cast<const Yield*>(expr)) {
+        return isAssignedIn(yield->expr.get(), name);
+    }
+    if (const Block* block = dynamic_cast<const Block*>(expr)) {
+        for (const auto& sub_expr : block->expressions) {
+            if (isAssignedIn(sub_expr.get(), name)) return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+// Object inlining ------------------------------------------------------------
+//
+// A field whose initializer is `new C`, which is never assigned, and whose
+// value is only ever used as the receiver of calls that do not let their self
+// escape, always holds the same object, that nothing else references. That
+// object is laid out inline in its parent (header included, so that its
+// methods work unchanged on an interior pointer), which saves an allocation
+// and a load per access. Its reference count is 0, so retain and release
+// ignore it, and the parent's drop releases its fields.
+
+// Whether the given method of Object is one of the print methods, which
+// return self
+static bool isPrintMethod(const std::string& method_name) {
+    return method_name == "print" || method_name == "printBool" || method_name == "printInt32";
+}
+
+// Find the fields whose object can be laid out inline (sets inline_fields for
+// the classes declaring them, generateClassTypes() propagates them to
+// subclasses). Every class that may see the fields must be known, so a
+// library keeps them all as pointers.
+void CodeGenerator::findInlineFields() {
+    inline_fields.clear();
+    if (program->library) return;
+    
+    const auto& class_defs = analyzer.getClassDefinitions();
+    auto isUserClass = [&](const std::string& class_name) {
+        return class_nodes.count(class_name) && !analyzer.isBuiltinClass(class_name) && !isImported(class_name);
+    };
+    auto conforms = [&](const std::string& class_name, const std::string& ancestor) {
+        return analyzer.resolveType(class_name).conformsTo(analyzer.resolveType(ancestor), class_defs);
+    };
+    
+    // Methods of each class whose self may escape, depending on whether the
+    // value of the call is used. This is a least fixpoint: mutually recursive
+    // methods only leak if one of them lets self escape on its own.
+    std::unordered_map<std::string, std::set<std::pair<std::string, bool>>> leaking;
+    std::unordered_set<std::string> escaping_inits; // Classes whose initializer lets self escape
+    auto analyzeClass = [&](const std::string& class_name) {
+        if (leaking.count(class_name)) return;
+        auto& class_leaking = leaking[class_name];
+        
+        std::vector<std::string> method_names;
+        std::vector<const Field*> fields;
+        for (std::string ancestor = class_name; isUserClass(ancestor) || isImported(ancestor);
+             ancestor = class_defs.at(ancestor).parent.empty() ? "Object" : class_defs.at(ancestor).parent) {
+            for (const auto& method : class_nodes.at(ancestor)->methods) {
+                if (method) method_names.push_back(method->name);
+            }
+            for (const auto& field : class_nodes.at(ancestor)->fields) {
+                if (field) fields.push_back(field.get());
+            }
+            if (isImported(ancestor)) {
+                // Its initializer is compiled in the library
+                escaping_inits.insert(class_name);
+            }
+        }
+        
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (const auto& method_name : method_names) {
+                for (bool used : {false, true}) {
+                    if (class_leaking.count({method_name, used})) continue;
+                    const Method* method = findMethodNode(class_name, method_name);
+                    if (!method) continue;
+                    if (!method->body || method->generator
+                        || mayEscape(method->body.get(), "self", used && method->return_type != "unit",
+                                     class_name, class_leaking)) {
+                        class_leaking.insert({method_name, used});
+                        changed = true;
+                    }
+                }
+            }
+        }
+        
+        for (const Field* field : fields) {
+            if (mayEscape(field->init_expr.get(), "self", true, class_name, class_leaking)) {
+                escaping_inits.insert(class_name);
+            }
+        }
+    };
+    
+    // Candidates: fields initialized with `new C`, whose uses in the methods
+    // and initializers of every class that sees them are all calls
+    std::vector<std::tuple<std::string, std::string, std::string>> candidates; // (class, field, inline class)
+    for (const auto& class_name : class_order) {
+        if (!isUserClass(class_name)) continue;
+        const ClassDef& class_def = class_defs.at(class_name);
+        
+        for (const auto& field : class_nodes.at(class_name)->fields) {
+            if (!field || !class_def.fields.count(field->name)) continue;
+            const New* new_expr = dynamic_cast<const New*>(field->init_expr.get());
+            if (!new_expr || !isUserClass(new_expr->type_name)) continue;
+            const std::string& inline_class = new_expr->type_name;
+            
+            analyzeClass(inline_class);
+            bool inlinable = !escaping_inits.count(inline_class);
+            for (const auto& other_name : class_order) {
+                if (!inlinable) break;
+                if (!isUserClass(other_name) || !conforms(other_name, class_name)) continue;
+                const Class* other = class_nodes.at(other_name);
+                
+                for (const auto& other_field : other->fields) {
+                    if (other_field && other_field.get() != field.get()
+                        && mayEscape(other_field->init_expr.get(), field->name, true,
+                                     inline_class, leaking[inline_class])) {
+                        inlinable = false;
+                    }
+                }
+                for (const auto& method : other->methods) {
+                    if (!method || !method->body) continue;
+                    // A formal of the same name hides the field
+                    bool hidden = false;
+                    for (const auto& formal : method->formals) {
+                        if (formal && formal->name == field->name) hidden = true;
+                    }
+                    if (!hidden && mayEscape(method->body.get(), field->name,
+                                             method->return_type != "unit" && !method->generator,
+                                             inline_class, leaking[inline_class])) {
+                        inlinable = false;
+                    }
+                }
+            }
+            if (inlinable) {
+                candidates.push_back({class_name, field->name, inline_class});
+            } else {
+                addRemark(Remark::Kind::MISSED, "vsop-inline-objects", "HeapObject", class_name + "___init", new_expr,
+                          "object of field " + field->name + " allocated on the heap: it may be reassigned or escape");
+            }
+        }
+    }
+    
+    // An object cannot contain itself: drop the fields whose inline object
+    // would (through its own inline fields) contain their parent, until there
+    // are none left
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+            const auto& [class_name, field_name, inline_class] = *it;
+            
+            // Classes whose objects are contained in an object of the inline
+            // class
+            std::unordered_set<std::string> contained;
+            std::vector<std::string> to_visit = {inline_class};
+            while (!to_visit.empty()) {
+                std::string container = to_visit.back();
+                to_visit.pop_back();
+                if (!contained.insert(container).second) continue;
+                for (const auto& [other_class, other_field, other_inline] : candidates) {
+                    if (conforms(container, other_class)) to_visit.push_back(other_inline);
+                }
+            }
+            
+            bool cyclic = false;
+            for (const auto& contained_class : contained) {
+                if (conforms(contained_class, class_name)) cyclic = true;
+            }
+            if (cyclic) {
+                for (const auto& field : class_nodes.at(class_name)->fields) {
+                    if (field && field->name == field_name) {
+                        addRemark(Remark::Kind::MISSED, "vsop-inline-objects", "HeapObject", class_name + "___init",
+                                  field->init_expr.get(), "object of field " + field_name
+                                  + " allocated on the heap: laid out inline, it would contain its parent");
+                    }
+                }
+                candidates.erase(it);
+                changed = true;
+                break;
+            }
+        }
+    }
+    
+    for (const auto& [class_name, field_name, inline_class] : candidates) {
+        inline_fields[class_name][field_name] = inline_class;
+        for (const auto& field : class_nodes.at(class_name)->fields) {
+            if (field && field->name == field_name) {
+                addRemark(Remark::Kind::PASSED, "vsop-inline-objects", "InlineObject", class_name + "___init",
+                          field->init_expr.get(), "object of field " + field_name + " laid out inline in "
+                          + class_name + ": no allocation of its own");
+            }
+        }
+    }
+}
+
+// The method implementing the given method for objects of the given class,
+// or nullptr if the runtime implements it
+const Method* CodeGenerator::findMethodNode(const std::string& class_name, const std::string& method_name) const {
+    const auto& class_defs = analyzer.getClassDefinitions();
+    std::string ancestor = class_name;
+    while (class_nodes.count(ancestor) && !analyzer.isBuiltinClass(ancestor)) {
+        for (const auto& method : class_nodes.at(ancestor)->methods) {
+            if (method && method->name == method_name) return method.get();
+        }
+        const std::string& parent = class_defs.at(ancestor).parent;
+        ancestor = parent.empty() ? "Object" : parent;
+    }
+    return nullptr;
+}
+
+// Whether the object designated by name (self, or a field holding an object
+// of the given class) may escape through the given expression: stored,
+// passed, compared, or returned if the value of the expression is used. Calls
+// on it are fine as long as the method called does not let its self escape
+// (leaking holds the (method, used) pairs of the class known to let it).
+bool CodeGenerator::mayEscape(const Expression* expr, const std::string& name, bool used,
+                              const std::string& class_name,
+                              const std::set<std::pair<std::string, bool>>& leaking) const {
+    if (!expr) return false;
+    bool is_self = name == "self";
+    auto escapes = [&](const Expression* sub_expr, bool sub_used) {
+        return mayEscape(sub_expr, name, sub_used, class_name, leaking);
+    };
+    
+    if (dynamic_cast<const Self*>(expr)) {
+        return is_self && used;
+    }
+    if (const Identifier* id = dynamic_cast<const Identifier*>(expr)) {
+        return !is_self && id->name == name && used;
+    }
+    if (const Assign* assign = dynamic_cast<const Assign*>(expr)) {
+        return (!is_self && assign->name == name) || escapes(assign->expr.get(), true);
+    }
+    if (const Call* call = dynamic_cast<const Call*>(expr)) {
+        for (const auto& arg : call->arguments) {
+            if (escapes(arg.get(), true)) return true;
+        }
+        
+        // Object's print methods return self, so calls can be chained on it
+        const Expression* object = call->object.get();
+        const Call* chained;
+        while ((chained = dynamic_cast<const Call*>(object)) && !findMethodNode(class_name, chained->method_name)
+               && isPrintMethod(chained->method_name)) {
+            object = chained->object.get();
+        }
+        bool on_object = object
+            ? (is_self ? dynamic_cast<const Self*>(object) != nullptr
+                       : dynamic_cast<const Identifier*>(object)
+                         && static_cast<const Identifier*>(object)->name == name)
+            : is_self;
+        if (on_object) {
+            return escapes(call->object.get(), false)
+                || methodLeaksSelf(class_name, call->method_name, used, leaking);
+        }
+        return escapes(call->object.get(), true);
+    }
+    if (const Let* let = dynamic_cast<const Let*>(expr)) {
+        return escapes(let->init_expr.get(), true)
+            || ((is_self || let->name != name) && escapes(let->scope_expr.get(), used));
+    }
+    if (const BinaryOp* binop = dynamic_cast<const BinaryOp*>(expr)) {
+        return escapes(binop->left.get(), true) || escapes(binop->right.get(), true);
+    }
+    if (const UnaryOp* unop = dynamic_cast<const UnaryOp*>(expr)) {
+        return escapes(unop->expr.get(), true);
+    }
+    if (const If* if_expr = dynamic_cast<const If*>(expr)) {
+        return escapes(if_expr->condition.get(), true) || escapes(if_expr->then_expr.get(), used)
+            || escapes(if_expr->else_expr.get(), used);
+    }
+    if (const While* while_expr = dynamic_cast<const While*>(expr)) {
+        return escapes(while_expr->condition.get(), true) || escapes(while_expr->body.get(), false);
+    }
+    if (const For* for_expr = dynamic_cast<const For*>(expr)) {
+        return escapes(for_expr->iterable.get(), true)
+            || ((is_self || for_expr->name != name) && escapes(for_expr->body.get(), false));
+    }
+    if (const Yield* yield = dynamic_cast<const Yield*>(expr)) {
+        return escapes(yield->expr.get(), true);
+    }
+    if (const Block* block = dynamic_cast<const Block*>(expr)) {
+        for (size_t i = 0; i < block->expressions.size(); ++i) {
+            if (escapes(block->expressions[i].get(), used && i + 1 == block->expressions.size())) return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+// Whether calling the given method on an object of the given class may let
+// the object escape. Object's print methods return self, and a generator's
+// frame keeps it.
+bool CodeGenerator::methodLeaksSelf(const std::string& class_name, const std::string& method_name, bool used,
+                                    const std::set<std::pair<std::string, bool>>& leaking) const {
+    const Method* method = findMethodNode(class_name, method_name);
+    if (!method) {
+        return used && isPrintMethod(method_name);
+    }
+    return method->generator || !method->body || leaking.count({method_name, used});
+}
+
+// The class of the object laid out inline in the field that the given
+// expression reads, or "" if it reads no such field
+std::string CodeGenerator::getInlineFieldClass(const Expression* expr) const {
+    const Identifier* id = dynamic_cast<const Identifier*>(expr);
+    if (!id || current_vars.count(id->name)) return "";
+    auto class_it = inline_fields.find(current_class);
+    if (class_it == inline_fields.end()) return "";
+    auto field_it = class_it->second.find(id->name);
+    return field_it != class_it->second.end() ? field_it->second : "";
+}
+
+// Method customization -------------------------------------------------------
+//
+// An inherited method is compiled once, in the class defining it, where self
+// may be an object of any of its subclasses, so every self-send in it goes
+// through the vtable. With --customize, the small inherited methods that send
+// messages to self are also compiled for each class inheriting them, with
+// self of that class, and the class's vtable points to its copy. Self-sends
+// that no subclass of the class overrides are then called directly (and can
+// be inlined). Leaf classes get all of them.
+
+// Largest body (in expressions) copied into the subclasses
+static const size_t CUSTOMIZE_MAX_SIZE = 64;
+
+// The direct subexpressions of the given expression
+static std::vector<const Expression*> getSubExpressions(const Expression* expr) {
+    if (const Assign* assign = dynamic_cast<const Assign*>(expr)) {
+        return {assign->expr.get()};
+    }
+    if (const Let* let = dynamic_cast<const Let*>(expr)) {
+        return {let->init_expr.get(), let->scope_expr.get()};
+    }
+    if (const BinaryOp* binop = dynamic_cast<const BinaryOp*>(expr)) {
+        return {binop->left.get(), binop->right.get()};
+    }
+    if (const UnaryOp* unop = dynamic_cast<const UnaryOp*>(expr)) {
+        return {unop->expr.get()};
+    }
+    if (const Call* call = dynamic_cast<const Call*>(expr)) {
+        std::vector<const Expression*> sub_exprs = {call->object.get()};
+        for (const auto& arg : call->arguments) {
+            sub_exprs.push_back(arg.get());
+        }
+        return sub_exprs;
+    }
+    if (const If* if_expr = dynamic_cast<const If*>(expr)) {
+        return {if_expr->condition.get(), if_expr->then_expr.get(), if_expr->else_expr.get()};
+    }
+    if (const While* while_expr = dynamic_cast<const While*>(expr)) {
+        return {while_expr->condition.get(), while_expr->body.get()};
+    }
+    if (const For* for_expr = dynamic_cast<const For*>(expr)) {
+        return {for_expr->iterable.get(), for_expr->body.get()};
+    }
+    if (const Yield* yield = dynamic_cast<const Yield*>(expr)) {
+        return {yield->expr.get()};
+    }
+    if (const Block* block = dynamic_cast<const Block*>(expr)) {
+        std::vector<const Expression*> sub_exprs;
+        for (const auto& sub_expr : block->expressions) {
+            sub_exprs.push_back(sub_expr.get());
+        }
+        return sub_exprs;
+    }
+    return {};
+}
+
+// Number of expressions in the given expression
+static size_t getExpressionSize(const Expression* expr) {
+    if (!expr) return 0;
+    size_t size = 1;
+    for (const Expression* sub_expr : getSubExpressions(expr)) {
+        size += getExpressionSize(sub_expr);
+    }
+    return size;
+}
+
+// Whether the given expression calls a method of self
+static bool hasSelfSend(const Expression* expr) {
+    if (!expr) return false;
+    if (const Call* call = dynamic_cast<const Call*>(expr)) {
+        if (!call->object || dynamic_cast<const Self*>(call->object.get())) return true;
+    }
+    for (const Expression* sub_expr : getSubExpressions(expr)) {
+        if (hasSelfSend(sub_expr)) return true;
+    }
+    return false;
+}
+
+// Choose the inherited methods to customize for each class (sets
+// customized_methods and clone_origins). A library's classes may be extended
+// by the programs using it, which may override any method, so a library
+// customizes nothing.
+void CodeGenerator::findCustomizedMethods() {
+    customized_methods.clear();
+    clone_origins.clear();
+    if (program->library) return;
+    
+    const auto& class_defs = analyzer.getClassDefinitions();
+    auto parentOf = [&](const std::string& class_name) {
+        const std::string& parent = class_defs.at(class_name).parent;
+        return parent.empty() ? std::string("Object") : parent;
+    };
+    
+    for (const auto& class_name : class_order) {
+        if (analyzer.isBuiltinClass(class_name) || isImported(class_name)) continue;
+        
+        // Walk up the ancestors: the nearest definition of a method is the
+        // one inherited
+        std::unordered_set<std::string> seen;
+        for (const auto& method : class_nodes.at(class_name)->methods) {
+            if (method) seen.insert(method->name);
+        }
+        for (std::string ancestor = parentOf(class_name);
+             class_nodes.count(ancestor) && !analyzer.isBuiltinClass(ancestor);
+             ancestor = parentOf(ancestor)) {
+            for (const auto& method : class_nodes.at(ancestor)->methods) {
+                if (!method || !seen.insert(method->name).second) continue;
+                // Imported methods have no body to copy, and a generator's
+                // calls are bound when its coroutine is created anyway
+                if (isImported(ancestor) || !method->body || method->generator
+                    || !class_defs.at(ancestor).methods.count(method->name)) continue;
+                if (getExpressionSize(method->body.get()) > CUSTOMIZE_MAX_SIZE
+                    || !hasSelfSend(method->body.get())) continue;
+                
+                customized_methods[class_name].push_back({method->name, method.get()});
+                clone_origins[class_name + "__" + method->name] = ancestor + "__" + method->name;
+            }
+        }
+    }
+}
+
+// Partial evaluation ---------------------------------------------------------
+//
+// Helper methods called on self with constant arguments (`self.table(3)`,
+// `fib(20)`) return the same result at every run. When such a method is pure
+// on self, i.e. it neither reads nor writes self's fields and only uses self
+// to call other such methods, the call is evaluated at compile time (see
+// Evaluator) and replaced by its result. The objects the method creates are
+// its own, so it may do anything with them. Whatever cannot be evaluated
+// (input and output, built-in classes, running out of fuel, ...) leaves the
+// call to run time. --report lists the calls evaluated and the ones given up.
+
+// Fuel of the evaluation of each call, in expressions evaluated
+static const size_t PARTIAL_EVAL_FUEL = 1000000;
+
+// Whether the given expression is made of literals and operators only
+static bool isConstantExpression(const Expression* expr) {
+    if (dynamic_cast<const Literal*>(expr)) return true;
+    if (!dynamic_cast<const UnaryOp*>(expr) && !dynamic_cast<const BinaryOp*>(expr)
+        && !dynamic_cast<const If*>(expr) && !dynamic_cast<const Block*>(expr)) return false;
+    for (const Expression* sub_expr : getSubExpressions(expr)) {
+        if (sub_expr && !isConstantExpression(sub_expr)) return false;
+    }
+    return true;
+}
+
+// Whether the given expression leaves self alone: it reads and assigns local
+// variables only (those in locals, and the ones it declares), and uses self
+// only to call its methods, which are added to self_sends
+static bool leavesSelfAlone(const Expression* expr, const std::unordered_set<std::string>& locals,
+                            std::vector<std::string>& self_sends) {
+    if (!expr) return true;
+    if (dynamic_cast<const Self*>(expr)) {
+        return false;
+    }
+    if (const Identifier* id = dynamic_cast<const Identifier*>(expr)) {
+        return locals.count(id->name) > 0;
+    }
+    if (const Assign* assign = dynamic_cast<const Assign*>(expr)) {
+        return locals.count(assign->name) && leavesSelfAlone(assign->expr.get(), locals, self_sends);
+    }
+    if (const Let* let = dynamic_cast<const Let*>(expr)) {
+        std::unordered_set<std::string> scope_locals = locals;
+        scope_locals.insert(let->name);
+        return leavesSelfAlone(let->init_expr.get(), locals, self_sends)
+            && leavesSelfAlone(let->scope_expr.get(), scope_locals, self_sends);
+    }
+    if (dynamic_cast<const For*>(expr) || dynamic_cast<const Yield*>(expr)) {
+        return false;
+    }
+    const Call* call = dynamic_cast<const Call*>(expr);
+    if (call && (!call->object || dynamic_cast<const Self*>(call->object.get()))) {
+        self_sends.push_back(call->method_name);
+        for (const auto& arg : call->arguments) {
+            if (!leavesSelfAlone(arg.get(), locals, self_sends)) return false;
+        }
+        return true;
+    }
+    for (const Expression* sub_expr : getSubExpressions(expr)) {
+        if (!leavesSelfAlone(sub_expr, locals, self_sends)) return false;
+    }
+    return true;
+}
+
+// Whether the given method, called on an object whose static type is the
+// given class, is pure on self: it and every method it calls on self have a
+// single implementation for the class and its subclasses, with a body that
+// leaves self alone. Its result then only depends on its arguments (and the
+// objects it creates), and the caller cannot see its effects.
+bool CodeGenerator::isPureMethod(const std::string& class_name, const std::string& method_name) {
+    auto pure_it = pure_methods.find({class_name, method_name});
+    if (pure_it != pure_methods.end()) return pure_it->second;
+    
+    bool pure = true;
+    std::unordered_set<std::string> visited;
+    std::vector<std::string> to_visit = {method_name};
+    while (pure && !to_visit.empty()) {
+        std::string name = to_visit.back();
+        to_visit.pop_back();
+        if (!visited.insert(name).second) continue;
+        
+        const Method* method = findMethodNode(class_name, name);
+        if (!method || !method->body || method->generator || !getUniqueImplementation(class_name, name)) {
+            pure = false;
+            break;
+        }
+        std::unordered_set<std::string> locals;
+        for (const auto& formal : method->formals) {
+            if (formal) locals.insert(formal->name);
+        }
+        pure = leavesSelfAlone(method->body.get(), locals, to_visit);
+    }
+    pure_methods[{class_name, method_name}] = pure;
+    return pure;
+}
+
+// The result of the given call, computed at compile time, if it calls a pure
+// method (see isPureMethod()) on self with constant arguments and returns an
+// int32, a bool or a string. Returns nullptr otherwise, or if the evaluation
+// gives up.
+llvm::Value* CodeGenerator::evaluatePureCall(const Call* call) {
+    if (current_class.empty() || !current_function
+        || (call->object && !dynamic_cast<const Self*>(call->object.get()))) return nullptr;
+    
+    std::optional<MethodSignature> method_sig = analyzer.findMethodSignature(current_class, call->method_name);
+    if (!method_sig.has_value() || method_sig->parameters.size() != call->arguments.size()) return nullptr;
+    std::string return_type = method_sig->returnType.toString();
+    if (return_type != "int32" && return_type != "bool" && return_type != "string") return nullptr;
+    for (const auto& arg : call->arguments) {
+        if (!isConstantExpression(arg.get())) return nullptr;
+    }
+    if (!isPureMethod(current_class, call->method_name)) {
+        addRemark(Remark::Kind::MISSED, "vsop-partial-eval", "NotEvaluated", current_function->getName().str(), call,
+                  call->method_name + " not evaluated: it is not pure on self");
+        return nullptr;
+    }
+    
+    // Arguments are evaluated in order, like the generated code would
+    Evaluator evaluator(program, analyzer, PARTIAL_EVAL_FUEL);
+    std::vector<EvalValue> args;
+    std::string call_text = call->method_name + "(";
+    for (const auto& arg : call->arguments) {
+        EvalValue value;
+        if (!evaluator.evaluateConstant(arg.get(), value)) {
+            report.push_back(current_function->getName().str() + ": " + call->method_name
+                             + " not evaluated: an argument " + evaluator.getFailure());
+            addRemark(Remark::Kind::MISSED, "vsop-partial-eval", "NotEvaluated", current_function->getName().str(), call,
+                      call->method_name + " not evaluated: an argument " + evaluator.getFailure());
+            return nullptr;
+        }
+        call_text += (args.empty() ? "" : ", ") + value.toString();
+        args.push_back(value);
+    }
+    call_text += ")";
+    
+    // A string built by the call is a new one each time it runs, which a
+    // constant cannot be
+    EvalValue result;
+    bool evaluated = evaluator.evaluateSend(current_class, call->method_name, args, result);
+    std::string failure = !evaluated ? evaluator.getFailure()
+        : result.kind == EvalValue::Kind::STRING && result.string_id >= 0 ? "returns a string built by the call" : "";
+    if (!failure.empty()) {
+        report.push_back(current_function->getName().str() + ": " + call_text + " not evaluated: it " + failure);
+        addRemark(Remark::Kind::MISSED, "vsop-partial-eval", "NotEvaluated", current_function->getName().str(), call,
+                  call_text + " not evaluated: it " + failure);
+        return nullptr;
     }
+    report.push_back(current_function->getName().str() + ": " + call_text + " evaluated to " + result.toString());
+    addRemark(Remark::Kind::PASSED, "vsop-partial-eval", "Evaluated", current_function->getName().str(), call,
+              call_text + " evaluated to " + result.toString() + " at compile time");
     
-    // If not found, report error and return i8* as fallback
-    reportError("Unknown type: " + vsop_type);
-    return llvm::Type::getInt8PtrTy(*context);
+    setExprType(call, return_type);
+    switch (result.kind) {
+        case EvalValue::Kind::INT32: return builder->getInt32(result.int_value);
+        case EvalValue::Kind::BOOL: return builder->getInt1(result.int_value);
+        default: return createStringConstant(result.string_value);
+    }
 }
 
-// Create a string constant
-llvm::Value* CodeGenerator::createStringConstant(const std::string& str) {
-    // Add null terminator
-    std::string with_null = str + '\0';
-    
-    // Create a constant array with the string data
-    llvm::Constant* string_constant = llvm::ConstantDataArray::getString(*context, with_null);
-    
-    // Create a global variable to hold the string
-    llvm::GlobalVariable* global_str = new llvm::GlobalVariable(
-        *module, string_constant->getType(), true,
-        llvm::GlobalValue::PrivateLinkage, string_constant, ".str");
-    
-    // Get a pointer to the first character
-    llvm::Value* zero = llvm::ConstantInt::get(llvm::Type::getInt32Ty(*context), 0);
-    llvm::Value* indices[] = {zero, zero};
-    return builder->CreateInBoundsGEP(string_constant->getType(), global_str, indices, "str");
+// Generators -----------------------------------------------------------------
+//
+// A generator is an LLVM coroutine with switched-resume lowering. Calling it
+// allocates its frame, stores its arguments and returns the coroutine's handle
+// without running the body. Each resume runs the body up to the next yield,
+// which stores the value in the coroutine's promise (a slot of the frame that
+// the for loop reads) and suspends. Once the body is done, the coroutine stays
+// suspended at its final suspend point until the loop destroys it.
+//
+// When the for loop calls the generator directly and inlines it, CoroElide
+// sees that the frame does not outlive the loop and puts it on the stack.
+
+// Emit the start of a generator: identify the coroutine, allocate its frame
+// unless it is elided and begin it. The promise holds values of the given
+// type.
+void CodeGenerator::beginGenerator(const std::string& yield_type) {
+    llvm::Function* func = current_function;
+    llvm::Type* i8_ptr = builder->getInt8PtrTy();
+    llvm::Value* null = llvm::ConstantPointerNull::get(builder->getInt8PtrTy());
+    
+    // Tells CoroSplit that the function is a coroutine left to split
+    func->addFnAttr("coroutine.presplit", "0");
+    
+    coro_promise = createEntryAlloca(getLLVMType(yield_type), "promise");
+    coro_id = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_id),
+        {builder->getInt32(coro_promise->getAlign().value()),
+         builder->CreateBitCast(coro_promise, i8_ptr), null, null}, "id");
+    
+    llvm::BasicBlock* entry = builder->GetInsertBlock();
+    llvm::BasicBlock* alloc_bb = llvm::BasicBlock::Create(*context, "coro.alloc", func);
+    llvm::BasicBlock* begin_bb = llvm::BasicBlock::Create(*context, "coro.begin", func);
+    llvm::Value* need_alloc = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_alloc), {coro_id}, "need_alloc");
+    builder->CreateCondBr(need_alloc, alloc_bb, begin_bb);
+    
+    builder->SetInsertPoint(alloc_bb);
+    llvm::Value* size = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_size, {builder->getInt64Ty()}),
+        {}, "size");
+    llvm::Value* mem = builder->CreateCall(module->getOrInsertFunction("malloc",
+        i8_ptr, llvm::Type::getInt64Ty(*context)), {size}, "mem");
+    builder->CreateBr(begin_bb);
+    
+    builder->SetInsertPoint(begin_bb);
+    llvm::PHINode* frame = builder->CreatePHI(i8_ptr, 2, "frame");
+    frame->addIncoming(null, entry);
+    frame->addIncoming(mem, alloc_bb);
+    coro_handle = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_begin), {coro_id, frame}, "hdl");
+    
+    // Shared by all suspend points, added by endGenerator()
+    coro_cleanup = llvm::BasicBlock::Create(*context, "coro.cleanup");
+    coro_suspend = llvm::BasicBlock::Create(*context, "coro.suspend");
+}
+
+// Suspend the generator. Resuming continues at the insertion point, while
+// destroying frees the frame. The final suspend point cannot be resumed.
+void CodeGenerator::emitSuspend(bool final) {
+    llvm::Value* state = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_suspend),
+        {llvm::ConstantTokenNone::get(*context), builder->getInt1(final)}, "state");
+    llvm::BasicBlock* resume_bb = llvm::BasicBlock::Create(*context, final ? "coro.final" : "coro.resume",
+                                                           current_function);
+    llvm::SwitchInst* dispatch = builder->CreateSwitch(state, coro_suspend, 2);
+    dispatch->addCase(builder->getInt8(0), resume_bb);
+    dispatch->addCase(builder->getInt8(1), coro_cleanup);
+    
+    builder->SetInsertPoint(resume_bb);
+    if (final) {
+        builder->CreateUnreachable();
+    }
+}
+
+// Emit the end of a generator: its final suspend point, the destruction of
+// its frame and the return of its handle to the caller (or resumer)
+void CodeGenerator::endGenerator() {
+    llvm::Function* func = current_function;
+    emitSuspend(true);
+    
+    func->getBasicBlockList().push_back(coro_cleanup);
+    builder->SetInsertPoint(coro_cleanup);
+    llvm::Value* mem = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_free), {coro_id, coro_handle}, "mem");
+    llvm::BasicBlock* free_bb = llvm::BasicBlock::Create(*context, "coro.free", func);
+    builder->CreateCondBr(builder->CreateIsNotNull(mem), free_bb, coro_suspend);
+    
+    builder->SetInsertPoint(free_bb);
+    builder->CreateCall(module->getOrInsertFunction("free",
+        builder->getVoidTy(), builder->getInt8PtrTy()), {mem});
+    builder->CreateBr(coro_suspend);
+    
+    func->getBasicBlockList().push_back(coro_suspend);
+    builder->SetInsertPoint(coro_suspend);
+    builder->CreateCall(llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_end),
+                        {coro_handle, builder->getFalse()});
+    builder->CreateRet(coro_handle);
+    
+    coro_id = nullptr;
+    coro_handle = nullptr;
+    coro_promise = nullptr;
+    coro_cleanup = nullptr;
+    coro_suspend = nullptr;
 }
 
 // Generate code for expressions
@@ -852,6 +2970,12 @@ llvm::Value* CodeGenerator::generateExpression(const Expression* expr) {
     else if (const While* whileExpr = dynamic_cast<const While*>(expr)) {
         return generateWhile(whileExpr);
     }
+    else if (const For* forExpr = dynamic_cast<const For*>(expr)) {
+        return generateFor(forExpr);
+    }
+    else if (const Yield* yieldExpr = dynamic_cast<const Yield*>(expr)) {
+        return generateYield(yieldExpr);
+    }
     else if (const Assign* assignExpr = dynamic_cast<const Assign*>(expr)) {
         return generateAssign(assignExpr);
     }
@@ -859,15 +2983,19 @@ llvm::Value* CodeGenerator::generateExpression(const Expression* expr) {
         return generateBlock(blockExpr);
     }
     else if (const IntegerLiteral* intLit = dynamic_cast<const IntegerLiteral*>(expr)) {
+        setExprType(expr, "int32");
         return llvm::ConstantInt::get(llvm::Type::getInt32Ty(*context), intLit->value);
     }
     else if (const BooleanLiteral* boolLit = dynamic_cast<const BooleanLiteral*>(expr)) {
+        setExprType(expr, "bool");
         return llvm::ConstantInt::get(llvm::Type::getInt1Ty(*context), boolLit->value);
     }
     else if (const StringLiteral* strLit = dynamic_cast<const StringLiteral*>(expr)) {
+        setExprType(expr, "string");
         return createStringConstant(strLit->value);
     }
-    else if (const UnitLiteral* unitLit = dynamic_cast<const UnitLiteral*>(expr)) {
+    else if (dynamic_cast<const UnitLiteral*>(expr)) {
+        setExprType(expr, "unit");
         return nullptr; // unit has no value
     }
     else if (const Identifier* id = dynamic_cast<const Identifier*>(expr)) {
@@ -895,6 +3023,15 @@ llvm::Value* CodeGenerator::generateBinaryOp(const BinaryOp* binop) {
     llvm::Value* left = generateExpression(binop->left.get());
     llvm::Value* right = generateExpression(binop->right.get());
     
+    // Comparisons yield bool, arithmetic yields int32
+    bool is_comparison = binop->op == "=" || binop->op == "<" || binop->op == "<=" || binop->op == "and";
+    setExprType(binop, is_comparison ? "bool" : "int32");
+    
+    // unit has a single value, so two units are always equal
+    if (binop->op == "=" && getExprType(binop->left.get()) == "unit") {
+        return llvm::ConstantInt::getTrue(*context);
+    }
+    
     if (!left || !right) {
         return nullptr; // Error already reported
     }
@@ -917,91 +3054,8 @@ llvm::Value* CodeGenerator::generateBinaryOp(const BinaryOp* binop) {
         return builder->CreateSDiv(left, right, "divtmp");
     }
     else if (binop->op == "^") {
-        // Power operation - implement using a loop or call to pow function
-        // For simplicity, we'll create a call to a custom power function
-        
-        // First, check if we already created this function
-        llvm::Function* pow_func = module->getFunction("vsop_pow");
-        
-        if (!pow_func) {
-            // Create the power function for int32 if it doesn't exist
-            llvm::Type* int32_type = llvm::Type::getInt32Ty(*context);
-            std::vector<llvm::Type*> args_types = {int32_type, int32_type};
-            llvm::FunctionType* func_type = llvm::FunctionType::get(int32_type, args_types, false);
-            
-            pow_func = llvm::Function::Create(func_type, llvm::Function::InternalLinkage, "vsop_pow", module.get());
-            
-            // Set argument names
-            auto args_it = pow_func->arg_begin();
-            args_it->setName("base");
-            (++args_it)->setName("exp");
-            
-            // Create the function body
-            llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", pow_func);
-            llvm::BasicBlock* loop_check = llvm::BasicBlock::Create(*context, "loop_check", pow_func);
-            llvm::BasicBlock* loop_body = llvm::BasicBlock::Create(*context, "loop_body", pow_func);
-            llvm::BasicBlock* loop_exit = llvm::BasicBlock::Create(*context, "loop_exit", pow_func);
-            
-            // Get function arguments
-            auto args = pow_func->arg_begin();
-            llvm::Value* base = args++;
-            llvm::Value* exp = args;
-            
-            // Create temporary builder for this function
-            llvm::IRBuilder<> temp_builder(*context);
-            
-            // Entry block logic
-            temp_builder.SetInsertPoint(entry);
-            
-            // Initialize result to 1 (base^0 = 1)
-            llvm::Value* result = llvm::ConstantInt::get(int32_type, 1);
-            llvm::Value* count = llvm::ConstantInt::get(int32_type, 0);
-            
-            // Create allocas for local variables
-            llvm::AllocaInst* result_alloca = temp_builder.CreateAlloca(int32_type, nullptr, "result");
-            llvm::AllocaInst* count_alloca = temp_builder.CreateAlloca(int32_type, nullptr, "count");
-            
-            // Initialize allocas
-            temp_builder.CreateStore(result, result_alloca);
-            temp_builder.CreateStore(count, count_alloca);
-            
-            // Branch to loop check
-            temp_builder.CreateBr(loop_check);
-            
-            // Loop check block
-            temp_builder.SetInsertPoint(loop_check);
-            
-            // Load current values
-            llvm::Value* current_count = temp_builder.CreateLoad(int32_type, count_alloca, "current_count");
-            llvm::Value* current_result = temp_builder.CreateLoad(int32_type, result_alloca, "current_result");
-            
-            // Check if count < exp
-            llvm::Value* cond = temp_builder.CreateICmpSLT(current_count, exp, "count_lt_exp");
-            temp_builder.CreateCondBr(cond, loop_body, loop_exit);
-            
-            // Loop body block
-            temp_builder.SetInsertPoint(loop_body);
-            
-            // result = result * base
-            llvm::Value* new_result = temp_builder.CreateMul(current_result, base, "new_result");
-            temp_builder.CreateStore(new_result, result_alloca);
-            
-            // count = count + 1
-            llvm::Value* new_count = temp_builder.CreateAdd(current_count, llvm::ConstantInt::get(int32_type, 1), "new_count");
-            temp_builder.CreateStore(new_count, count_alloca);
-            
-            // Branch back to loop check
-            temp_builder.CreateBr(loop_check);
-            
-            // Loop exit block
-            temp_builder.SetInsertPoint(loop_exit);
-            
-            // Return the result
-            temp_builder.CreateRet(current_result);
-        }
-        
-        // Call the power function
-        return builder->CreateCall(pow_func, {left, right}, "powtmp");
+        // Power operation - call the power function (see getPowFunction())
+        return builder->CreateCall(getPowFunction(), {left, right}, "powtmp");
     }
     else if (binop->op == "=") {
         // Equality comparison - result is a boolean (i1)
@@ -1014,8 +3068,11 @@ llvm::Value* CodeGenerator::generateBinaryOp(const BinaryOp* binop) {
             return builder->CreateICmpEQ(left, right, "eqtmp");
         }
         else if (left->getType()->isPointerTy()) {
-            // For objects/strings
-            return builder->CreateICmpEQ(left, right, "eqtmp");
+            // For objects/strings (objects may have different static classes)
+            llvm::Value* eq = builder->CreateICmpEQ(left, castValue(right, left->getType()), "eqtmp");
+            releaseTemporary(binop->left.get(), left);
+            releaseTemporary(binop->right.get(), right);
+            return eq;
         }
         reportError("Unsupported types for equality comparison");
         return nullptr;
@@ -1037,6 +3094,91 @@ llvm::Value* CodeGenerator::generateBinaryOp(const BinaryOp* binop) {
     return nullptr;
 }
 
+// The internal function computing base ^ exp, created when first used
+llvm::Function* CodeGenerator::getPowFunction() {
+    // First, check if we already created this function
+    llvm::Function* pow_func = module->getFunction("vsop_pow");
+    
+    if (!pow_func) {
+        // Create the power function for int32 if it doesn't exist
+        llvm::Type* int32_type = llvm::Type::getInt32Ty(*context);
+        std::vector<llvm::Type*> args_types = {int32_type, int32_type};
+        llvm::FunctionType* func_type = llvm::FunctionType::get(int32_type, args_types, false);
+        
+        pow_func = llvm::Function::Create(func_type, llvm::Function::InternalLinkage, "vsop_pow", module.get());
+        
+        // Set argument names
+        auto args_it = pow_func->arg_begin();
+        args_it->setName("base");
+        (++args_it)->setName("exp");
+        
+        // Create the function body
+        llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", pow_func);
+        llvm::BasicBlock* loop_check = llvm::BasicBlock::Create(*context, "loop_check", pow_func);
+        llvm::BasicBlock* loop_body = llvm::BasicBlock::Create(*context, "loop_body", pow_func);
+        llvm::BasicBlock* loop_exit = llvm::BasicBlock::Create(*context, "loop_exit", pow_func);
+        
+        // Get function arguments
+        auto args = pow_func->arg_begin();
+        llvm::Value* base = args++;
+        llvm::Value* exp = args;
+        
+        // Create temporary builder for this function
+        llvm::IRBuilder<> temp_builder(*context);
+        
+        // Entry block logic
+        temp_builder.SetInsertPoint(entry);
+        
+        // Initialize result to 1 (base^0 = 1)
+        llvm::Value* result = llvm::ConstantInt::get(int32_type, 1);
+        llvm::Value* count = llvm::ConstantInt::get(int32_type, 0);
+        
+        // Create allocas for local variables
+        llvm::AllocaInst* result_alloca = temp_builder.CreateAlloca(int32_type, nullptr, "result");
+        llvm::AllocaInst* count_alloca = temp_builder.CreateAlloca(int32_type, nullptr, "count");
+        
+        // Initialize allocas
+        temp_builder.CreateStore(result, result_alloca);
+        temp_builder.CreateStore(count, count_alloca);
+        
+        // Branch to loop check
+        temp_builder.CreateBr(loop_check);
+        
+        // Loop check block
+        temp_builder.SetInsertPoint(loop_check);
+        
+        // Load current values
+        llvm::Value* current_count = temp_builder.CreateLoad(int32_type, count_alloca, "current_count");
+        llvm::Value* current_result = temp_builder.CreateLoad(int32_type, result_alloca, "current_result");
+        
+        // Check if count < exp
+        llvm::Value* cond = temp_builder.CreateICmpSLT(current_count, exp, "count_lt_exp");
+        temp_builder.CreateCondBr(cond, loop_body, loop_exit);
+        
+        // Loop body block
+        temp_builder.SetInsertPoint(loop_body);
+        
+        // result = result * base
+        llvm::Value* new_result = temp_builder.CreateMul(current_result, base, "new_result");
+        temp_builder.CreateStore(new_result, result_alloca);
+        
+        // count = count + 1
+        llvm::Value* new_count = temp_builder.CreateAdd(current_count, llvm::ConstantInt::get(int32_type, 1), "new_count");
+        temp_builder.CreateStore(new_count, count_alloca);
+        
+        // Branch back to loop check
+        temp_builder.CreateBr(loop_check);
+        
+        // Loop exit block
+        temp_builder.SetInsertPoint(loop_exit);
+        
+        // Return the result
+        temp_builder.CreateRet(current_result);
+    }
+    
+    return pow_func;
+}
+
 // Let's also implement a simpler expression handler: literals
 llvm::Value* CodeGenerator::generateLiteral(const Literal* literal) {
     if (const IntegerLiteral* intLit = dynamic_cast<const IntegerLiteral*>(literal)) {
@@ -1077,17 +3219,22 @@ llvm::Value* CodeGenerator::generateUnaryOp(const UnaryOp* unop) {
     // Perform operation based on the operator
     if (unop->op == "-") {
         // Unary minus - negate the operand
+        setExprType(unop, "int32");
         return builder->CreateNeg(operand, "negtmp");
     }
     else if (unop->op == "not") {
         // Logical NOT - invert the boolean value
+        setExprType(unop, "bool");
         return builder->CreateNot(operand, "nottmp");
     }
     else if (unop->op == "isnull") {
         // Check if the object is null
+        setExprType(unop, "bool");
         llvm::Value* null_ptr = llvm::ConstantPointerNull::get(
             llvm::cast<llvm::PointerType>(operand->getType()));
-        return builder->CreateICmpEQ(operand, null_ptr, "isnulltmp");
+        llvm::Value* is_null = builder->CreateICmpEQ(operand, null_ptr, "isnulltmp");
+        releaseTemporary(unop->expr.get(), operand);
+        return is_null;
     }
     
     reportError("Unknown unary operator: " + unop->op);
@@ -1112,14 +3259,10 @@ llvm::Value* CodeGenerator::generateIf(const If* ifExpr) {
     llvm::Function* func = builder->GetInsertBlock()->getParent();
     llvm::BasicBlock* then_bb = llvm::BasicBlock::Create(*context, "then", func);
     llvm::BasicBlock* else_bb = nullptr;
-    llvm::BasicBlock* merge_bb = nullptr;
+    llvm::BasicBlock* merge_bb = llvm::BasicBlock::Create(*context, "ifcont");
     
     if (ifExpr->else_expr) {
         else_bb = llvm::BasicBlock::Create(*context, "else");
-        merge_bb = llvm::BasicBlock::Create(*context, "ifcont");
-    } else {
-        // No else branch, so merge block is the same as else block
-        merge_bb = llvm::BasicBlock::Create(*context, "ifcont");
     }
     
     // Create conditional branch based on condition
@@ -1128,50 +3271,68 @@ llvm::Value* CodeGenerator::generateIf(const If* ifExpr) {
     // Generate code for then branch
     builder->SetInsertPoint(then_bb);
     llvm::Value* then_val = generateExpression(ifExpr->then_expr.get());
-    if (!then_val) {
-        return nullptr; // Error already reported
+    
+    // Without else branch, the result is unit
+    if (!ifExpr->else_expr) {
+        releaseTemporary(ifExpr->then_expr.get(), then_val);
+        builder->CreateBr(merge_bb);
+        func->getBasicBlockList().push_back(merge_bb);
+        builder->SetInsertPoint(merge_bb);
+        setExprType(ifExpr, "unit");
+        return nullptr;
     }
     
-    // Branch to merge block
-    builder->CreateBr(merge_bb);
+    // The 'then' block is left open: its value can only be converted once
+    // the type of the 'else' branch is known
+    llvm::BasicBlock* then_end = builder->GetInsertBlock();
     
-    // Remember the block where we generated the 'then' value for PHI node
-    then_bb = builder->GetInsertBlock();
+    // Generate code for else branch
+    func->getBasicBlockList().push_back(else_bb);
+    builder->SetInsertPoint(else_bb);
+    llvm::Value* else_val = generateExpression(ifExpr->else_expr.get());
+    llvm::BasicBlock* else_end = builder->GetInsertBlock();
     
-    // Generate code for else branch if it exists
-    llvm::Value* else_val = nullptr;
-    if (ifExpr->else_expr) {
-        func->getBasicBlockList().push_back(else_bb);
-        builder->SetInsertPoint(else_bb);
-        
-        else_val = generateExpression(ifExpr->else_expr.get());
-        if (!else_val) {
-            return nullptr; // Error already reported
-        }
-        
-        // Branch to merge block
-        builder->CreateBr(merge_bb);
-        
-        // Remember the block where we generated the 'else' value for PHI node
-        else_bb = builder->GetInsertBlock();
+    // Both branches are converted to their common ancestor type
+    std::string result_type = analyzer.findCommonAncestor(
+        analyzer.resolveType(getExprType(ifExpr->then_expr.get())),
+        analyzer.resolveType(getExprType(ifExpr->else_expr.get()))).toString();
+    if (getExprType(ifExpr->then_expr.get()) == "unit" || getExprType(ifExpr->else_expr.get()) == "unit") {
+        result_type = "unit";
     }
+    setExprType(ifExpr, result_type);
+    llvm::Type* result_llvm_type = result_type == "unit" ? nullptr : getLLVMType(result_type);
+    
+    // An object result is owned whichever branch produced it, other values
+    // of the branches are discarded
+    bool counted = isCounted(result_type);
+    if (counted) owned_exprs.insert(ifExpr);
+    
+    builder->SetInsertPoint(then_end);
+    if (counted) then_val = takeOwnership(ifExpr->then_expr.get(), then_val);
+    else if (!result_llvm_type) releaseTemporary(ifExpr->then_expr.get(), then_val);
+    if (then_val && result_llvm_type) then_val = castValue(then_val, result_llvm_type);
+    builder->CreateBr(merge_bb);
+    then_bb = builder->GetInsertBlock();
+    
+    builder->SetInsertPoint(else_end);
+    if (counted) else_val = takeOwnership(ifExpr->else_expr.get(), else_val);
+    else if (!result_llvm_type) releaseTemporary(ifExpr->else_expr.get(), else_val);
+    if (else_val && result_llvm_type) else_val = castValue(else_val, result_llvm_type);
+    builder->CreateBr(merge_bb);
+    else_bb = builder->GetInsertBlock();
     
     // Generate code for merge block
     func->getBasicBlockList().push_back(merge_bb);
     builder->SetInsertPoint(merge_bb);
     
     // Create PHI node for the result if needed
-    if (ifExpr->else_expr) {
-        llvm::PHINode* phi = builder->CreatePHI(then_val->getType(), 2, "iftmp");
-        
-        phi->addIncoming(then_val, then_bb);
-        phi->addIncoming(else_val, else_bb);
-        
-        return phi;
-    } else {
-        // If no else branch, the result is unit (void)
+    if (!then_val || !else_val || !result_llvm_type || result_llvm_type->isVoidTy()) {
         return nullptr;
     }
+    llvm::PHINode* phi = builder->CreatePHI(result_llvm_type, 2, "iftmp");
+    phi->addIncoming(then_val, then_bb);
+    phi->addIncoming(else_val, else_bb);
+    return phi;
 }
 
 // Implementation for identifiers (variable access)
@@ -1181,30 +3342,30 @@ llvm::Value* CodeGenerator::generateIdentifier(const Identifier* id) {
         return nullptr;
     }
     
-    // Check if it's a local variable
+    // Check if it's a local variable or a parameter
     auto it = current_vars.find(id->name);
     if (it != current_vars.end()) {
-        return it->second;
+        setExprType(id, current_var_types[id->name]);
+        if (!it->second) {
+            return nullptr; // unit variable
+        }
+        return builder->CreateLoad(it->second->getAllocatedType(), it->second, id->name);
     }
     
     // Check if it's a field of the current class
     if (!current_class.empty()) {
-        // Get the 'self' parameter
-        llvm::Function* func = builder->GetInsertBlock()->getParent();
-        llvm::Argument* self = func->arg_begin();
-        
-        // Look up field index
         std::optional<Type> field_type_opt = analyzer.findFieldType(current_class, id->name);
-        if (field_type_opt.has_value()) {
-            // Calculate field index - this is simplistic and assumes fields are in order
-            // In a real implementation, you'd need a proper field index map
-            int field_idx = 1; // Skip the vtable pointer
-            
-            // Create a GEP to access the field
-            llvm::Value* field_ptr = builder->CreateStructGEP(
-                class_types[current_class], self, field_idx, id->name);
-            
-            // Load the field value
+        if (field_type_opt.has_value() && field_type_opt.value().toString() == "unit") {
+            setExprType(id, "unit");
+            return nullptr; // unit field
+        }
+        llvm::Value* field_ptr = getFieldPointer(id->name);
+        if (field_type_opt.has_value() && field_ptr) {
+            setExprType(id, field_type_opt.value().toString());
+            // An object laid out inline is used where it is
+            if (!getInlineFieldClass(id).empty()) {
+                return castValue(field_ptr, getLLVMType(field_type_opt.value().toString()));
+            }
             return builder->CreateLoad(getLLVMType(field_type_opt.value().toString()), field_ptr, id->name);
         }
     }
@@ -1225,6 +3386,8 @@ llvm::Value* CodeGenerator::generateSelf(const Self* self) {
         return nullptr;
     }
     
+    setExprType(self, current_class);
+    
     // Get the 'self' parameter from the current function
     llvm::Function* func = builder->GetInsertBlock()->getParent();
     llvm::Argument* self_arg = func->arg_begin();
@@ -1239,6 +3402,39 @@ llvm::Value* CodeGenerator::generateCall(const Call* call) {
         return nullptr;
     }
     
+    // Pure method called on self with constant arguments: use its result
+    if (options.partial_evaluation && options.optimization_level > 0) {
+        if (llvm::Value* result = evaluatePureCall(call)) return result;
+    }
+    
+    // The callee borrows its receiver and arguments, which must stay valid
+    // until it returns. Owned ones are released after the call. Borrowed ones
+    // are retained for the call unless they are stable, i.e. self or a local
+    // variable that no later argument assigns to.
+    std::vector<llvm::Value*> to_release;
+    auto keepOperand = [&](size_t index, const Expression* operand, llvm::Value* value) {
+        if (!isCounted(getExprType(operand))) return;
+        if (owned_exprs.count(operand)) {
+            to_release.push_back(value);
+            return;
+        }
+        bool stable = isStableBorrow(operand);
+        if (const Identifier* id = dynamic_cast<const Identifier*>(operand)) {
+            for (size_t j = index; stable && j < call->arguments.size(); ++j) {
+                stable = !isAssignedIn(call->arguments[j].get(), id->name);
+            }
+        }
+        if (!stable) {
+            emitRetain(value);
+            to_release.push_back(value);
+        }
+        else {
+            addRemark(Remark::Kind::PASSED, "vsop-refcount", "RetainElided", current_function->getName().str(), call,
+                      std::string(index == 0 ? "receiver" : "argument " + std::to_string(index)) + " of " + call->method_name
+                      + " not retained for the call: it is self or a local variable that stays valid");
+        }
+    };
+    
     // Generate code for the object expression (or use 'self' if null)
     llvm::Value* object = nullptr;
     std::string object_class_name;
@@ -1249,19 +3445,8 @@ llvm::Value* CodeGenerator::generateCall(const Call* call) {
         if (!object) {
             return nullptr; // Error already reported
         }
-        
-        // Determine the class of the object
-        if (const Self* self = dynamic_cast<const Self*>(call->object.get())) {
-            object_class_name = current_class;
-        }
-        else if (const New* newExpr = dynamic_cast<const New*>(call->object.get())) {
-            object_class_name = newExpr->type_name;
-        }
-        else {
-            // For other expressions, we need to determine the class at runtime
-            // This is a simplification - in a real implementation, you'd need RTTI or virtual methods
-            object_class_name = "Object"; // Use Object as fallback
-        }
+        object_class_name = getExprType(call->object.get());
+        keepOperand(0, call->object.get(), object);
     }
     else {
         // Implicit self
@@ -1280,73 +3465,107 @@ llvm::Value* CodeGenerator::generateCall(const Call* call) {
     std::optional<MethodSignature> method_sig_opt = analyzer.findMethodSignature(object_class_name, call->method_name);
     
     if (!method_sig_opt.has_value()) {
-        // Check if it's a built-in Object method
-        if (call->method_name == "print" || call->method_name == "printInt32" || 
-            call->method_name == "inputInt32" || call->method_name == "inputString") {
-            // These are handled specially as they're part of the runtime
-            std::string method_name = "Object__" + call->method_name;
-            llvm::Function* method_func = methods[method_name];
-            
-            if (!method_func) {
-                reportError("Built-in method not found: " + method_name);
-                return nullptr;
-            }
-            
-            // Prepare arguments
-            std::vector<llvm::Value*> args;
-            args.push_back(object); // First argument is always the object
-            
-            // Add method arguments
-            for (const auto& arg : call->arguments) {
-                llvm::Value* arg_val = generateExpression(arg.get());
-                if (!arg_val) {
-                    return nullptr; // Error already reported
-                }
-                args.push_back(arg_val);
-            }
-            
-            // Call the method
-            return builder->CreateCall(method_func, args, call->method_name + "_call");
-        }
-        
         reportError("Method not found: " + call->method_name + " in class " + object_class_name);
         return nullptr;
     }
-    
-    // Construct the method name
-    std::string method_name = object_class_name + "__" + call->method_name;
-    
-    // Find the method function
-    llvm::Function* method_func = methods[method_name];
-    
-    if (!method_func) {
-        reportError("Method function not found: " + method_name);
-        return nullptr;
-    }
-    
-    // Prepare arguments
-    std::vector<llvm::Value*> args;
-    args.push_back(object); // First argument is always the object
+    const MethodSignature& method_sig = method_sig_opt.value();
     
     // Check argument count
-    if (call->arguments.size() != method_sig_opt.value().parameters.size()) {
+    if (call->arguments.size() != method_sig.parameters.size()) {
         reportError("Incorrect number of arguments for method " + call->method_name + 
-                    ": expected " + std::to_string(method_sig_opt.value().parameters.size()) + 
+                    ": expected " + std::to_string(method_sig.parameters.size()) + 
                     ", got " + std::to_string(call->arguments.size()));
         return nullptr;
     }
     
-    // Add method arguments
+    // Look the method up in the receiver's vtable. Strings have no vtable,
+    // and built-in classes other than Object cannot be extended, so their
+    // methods are called directly.
+    // So are generators that no subclass overrides: the for loop can then
+    // see the coroutine and keep its frame on the stack. The class of an
+    // object laid out inline is known exactly.
+    llvm::FunctionCallee callee;
+    llvm::Function* generator_impl = nullptr;
+    std::string inline_class = getInlineFieldClass(call->object.get());
+    if (object_class_name == "string") {
+        callee = getStringMethod(call->method_name);
+    }
+    else if (object_class_name != "Object" && analyzer.isBuiltinClass(object_class_name)) {
+        callee = methods[vtable_impls[object_class_name][call->method_name]];
+    }
+    else if (!inline_class.empty()) {
+        callee = methods[vtable_impls[inline_class][call->method_name]];
+    }
+    else if (options.customize_methods && (!call->object || dynamic_cast<const Self*>(call->object.get()))
+             && (callee = getUniqueImplementation(object_class_name, call->method_name))) {
+        // Self-send that no subclass of the current class overrides
+    }
+    else if (method_sig.generator
+             && (generator_impl = getUniqueImplementation(object_class_name, call->method_name))) {
+        callee = generator_impl;
+    }
+    else {
+        callee = generateDispatch(object, object_class_name, call->method_name);
+    }
+    if (!callee) {
+        return nullptr; // Error already reported
+    }
+    if (options.remarks) {
+        std::string call_text = "call of " + call->method_name + " on " + object_class_name;
+        llvm::Function* direct = llvm::dyn_cast<llvm::Function>(callee.getCallee());
+        if (direct) {
+            std::string reason = object_class_name == "string" ? "methods of strings are runtime functions"
+                : analyzer.isBuiltinClass(object_class_name) && object_class_name != "Object"
+                ? "built-in classes cannot be extended"
+                : !inline_class.empty() ? "its receiver is an object of class " + inline_class + " laid out inline"
+                : "no subclass of " + object_class_name + " overrides it";
+            addRemark(Remark::Kind::PASSED, "vsop-devirtualize", "DirectCall", current_function->getName().str(), call,
+                      call_text + " bound to " + direct->getName().str() + ": " + reason);
+        } else {
+            bool self_send = !call->object || dynamic_cast<const Self*>(call->object.get());
+            std::string reason = program->library ? "the programs using the library may override it"
+                : !getUniqueImplementation(object_class_name, call->method_name)
+                ? "a subclass of " + object_class_name + " overrides it"
+                : self_send ? "no subclass overrides it, but self-sends are only bound statically with --customize"
+                : "no subclass overrides it, but only self-sends and generators are bound statically";
+            addRemark(Remark::Kind::MISSED, "vsop-devirtualize", "VirtualCall", current_function->getName().str(), call,
+                      call_text + " dispatched through the vtable: " + reason);
+        }
+    }
+    llvm::FunctionType* func_type = callee.getFunctionType();
+    
+    // Prepare arguments
+    std::vector<llvm::Value*> args;
+    args.push_back(castValue(object, func_type->getParamType(0))); // First argument is always the object
+    
+    // Add method arguments. Unit ones are evaluated for their effects, but
+    // not passed.
     for (size_t i = 0; i < call->arguments.size(); i++) {
         llvm::Value* arg_val = generateExpression(call->arguments[i].get());
+        if (getExprType(call->arguments[i].get()) == "unit") continue;
         if (!arg_val) {
             return nullptr; // Error already reported
         }
-        args.push_back(arg_val);
+        keepOperand(i + 1, call->arguments[i].get(), arg_val);
+        args.push_back(castValue(arg_val, func_type->getParamType(args.size())));
     }
     
+    setExprType(call, method_sig.returnType.toString());
+    
     // Call the method
-    return builder->CreateCall(method_func, args, call->method_name + "_call");
+    llvm::Value* result = nullptr;
+    if (func_type->getReturnType()->isVoidTy()) {
+        builder->CreateCall(callee, args);
+    } else {
+        result = builder->CreateCall(callee, args, call->method_name + "_call");
+        // A generator call is the handle of a coroutine, which the enclosing
+        // for loop destroys
+        if (!method_sig.generator) owned_exprs.insert(call);
+    }
+    for (llvm::Value* value : to_release) {
+        emitRelease(value);
+    }
+    return result;
 }
 
 // Implementation for blocks
@@ -1357,25 +3576,24 @@ llvm::Value* CodeGenerator::generateBlock(const Block* block) {
     }
     
     // If the block is empty, return nullptr (unit value)
+    setExprType(block, "unit");
     if (block->expressions.empty()) {
         return nullptr;
     }
     
-    // Generate code for each expression in the block
+    // Generate code for each expression in the block. Intermediate
+    // expressions may legitimately be unit (nullptr), and their values are
+    // discarded.
     llvm::Value* result = nullptr;
-    for (const auto& expr : block->expressions) {
-        // Generate code for this expression
-        result = generateExpression(expr.get());
-        
-        if (!result && expr != block->expressions.back()) {
-            // Only the last expression can return unit (nullptr)
-            // For intermediate expressions, we should at least have generated code
-            reportError("Failed to generate code for block expression");
-            return nullptr;
-        }
+    for (size_t i = 0; i < block->expressions.size(); ++i) {
+        if (i > 0) releaseTemporary(block->expressions[i - 1].get(), result);
+        result = generateExpression(block->expressions[i].get());
     }
     
     // Return the value of the last expression
+    const Expression* last = block->expressions.back().get();
+    setExprType(block, getExprType(last));
+    if (owned_exprs.count(last)) owned_exprs.insert(block);
     return result;
 }
 
@@ -1386,43 +3604,41 @@ llvm::Value* CodeGenerator::generateAssign(const Assign* assign) {
         return nullptr;
     }
     
-    // Generate code for the right-hand side expression
+    // Generate code for the right-hand side expression. The variable takes
+    // its own reference to the new value and drops the one to the old value
+    // (the result is borrowed from the variable).
     llvm::Value* value = generateExpression(assign->expr.get());
-    
-    if (!value) {
-        return nullptr; // Error already reported
-    }
+    setExprType(assign, getExprType(assign->expr.get()));
+    value = takeOwnership(assign->expr.get(), value);
+    bool counted = isCounted(getExprType(assign));
     
     // Check if it's a local variable
     auto it = current_vars.find(assign->name);
     if (it != current_vars.end()) {
-        // For simplicity, we'll just update the variable map
-        // In a real implementation with proper scoping, you'd store variables in alloca and update with store
-        current_vars[assign->name] = value;
+        if (it->second && value) {
+            llvm::Type* var_type = it->second->getAllocatedType();
+            llvm::Value* old_value = counted ? builder->CreateLoad(var_type, it->second, "old") : nullptr;
+            builder->CreateStore(castValue(value, var_type), it->second);
+            emitRelease(old_value);
+        }
         return value;
     }
     
-    // Check if it's a field of the current class
-    if (!current_class.empty()) {
-        // Get the 'self' parameter
-        llvm::Function* func = builder->GetInsertBlock()->getParent();
-        llvm::Argument* self = func->arg_begin();
-        
-        // Look up field index
-        std::optional<Type> field_type_opt = analyzer.findFieldType(current_class, assign->name);
-        if (field_type_opt.has_value()) {
-            // Calculate field index - this is simplistic and assumes fields are in order
-            // In a real implementation, you'd need a proper field index map
-            int field_idx = 1; // Skip the vtable pointer
-            
-            // Create a GEP to access the field
-            llvm::Value* field_ptr = builder->CreateStructGEP(
-                class_types[current_class], self, field_idx, assign->name);
-            
-            // Store the new value
-            builder->CreateStore(value, field_ptr);
-            return value;
+    // Check if it's a field of the current class (a unit one has no storage)
+    std::optional<Type> field_type_opt = analyzer.findFieldType(current_class, assign->name);
+    if (field_type_opt.has_value() && field_type_opt.value().toString() == "unit") {
+        return value;
+    }
+    llvm::Value* field_ptr = getFieldPointer(assign->name);
+    if (field_ptr) {
+        if (value) {
+            llvm::Type* field_type = class_types[current_class]->getElementType(
+                field_indices[current_class][assign->name]);
+            llvm::Value* old_value = counted ? builder->CreateLoad(field_type, field_ptr, "old") : nullptr;
+            builder->CreateStore(castValue(value, field_type), field_ptr);
+            emitRelease(old_value);
         }
+        return value;
     }
     
     reportError("Undefined variable or field for assignment: " + assign->name);
@@ -1436,42 +3652,70 @@ llvm::Value* CodeGenerator::generateLet(const Let* letExpr) {
         return nullptr;
     }
     
-    // Generate code for initializer if present
-    llvm::Value* init_val = nullptr;
-    if (letExpr->init_expr) {
-        init_val = generateExpression(letExpr->init_expr.get());
-        
-        if (!init_val) {
-            return nullptr; // Error already reported
-        }
-    }
-    else {
-        // Default initialization based on type
-        if (letExpr->type == "int32") {
-            init_val = llvm::ConstantInt::get(llvm::Type::getInt32Ty(*context), 0);
-        }
-        else if (letExpr->type == "bool") {
-            init_val = llvm::ConstantInt::get(llvm::Type::getInt1Ty(*context), 0);
-        }
-        else if (letExpr->type == "string") {
-            init_val = createStringConstant("");
-        }
-        else {
-            // Default to null for class types
-            llvm::Type* type_val = getLLVMType(letExpr->type);
-            init_val = llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(type_val));
+    // Generate code for initializer if present, or use the type's default
+    llvm::Value* init_val = letExpr->init_expr
+        ? generateExpression(letExpr->init_expr.get())
+        : defaultValue(letExpr->type);
+    
+    // An object variable holds its own reference, released at the end of
+    // the scope, unless it can borrow the one of self or of an enclosing
+    // variable: neither may be assigned in the scope, so that the borrowed
+    // reference outlives the variable.
+    bool owned = isCounted(letExpr->type);
+    if (owned && letExpr->init_expr && isStableBorrow(letExpr->init_expr.get())
+        && !isAssignedIn(letExpr->scope_expr.get(), letExpr->name)) {
+        const Identifier* id = dynamic_cast<const Identifier*>(letExpr->init_expr.get());
+        owned = id && isAssignedIn(letExpr->scope_expr.get(), id->name);
+    }
+    if (owned && letExpr->init_expr) {
+        init_val = takeOwnership(letExpr->init_expr.get(), init_val);
+    } else if (!owned && letExpr->init_expr) {
+        releaseTemporary(letExpr->init_expr.get(), init_val);
+    }
+    
+    // The variable lives in a stack slot so that it can be assigned to
+    llvm::Type* var_type = getLLVMType(letExpr->type);
+    llvm::AllocaInst* slot = nullptr;
+    if (!var_type->isVoidTy()) {
+        slot = createEntryAlloca(var_type, letExpr->name);
+        if (init_val) {
+            builder->CreateStore(castValue(init_val, var_type), slot);
         }
     }
     
-    // Add variable to current scope
-    // In a real implementation with proper scoping, you'd create an alloca and store the value
-    current_vars[letExpr->name] = init_val;
+    // Add variable to current scope, shadowing any outer one
+    auto outer_var = current_vars.find(letExpr->name);
+    bool had_outer = outer_var != current_vars.end();
+    llvm::AllocaInst* outer_slot = had_outer ? outer_var->second : nullptr;
+    std::string outer_type = had_outer ? current_var_types[letExpr->name] : "";
+    current_vars[letExpr->name] = slot;
+    current_var_types[letExpr->name] = letExpr->type;
     
     // Generate code for the scope expression
     llvm::Value* scope_val = generateExpression(letExpr->scope_expr.get());
+    setExprType(letExpr, getExprType(letExpr->scope_expr.get()));
+    
+    // The result may be borrowed from the variable, so it is retained before
+    // the variable's reference goes away
+    if (owned_exprs.count(letExpr->scope_expr.get())) {
+        owned_exprs.insert(letExpr);
+    }
+    if (owned && slot) {
+        if (isCounted(getExprType(letExpr)) && !owned_exprs.count(letExpr)) {
+            scope_val = takeOwnership(letExpr->scope_expr.get(), scope_val);
+            owned_exprs.insert(letExpr);
+        }
+        emitRelease(builder->CreateLoad(var_type, slot, letExpr->name));
+    }
     
-    // Remove variable from current scope
-    current_vars.erase(letExpr->name);
+    // Restore the outer scope
+    if (had_outer) {
+        current_vars[letExpr->name] = outer_slot;
+        current_var_types[letExpr->name] = outer_type;
+    } else {
+        current_vars.erase(letExpr->name);
+        current_var_types.erase(letExpr->name);
+    }
     
     return scope_val;
 }
@@ -1503,17 +3747,10 @@ llvm::Value* CodeGenerator::generateWhile(const While* whileExpr) {
     // Create conditional branch
     builder->CreateCondBr(cond_val, body_bb, end_bb);
     
-    // Generate body code
+    // Generate body code (its value, possibly unit, is discarded)
     func->getBasicBlockList().push_back(body_bb);
     builder->SetInsertPoint(body_bb);
-    
-    llvm::Value* body_val = generateExpression(whileExpr->body.get());
-    
-    if (!body_val && !dynamic_cast<const UnitLiteral*>(whileExpr->body.get())) {
-        // Only UnitLiteral can return nullptr legitimately
-        reportError("Failed to generate code for while body");
-        return nullptr;
-    }
+    releaseTemporary(whileExpr->body.get(), generateExpression(whileExpr->body.get()));
     
     // Loop back to condition
     builder->CreateBr(cond_bb);
@@ -1523,6 +3760,106 @@ llvm::Value* CodeGenerator::generateWhile(const While* whileExpr) {
     builder->SetInsertPoint(end_bb);
     
     // While expression always returns unit (void)
+    setExprType(whileExpr, "unit");
+    return nullptr;
+}
+
+// Implementation for for loops over a generator
+llvm::Value* CodeGenerator::generateFor(const For* forExpr) {
+    if (!forExpr) {
+        reportError("Null for expression");
+        return nullptr;
+    }
+    
+    // Calling the generator creates its coroutine (see beginGenerator())
+    const Call* call = dynamic_cast<const Call*>(forExpr->iterable.get());
+    llvm::Value* handle = call ? generateCall(call) : nullptr;
+    if (!handle) {
+        reportError("For loop without generator call");
+        return nullptr;
+    }
+    std::string element_type = getExprType(call);
+    llvm::Type* var_type = getLLVMType(element_type);
+    
+    // The yielded values are read from the promise
+    llvm::Value* promise = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_promise),
+        {handle, builder->getInt32(module->getDataLayout().getPrefTypeAlign(var_type).value()),
+         builder->getFalse()}, "promise");
+    promise = builder->CreateBitCast(promise, llvm::PointerType::get(var_type, 0));
+    
+    // Resume the generator until it is done
+    llvm::Function* func = builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock* next_bb = llvm::BasicBlock::Create(*context, "for.next", func);
+    llvm::BasicBlock* body_bb = llvm::BasicBlock::Create(*context, "for.body");
+    llvm::BasicBlock* end_bb = llvm::BasicBlock::Create(*context, "for.end");
+    builder->CreateBr(next_bb);
+    
+    builder->SetInsertPoint(next_bb);
+    builder->CreateCall(llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_resume), {handle});
+    llvm::Value* done = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_done), {handle}, "done");
+    builder->CreateCondBr(done, end_bb, body_bb);
+    
+    // The variable borrows the value from the generator, which keeps it until
+    // it is resumed, unless the body assigns to the variable
+    func->getBasicBlockList().push_back(body_bb);
+    builder->SetInsertPoint(body_bb);
+    llvm::Value* value = builder->CreateLoad(var_type, promise, forExpr->name);
+    llvm::AllocaInst* slot = createEntryAlloca(var_type, forExpr->name);
+    bool owned = isCounted(element_type) && isAssignedIn(forExpr->body.get(), forExpr->name);
+    if (owned) emitRetain(value);
+    builder->CreateStore(value, slot);
+    
+    auto outer_var = current_vars.find(forExpr->name);
+    bool had_outer = outer_var != current_vars.end();
+    llvm::AllocaInst* outer_slot = had_outer ? outer_var->second : nullptr;
+    std::string outer_type = had_outer ? current_var_types[forExpr->name] : "";
+    current_vars[forExpr->name] = slot;
+    current_var_types[forExpr->name] = element_type;
+    
+    releaseTemporary(forExpr->body.get(), generateExpression(forExpr->body.get()));
+    if (owned) emitRelease(builder->CreateLoad(var_type, slot, forExpr->name));
+    builder->CreateBr(next_bb);
+    
+    if (had_outer) {
+        current_vars[forExpr->name] = outer_slot;
+        current_var_types[forExpr->name] = outer_type;
+    } else {
+        current_vars.erase(forExpr->name);
+        current_var_types.erase(forExpr->name);
+    }
+    
+    // The generator is at its final suspend point
+    func->getBasicBlockList().push_back(end_bb);
+    builder->SetInsertPoint(end_bb);
+    builder->CreateCall(llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_destroy), {handle});
+    
+    setExprType(forExpr, "unit");
+    return nullptr;
+}
+
+// Implementation for yield expressions
+llvm::Value* CodeGenerator::generateYield(const Yield* yieldExpr) {
+    if (!yieldExpr) {
+        reportError("Null yield expression");
+        return nullptr;
+    }
+    if (!coro_promise) {
+        reportError("Yield outside of a generator");
+        return nullptr;
+    }
+    
+    // The generator keeps a reference to the value until the loop resumes it
+    llvm::Value* value = generateExpression(yieldExpr->expr.get());
+    value = takeOwnership(yieldExpr->expr.get(), value);
+    if (value) {
+        builder->CreateStore(castValue(value, coro_promise->getAllocatedType()), coro_promise);
+    }
+    emitSuspend(false);
+    if (isCounted(getExprType(yieldExpr->expr.get()))) emitRelease(value);
+    
+    setExprType(yieldExpr, "unit");
     return nullptr;
 }
 
@@ -1539,56 +3876,54 @@ llvm::Value* CodeGenerator::generateNew(const New* newExpr) {
         reportError("Unknown class type: " + newExpr->type_name);
         return nullptr;
     }
+    setExprType(newExpr, newExpr->type_name);
+    if (options.reference_counting) owned_exprs.insert(newExpr);
+    return generateNewObject(newExpr->type_name, newExpr);
+}
+
+// A new object of the given class, initialized, for the new expression at
+// the given node (which locates the remarks)
+llvm::Value* CodeGenerator::generateNewObject(const std::string& class_name, const Expression* at) {
+    if (class_name == "Object" && options.relative_vtables) {
+        // The runtime's Object___new would install its absolute vtable, so
+        // allocate the object here and point it to our relative one
+        return generateAllocation("Object");
+    }
+    
+    // With site heaps, allocate here from the expression's own region, then
+    // initialize as the constructor would. Built-in classes are allocated by
+    // the runtime.
+    if (options.site_heaps && !analyzer.isBuiltinClass(class_name)) {
+        llvm::Function* init_func = methods[class_name + "___init"];
+        llvm::GlobalVariable* site = createSiteRegion("site");
+        addRemark(Remark::Kind::PASSED, "vsop-sites", "SiteHeap", current_function->getName().str(), at,
+                  "objects of " + class_name + " allocated from " + site->getName().str());
+        llvm::Value* obj = generateAllocation(class_name, site);
+        return builder->CreateCall(init_func, {obj}, "new_" + class_name);
+    }
     
-    // Get the class structure type
-    llvm::StructType* class_type = it->second;
-    
-    // Call the constructor function
-    std::string ctor_name = newExpr->type_name + "___new";
-    llvm::Function* ctor_func = module->getFunction(ctor_name);
-    
+    // Call the constructor
+    llvm::Function* ctor_func = methods[class_name + "___new"];
     if (!ctor_func) {
-        // If constructor not found, try to create a simple one
-        
-        // First create the function type (no arguments, returns class pointer)
-        llvm::FunctionType* func_type = llvm::FunctionType::get(
-            llvm::PointerType::get(class_type, 0), false);
-        
-        // Create the function
-        ctor_func = llvm::Function::Create(
-            func_type, llvm::Function::ExternalLinkage, ctor_name, module.get());
-        
-        // Create the function body
-        llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", ctor_func);
-        llvm::IRBuilder<> temp_builder(*context);
-        temp_builder.SetInsertPoint(entry);
-        
-        // Allocate memory for the object
-        llvm::Value* size_val = llvm::ConstantExpr::getSizeOf(class_type);
-        llvm::Value* mem = temp_builder.CreateCall(
-            module->getOrInsertFunction("malloc", 
-                llvm::Type::getInt8PtrTy(*context),
-                llvm::Type::getInt64Ty(*context)),
-            {size_val}, "mem");
-        
-        // Cast to class pointer
-        llvm::Value* obj_ptr = temp_builder.CreateBitCast(
-            mem, llvm::PointerType::get(class_type, 0), "obj_ptr");
-        
-        // Set vtable pointer (first field)
-        // Note: In a real implementation, you need to set up the proper vtable
-        llvm::Value* null_vtable = llvm::ConstantPointerNull::get(
-            llvm::PointerType::get(llvm::Type::getInt8Ty(*context), 0));
-        llvm::Value* vtable_ptr = temp_builder.CreateStructGEP(class_type, obj_ptr, 0, "vtable_ptr");
-        temp_builder.CreateStore(null_vtable, vtable_ptr);
-        
-        // Return the object pointer
-        temp_builder.CreateRet(obj_ptr);
+        reportError("Constructor not found for class " + class_name);
+        return nullptr;
     }
+    llvm::Value* obj = builder->CreateCall(ctor_func, {}, "new_" + class_name);
     
-    // Call the constructor
-    return builder->CreateCall(ctor_func);
+    // Likewise, built-in classes get the module's relative vtable. The
+    // runtime does not count references on its own, so counting starts here.
+    if (analyzer.isBuiltinClass(class_name)) {
+        llvm::StructType* class_type = class_types[class_name];
+        if (options.relative_vtables) {
+            llvm::Value* vtable_ptr = builder->CreateStructGEP(class_type, obj, 0, "vtable_ptr");
+            builder->CreateStore(castValue(vtable_globals[class_name], class_type->getElementType(0)), vtable_ptr);
+        }
+        if (options.reference_counting) {
+            builder->CreateStore(builder->getInt32(1), builder->CreateStructGEP(class_type, obj, 1, "refcount_ptr"));
+        }
+    }
+    return obj;
 }
 
 
-} // namespace VSOP
\ No newline at end of file
+} // namespace VSOP
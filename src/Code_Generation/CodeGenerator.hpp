@@ -3,6 +3,9 @@
 
 #include "AST.hpp"
 #include "SemanticAnalyzer.hpp"
+#include "Interface.hpp"
+#include "Remarks.hpp"
+#include "VIR.hpp"
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
@@ -13,19 +16,95 @@
 #include <llvm/IR/Verifier.h>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
 #include <memory>
+#include <set>
 #include <vector>
 
 namespace VSOP {
 
+// Options controlling code generation (set from the command line)
+struct CodeGeneratorOptions {
+    // Emit vtables as 32-bit offsets relative to the vtable address instead of
+    // absolute function pointers, so they need no dynamic relocations and can
+    // live in read-only, shareable pages
+    bool relative_vtables = false;
+    
+    // Fold methods (and constructors) whose typed bodies are identical into a
+    // single implementation and share identical vtables (at -O1 and above)
+    bool fold_identical_code = true;
+    
+    // Lay out the object held by a field inline in its parent when it is
+    // created by the field's initializer and never reassigned nor shared (at
+    // -O1 and above)
+    bool inline_objects = true;
+    
+    // Compile small inherited methods again for each subclass, with self of
+    // the subclass, so that their self-sends can be bound statically
+    bool customize_methods = false;
+    
+    // Construct Main at compile time and start the program from a copy of
+    // the resulting objects in the data section
+    bool snapshot_main = false;
+    
+    // Replace calls of pure methods on self with constant arguments by their
+    // result, computed at compile time (at -O1 and above)
+    bool partial_evaluation = true;
+    
+    // Record optimization remarks, vsopc's own and LLVM's (see getRemarks())
+    bool remarks = false;
+    
+    // Count the calls of each method in the runtime metrics, and allocate
+    // objects through the runtime so that they are counted too (see
+    // runtime/runtime/metrics.h)
+    bool metrics = false;
+    
+    // Reclaim objects by reference counting (--memory=rc) instead of never
+    // freeing them
+    bool reference_counting = false;
+    
+    // Allocate the objects of each new expression from a bump region of its
+    // own (see Object___site_alloc in runtime/runtime/object.h)
+    bool site_heaps = false;
+    
+    // x86-64 levels (x86-64-v2 to x86-64-v4) the methods containing loops are
+    // compiled again for. Each method becomes an ifunc whose resolver picks
+    // the version for the running processor when the program is loaded.
+    std::vector<std::string> multiversion_targets;
+    
+    // Lower method bodies from their VIR (optimized by the default VIR passes
+    // at -O1 and above) rather than from the typed AST. Generators, memo
+    // methods, methods with for loops, customized copies and every method
+    // with reference counting are still lowered from the AST.
+    bool lower_from_vir = false;
+    
+    // Optimization level (-O0 to -O3). Generators are lowered to LLVM
+    // coroutines, which must be split even at -O0, and at -O2 a for loop over
+    // a generator called directly gets its frame on the stack (CoroElide).
+    int optimization_level = 0;
+};
+
 class CodeGenerator {
 public:
     CodeGenerator(const std::string& source_file, const std::string& module_name = "vsop_module");
     ~CodeGenerator();
     
+    // Set the code generation options (before calling generate)
+    void setOptions(const CodeGeneratorOptions& opts) { options = opts; }
+    
+    // Use the classes of a compiled library (its Class nodes must also be in
+    // the program given to generate): checks that the library's layouts and
+    // vtables match the ones computed from its declarations
+    void addInterface(const Interface& interface) { interfaces.push_back(interface); }
+    
     // Generate LLVM IR from the AST
     bool generate(std::shared_ptr<Program> program, bool include_runtime = true);
     
+    // Describe the classes defined by the program (after generate), for
+    // other programs to use them through an interface file
+    Interface getInterface(const std::string& object_file) const;
+    
     // Output the generated LLVM IR
     void dumpIR(std::ostream& os);
     
@@ -35,8 +114,16 @@ public:
     // Get error messages
     const std::vector<std::string>& getErrors() const { return errors; }
     
+    // Get the optimization report (one line per optimization attempted)
+    const std::vector<std::string>& getReport() const { return report; }
+    
+    // Get the optimization remarks (if options.remarks)
+    const std::vector<Remark>& getRemarks() const { return remarks; }
+    
 private:
     std::shared_ptr<Program> program;
+    CodeGeneratorOptions options;
+    std::vector<Interface> interfaces;
     
     // Source file information
     std::string source_file;
@@ -54,6 +141,14 @@ private:
     // Error handling
     std::vector<std::string> errors;
     
+    // Optimization report
+    std::vector<std::string> report;
+    
+    // Optimization remarks, and the class declaring the code of each function
+    // and the method it compiles (nullptr for a constructor), to locate them
+    std::vector<Remark> remarks;
+    std::unordered_map<std::string, std::pair<const Class*, const Method*>> remark_sources;
+    
     // Semantic analyzer for type information
     SemanticAnalyzer analyzer;
     
@@ -62,26 +157,133 @@ private:
     std::unordered_map<std::string, llvm::Type*> primitive_types;       // Primitive type name -> LLVM type
     std::unordered_map<std::string, llvm::Function*> methods;           // Method name -> LLVM function
     std::unordered_map<std::string, std::vector<std::string>> vtables;  // Class name -> method list
+    std::unordered_map<std::string, std::vector<std::string>> builtin_methods; // Built-in class -> own methods, in runtime vtable order
+    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> vtable_impls; // Class name -> method -> implementing function
+    std::unordered_map<std::string, const Class*> class_nodes;          // Class name -> AST node
+    std::vector<std::string> class_order;                               // Class names, parents before children
+    std::unordered_map<std::string, std::vector<std::pair<std::string, std::string>>> class_fields; // Class name -> (field, type) in layout order
+    std::unordered_map<std::string, std::unordered_map<std::string, unsigned>> field_indices;      // Class name -> field -> struct index
+    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> inline_fields;   // Class name -> field -> class of the object laid out inline
+    std::unordered_map<std::string, std::vector<std::pair<std::string, const Method*>>> customized_methods; // Class name -> inherited methods compiled for it
+    std::unordered_map<std::string, std::string> clone_origins;         // Customized method -> function of the method it copies
+    std::map<std::pair<std::string, std::string>, bool> pure_methods;   // (Class name, method) -> whether it is pure on self
+    std::unique_ptr<VIRModule> vir_module;                              // VIR of the program (options.lower_from_vir)
+    std::unordered_map<std::string, const VIRFunction*> vir_functions;  // Function name -> its VIR
+    std::vector<std::string> counted_methods;                           // Class.method of each call counter (--metrics)
+    
+    // String literal -> global holding it
+    std::unordered_map<std::string, llvm::GlobalVariable*> string_constants;
+    
+    // Static VSOP type of each generated expression
+    std::unordered_map<const Expression*, std::string> expr_types;
     
     // Current context for code generation
     std::string current_class;
     llvm::Function* current_function;
-    std::unordered_map<std::string, llvm::Value*> current_vars;  // Variable name -> LLVM value
+    std::unordered_map<std::string, llvm::AllocaInst*> current_vars;  // Variable name -> stack slot (nullptr for unit)
+    std::unordered_map<std::string, std::string> current_var_types;   // Variable name -> VSOP type
+    
+    // Reference counting: expressions whose value is a new reference (to be
+    // released or stored by their user), and parameters of the current method
+    // holding a reference of their own (the others borrow the caller's one)
+    std::unordered_set<const Expression*> owned_exprs;
+    std::vector<llvm::AllocaInst*> owned_params;
+    
+    // Generator being generated: its coroutine id and handle, the promise
+    // holding the last value yielded, and the blocks destroying the frame and
+    // returning to the caller
+    llvm::Value* coro_id = nullptr;
+    llvm::Value* coro_handle = nullptr;
+    llvm::AllocaInst* coro_promise = nullptr;
+    llvm::BasicBlock* coro_cleanup = nullptr;
+    llvm::BasicBlock* coro_suspend = nullptr;
 
     // Helper methods
     void reportError(const std::string& message);
+    void addRemark(Remark::Kind kind, const std::string& pass, const std::string& name,
+                   const std::string& function, const ASTNode* at, const std::string& message);
     void initPrimitiveTypes();
     void includeRuntimeCode();
+    void appendParamTypes(std::vector<llvm::Type*>& param_types, const MethodSignature& method_sig);
     void declareRuntimeMethod(const std::string& name, llvm::Type* returnType, const std::vector<llvm::Type*>& paramTypes);
+    void declareRuntimeClass(const std::string& class_name, const std::vector<std::string>& own_methods);
+    llvm::Function* getStringMethod(const std::string& method_name);
     llvm::Type* getLLVMType(const std::string& vsop_type);
     llvm::Value* createStringConstant(const std::string& str);
+    llvm::Value* castValue(llvm::Value* value, llvm::Type* type);
+    llvm::Value* defaultValue(const std::string& vsop_type);
+    llvm::AllocaInst* createEntryAlloca(llvm::Type* type, const std::string& name);
+    llvm::Value* getFieldPointer(const std::string& field_name);
+    llvm::FunctionCallee generateDispatch(llvm::Value* object, const std::string& class_name,
+                                          const std::string& method_name);
+    llvm::Function* declareMethod(const std::string& class_name, const std::string& method_name,
+                                  const MethodSignature& method_sig);
+    llvm::Function* getUniqueImplementation(const std::string& class_name, const std::string& method_name);
+    bool isImported(const std::string& class_name) const;
+    void setExprType(const Expression* expr, const std::string& type);
+    std::string getExprType(const Expression* expr) const;
+    
+    // Reference counting helpers (no-ops unless options.reference_counting)
+    bool isCounted(const std::string& vsop_type) const;
+    llvm::Value* generateAllocation(const std::string& class_name, llvm::Value* site = nullptr);
+    llvm::GlobalVariable* createSiteRegion(const std::string& name);
+    void emitRetain(llvm::Value* object);
+    void emitRelease(llvm::Value* object);
+    llvm::Value* takeOwnership(const Expression* expr, llvm::Value* value);
+    void releaseTemporary(const Expression* expr, llvm::Value* value);
+    bool isStableBorrow(const Expression* expr) const;
+    static bool isAssignedIn(const Expression* expr, const std::string& name);
+    
+    // Object inlining helpers (see findInlineFields())
+    const Method* findMethodNode(const std::string& class_name, const std::string& method_name) const;
+    bool mayEscape(const Expression* expr, const std::string& name, bool used, const std::string& class_name,
+                   const std::set<std::pair<std::string, bool>>& leaking) const;
+    bool methodLeaksSelf(const std::string& class_name, const std::string& method_name, bool used,
+                         const std::set<std::pair<std::string, bool>>& leaking) const;
+    std::string getInlineFieldClass(const Expression* expr) const;
+    void emitObjectHeader(const std::string& class_name, llvm::Value* object, bool counted);
+    void emitReleaseFields(const std::string& class_name, llvm::Value* object);
+    
+    // Partial evaluation helpers
+    bool isPureMethod(const std::string& class_name, const std::string& method_name);
+    llvm::Value* evaluatePureCall(const Call* call);
+    
+    // Lowering from VIR (options.lower_from_vir)
+    void generateVIR();
+    bool canLowerFromVIR(const Method* method, const VIRFunction* vir_function) const;
+    void generateMethodBodyFromVIR(const Method* method, const VIRFunction* vir_function);
+    llvm::Value* generateVIRInstruction(const VIRInstruction* instruction,
+                                        const std::unordered_map<const VIRInstruction*, llvm::Value*>& values,
+                                        const std::unordered_map<const VIRBlock*, llvm::BasicBlock*>& blocks);
+    
+    // Generator helpers (LLVM coroutines, switched-resume lowering)
+    void beginGenerator(const std::string& yield_type);
+    void emitSuspend(bool final);
+    void endGenerator();
 
     // Code generation passes
+    void findInlineFields();
     void generateClassTypes();
     void generateClassVTables();
+    void checkInterfaces();
     void generateClassMethods();
+    void findCustomizedMethods();
+    void generateClassConstructors();
     void generateMethodBodies();
+    void generateMethodBody(const Method* method, const std::string& func_name);
     void generateMainEntryPoint();
+    llvm::Value* generateMemoizedBody(const Method* method, const std::string& func_name);
+    void emitCallCounter(const std::string& func_name, const Method* method);
+    void emitRegisterCalls();
+    llvm::Constant* generateMainSnapshot();
+    void multiversionMethods();
+    void multiversionMethod(llvm::Function* func, const Method* method);
+    void foldIdenticalCode();
+    void optimizeModule();
+    
+    // Identical code folding helpers (return whether anything was folded)
+    bool foldIdenticalFunctions();
+    bool foldIdenticalVTables();
 
     // Expression code generation
     llvm::Value* generateExpression(const Expression* expr);
@@ -89,9 +291,13 @@ private:
     llvm::Value* generateUnaryOp(const UnaryOp* unop);
     llvm::Value* generateCall(const Call* call);
     llvm::Value* generateNew(const New* newExpr);
+    llvm::Value* generateNewObject(const std::string& class_name, const Expression* at);
+    llvm::Function* getPowFunction();
     llvm::Value* generateLet(const Let* letExpr);
     llvm::Value* generateIf(const If* ifExpr);
     llvm::Value* generateWhile(const While* whileExpr);
+    llvm::Value* generateFor(const For* forExpr);
+    llvm::Value* generateYield(const Yield* yieldExpr);
     llvm::Value* generateAssign(const Assign* assignExpr);
     llvm::Value* generateBlock(const Block* blockExpr);
     llvm::Value* generateLiteral(const Literal* literal);
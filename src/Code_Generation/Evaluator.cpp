@@ -0,0 +1,364 @@
+#include "Evaluator.hpp"
+#include <algorithm>
+#include <climits>
+
+namespace VSOP {
+
+std::string EvalValue::toString() const {
+    switch (kind) {
+        case Kind::UNIT: return "()";
+        case Kind::INT32: return std::to_string(int_value);
+        case Kind::BOOL: return int_value ? "true" : "false";
+        case Kind::STRING: return "\"" + string_value + "\"";
+        default: return object < 0 ? "null" : "object";
+    }
+}
+
+// Deepest chain of method calls evaluated (deeper recursions are left to run
+// time rather than risk overflowing the compiler's stack)
+static const size_t MAX_CALL_DEPTH = 1000;
+
+// Thrown to abandon an evaluation
+struct EvaluationFailure {
+    std::string reason;
+};
+
+Evaluator::Evaluator(std::shared_ptr<Program> program, const SemanticAnalyzer& analyzer, size_t fuel)
+    : program(program), analyzer(analyzer), fuel(fuel) {
+    for (const auto& cls : program->classes) {
+        if (cls) class_nodes[cls->name] = cls.get();
+    }
+}
+
+bool Evaluator::evaluateNew(const std::string& class_name, EvalValue& result) {
+    failure.clear();
+    try {
+        if (analyzer.isBuiltinClass(class_name) && class_name != "Object") {
+            giveUp("instantiates built-in class " + class_name);
+        }
+        int object = allocate(class_name);
+        initialize(object, class_name);
+        result = EvalValue::makeObject(object);
+        return true;
+    }
+    catch (const EvaluationFailure& e) {
+        failure = e.reason;
+        return false;
+    }
+}
+
+bool Evaluator::evaluateConstant(const Expression* expr, EvalValue& result) {
+    failure.clear();
+    try {
+        result = evaluate(expr);
+        return true;
+    }
+    catch (const EvaluationFailure& e) {
+        failure = e.reason;
+        return false;
+    }
+}
+
+bool Evaluator::evaluateSend(const std::string& class_name, const std::string& method_name,
+                             const std::vector<EvalValue>& args, EvalValue& result) {
+    failure.clear();
+    try {
+        const Method* method = findMethod(class_name, method_name);
+        if (!method) giveUp("calls Object::" + method_name);
+        result = invoke(allocate(class_name), method, args);
+        return true;
+    }
+    catch (const EvaluationFailure& e) {
+        failure = e.reason;
+        return false;
+    }
+}
+
+void Evaluator::giveUp(const std::string& reason) const {
+    throw EvaluationFailure{reason};
+}
+
+std::string Evaluator::parentOf(const std::string& class_name) const {
+    const std::string& parent = analyzer.getClassDefinitions().at(class_name).parent;
+    return parent.empty() ? "Object" : parent;
+}
+
+// The method implementing the given method for objects of the given class,
+// or nullptr if the runtime implements it
+const Method* Evaluator::findMethod(const std::string& class_name, const std::string& method_name) const {
+    for (std::string ancestor = class_name; class_nodes.count(ancestor) && !analyzer.isBuiltinClass(ancestor);
+         ancestor = parentOf(ancestor)) {
+        for (const auto& method : class_nodes.at(ancestor)->methods) {
+            if (method && method->name == method_name) return method.get();
+        }
+    }
+    return nullptr;
+}
+
+EvalValue Evaluator::defaultValue(const std::string& vsop_type) const {
+    if (vsop_type == "int32") return EvalValue::makeInt(0);
+    if (vsop_type == "bool") return EvalValue::makeBool(false);
+    if (vsop_type == "string") return EvalValue::makeString("");
+    if (vsop_type == "unit") return EvalValue();
+    return EvalValue::makeObject(-1);
+}
+
+// Allocate an object of the given class, with every field (inherited ones
+// included) set to its default value
+int Evaluator::allocate(const std::string& class_name) {
+    const auto& class_defs = analyzer.getClassDefinitions();
+    EvalObject object;
+    object.class_name = class_name;
+    for (std::string ancestor = class_name; class_nodes.count(ancestor) && !analyzer.isBuiltinClass(ancestor);
+         ancestor = parentOf(ancestor)) {
+        for (const auto& field : class_nodes.at(ancestor)->fields) {
+            if (field && class_defs.at(ancestor).fields.count(field->name)) {
+                object.fields[field->name] = defaultValue(field->type);
+            }
+        }
+    }
+    heap.push_back(std::move(object));
+    return heap.size() - 1;
+}
+
+// Run the initializer of the given class on an object: the parent's one,
+// then the field initializers in declaration order (like <Class>___init)
+void Evaluator::initialize(int object, const std::string& class_name) {
+    if (analyzer.isBuiltinClass(class_name)) return;
+    auto node_it = class_nodes.find(class_name);
+    if (node_it == class_nodes.end() || node_it->second->imported) {
+        giveUp("instantiates " + class_name + ", which is compiled in a library");
+    }
+    initialize(object, parentOf(class_name));
+
+    const ClassDef& class_def = analyzer.getClassDefinitions().at(class_name);
+    int saved_self = self;
+    auto saved_vars = std::move(vars);
+    self = object;
+    vars.clear();
+    for (const auto& field : node_it->second->fields) {
+        if (!field || !field->init_expr || !class_def.fields.count(field->name)) continue;
+        EvalValue value = evaluate(field->init_expr.get());
+        heap[object].fields[field->name] = value;
+    }
+    self = saved_self;
+    vars = std::move(saved_vars);
+}
+
+// Run a method on an object with the given arguments
+EvalValue Evaluator::invoke(int object, const Method* method, const std::vector<EvalValue>& args) {
+    if (method->generator) giveUp("calls generator " + method->name);
+    if (!method->body) giveUp("calls " + method->name + ", which is compiled in a library");
+    if (depth >= MAX_CALL_DEPTH) giveUp("recurses too deeply");
+
+    int saved_self = self;
+    auto saved_vars = std::move(vars);
+    self = object;
+    vars.clear();
+    for (size_t i = 0; i < method->formals.size() && i < args.size(); ++i) {
+        if (method->formals[i]) vars[method->formals[i]->name] = args[i];
+    }
+
+    ++depth;
+    EvalValue result = evaluate(method->body.get());
+    --depth;
+
+    self = saved_self;
+    vars = std::move(saved_vars);
+    return method->return_type == "unit" ? EvalValue() : result;
+}
+
+EvalValue Evaluator::evaluate(const Expression* expr) {
+    if (!expr) return EvalValue();
+    if (fuel == 0) giveUp("runs out of fuel");
+    --fuel;
+
+    if (const IntegerLiteral* literal = dynamic_cast<const IntegerLiteral*>(expr)) {
+        return EvalValue::makeInt(literal->value);
+    }
+    if (const BooleanLiteral* literal = dynamic_cast<const BooleanLiteral*>(expr)) {
+        return EvalValue::makeBool(literal->value);
+    }
+    if (const StringLiteral* literal = dynamic_cast<const StringLiteral*>(expr)) {
+        return EvalValue::makeString(literal->value);
+    }
+    if (dynamic_cast<const UnitLiteral*>(expr)) {
+        return EvalValue();
+    }
+    if (dynamic_cast<const Self*>(expr)) {
+        return EvalValue::makeObject(self);
+    }
+    if (const Identifier* id = dynamic_cast<const Identifier*>(expr)) {
+        auto var_it = vars.find(id->name);
+        if (var_it != vars.end()) return var_it->second;
+        if (self < 0) giveUp("reads " + id->name + " outside of an object");
+        auto field_it = heap[self].fields.find(id->name);
+        if (field_it != heap[self].fields.end()) return field_it->second;
+        giveUp("reads unknown identifier " + id->name);
+    }
+    if (const Assign* assign = dynamic_cast<const Assign*>(expr)) {
+        EvalValue value = evaluate(assign->expr.get());
+        auto var_it = vars.find(assign->name);
+        if (var_it != vars.end()) {
+            var_it->second = value;
+        } else {
+            if (self < 0) giveUp("assigns " + assign->name + " outside of an object");
+            heap[self].fields[assign->name] = value;
+        }
+        return value;
+    }
+    if (const UnaryOp* unop = dynamic_cast<const UnaryOp*>(expr)) {
+        EvalValue operand = evaluate(unop->expr.get());
+        if (unop->op == "-") return EvalValue::makeInt((int32_t) (0u - (uint32_t) operand.int_value));
+        if (unop->op == "not") return EvalValue::makeBool(!operand.int_value);
+        if (unop->op == "isnull") return EvalValue::makeBool(operand.object < 0);
+        giveUp("uses unknown operator " + unop->op);
+    }
+    if (const BinaryOp* binop = dynamic_cast<const BinaryOp*>(expr)) {
+        return evaluateBinaryOp(binop);
+    }
+    if (const Call* call = dynamic_cast<const Call*>(expr)) {
+        return evaluateCall(call);
+    }
+    if (const New* new_expr = dynamic_cast<const New*>(expr)) {
+        if (analyzer.isBuiltinClass(new_expr->type_name) && new_expr->type_name != "Object") {
+            giveUp("instantiates built-in class " + new_expr->type_name);
+        }
+        int object = allocate(new_expr->type_name);
+        initialize(object, new_expr->type_name);
+        return EvalValue::makeObject(object);
+    }
+    if (const Let* let = dynamic_cast<const Let*>(expr)) {
+        EvalValue value = let->init_expr ? evaluate(let->init_expr.get()) : defaultValue(let->type);
+        auto saved_it = vars.find(let->name);
+        bool shadows = saved_it != vars.end();
+        EvalValue saved = shadows ? saved_it->second : EvalValue();
+        vars[let->name] = value;
+        EvalValue result = evaluate(let->scope_expr.get());
+        if (shadows) {
+            vars[let->name] = saved;
+        } else {
+            vars.erase(let->name);
+        }
+        return result;
+    }
+    if (const If* if_expr = dynamic_cast<const If*>(expr)) {
+        EvalValue condition = evaluate(if_expr->condition.get());
+        if (!if_expr->else_expr) {
+            if (condition.int_value) evaluate(if_expr->then_expr.get());
+            return EvalValue();
+        }
+        return evaluate(condition.int_value ? if_expr->then_expr.get() : if_expr->else_expr.get());
+    }
+    if (const While* while_expr = dynamic_cast<const While*>(expr)) {
+        while (evaluate(while_expr->condition.get()).int_value) {
+            evaluate(while_expr->body.get());
+        }
+        return EvalValue();
+    }
+    if (const Block* block = dynamic_cast<const Block*>(expr)) {
+        EvalValue result;
+        for (const auto& sub_expr : block->expressions) {
+            result = evaluate(sub_expr.get());
+        }
+        return result;
+    }
+    if (dynamic_cast<const For*>(expr) || dynamic_cast<const Yield*>(expr)) {
+        giveUp("uses a generator");
+    }
+    giveUp("uses an unknown expression");
+}
+
+EvalValue Evaluator::evaluateBinaryOp(const BinaryOp* binop) {
+    EvalValue left = evaluate(binop->left.get());
+    EvalValue right = evaluate(binop->right.get());
+
+    // int32 arithmetic wraps around, like LLVM's add, sub and mul
+    uint32_t l = (uint32_t) left.int_value;
+    uint32_t r = (uint32_t) right.int_value;
+    if (binop->op == "+") return EvalValue::makeInt((int32_t) (l + r));
+    if (binop->op == "-") return EvalValue::makeInt((int32_t) (l - r));
+    if (binop->op == "*") return EvalValue::makeInt((int32_t) (l * r));
+    if (binop->op == "/") {
+        if (right.int_value == 0 || (left.int_value == INT32_MIN && right.int_value == -1)) {
+            giveUp("divides by zero or overflows a division");
+        }
+        return EvalValue::makeInt(left.int_value / right.int_value);
+    }
+    if (binop->op == "^") {
+        // Same result as vsop_pow's loop (1 for a negative exponent), by
+        // squaring
+        uint32_t result = 1;
+        uint32_t base = l;
+        for (int32_t exp = right.int_value; exp > 0; exp >>= 1) {
+            if (exp & 1) result *= base;
+            base *= base;
+        }
+        return EvalValue::makeInt((int32_t) result);
+    }
+    if (binop->op == "=") {
+        switch (left.kind) {
+            case EvalValue::Kind::UNIT: return EvalValue::makeBool(true);
+            case EvalValue::Kind::STRING:
+                // Literals with the same content share their global, built
+                // strings are only equal to themselves
+                return EvalValue::makeBool(left.string_id == right.string_id
+                                           && (left.string_id >= 0 || left.string_value == right.string_value));
+            case EvalValue::Kind::OBJECT: return EvalValue::makeBool(left.object == right.object);
+            default: return EvalValue::makeBool(left.int_value == right.int_value);
+        }
+    }
+    if (binop->op == "<") return EvalValue::makeBool(left.int_value < right.int_value);
+    if (binop->op == "<=") return EvalValue::makeBool(left.int_value <= right.int_value);
+    if (binop->op == "and") return EvalValue::makeBool(left.int_value && right.int_value);
+    giveUp("uses unknown operator " + binop->op);
+}
+
+// A new string, as returned by concat and substr at run time
+EvalValue Evaluator::buildString(const std::string& s) {
+    EvalValue value = EvalValue::makeString(s);
+    value.string_id = built_strings++;
+    return value;
+}
+
+// Methods of strings, as implemented by the runtime (string_methods.c)
+EvalValue Evaluator::evaluateStringMethod(const std::string& self_string, const std::string& method_name,
+                                          const std::vector<EvalValue>& args) {
+    int32_t length = (int32_t) self_string.size();
+    if (method_name == "length") return EvalValue::makeInt(length);
+    if (method_name == "concat") return buildString(self_string + args[0].string_value);
+    if (method_name == "substr") {
+        int32_t start = std::min(std::max(args[0].int_value, 0), length);
+        int32_t count = std::min(std::max(args[1].int_value, 0), length - start);
+        return buildString(self_string.substr(start, count));
+    }
+    if (method_name == "indexOf") {
+        size_t position = self_string.find(args[0].string_value);
+        return EvalValue::makeInt(position == std::string::npos ? -1 : (int32_t) position);
+    }
+    if (method_name == "equals") return EvalValue::makeBool(self_string == args[0].string_value);
+    giveUp("calls unknown string method " + method_name);
+}
+
+EvalValue Evaluator::evaluateCall(const Call* call) {
+    // Receiver first, then the arguments, like the generated code
+    EvalValue object = call->object ? evaluate(call->object.get()) : EvalValue::makeObject(self);
+    if (object.kind != EvalValue::Kind::STRING && object.object < 0) giveUp("calls " + call->method_name + " on null");
+
+    std::vector<EvalValue> args;
+    for (const auto& arg : call->arguments) {
+        args.push_back(evaluate(arg.get()));
+    }
+    if (object.kind == EvalValue::Kind::STRING) {
+        return evaluateStringMethod(object.string_value, call->method_name, args);
+    }
+
+    const Method* method = findMethod(heap[object.object].class_name, call->method_name);
+    if (!method) {
+        // Object's methods read or write the standard streams
+        giveUp("calls Object::" + call->method_name);
+    }
+    return invoke(object.object, method, args);
+}
+
+} // namespace VSOP
@@ -0,0 +1,109 @@
+#ifndef EVALUATOR_HPP
+#define EVALUATOR_HPP
+
+#include "AST.hpp"
+#include "SemanticAnalyzer.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace VSOP {
+
+// Value computed at compile time. Objects are indices in the evaluator's
+// heap, -1 being null. Strings are kept by content, with an identity as `=`
+// compares them by address: the code generator shares one global per literal,
+// but each string built by a method (concat, substr) is a new one.
+struct EvalValue {
+    enum class Kind {
+        UNIT,
+        INT32,
+        BOOL,
+        STRING,
+        OBJECT
+    };
+
+    Kind kind = Kind::UNIT;
+    int32_t int_value = 0;      // int32, and bool (0 or 1)
+    std::string string_value;
+    int string_id = -1;         // Built string (one per concat or substr), -1 for a literal
+    int object = -1;
+
+    static EvalValue makeInt(int32_t i) { EvalValue v; v.kind = Kind::INT32; v.int_value = i; return v; }
+    static EvalValue makeBool(bool b) { EvalValue v; v.kind = Kind::BOOL; v.int_value = b; return v; }
+    static EvalValue makeString(const std::string& s) { EvalValue v; v.kind = Kind::STRING; v.string_value = s; return v; }
+    static EvalValue makeObject(int o) { EvalValue v; v.kind = Kind::OBJECT; v.object = o; return v; }
+    
+    // The value as VSOP source (objects as "object" or "null")
+    std::string toString() const;
+};
+
+// Object allocated at compile time
+struct EvalObject {
+    std::string class_name;
+    std::unordered_map<std::string, EvalValue> fields;
+};
+
+// Compile-time interpreter for VSOP, with the semantics of the generated code
+// (32-bit wrapping arithmetic, both operands of `and` evaluated, ...). It
+// gives up, rather than guess, on anything whose result depends on the run:
+// input and output, built-in classes other than Object, generators, division
+// by zero, calls on null, and running out of fuel (one unit per expression
+// evaluated) or of call depth.
+class Evaluator {
+public:
+    Evaluator(std::shared_ptr<Program> program, const SemanticAnalyzer& analyzer, size_t fuel);
+
+    // Evaluate `new <class_name>` (allocation, then the ___init chain).
+    // Returns false if it cannot be evaluated (see getFailure()).
+    bool evaluateNew(const std::string& class_name, EvalValue& result);
+    
+    // Evaluate an expression made of literals and operators only. Returns
+    // false if it cannot be evaluated (see getFailure()).
+    bool evaluateConstant(const Expression* expr, EvalValue& result);
+    
+    // Evaluate a call of the given method on an object of the given class
+    // whose fields are left uninitialized (so the method must not read them).
+    // Returns false if it cannot be evaluated (see getFailure()).
+    bool evaluateSend(const std::string& class_name, const std::string& method_name,
+                      const std::vector<EvalValue>& args, EvalValue& result);
+
+    // Objects allocated so far
+    const std::vector<EvalObject>& getHeap() const { return heap; }
+
+    // Why the last evaluation gave up
+    const std::string& getFailure() const { return failure; }
+
+private:
+    std::shared_ptr<Program> program;
+    const SemanticAnalyzer& analyzer;
+    std::unordered_map<std::string, const Class*> class_nodes;
+    size_t fuel;
+    size_t depth = 0;
+    std::vector<EvalObject> heap;
+    int built_strings = 0;
+    std::string failure;
+
+    // Current method or initializer: self and the local variables
+    int self = -1;
+    std::unordered_map<std::string, EvalValue> vars;
+
+    EvalValue evaluate(const Expression* expr);
+    EvalValue evaluateCall(const Call* call);
+    EvalValue evaluateStringMethod(const std::string& self_string, const std::string& method_name,
+                                   const std::vector<EvalValue>& args);
+    EvalValue evaluateBinaryOp(const BinaryOp* binop);
+    EvalValue buildString(const std::string& s);
+    EvalValue invoke(int object, const Method* method, const std::vector<EvalValue>& args);
+    int allocate(const std::string& class_name);
+    void initialize(int object, const std::string& class_name);
+    EvalValue defaultValue(const std::string& vsop_type) const;
+    const Method* findMethod(const std::string& class_name, const std::string& method_name) const;
+    std::string parentOf(const std::string& class_name) const;
+    [[noreturn]] void giveUp(const std::string& reason) const;
+};
+
+} // namespace VSOP
+
+#endif // EVALUATOR_HPP
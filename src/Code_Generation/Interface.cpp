@@ -0,0 +1,162 @@
+#include "Interface.hpp"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace VSOP {
+
+// Version 2 added the reference count to the object layout
+static const int INTERFACE_VERSION = 2;
+
+bool writeInterface(const std::string& path, const Interface& interface, std::string& error) {
+    std::ofstream out(path);
+    if (!out) {
+        error = "cannot write interface " + path;
+        return false;
+    }
+
+    out << "vsopi " << INTERFACE_VERSION << "\n";
+    out << "object " << interface.object_file << "\n";
+    out << "vtables " << (interface.relative_vtables ? "relative" : "absolute") << "\n";
+    out << "memory " << (interface.reference_counting ? "rc" : "none") << "\n";
+
+    for (const auto& cls : interface.classes) {
+        out << "class " << cls->name << " " << cls->parent << "\n";
+        for (const auto& field : cls->fields) {
+            out << "field " << field->name << " " << field->type << "\n";
+        }
+        for (const auto& method : cls->methods) {
+            out << (method->generator ? "generator " : "method ") << method->name << " " << method->return_type;
+            for (const auto& formal : method->formals) {
+                out << " " << formal->name << " " << formal->type;
+            }
+            out << "\n";
+        }
+
+        auto layout_it = interface.layouts.find(cls->name);
+        if (layout_it != interface.layouts.end()) {
+            for (const auto& [field_name, field_type] : layout_it->second) {
+                out << "layout " << field_name << " " << field_type << "\n";
+            }
+        }
+
+        auto vtable_it = interface.vtables.find(cls->name);
+        if (vtable_it != interface.vtables.end()) {
+            for (const auto& [method_name, impl_name] : vtable_it->second) {
+                out << "slot " << method_name << " " << impl_name << "\n";
+            }
+        }
+        out << "end\n";
+    }
+
+    if (!out) {
+        error = "cannot write interface " + path;
+        return false;
+    }
+    return true;
+}
+
+bool readInterface(const std::string& path, Interface& interface, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open interface " + path;
+        return false;
+    }
+
+    std::shared_ptr<Class> cls;
+    std::string line;
+    int line_number = 0;
+
+    auto fail = [&](const std::string& message) {
+        error = path + ":" + std::to_string(line_number) + ": " + message;
+        return false;
+    };
+
+    while (std::getline(in, line)) {
+        ++line_number;
+        std::istringstream record(line);
+        std::string kind;
+        if (!(record >> kind)) continue;
+
+        if (kind == "vsopi") {
+            int version = 0;
+            if (!(record >> version) || version != INTERFACE_VERSION) {
+                return fail("unsupported interface version");
+            }
+        }
+        else if (kind == "object") {
+            std::string object_file;
+            if (!(record >> object_file)) return fail("missing object file");
+
+            // Stored relative to the interface itself
+            std::filesystem::path object_path(object_file);
+            if (object_path.is_relative()) {
+                object_path = std::filesystem::path(path).parent_path() / object_path;
+            }
+            interface.object_file = object_path.lexically_normal().string();
+        }
+        else if (kind == "vtables") {
+            std::string mode;
+            record >> mode;
+            if (mode != "absolute" && mode != "relative") return fail("invalid vtable kind " + mode);
+            interface.relative_vtables = mode == "relative";
+        }
+        else if (kind == "memory") {
+            std::string mode;
+            record >> mode;
+            if (mode != "none" && mode != "rc") return fail("invalid memory management " + mode);
+            interface.reference_counting = mode == "rc";
+        }
+        else if (kind == "class") {
+            std::string name, parent;
+            if (!(record >> name >> parent)) return fail("invalid class record");
+            cls = std::make_shared<Class>(name, parent);
+            cls->imported = true;
+        }
+        else if (kind == "end") {
+            if (!cls) return fail("'end' outside of a class");
+            interface.classes.push_back(cls);
+            cls = nullptr;
+        }
+        else if (!cls) {
+            return fail("'" + kind + "' outside of a class");
+        }
+        else if (kind == "field") {
+            std::string name, type;
+            if (!(record >> name >> type)) return fail("invalid field record");
+            cls->fields.push_back(std::make_shared<Field>(name, type));
+        }
+        else if (kind == "method" || kind == "generator") {
+            std::string name, return_type;
+            if (!(record >> name >> return_type)) return fail("invalid method record");
+
+            std::vector<std::shared_ptr<Formal>> formals;
+            std::string formal_name, formal_type;
+            while (record >> formal_name) {
+                if (!(record >> formal_type)) return fail("missing type of formal " + formal_name);
+                formals.push_back(std::make_shared<Formal>(formal_name, formal_type));
+            }
+            cls->methods.push_back(std::make_shared<Method>(name, formals, return_type, nullptr));
+            cls->methods.back()->generator = kind == "generator";
+        }
+        else if (kind == "layout") {
+            std::string name, type;
+            if (!(record >> name >> type)) return fail("invalid layout record");
+            interface.layouts[cls->name].push_back({name, type});
+        }
+        else if (kind == "slot") {
+            std::string method_name, impl_name;
+            if (!(record >> method_name >> impl_name)) return fail("invalid slot record");
+            interface.vtables[cls->name].push_back({method_name, impl_name});
+        }
+        else {
+            return fail("unknown record '" + kind + "'");
+        }
+    }
+
+    if (cls) return fail("unterminated class " + cls->name);
+    if (interface.object_file.empty()) return fail("missing object file");
+    return true;
+}
+
+} // namespace VSOP
@@ -0,0 +1,59 @@
+#ifndef INTERFACE_HPP
+#define INTERFACE_HPP
+
+#include "AST.hpp"
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+
+namespace VSOP {
+
+// Interface of a compiled library (a .vsopi file, see vsopc --emit-interface).
+// It holds everything a program needs to type-check against the library's
+// classes and to generate code using them without their source: the class
+// declarations (ClassDef tables), the object layouts and the vtable slots.
+//
+// The file is line based, one record per line:
+//
+//   vsopi 2
+//   object <object file, relative to the interface>
+//   vtables <absolute|relative>
+//   memory <none|rc>
+//   class <name> <parent>
+//   field <name> <type>                          (own fields, in order)
+//   method <name> <return type> [<formal> <type>]...
+//   generator <name> <yielded type> [<formal> <type>]...
+//   layout <field> <type>                        (all fields, struct order)
+//   slot <method> <implementing function>        (vtable order)
+//   end
+struct Interface {
+    // Precompiled object implementing the classes
+    std::string object_file;
+
+    // Whether the library was compiled with --relative-vtables
+    bool relative_vtables = false;
+
+    // Whether the library was compiled with --memory=rc
+    bool reference_counting = false;
+
+    // Class declarations (Class::imported is set, no initializer nor body)
+    std::vector<std::shared_ptr<Class>> classes;
+
+    // Class name -> (field, type) in struct order, inherited fields first
+    std::unordered_map<std::string, std::vector<std::pair<std::string, std::string>>> layouts;
+
+    // Class name -> (method, implementing function) in vtable slot order
+    std::unordered_map<std::string, std::vector<std::pair<std::string, std::string>>> vtables;
+};
+
+// Write an interface file. Returns false (and sets error) on I/O failure.
+bool writeInterface(const std::string& path, const Interface& interface, std::string& error);
+
+// Read an interface file. The object file path is made relative to the
+// current directory. Returns false (and sets error) if the file is invalid.
+bool readInterface(const std::string& path, Interface& interface, std::string& error);
+
+} // namespace VSOP
+
+#endif // INTERFACE_HPP
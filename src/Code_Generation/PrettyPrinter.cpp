@@ -22,6 +22,7 @@ void PrettyPrinter::print(const Program* program) {
             std::cerr << "ERROR: Class at index " << i << " is null!" << std::endl;
             continue;
         }
+        if (cls->imported) continue;
         
         if (!first) {
             os << ",\n ";
@@ -311,6 +312,45 @@ void PrettyPrinter::visit(const While* node) {
     os << ")";
 }
 
+void PrettyPrinter::visit(const For* node) {
+    if (!node) {
+        std::cerr << "ERROR: For node is null" << std::endl;
+        return;
+    }
+    
+    os << "For(" << node->name << ", ";
+    if (node->iterable) {
+        node->iterable->accept(this);
+    } else {
+        std::cerr << "ERROR: For iterable is null!" << std::endl;
+        os << "null";
+    }
+    os << ", ";
+    if (node->body) {
+        node->body->accept(this);
+    } else {
+        std::cerr << "ERROR: For body is null!" << std::endl;
+        os << "null";
+    }
+    os << ")";
+}
+
+void PrettyPrinter::visit(const Yield* node) {
+    if (!node) {
+        std::cerr << "ERROR: Yield node is null" << std::endl;
+        return;
+    }
+    
+    os << "Yield(";
+    if (node->expr) {
+        node->expr->accept(this);
+    } else {
+        std::cerr << "ERROR: Yield expression is null!" << std::endl;
+        os << "null";
+    }
+    os << ")";
+}
+
 void PrettyPrinter::visit(const Assign* node) {
     if (!node) {
         std::cerr << "ERROR: Assign node is null" << std::endl;
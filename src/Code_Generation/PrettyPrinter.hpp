@@ -33,6 +33,8 @@ private:
     void visit(const Let* node) override;
     void visit(const If* node) override;
     void visit(const While* node) override;
+    void visit(const For* node) override;
+    void visit(const Yield* node) override;
     void visit(const Assign* node) override;
     void visit(const StringLiteral* node) override;
     void visit(const IntegerLiteral* node) override;
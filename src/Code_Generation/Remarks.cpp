@@ -0,0 +1,57 @@
+#include "Remarks.hpp"
+#include <fstream>
+
+namespace VSOP {
+
+// Quote a string for YAML: single quotes, doubled inside, on a single line
+static std::string quoteYAML(const std::string& str) {
+    std::string quoted = "'";
+    for (char c : str) {
+        if (c == '\'') {
+            quoted += "''";
+        } else if (c == '\n') {
+            quoted += ' ';
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+}
+
+bool writeRemarks(const std::string& path, const std::vector<Remark>& remarks, std::string& error) {
+    std::ofstream out(path);
+    if (!out) {
+        error = "cannot write remarks " + path;
+        return false;
+    }
+
+    for (const Remark& remark : remarks) {
+        switch (remark.kind) {
+            case Remark::Kind::PASSED: out << "--- !Passed\n"; break;
+            case Remark::Kind::MISSED: out << "--- !Missed\n"; break;
+            case Remark::Kind::ANALYSIS: out << "--- !Analysis\n"; break;
+        }
+        out << "Pass:            " << quoteYAML(remark.pass) << "\n";
+        out << "Name:            " << quoteYAML(remark.name) << "\n";
+        if (!remark.file.empty() && remark.line > 0) {
+            out << "DebugLoc:        { File: " << quoteYAML(remark.file) << ", Line: " << remark.line
+                << ", Column: " << remark.column << " }\n";
+        }
+        out << "Function:        " << quoteYAML(remark.function) << "\n";
+        out << "Args:\n";
+        if (!remark.method.empty()) {
+            out << "  - Method:          " << quoteYAML(remark.method) << "\n";
+            out << "  - String:          ': '\n";
+        }
+        out << "  - String:          " << quoteYAML(remark.message) << "\n";
+        out << "...\n";
+    }
+
+    if (!out) {
+        error = "cannot write remarks " + path;
+        return false;
+    }
+    return true;
+}
+
+} // namespace VSOP
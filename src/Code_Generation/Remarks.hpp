@@ -0,0 +1,36 @@
+#ifndef REMARKS_HPP
+#define REMARKS_HPP
+
+#include <string>
+#include <vector>
+
+namespace VSOP {
+
+// Optimization remark (see vsopc --remarks): an optimization applied (passed)
+// or given up (missed) somewhere in the program, either by vsopc itself
+// (passes named vsop-*) or by LLVM's pipeline. Remarks are attributed to the
+// function they were emitted for, to the VSOP method it compiles, and to a
+// source position: the call or new concerned when known, else the method.
+struct Remark {
+    enum class Kind { PASSED, MISSED, ANALYSIS };
+
+    Kind kind = Kind::PASSED;
+    std::string pass;       // e.g. vsop-devirtualize, inline, loop-vectorize
+    std::string name;       // Identifies the decision within the pass
+    std::string function;   // LLVM function (Class__method, Class___init, ...)
+    std::string method;     // Class.method ("" if the function is no method)
+    std::string file;       // "" if unknown
+    int line = 0;           // 0 if unknown
+    int column = 0;
+    std::string message;
+};
+
+// Write remarks in the YAML format of LLVM's optimization records (one
+// document per remark, as written by clang -fsave-optimization-record), which
+// opt-viewer and llvm-opt-report read. Returns false (and sets error) on I/O
+// failure.
+bool writeRemarks(const std::string& path, const std::vector<Remark>& remarks, std::string& error);
+
+} // namespace VSOP
+
+#endif // REMARKS_HPP
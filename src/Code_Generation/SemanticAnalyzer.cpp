@@ -2,7 +2,6 @@
 #include <iostream>
 #include <algorithm>
 #include <sstream>
-#include <set> // Include set for hierarchy checks
 
 namespace VSOP {
 
@@ -38,7 +37,10 @@ const std::unordered_map<std::string, ClassDef>& SemanticAnalyzer::getClassDefin
 bool MethodSignature::isCompatible(const MethodSignature& other) const {
     // Check return type and parameter count
     // For VSOP, require exact match for return type
+    // An override must also be a generator if and only if the overridden
+    // method is one, as they are not called the same way
     if (returnType.toString() != other.returnType.toString() ||
+        generator != other.generator ||
         parameters.size() != other.parameters.size()) {
         return false;
     }
@@ -53,29 +55,6 @@ bool MethodSignature::isCompatible(const MethodSignature& other) const {
     return true;
 }
 
-// ClassDef implementation - modified to use ClassDef map
-bool ClassDef::hasCyclicInheritance(const std::unordered_map<std::string, ClassDef>& class_definitions) const {
-    std::set<std::string> visited;
-    std::string current = name;
-
-    while (current != "Object" && !current.empty()) {
-        if (visited.count(current)) {
-            return true; // Cycle detected
-        }
-        visited.insert(current);
-
-        auto it = class_definitions.find(current);
-        if (it == class_definitions.end()) {
-            return false; // Broken chain, not necessarily a cycle (error reported elsewhere)
-        }
-        current = it->second.parent;
-
-        // Check if parent is the original class name
-        if (current == name) return true;
-    }
-    return false; // Reached Object or end without cycle
-}
-
 // Scope implementation remains the same
 std::pair<bool, Type> Scope::lookupVariable(const std::string& name) const {
     auto it = variables.find(name);
@@ -95,7 +74,15 @@ void Scope::addVariable(const std::string& name, const Type& type) {
 // SemanticAnalyzer implementation
 SemanticAnalyzer::SemanticAnalyzer() {
     current_scope = std::make_shared<Scope>(); // Global scope might be needed later
+    initBuiltinClasses();
+}
+
+void SemanticAnalyzer::initBuiltinClasses() {
+    builtin_classes = {"Object", "StringMap", "File"};
     initObjectMethods();
+    initStringMapMethods();
+    initFileMethods();
+    initStringMethods();
 }
 
 void SemanticAnalyzer::initObjectMethods() {
@@ -120,13 +107,61 @@ void SemanticAnalyzer::initObjectMethods() {
     class_definitions["Object"] = object_def;
 }
 
+// StringMap is implemented by the runtime (stringmap.c): a hash table from
+// strings to objects. get returns null (test with isnull) for unbound keys.
+void SemanticAnalyzer::initStringMapMethods() {
+    ClassDef map_def("StringMap", "Object");
+    Type map_type("StringMap");
+    std::vector<FormalParam> key_params = {FormalParam("key", Type::String())};
+    map_def.methods["get"] = MethodSignature("get", key_params, Type::Object());
+    std::vector<FormalParam> put_params = {FormalParam("key", Type::String()), FormalParam("value", Type::Object())};
+    map_def.methods["put"] = MethodSignature("put", put_params, map_type);
+    map_def.methods["contains"] = MethodSignature("contains", key_params, Type::Boolean());
+    map_def.methods["remove"] = MethodSignature("remove", key_params, Type::Boolean());
+    std::vector<FormalParam> size_params;
+    map_def.methods["size"] = MethodSignature("size", size_params, Type::Int32());
+
+    class_definitions["StringMap"] = map_def;
+}
+
+// File is implemented by the runtime (file.c): a memory-mapped input file.
+void SemanticAnalyzer::initFileMethods() {
+    ClassDef file_def("File", "Object");
+    std::vector<FormalParam> open_params = {FormalParam("path", Type::String())};
+    file_def.methods["open"] = MethodSignature("open", open_params, Type::Boolean());
+    std::vector<FormalParam> no_params;
+    file_def.methods["nextLine"] = MethodSignature("nextLine", no_params, Type::String());
+    file_def.methods["nextInt32"] = MethodSignature("nextInt32", no_params, Type::Int32());
+    file_def.methods["atEnd"] = MethodSignature("atEnd", no_params, Type::Boolean());
+
+    class_definitions["File"] = file_def;
+}
+
+// Methods of the string type, implemented by the runtime (string_methods.c)
+// and called directly, with the string as first argument.
+void SemanticAnalyzer::initStringMethods() {
+    string_methods.clear();
+    std::vector<FormalParam> no_params;
+    string_methods["length"] = MethodSignature("length", no_params, Type::Int32());
+    std::vector<FormalParam> string_params = {FormalParam("s", Type::String())};
+    string_methods["concat"] = MethodSignature("concat", string_params, Type::String());
+    std::vector<FormalParam> substr_params = {FormalParam("start", Type::Int32()), FormalParam("length", Type::Int32())};
+    string_methods["substr"] = MethodSignature("substr", substr_params, Type::String());
+    string_methods["indexOf"] = MethodSignature("indexOf", string_params, Type::Int32());
+    string_methods["equals"] = MethodSignature("equals", string_params, Type::Boolean());
+}
+
+bool SemanticAnalyzer::isBuiltinClass(const std::string& className) const {
+    return std::find(builtin_classes.begin(), builtin_classes.end(), className) != builtin_classes.end();
+}
+
 bool SemanticAnalyzer::analyze(std::shared_ptr<Program> prog) {
     program = prog;
     errors.clear();
     class_table.clear();
-    // Clear class_definitions but keep Object
+    // Clear class_definitions but keep the built-in classes
     class_definitions.erase(class_definitions.begin(), class_definitions.end());
-    initObjectMethods(); // Re-initialize Object definition
+    initBuiltinClasses(); // Re-initialize the built-in class definitions
 
     current_scope = std::make_shared<Scope>(); // Reset global scope
 
@@ -144,7 +179,8 @@ bool SemanticAnalyzer::analyze(std::shared_ptr<Program> prog) {
     collectMethodsAndFields();
     if (!errors.empty()) return false; // Stop if members have issues
 
-    // Check for Main class and main method
+    // Check for Main class and main method (a library has no entry point)
+    if (program->library) return errors.empty();
     auto main_class_it = class_definitions.find("Main");
     if (main_class_it == class_definitions.end()) {
         reportError("Program must have a Main class");
@@ -160,15 +196,62 @@ bool SemanticAnalyzer::analyze(std::shared_ptr<Program> prog) {
             if (main_sig.returnType.toString() != "int32") {
                 reportError("Main.main method must have return type int32");
             }
+            if (main_sig.generator) {
+                reportError("Main.main method cannot be a generator");
+            }
         }
     }
 
     return errors.empty();
 }
 
+// Whether the given expression contains a yield
+bool SemanticAnalyzer::containsYield(const Expression* expr) {
+    if (!expr) return false;
+    
+    if (dynamic_cast<const Yield*>(expr)) return true;
+    if (const For* for_expr = dynamic_cast<const For*>(expr)) {
+        return containsYield(for_expr->iterable.get()) || containsYield(for_expr->body.get());
+    }
+    if (const Assign* assign = dynamic_cast<const Assign*>(expr)) {
+        return containsYield(assign->expr.get());
+    }
+    if (const Let* let = dynamic_cast<const Let*>(expr)) {
+        return containsYield(let->init_expr.get()) || containsYield(let->scope_expr.get());
+    }
+    if (const BinaryOp* binop = dynamic_cast<const BinaryOp*>(expr)) {
+        return containsYield(binop->left.get()) || containsYield(binop->right.get());
+    }
+    if (const UnaryOp* unop = dynamic_cast<const UnaryOp*>(expr)) {
+        return containsYield(unop->expr.get());
+    }
+    if (const Call* call = dynamic_cast<const Call*>(expr)) {
+        if (containsYield(call->object.get())) return true;
+        for (const auto& arg : call->arguments) {
+            if (containsYield(arg.get())) return true;
+        }
+        return false;
+    }
+    if (const If* if_expr = dynamic_cast<const If*>(expr)) {
+        return containsYield(if_expr->condition.get()) || containsYield(if_expr->then_expr.get())
+            || containsYield(if_expr->else_expr.get());
+    }
+    if (const While* while_expr = dynamic_cast<const While*>(expr)) {
+        return containsYield(while_expr->condition.get()) || containsYield(while_expr->body.get());
+    }
+    if (const Block* block = dynamic_cast<const Block*>(expr)) {
+        for (const auto& sub_expr : block->expressions) {
+            if (containsYield(sub_expr.get())) return true;
+        }
+        return false;
+    }
+    return false;
+}
+
 void SemanticAnalyzer::buildClassDefinitions() {
     std::unordered_set<std::string> defined_classes;
-    defined_classes.insert("Object"); // Object is implicitly defined
+    // Object and the other built-in classes are implicitly defined
+    defined_classes.insert(builtin_classes.begin(), builtin_classes.end());
 
     for (const auto& cls : program->classes) {
         if (!cls) continue; // Should not happen if parser works
@@ -178,9 +261,9 @@ void SemanticAnalyzer::buildClassDefinitions() {
             reportError("Cannot redefine primitive type: " + cls->name);
             continue;
         }
-        // Check for Object redefinition
-        if (cls->name == "Object") {
-            reportError("Class Object cannot be redefined");
+        // Check for built-in class redefinition
+        if (isBuiltinClass(cls->name)) {
+            reportError("Class " + cls->name + " cannot be redefined");
              continue;
         }
 
@@ -197,37 +280,109 @@ void SemanticAnalyzer::buildClassDefinitions() {
     }
 }
 
+// Validate the whole hierarchy in a single depth-first pass over the parent
+// links. Each class is white (not visited yet), gray (on the current parent
+// chain) or black (done): reaching a gray class means a cycle, and a black one
+// already has its depth, so every class is visited once. Classes are finished
+// parents first, which gives the topological order. Classes that are part of a
+// cycle (or inherit from one) get no depth and are left out of the order.
 void SemanticAnalyzer::validateInheritanceHierarchy() {
+    enum class Color { WHITE, GRAY, BLACK };
+    std::unordered_map<std::string, Color> colors;
+    colors.reserve(class_definitions.size());
     for (const auto& [name, class_def] : class_definitions) {
-        if (name == "Object") continue;
+        colors[name] = Color::WHITE;
+    }
 
-        const std::string& parent_name = class_def.parent;
+    class_order.clear();
+    class_depths.clear();
+    // Built-in classes are done already (they all extend Object directly)
+    for (const auto& name : builtin_classes) {
+        class_order.push_back(name);
+        class_depths[name] = name == "Object" ? 0 : 1;
+        colors[name] = Color::BLACK;
+    }
 
-        // Check parent exists and is not a primitive type
-        if (parent_name == "int32" || parent_name == "bool" || parent_name == "string" || parent_name == "unit") {
-             reportError("Class " + name + " cannot extend primitive type " + parent_name);
-             continue;
-        }
-        if (class_definitions.find(parent_name) == class_definitions.end()) {
-             reportError("Class " + name + " extends undefined class " + parent_name);
-             continue;
+    // Follow the classes in source order, for deterministic errors and order
+    std::vector<std::string> roots;
+    for (const auto& cls : program->classes) {
+        if (cls && class_definitions.count(cls->name)) roots.push_back(cls->name);
+    }
+
+    std::vector<std::string> chain; // Gray classes, from the root to the top
+    for (const auto& root : roots) {
+        if (colors[root] != Color::WHITE) continue;
+
+        // Climb until a class that is done (or a broken link)
+        std::string current = root;
+        bool cyclic = false;
+        int base_depth = 0;
+        while (true) {
+            Color& color = colors[current];
+            if (color == Color::BLACK) {
+                base_depth = class_depths[current];
+                cyclic = base_depth < 0;
+                break;
+            }
+            if (color == Color::GRAY) {
+                cyclic = true;
+                break;
+            }
+            color = Color::GRAY;
+            chain.push_back(current);
+
+            const std::string& parent_name = class_definitions.at(current).parent;
+
+            // Check parent exists and is not a primitive type
+            if (parent_name == "int32" || parent_name == "bool" || parent_name == "string" || parent_name == "unit") {
+                reportError("Class " + current + " cannot extend primitive type " + parent_name);
+                break;
+            }
+            if (class_definitions.find(parent_name) == class_definitions.end()) {
+                reportError("Class " + current + " extends undefined class " + parent_name);
+                break;
+            }
+            // Built-in classes other than Object are final, so that their
+            // methods can be called directly
+            if (parent_name != "Object" && isBuiltinClass(parent_name)) {
+                reportError("Class " + current + " cannot extend built-in class " + parent_name);
+                break;
+            }
+            current = parent_name;
         }
 
-        // Check for inheritance cycles using the map
-        if (class_def.hasCyclicInheritance(class_definitions)) {
-            reportError("Class " + name + " has cyclic inheritance");
+        // Walk back down the chain: every class on it (or leading to it) is
+        // part of a cycle, or is one level below its parent
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            colors[*it] = Color::BLACK;
+            if (cyclic) {
+                reportError("Class " + *it + " has cyclic inheritance");
+                class_depths[*it] = -1;
+                continue;
+            }
+            class_depths[*it] = ++base_depth;
+            class_order.push_back(*it);
         }
+        chain.clear();
     }
 }
 
+int SemanticAnalyzer::getClassDepth(const std::string& className) const {
+    auto it = class_depths.find(className);
+    return it == class_depths.end() ? -1 : it->second;
+}
+
 void SemanticAnalyzer::collectMethodsAndFields() {
      // Use sets to track defined names in the hierarchy to check overriding/shadowing
     std::unordered_map<std::string, std::unordered_set<std::string>> class_fields;
     std::unordered_map<std::string, std::unordered_map<std::string, MethodSignature>> class_methods;
 
-    // Iterate through the AST classes
-    for (const auto& [name, cls_node] : class_table) {
-        if (!cls_node) continue;
+    // Iterate through the AST classes, parents first so that overrides are
+    // checked against complete ancestor definitions
+    for (const auto& name : class_order) {
+        auto node_it = class_table.find(name);
+        if (node_it == class_table.end() || !node_it->second) continue;
+        const auto& cls_node = node_it->second;
         auto& class_def = class_definitions[name]; // Get the definition being built
 
         // Check fields
@@ -314,8 +469,45 @@ void SemanticAnalyzer::collectMethodsAndFields() {
              // Only proceed if parameter and return types were valid
              if (param_type_error) continue;
 
+             // A method is a generator if its body yields (imported methods
+             // have no body, their interface tells)
+             if (method_node->body) {
+                 method_node->generator = containsYield(method_node->body.get());
+             }
+             if (method_node->generator && return_type.toString() == "unit") {
+                 reportError("Generator method " + method_node->name + " in class " + name +
+                             " cannot yield values of type unit");
+                 continue;
+             }
+             
+             // The results of a memo method are cached on its arguments, and
+             // must be values that the cache can hold and compare
+             if (method_node->memo) {
+                 auto isMemoValue = [](const Type& type) {
+                     return type.toString() == "int32" || type.toString() == "bool" || type.toString() == "string";
+                 };
+                 bool memo_error = false;
+                 for (const auto& param : formal_params) {
+                     if (!isMemoValue(param.type)) {
+                         reportError("Parameter " + param.name + " of memo method " + method_node->name + " in class " +
+                                     name + " has type " + param.type.toString() + " (expected int32, bool or string)");
+                         memo_error = true;
+                     }
+                 }
+                 if (method_node->generator) {
+                     reportError("Generator method " + method_node->name + " in class " + name + " cannot be memo");
+                     memo_error = true;
+                 } else if (!isMemoValue(return_type)) {
+                     reportError("Memo method " + method_node->name + " in class " + name + " returns " +
+                                 return_type.toString() + " (expected int32, bool or string)");
+                     memo_error = true;
+                 }
+                 if (memo_error) continue;
+             }
+
              // Create method signature
              MethodSignature current_sig(method_node->name, formal_params, return_type);
+             current_sig.generator = method_node->generator;
 
              // Check method overriding: find method in parent hierarchy
              std::optional<MethodSignature> parent_sig_opt = findMethodSignature(class_def.parent, method_node->name);
@@ -387,6 +579,11 @@ std::optional<Type> SemanticAnalyzer::findFieldType(const std::string& className
 }
 
 std::optional<MethodSignature> SemanticAnalyzer::findMethodSignature(const std::string& className, const std::string& methodName) {
+    if (className == "string") {
+        auto method_it = string_methods.find(methodName);
+        if (method_it == string_methods.end()) return std::nullopt;
+        return method_it->second;
+    }
     std::string current_class = className;
     while (!current_class.empty()) {
         auto class_it = class_definitions.find(current_class);
@@ -418,29 +615,28 @@ Type SemanticAnalyzer::findCommonAncestor(const Type& type1, const Type& type2)
         return Type::Object();
     }
 
-    // Both are class types, find common ancestor
-    std::set<std::string> ancestors1;
-    std::string current = type1.getName();
-    while (!current.empty()) {
-        ancestors1.insert(current);
-        if (current == "Object") break;
-        auto it = class_definitions.find(current);
-        if (it == class_definitions.end()) return Type::Error(); // Should not happen
-        current = it->second.parent;
+    // Both are class types: bring the deeper one up to the depth of the other,
+    // then climb both until they meet
+    std::string current1 = type1.getName();
+    std::string current2 = type2.getName();
+    int depth1 = getClassDepth(current1);
+    int depth2 = getClassDepth(current2);
+    if (depth1 < 0 || depth2 < 0) return Type::Error(); // Should not happen
+
+    while (depth1 > depth2) {
+        current1 = class_definitions.at(current1).parent;
+        --depth1;
     }
-
-    current = type2.getName();
-    while (!current.empty()) {
-        if (ancestors1.count(current)) {
-            return Type(current, Type::Kind::CLASS); // Found common ancestor
-        }
-        if (current == "Object") break;
-        auto it = class_definitions.find(current);
-         if (it == class_definitions.end()) return Type::Error(); // Should not happen
-        current = it->second.parent;
+    while (depth2 > depth1) {
+        current2 = class_definitions.at(current2).parent;
+        --depth2;
+    }
+    while (current1 != current2) {
+        current1 = class_definitions.at(current1).parent;
+        current2 = class_definitions.at(current2).parent;
     }
 
-    return Type::Object(); // Should technically always find Object
+    return Type(current1, Type::Kind::CLASS);
 }
 
 
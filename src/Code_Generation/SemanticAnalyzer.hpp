@@ -70,6 +70,8 @@ struct MethodSignature {
     std::string name;
     std::vector<FormalParam> parameters;
     Type returnType;
+    // Generator method: returnType is the type of the yielded values
+    bool generator = false;
 
     MethodSignature() : name(""), returnType(Type::Error()) {}  // Default constructor
     MethodSignature(const std::string& name, const std::vector<FormalParam>& parameters, const Type& returnType)
@@ -91,9 +93,6 @@ struct ClassDef {
     ClassDef() : name(""), parent("") {}  // Default constructor
     ClassDef(const std::string& name, const std::string& parent)
         : name(name), parent(parent) {}
-
-    // Check for cyclic inheritance (needs access to the map)
-    bool hasCyclicInheritance(const std::unordered_map<std::string, ClassDef>& class_definitions) const;
 };
 
 // Represents a scope for variable lookup
@@ -122,6 +121,21 @@ public:
     
     const std::unordered_map<std::string, ClassDef>& getClassDefinitions() const;
 
+    // Classes in topological order (Object first, parents before children)
+    // and their depth in the hierarchy (Object is at depth 0), as computed by
+    // validateInheritanceHierarchy
+    const std::vector<std::string>& getClassOrder() const { return class_order; }
+    int getClassDepth(const std::string& className) const;
+
+    // Classes implemented by the runtime (Object first). They have a ClassDef
+    // but no AST node, and all but Object are final.
+    const std::vector<std::string>& getBuiltinClasses() const { return builtin_classes; }
+    bool isBuiltinClass(const std::string& className) const;
+
+    // Methods of the string type (length, concat, substr, indexOf, equals),
+    // which findMethodSignature() also finds for class "string"
+    const std::unordered_map<std::string, MethodSignature>& getStringMethods() const { return string_methods; }
+
     // Get semantic error messages
     const std::vector<std::string>& getErrors() const { return errors; }
 
@@ -146,6 +160,7 @@ private:
 
     // Utility methods
     void reportError(const std::string& message);
+    static bool containsYield(const Expression* expr);
     // Type findMethodReturnType(const std::string& className, const std::string& methodName,
     //                           const std::vector<Type>& argTypes); // Replaced by findMethodSignature
 
@@ -156,14 +171,22 @@ private:
     std::unordered_map<std::string, std::shared_ptr<Class>> class_table; // From AST nodes
     // ClassDef is now fully defined before this usage
     std::unordered_map<std::string, ClassDef> class_definitions; // Built definitions
+    std::vector<std::string> class_order; // Parents before children
+    std::unordered_map<std::string, int> class_depths; // Class name -> depth (Object = 0)
+    std::vector<std::string> builtin_classes; // Object, StringMap, File
+    std::unordered_map<std::string, MethodSignature> string_methods;
     std::shared_ptr<Scope> current_scope; // Analyzer might still manage global scope?
     std::string current_class_name; // Analyzer might still manage global scope?
 
     // Location information for errors
     std::string source_file;
 
-    // Predefined Object methods
+    // Predefined classes and their methods
+    void initBuiltinClasses();
     void initObjectMethods();
+    void initStringMapMethods();
+    void initFileMethods();
+    void initStringMethods();
 };
 
 } // namespace VSOP
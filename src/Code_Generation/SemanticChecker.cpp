@@ -40,6 +40,14 @@ bool SemanticChecker::check(std::shared_ptr<Program> prog) {
         return false;
     }
     
+    // Index the class members, parents first
+    buildMemberIndex(analyzer.getClassOrder());
+    builtin_classes.clear();
+    for (const auto& name : analyzer.getBuiltinClasses()) {
+        builtin_classes[name] = analyzer.getClassDefinitions().at(name);
+    }
+    string_methods = analyzer.getStringMethods();
+    
     // Type check program
     TypeChecker checker(source_file);
     if (!checker.check(program)) {
@@ -55,6 +63,64 @@ bool SemanticChecker::check(std::shared_ptr<Program> prog) {
     return errors.empty();
 }
 
+void SemanticChecker::buildMemberIndex(const std::vector<std::string>& class_order) {
+    field_index.clear();
+    method_index.clear();
+    any_field_index.clear();
+    any_method_index.clear();
+    
+    std::unordered_map<std::string, const Class*> class_nodes;
+    for (const auto& cls : program->classes) {
+        if (!cls) continue;
+        class_nodes.emplace(cls->name, cls.get());
+        
+        // The fallback keeps the first declaration in program order
+        for (const auto& field : cls->fields) {
+            if (field) any_field_index.emplace(field->name, field.get());
+        }
+        for (const auto& method : cls->methods) {
+            if (method) any_method_index.emplace(method->name, method.get());
+        }
+    }
+    
+    auto no_fields = std::make_shared<const FieldIndex>();
+    auto no_methods = std::make_shared<const MethodIndex>();
+    
+    for (const auto& class_name : class_order) {
+        auto node_it = class_nodes.find(class_name);
+        if (node_it == class_nodes.end()) {
+            // Object: no fields, and its methods have no AST node
+            field_index[class_name] = no_fields;
+            method_index[class_name] = no_methods;
+            continue;
+        }
+        const Class* cls = node_it->second;
+        
+        auto parent_fields = field_index.count(cls->parent) ? field_index[cls->parent] : no_fields;
+        auto parent_methods = method_index.count(cls->parent) ? method_index[cls->parent] : no_methods;
+        
+        if (cls->fields.empty()) {
+            field_index[class_name] = parent_fields;
+        } else {
+            auto fields = std::make_shared<FieldIndex>(*parent_fields);
+            for (const auto& field : cls->fields) {
+                if (field) (*fields)[field->name] = field.get();
+            }
+            field_index[class_name] = fields;
+        }
+        
+        if (cls->methods.empty()) {
+            method_index[class_name] = parent_methods;
+        } else {
+            auto methods = std::make_shared<MethodIndex>(*parent_methods);
+            for (const auto& method : cls->methods) {
+                if (method) (*methods)[method->name] = method.get();
+            }
+            method_index[class_name] = methods;
+        }
+    }
+}
+
 void SemanticChecker::buildTypeContext() {
     // Build param and local variable type info for better expression typing
     for (const auto& cls : program->classes) {
@@ -77,9 +143,10 @@ void SemanticChecker::buildTypeContext() {
                 current_params[formal->name] = formal->type;
             }
             
-            // Process method body
+            // Process method body (a generator's body has no expected type,
+            // its value is discarded)
             if (method->body) {
-                annotateMethodBody(method->body.get(), method->return_type);
+                annotateMethodBody(method->body.get(), method->generator ? "" : method->return_type);
             }
             
             current_method_name = "";
@@ -219,6 +286,19 @@ void SemanticChecker::annotateExpressionType(const Expression* expr, const std::
         // While expression always has unit type
         expr_types[expr] = "unit";
     }
+    else if (const For* forExpr = dynamic_cast<const For*>(expr)) {
+        // The variable takes the values yielded by the generator call
+        if (forExpr->iterable) annotateExpressionType(forExpr->iterable.get());
+        current_locals[forExpr->name] = getTypeAnnotation(forExpr->iterable.get());
+        if (forExpr->body) annotateExpressionType(forExpr->body.get());
+        current_locals.erase(forExpr->name);
+        // For expression always has unit type
+        expr_types[expr] = "unit";
+    }
+    else if (const Yield* yieldExpr = dynamic_cast<const Yield*>(expr)) {
+        if (yieldExpr->expr) annotateExpressionType(yieldExpr->expr.get());
+        expr_types[expr] = "unit";
+    }
     else if (const Let* letExpr = dynamic_cast<const Let*>(expr)) {
         // Visit initializer if present
         if (letExpr->init_expr) {
@@ -284,6 +364,21 @@ void SemanticChecker::annotateExpressionType(const Expression* expr, const std::
         else if (callExpr->method_name == "inputString") {
             expr_types[expr] = "string";
         }
+        else if (builtin_classes.count(object_class)) {
+            // Built-in classes have no AST node, only signatures
+            const auto& class_methods = builtin_classes.at(object_class).methods;
+            auto signature_it = class_methods.find(callExpr->method_name);
+            if (signature_it != class_methods.end()) {
+                expr_types[expr] = signature_it->second.returnType.toString();
+            }
+        }
+        else if (object_class == "string") {
+            // Likewise for the methods of strings
+            auto signature_it = string_methods.find(callExpr->method_name);
+            if (signature_it != string_methods.end()) {
+                expr_types[expr] = signature_it->second.returnType.toString();
+            }
+        }
         else {
             // Look for the method in the class
             const Method* method = findMethodWithName(callExpr->method_name, object_class);
@@ -305,6 +400,7 @@ void SemanticChecker::printTypedAST(std::ostream& os) const {
     bool first_class = true;
     
     for (const auto& cls : program->classes) {
+        if (cls->imported) continue;
         if (!first_class) {
             os << ",\n ";
         }
@@ -471,6 +567,18 @@ void SemanticChecker::printExpression(std::ostream& os, const Expression* expr,
         printExpression(os, whileExpr->body.get(), indent);
         os << ")";
     }
+    else if (const For* forExpr = dynamic_cast<const For*>(expr)) {
+        os << "For(" << forExpr->name << ", ";
+        printExpression(os, forExpr->iterable.get(), indent);
+        os << ", ";
+        printExpression(os, forExpr->body.get(), indent);
+        os << ")";
+    }
+    else if (const Yield* yieldExpr = dynamic_cast<const Yield*>(expr)) {
+        os << "Yield(";
+        printExpression(os, yieldExpr->expr.get(), indent);
+        os << ")";
+    }
     else if (const Assign* assign = dynamic_cast<const Assign*>(expr)) {
         os << "Assign(" << assign->name << ", ";
         printExpression(os, assign->expr.get(), indent);
@@ -597,7 +705,8 @@ std::string SemanticChecker::getTypeAnnotation(const Expression* expr) const {
             return getTypeAnnotation(ifExpr->then_expr.get());
         }
     }
-    else if (const While* whileExpr = dynamic_cast<const While*>(expr)) {
+    else if (dynamic_cast<const While*>(expr) || dynamic_cast<const For*>(expr)
+             || dynamic_cast<const Yield*>(expr)) {
         return "unit";
     }
     else if (const Let* letExpr = dynamic_cast<const Let*>(expr)) {
@@ -642,6 +751,14 @@ std::string SemanticChecker::getTypeAnnotation(const Expression* expr) const {
             object_class = current_class_name;
         }
         
+        if (object_class == "string") {
+            auto signature_it = string_methods.find(callExpr->method_name);
+            if (signature_it != string_methods.end()) {
+                return signature_it->second.returnType.toString();
+            }
+            return "Object";
+        }
+        
         const Method* method = findMethodWithName(callExpr->method_name, object_class);
         if (method) {
             return method->return_type;
@@ -654,68 +771,34 @@ std::string SemanticChecker::getTypeAnnotation(const Expression* expr) const {
 
 // Helper methods for type annotation
 const Field* SemanticChecker::findFieldWithName(const std::string& name) const {
-    // Look in the current class first
-    for (const auto& cls : program->classes) {
-        if (cls->name == current_class_name) {
-            for (const auto& field : cls->fields) {
-                if (field && field->name == name) {
-                    return field.get();
-                }
-            }
+    // Look in the current class (and its ancestors) first
+    auto class_it = field_index.find(current_class_name);
+    if (class_it != field_index.end()) {
+        auto field_it = class_it->second->find(name);
+        if (field_it != class_it->second->end()) {
+            return field_it->second;
         }
     }
     
     // If not found in current class, look in all classes
-    for (const auto& cls : program->classes) {
-        for (const auto& field : cls->fields) {
-            if (field && field->name == name) {
-                return field.get();
-            }
-        }
-    }
-    
-    return nullptr;
+    auto field_it = any_field_index.find(name);
+    return field_it != any_field_index.end() ? field_it->second : nullptr;
 }
 
 const Method* SemanticChecker::findMethodWithName(const std::string& name, const std::string& class_name) const {
-    // If class specified, look there first
-    if (!class_name.empty()) {
-        for (const auto& cls : program->classes) {
-            if (cls->name == class_name) {
-                for (const auto& method : cls->methods) {
-                    if (method && method->name == name) {
-                        return method.get();
-                    }
-                }
-                break; // Stop searching in this class
-            }
-        }
-    }
-    
-    // Look in current class (if different from specified class)
-    if (class_name != current_class_name && !current_class_name.empty()) {
-        for (const auto& cls : program->classes) {
-            if (cls->name == current_class_name) {
-                for (const auto& method : cls->methods) {
-                    if (method && method->name == name) {
-                        return method.get();
-                    }
-                }
-                break; // Stop searching in this class
-            }
-        }
-    }
+    // Look in the specified class, then in the current one (with their ancestors)
+    auto find_in_class = [&](const std::string& lookup_class) -> const Method* {
+        auto class_it = method_index.find(lookup_class);
+        if (class_it == method_index.end()) return nullptr;
+        auto method_it = class_it->second->find(name);
+        return method_it != class_it->second->end() ? method_it->second : nullptr;
+    };
+    if (const Method* method = find_in_class(class_name)) return method;
+    if (const Method* method = find_in_class(current_class_name)) return method;
     
     // If not found in specified classes, look in all classes
-    for (const auto& cls : program->classes) {
-        for (const auto& method : cls->methods) {
-            if (method && method->name == name) {
-                return method.get();
-            }
-        }
-    }
-    
-    return nullptr;
+    auto method_it = any_method_index.find(name);
+    return method_it != any_method_index.end() ? method_it->second : nullptr;
 }
 
 // Get error messages
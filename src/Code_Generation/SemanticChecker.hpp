@@ -5,6 +5,7 @@
 #include "SemanticAnalyzer.hpp"
 #include "TypeChecker.hpp"
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <memory>
 
@@ -28,6 +29,25 @@ private:
     std::shared_ptr<Program> program;
     std::vector<std::string> errors;
     
+    // Member indexes, built once per check. A class's index holds its own
+    // members and the inherited ones it does not redefine; classes that
+    // declare no member of a kind share their parent's index.
+    using FieldIndex = std::unordered_map<std::string, const Field*>;
+    using MethodIndex = std::unordered_map<std::string, const Method*>;
+    std::unordered_map<std::string, std::shared_ptr<const FieldIndex>> field_index;    // Class name -> fields
+    std::unordered_map<std::string, std::shared_ptr<const MethodIndex>> method_index;  // Class name -> methods
+    FieldIndex any_field_index;    // Name -> first field with that name (any class)
+    MethodIndex any_method_index;  // Name -> first method with that name (any class)
+    
+    // Definitions of the built-in classes, which have no AST node
+    std::unordered_map<std::string, ClassDef> builtin_classes;
+    
+    // Signatures of the methods of the string type
+    std::unordered_map<std::string, MethodSignature> string_methods;
+    
+    // Build the member indexes (classes in topological order)
+    void buildMemberIndex(const std::vector<std::string>& class_order);
+    
     // Type context building
     void buildTypeContext();
     void annotateMethodBody(const Expression* expr, const std::string& return_type);
@@ -0,0 +1,80 @@
+#include "SourceMap.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace VSOP {
+
+LineIndex::LineIndex(const std::string& text) {
+    line_starts.push_back(0);
+
+    const char* data = text.data();
+    size_t size = text.size();
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // Compare 16 bytes at a time with both line terminators: most chunks
+    // hold none, and the others are walked through the bits of the mask
+    const __m128i line_feed = _mm_set1_epi8('\n');
+    const __m128i form_feed = _mm_set1_epi8('\f');
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, line_feed),
+                                                                   _mm_cmpeq_epi8(chunk, form_feed)));
+        while (mask) {
+            line_starts.push_back((uint32_t) (i + __builtin_ctz(mask) + 1));
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i < size; ++i) {
+        if (data[i] == '\n' || data[i] == '\f') {
+            line_starts.push_back((uint32_t) (i + 1));
+        }
+    }
+}
+
+SourcePosition LineIndex::resolve(uint32_t offset) const {
+    // Last line starting at or before the offset
+    auto it = std::upper_bound(line_starts.begin(), line_starts.end(), offset) - 1;
+
+    SourcePosition position;
+    position.line = (int) (it - line_starts.begin()) + 1;
+    position.column = (int) (offset - *it) + 1;
+    return position;
+}
+
+// Indexes of the files whose positions were resolved, and texts of the ones
+// that cannot be read again
+static std::map<std::string, std::unique_ptr<LineIndex>> line_indexes;
+static std::map<std::string, std::string> source_texts;
+
+void registerSourceText(const std::string& file, const std::string& text) {
+    source_texts[file] = text;
+    line_indexes.erase(file);
+}
+
+SourcePosition resolvePosition(const std::string& file, uint32_t offset) {
+    auto& index = line_indexes[file];
+    if (!index) {
+        auto text_it = source_texts.find(file);
+        if (text_it != source_texts.end()) {
+            index = std::make_unique<LineIndex>(text_it->second);
+        } else {
+            std::ifstream stream(file, std::ios::binary);
+            std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+            index = std::make_unique<LineIndex>(text);
+        }
+    }
+    return index->resolve(offset);
+}
+
+} // namespace VSOP
@@ -0,0 +1,54 @@
+#ifndef SOURCE_MAP_HPP
+#define SOURCE_MAP_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace VSOP {
+
+// Source positions are byte offsets into their file: the lexer only adds the
+// length of each token to the current offset, and lines and columns are
+// computed when a message or the -l output needs them, from an index of the
+// line starts built once per file.
+
+// Offset used for nodes without a position
+constexpr uint32_t UNKNOWN_OFFSET = UINT32_MAX;
+
+// Location of a token (the parser's location type, see parser.y): offsets of
+// its first byte and of the byte following it
+struct SourceRange {
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+// Line and column, both starting at 1
+struct SourcePosition {
+    int line = 1;
+    int column = 1;
+};
+
+// Offsets at which the lines of a text start. As in the lexer, both line
+// feeds and form feeds end a line, and columns count bytes.
+class LineIndex {
+public:
+    explicit LineIndex(const std::string& text);
+
+    SourcePosition resolve(uint32_t offset) const;
+
+private:
+    std::vector<uint32_t> line_starts;
+};
+
+// Make the text read from a file that cannot be read again (stdin) known, so
+// that positions in it can still be resolved
+void registerSourceText(const std::string& file, const std::string& text);
+
+// Line and column of an offset in a file. The file is read and indexed the
+// first time one of its positions is resolved; an unreadable file has a
+// single line.
+SourcePosition resolvePosition(const std::string& file, uint32_t offset);
+
+} // namespace VSOP
+
+#endif // SOURCE_MAP_HPP
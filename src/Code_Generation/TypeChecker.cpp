@@ -34,6 +34,7 @@ bool TypeChecker::check(std::shared_ptr<Program> prog) {
     for (const auto& cls : program->classes) {
         if (cls) cls->accept(this); // Check for null just in case
     }
+    checkMemoMethods();
 
     return errors.empty();
 }
@@ -119,12 +120,27 @@ void TypeChecker::reportError(const std::string& message, int line, int col) {
     }
 }
 
+// Report an error at the position of a node (1:1 if the parser set none)
+void TypeChecker::reportErrorAt(const ASTNode* node, const std::string& message) {
+    if (node->offset == UNKNOWN_OFFSET) {
+        reportError(message);
+        return;
+    }
+    SourcePosition position = resolvePosition(current_file, node->offset);
+    reportError(message, position.line, position.column);
+}
+
 // ---- Visitor Implementations (using analyzer methods) ----
 
 void TypeChecker::visit(const Class* node) {
+    // Imported classes were checked when their library was compiled
+    if (node->imported) return;
+    
     current_class = node->name;
+    current_file = node->file;
     enterScope();
     addSymbol("self", node->name);
+    effects[{node->name, ""}];
 
     // Fields are conceptually members, not lexical variables in the same way.
     // Don't add them to scope here. lookupSymbol will check fields via analyzer.
@@ -142,7 +158,9 @@ void TypeChecker::visit(const Field* node) {
     }
 
     if (node->init_expr) {
+        current_effects = &effects[{current_class, ""}];
         node->init_expr->accept(this);
+        current_effects = nullptr;
         std::string init_type = getExprType(node->init_expr.get());
         if (isValidType(node->type) && init_type != "__error__") {
             if (!isSubtypeOf(init_type, node->type)) {
@@ -155,6 +173,7 @@ void TypeChecker::visit(const Field* node) {
 
 void TypeChecker::visit(const Method* node) {
     current_method = node->name;
+    current_effects = &effects[{current_class, node->name}];
     enterScope();
     addSymbol("self", current_class);
 
@@ -171,10 +190,15 @@ void TypeChecker::visit(const Method* node) {
         }
     }
 
+    // The value of a generator's body is discarded, it yields its results
+    current_yield_type = node->generator ? node->return_type : "";
+
     if (node->body) {
         node->body->accept(this);
         std::string body_type = getExprType(node->body.get());
-        if (body_type != "__error__" && isValidType(node->return_type)) {
+        if (node->generator) {
+            // Checked by visit(Yield)
+        } else if (body_type != "__error__" && isValidType(node->return_type)) {
              if (!isSubtypeOf(body_type, node->return_type)) {
                  reportError("Method '" + node->name + "' body final type " + body_type +
                              " is not a subtype of return type " + node->return_type);
@@ -186,6 +210,8 @@ void TypeChecker::visit(const Method* node) {
 
     exitScope();
     current_method = "";
+    current_yield_type = "";
+    current_effects = nullptr;
 }
 
 void TypeChecker::visit(const Formal* node) {
@@ -280,7 +306,9 @@ void TypeChecker::visit(const Call* node) {
 
     if (object_type == "__error__") { setExprType(node, "__error__"); return; }
 
-    bool is_prim = (object_type == "int32" || object_type == "bool" || object_type == "string" || object_type == "unit");
+    // Strings have built-in methods, other primitive types none
+    bool is_prim = (object_type == "int32" || object_type == "bool" || object_type == "unit")
+        || (object_type == "string" && !analyzer.findMethodSignature(object_type, node->method_name));
     if (is_prim) {
          reportError("Cannot call method '" + node->method_name + "' on primitive type " + object_type);
          setExprType(node, "__error__"); return;
@@ -300,6 +328,17 @@ void TypeChecker::visit(const Call* node) {
 
     // Use the helper that now uses the analyzer's findMethodSignature
     std::string return_type = getMethodReturnType(object_type, node->method_name, arg_types);
+    
+    if (current_effects) {
+        current_effects->calls.push_back({object_type, node->method_name});
+    }
+    
+    // A generator call has no value of its own: it can only be iterated
+    std::optional<MethodSignature> sig_opt = analyzer.findMethodSignature(object_type, node->method_name);
+    if (return_type != "__error__" && sig_opt.has_value() && sig_opt->generator && node != for_iterable) {
+        reportErrorAt(node, "Generator method '" + node->method_name + "' can only be called as the iterable of a for loop");
+        return_type = "__error__";
+    }
     setExprType(node, return_type);
 }
 
@@ -314,6 +353,9 @@ void TypeChecker::visit(const New* node) {
     }
     // Type is valid and not primitive/unit, so it's a class type
     setExprType(node, node->type_name);
+    if (current_effects) {
+        current_effects->news.push_back(node->type_name);
+    }
 }
 
 void TypeChecker::visit(const Let* node) {
@@ -383,6 +425,52 @@ void TypeChecker::visit(const While* node) {
     setExprType(node, (condition_type == "__error__" || body_type == "__error__") ? "__error__" : "unit");
 }
 
+void TypeChecker::visit(const For* node) {
+    // The loop iterates over the values yielded by a generator call, which
+    // the variable takes in turn
+    const Call* call = dynamic_cast<const Call*>(node->iterable.get());
+    for_iterable = call;
+    node->iterable->accept(this);
+    for_iterable = nullptr;
+    std::string element_type = getExprType(node->iterable.get());
+
+    if (element_type != "__error__") {
+        std::string object_type = call && call->object ? getExprType(call->object.get()) : lookupSymbol("self");
+        std::optional<MethodSignature> sig_opt = call
+            ? analyzer.findMethodSignature(object_type, call->method_name) : std::nullopt;
+        if (!sig_opt.has_value() || !sig_opt->generator) {
+            reportErrorAt(node, "For loop must iterate over a call to a generator method");
+            element_type = "__error__";
+        }
+    }
+
+    enterScope();
+    addSymbol(node->name, element_type);
+    if (node->body) node->body->accept(this);
+    std::string body_type = getExprType(node->body.get());
+    exitScope();
+
+    setExprType(node, (element_type == "__error__" || body_type == "__error__") ? "__error__" : "unit");
+}
+
+void TypeChecker::visit(const Yield* node) {
+    node->expr->accept(this);
+    std::string expr_type = getExprType(node->expr.get());
+
+    if (current_yield_type.empty()) {
+        reportError("Yield outside of a method body");
+        setExprType(node, "__error__"); return;
+    }
+    if (expr_type == "__error__") { setExprType(node, "__error__"); return; }
+
+    if (!isSubtypeOf(expr_type, current_yield_type)) {
+        reportErrorAt(node, "Method '" + current_method + "' yields a value of type " + expr_type +
+                    ", which is not a subtype of its return type " + current_yield_type);
+        setExprType(node, "__error__"); return;
+    }
+    setExprType(node, "unit");
+}
+
 void TypeChecker::visit(const Assign* node) {
     std::string var_type = lookupSymbol(node->name);
     if (var_type == "__error__") {
@@ -406,6 +494,18 @@ void TypeChecker::visit(const Assign* node) {
         // Assignment result type is still expr_type, error is reported
     }
     setExprType(node, expr_type);
+    
+    // Fields are not in the lexical scopes
+    bool local = std::any_of(scopes.begin(), scopes.end(),
+                             [&](const auto& scope) { return scope.count(node->name) > 0; });
+    if (!local) {
+        if (current_effects && current_effects->impurity.empty()) {
+            current_effects->impurity = "assigns to field " + node->name;
+        }
+        field_writers.emplace(std::make_pair(fieldOwner(current_class, node->name), node->name),
+                              current_method.empty() ? "the field initializers of " + current_class
+                                                     : current_class + "." + current_method);
+    }
 }
 
 void TypeChecker::visit(const StringLiteral* node) { setExprType(node, "string"); }
@@ -415,9 +515,16 @@ void TypeChecker::visit(const UnitLiteral* node) { setExprType(node, "unit"); }
 
 void TypeChecker::visit(const Identifier* node) {
     std::string type = lookupSymbol(node->name);
-    if (type == "__error__") {
+    // A variable bound to an erroneous value (e.g. by a for loop over a
+    // non-generator) has already been reported
+    bool bound = std::any_of(scopes.begin(), scopes.end(),
+                             [&](const auto& scope) { return scope.count(node->name) > 0; });
+    if (type == "__error__" && !bound) {
         reportError("Undefined identifier: " + node->name);
     }
+    if (current_effects && !bound && type != "__error__") {
+        current_effects->reads.push_back(node->name);
+    }
     setExprType(node, type);
 }
 
@@ -495,4 +602,101 @@ std::string TypeChecker::getMethodReturnType(const std::string& className,
     return signature.returnType.toString();
 }
 
-} // namespace VSOP
\ No newline at end of file
+// ---- Memo methods ----
+
+// A memo method must be pure, as its results are cached (see
+// CodeGenerator::generateMemoizedBody()): neither it nor anything it may call
+// (every implementation of the methods it calls, and the field initializers
+// of the classes it instantiates) assigns to a field or uses a built-in class
+// (input and output, files, maps). It may only read fields that nothing
+// assigns, in any class: results are cached per self, so a field that could
+// change between two calls would make the second one return a stale result.
+void TypeChecker::checkMemoMethods() {
+    for (const auto& cls : program->classes) {
+        if (!cls || cls->imported) continue;
+        for (const auto& method : cls->methods) {
+            if (!method || !method->memo) continue;
+            std::string impurity = findImpurity(cls->name, method->name);
+            if (!impurity.empty()) {
+                SourcePosition position = resolvePosition(cls->file, method->offset);
+                reportError("Memo method '" + method->name + "' in class " + cls->name + " is not pure: " + impurity,
+                            position.line, position.column);
+            }
+        }
+    }
+}
+
+// Why the given method is not pure ("" if it is)
+std::string TypeChecker::findImpurity(const std::string& class_name, const std::string& method_name) {
+    const auto& class_defs = analyzer.getClassDefinitions();
+    std::set<std::pair<std::string, std::string>> visited;
+    std::vector<std::pair<std::string, std::string>> to_visit = {{class_name, method_name}};
+    
+    // The implementations a call may run: the one the static type of the
+    // receiver inherits, and the ones of its subclasses
+    auto addCall = [&](const std::string& static_type, const std::string& called) {
+        if (static_type == "string" || !class_defs.count(static_type)) return;
+        for (std::string cls = static_type; class_defs.count(cls); cls = class_defs.at(cls).parent) {
+            if (class_defs.at(cls).methods.count(called)) {
+                to_visit.push_back({cls, called});
+                break;
+            }
+        }
+        for (const auto& [cls, def] : class_defs) {
+            if (cls != static_type && def.methods.count(called) && isSubtypeOf(cls, static_type)) {
+                to_visit.push_back({cls, called});
+            }
+        }
+    };
+    
+    while (!to_visit.empty()) {
+        auto [cls, method] = to_visit.back();
+        to_visit.pop_back();
+        if (!visited.insert({cls, method}).second) continue;
+        
+        std::string what = method.empty() ? "the field initializers of " + cls : cls + "." + method;
+        if (analyzer.isBuiltinClass(cls)) {
+            if (method.empty()) continue;
+            return "it may call built-in method " + what;
+        }
+        auto effects_it = effects.find({cls, method});
+        if (effects_it == effects.end()) {
+            return "it may call " + what + ", whose body is not known";
+        }
+        const Effects& body_effects = effects_it->second;
+        std::string subject = cls == class_name && method == method_name ? "it" : what;
+        if (!body_effects.impurity.empty()) {
+            return subject + " " + body_effects.impurity;
+        }
+        for (const auto& field : body_effects.reads) {
+            std::string owner = fieldOwner(cls, field);
+            auto writer = field_writers.find({owner, field});
+            if (writer != field_writers.end()) {
+                return subject + " reads field " + field + ", which " + writer->second + " assigns";
+            }
+            if (!effects.count({owner, ""})) {
+                return subject + " reads field " + field + " of " + owner + ", whose methods are not known";
+            }
+        }
+        for (const auto& [static_type, called] : body_effects.calls) {
+            addCall(static_type, called);
+        }
+        for (const auto& created : body_effects.news) {
+            for (std::string ancestor = created; class_defs.count(ancestor); ancestor = class_defs.at(ancestor).parent) {
+                to_visit.push_back({ancestor, ""});
+            }
+        }
+    }
+    return "";
+}
+
+// The class declaring the given field, which the given class has
+std::string TypeChecker::fieldOwner(const std::string& class_name, const std::string& field_name) {
+    const auto& class_defs = analyzer.getClassDefinitions();
+    for (std::string cls = class_name; class_defs.count(cls); cls = class_defs.at(cls).parent) {
+        if (class_defs.at(cls).fields.count(field_name)) return cls;
+    }
+    return class_name;
+}
+
+} // namespace VSOP
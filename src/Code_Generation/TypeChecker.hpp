@@ -3,6 +3,7 @@
 
 #include "AST.hpp"
 #include "SemanticAnalyzer.hpp"
+#include <map>
 #include <unordered_map>
 #include <string>
 #include <memory>
@@ -34,6 +35,8 @@ public:
     void visit(const Let* node) override;
     void visit(const If* node) override;
     void visit(const While* node) override;
+    void visit(const For* node) override;
+    void visit(const Yield* node) override;
     void visit(const Assign* node) override;
     void visit(const StringLiteral* node) override;
     void visit(const IntegerLiteral* node) override;
@@ -51,17 +54,35 @@ private:
     
     // Current context
     std::string current_class;
+    std::string current_file;                // File declaring the current class
     std::string current_method;
+    std::string current_yield_type;          // Values yielded by the current method ("" if not a generator)
+    const Expression* for_iterable = nullptr; // Generator call iterated by the enclosing for loop
     std::unordered_map<std::string, std::string> symbol_types;
     
     // Track expression types
     std::unordered_map<const Expression*, std::string> expr_types;
     
+    // What the body of each method (and the field initializers of each
+    // class, under an empty method name) does besides computing its value,
+    // for checkMemoMethods()
+    struct Effects {
+        std::string impurity;                                   // First effect of its own ("" if none)
+        std::vector<std::pair<std::string, std::string>> calls; // Static type of the receiver, method
+        std::vector<std::string> news;                          // Instantiated classes
+        std::vector<std::string> reads;                         // Fields read
+    };
+    std::map<std::pair<std::string, std::string>, Effects> effects;
+    Effects* current_effects = nullptr;
+    // First body assigning each field (class declaring it, field name)
+    std::map<std::pair<std::string, std::string>, std::string> field_writers;
+    
     // Error tracking
     std::vector<std::string> errors;
     
     // Helper methods
     void reportError(const std::string& message, int line = 1, int col = 1);
+    void reportErrorAt(const ASTNode* node, const std::string& message);
     bool isSubtypeOf(const std::string& type, const std::string& parent_type);
     std::string getCommonAncestor(const std::string& type1, const std::string& type2);
     bool isValidType(const std::string& type);
@@ -79,6 +100,11 @@ private:
     // Node-specific helpers
     std::string getMethodReturnType(const std::string& class_name, const std::string& method_name, 
                                    const std::vector<std::string>& arg_types);
+    
+    // Memo methods
+    void checkMemoMethods();
+    std::string findImpurity(const std::string& class_name, const std::string& method_name);
+    std::string fieldOwner(const std::string& class_name, const std::string& field_name);
 };
 
 } // namespace VSOP
@@ -0,0 +1,697 @@
+#include "VIR.hpp"
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace VSOP {
+
+// Structure ------------------------------------------------------------------
+
+VIRInstruction* VIRBlock::getTerminator() const {
+    if (instructions.empty() || !instructions.back()->isTerminator()) return nullptr;
+    return instructions.back().get();
+}
+
+std::vector<VIRBlock*> VIRBlock::getSuccessors() const {
+    VIRInstruction* terminator = getTerminator();
+    return terminator ? terminator->targets : std::vector<VIRBlock*>();
+}
+
+VIRBlock* VIRFunction::createBlock() {
+    blocks.push_back(std::make_unique<VIRBlock>());
+    blocks.back()->id = blocks.size() - 1;
+    return blocks.back().get();
+}
+
+void VIRFunction::replaceAllUses(VIRInstruction* from, VIRInstruction* to) {
+    for (const auto& block : blocks) {
+        for (const auto& instruction : block->instructions) {
+            std::replace(instruction->operands.begin(), instruction->operands.end(), from, to);
+        }
+    }
+    for (VIRInstruction*& param : params) {
+        if (param == from) param = to;
+    }
+}
+
+void VIRModule::addClass(const VIRClass& vir_class) {
+    class_indices[vir_class.name] = classes.size();
+    classes.push_back(vir_class);
+}
+
+const VIRClass* VIRModule::findClass(const std::string& name) const {
+    auto index_it = class_indices.find(name);
+    return index_it != class_indices.end() ? &classes[index_it->second] : nullptr;
+}
+
+bool VIRModule::conformsTo(const std::string& class_name, const std::string& ancestor_name) const {
+    for (const VIRClass* vir_class = findClass(class_name); vir_class; vir_class = findClass(vir_class->parent)) {
+        if (vir_class->name == ancestor_name) return true;
+    }
+    return false;
+}
+
+std::string VIRModule::findFieldType(const std::string& class_name, const std::string& field_name) const {
+    for (const VIRClass* vir_class = findClass(class_name); vir_class; vir_class = findClass(vir_class->parent)) {
+        for (const auto& [name, type] : vir_class->fields) {
+            if (name == field_name) return type;
+        }
+    }
+    return "";
+}
+
+// Textual form ---------------------------------------------------------------
+//
+//   class Main : Object {
+//     field count : int32
+//     method main -> Main__main
+//   }
+//
+//   func Main__main(%0 : Main) : int32 {
+//   bb0:
+//     %1 : int32 = getfield %0, Main.count
+//     %2 : int32 = vcall %0, Main.fib(%1)
+//     ret %2
+//   }
+
+static const char* getOpName(VIROp op) {
+    switch (op) {
+        case VIROp::PARAM: return "param";
+        case VIROp::CONST_INT: case VIROp::CONST_BOOL: case VIROp::CONST_STRING: case VIROp::CONST_UNIT:
+            return "const";
+        case VIROp::CONST_NULL: return "null";
+        case VIROp::ADD: return "add";
+        case VIROp::SUB: return "sub";
+        case VIROp::MUL: return "mul";
+        case VIROp::DIV: return "div";
+        case VIROp::POW: return "pow";
+        case VIROp::NEG: return "neg";
+        case VIROp::NOT: return "not";
+        case VIROp::EQ: return "eq";
+        case VIROp::LT: return "lt";
+        case VIROp::LE: return "le";
+        case VIROp::AND: return "and";
+        case VIROp::NEW: return "new";
+        case VIROp::GETFIELD: return "getfield";
+        case VIROp::SETFIELD: return "setfield";
+        case VIROp::ISNULL: return "isnull";
+        case VIROp::VCALL: return "vcall";
+        case VIROp::SCALL: return "scall";
+        case VIROp::RESUME: return "resume";
+        case VIROp::CURRENT: return "current";
+        case VIROp::DESTROY: return "destroy";
+        case VIROp::YIELD: return "yield";
+        case VIROp::PHI: return "phi";
+        case VIROp::BR: return "br";
+        case VIROp::CONDBR: return "condbr";
+        case VIROp::RET: return "ret";
+    }
+    return "?";
+}
+
+static std::string escapeString(const std::string& str) {
+    std::string escaped;
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            static const char hex[] = "0123456789abcdef";
+            escaped += "\\x";
+            escaped += hex[c >> 4];
+            escaped += hex[c & 0xf];
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static std::string valueName(const VIRInstruction* value) {
+    return value ? "%" + std::to_string(value->id) : "%?";
+}
+
+static std::string blockName(const VIRBlock* block) {
+    return block ? "bb" + std::to_string(block->id) : "bb?";
+}
+
+static void printInstruction(const VIRInstruction& instruction, std::ostream& os) {
+    // Terminators define no value
+    os << "  ";
+    if (!instruction.isTerminator()) os << valueName(&instruction) << " : " << instruction.type << " = ";
+    os << getOpName(instruction.op);
+    auto printOperands = [&](size_t first) {
+        for (size_t i = first; i < instruction.operands.size(); ++i) {
+            os << (i > first ? ", " : "") << valueName(instruction.operands[i]);
+        }
+    };
+    switch (instruction.op) {
+        case VIROp::CONST_INT:
+            os << " " << instruction.int_value;
+            break;
+        case VIROp::CONST_BOOL:
+            os << (instruction.int_value ? " true" : " false");
+            break;
+        case VIROp::CONST_STRING:
+            os << " \"" << escapeString(instruction.name) << "\"";
+            break;
+        case VIROp::CONST_UNIT:
+            os << " ()";
+            break;
+        case VIROp::NEW:
+            os << " " << instruction.class_name;
+            break;
+        case VIROp::GETFIELD:
+            os << " " << valueName(instruction.operands[0]) << ", " << instruction.class_name << "." << instruction.name;
+            break;
+        case VIROp::SETFIELD:
+            os << " " << valueName(instruction.operands[0]) << ", " << instruction.class_name << "." << instruction.name
+               << ", " << valueName(instruction.operands[1]);
+            break;
+        case VIROp::VCALL:
+            os << " " << valueName(instruction.operands[0]) << ", " << instruction.class_name << "."
+               << instruction.name << "(";
+            printOperands(1);
+            os << ")";
+            break;
+        case VIROp::SCALL:
+            os << " " << instruction.name << "(";
+            printOperands(0);
+            os << ")";
+            break;
+        case VIROp::PHI:
+            for (size_t i = 0; i < instruction.operands.size(); ++i) {
+                os << (i ? ", [" : " [") << blockName(instruction.incoming[i]) << ": "
+                   << valueName(instruction.operands[i]) << "]";
+            }
+            break;
+        case VIROp::BR:
+            os << " " << blockName(instruction.targets[0]);
+            break;
+        case VIROp::CONDBR:
+            os << " " << valueName(instruction.operands[0]) << ", " << blockName(instruction.targets[0]) << ", "
+               << blockName(instruction.targets[1]);
+            break;
+        default:
+            if (!instruction.operands.empty()) os << " ";
+            printOperands(0);
+            break;
+    }
+    os << "\n";
+}
+
+void printVIR(const VIRModule& module, std::ostream& os) {
+    for (const auto& vir_class : module.classes) {
+        os << (vir_class.builtin ? "builtin class " : "class ") << vir_class.name;
+        if (!vir_class.parent.empty()) os << " : " << vir_class.parent;
+        os << " {\n";
+        for (const auto& [name, type] : vir_class.fields) {
+            os << "  field " << name << " : " << type << "\n";
+        }
+        for (const auto& [method, function] : vir_class.vtable) {
+            os << "  method " << method << " -> " << function << "\n";
+        }
+        os << "}\n\n";
+    }
+    for (const auto& function : module.functions) {
+        os << "func " << function->name << "(";
+        for (size_t i = 0; i < function->params.size(); ++i) {
+            os << (i ? ", " : "") << valueName(function->params[i]) << " : " << function->params[i]->type;
+        }
+        os << ") : " << (function->generator ? "gen<" + function->return_type + ">" : function->return_type)
+           << " {\n";
+        for (const auto& block : function->blocks) {
+            os << blockName(block.get()) << ":";
+            if (!block->predecessors.empty()) {
+                os << "    ; preds:";
+                for (VIRBlock* pred : block->predecessors) os << " " << blockName(pred);
+            }
+            os << "\n";
+            for (const auto& instruction : block->instructions) {
+                if (instruction->op != VIROp::PARAM) printInstruction(*instruction, os);
+            }
+        }
+        os << "}\n\n";
+    }
+}
+
+// Verifier -------------------------------------------------------------------
+
+// Whether a value of type from can be used where a value of type to is
+// expected
+static bool typeConforms(const VIRModule& module, const std::string& from, const std::string& to) {
+    return from == to || module.conformsTo(from, to);
+}
+
+// Type of the values yielded through a handle of the given type ("" if it is
+// not a handle)
+static std::string getYieldedType(const std::string& handle_type) {
+    if (handle_type.rfind("gen<", 0) != 0 || handle_type.back() != '>') return "";
+    return handle_type.substr(4, handle_type.size() - 5);
+}
+
+// Immediate dominators of the blocks reachable from the entry (Cooper,
+// Harvey and Kennedy's iterative algorithm). The entry is its own dominator.
+static std::unordered_map<const VIRBlock*, const VIRBlock*> computeDominators(const VIRFunction& function) {
+    std::vector<const VIRBlock*> postorder;
+    std::unordered_set<const VIRBlock*> visited;
+    std::function<void(const VIRBlock*)> visit = [&](const VIRBlock* block) {
+        if (!visited.insert(block).second) return;
+        for (VIRBlock* succ : block->getSuccessors()) visit(succ);
+        postorder.push_back(block);
+    };
+    visit(function.blocks.front().get());
+    std::unordered_map<const VIRBlock*, size_t> order;
+    for (size_t i = 0; i < postorder.size(); ++i) order[postorder[i]] = i;
+
+    std::unordered_map<const VIRBlock*, const VIRBlock*> idom;
+    const VIRBlock* entry = function.blocks.front().get();
+    idom[entry] = entry;
+    auto intersect = [&](const VIRBlock* a, const VIRBlock* b) {
+        while (a != b) {
+            while (order[a] < order[b]) a = idom[a];
+            while (order[b] < order[a]) b = idom[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+            const VIRBlock* block = *it;
+            if (block == entry) continue;
+            const VIRBlock* new_idom = nullptr;
+            for (const VIRBlock* pred : block->predecessors) {
+                if (!idom.count(pred)) continue;
+                new_idom = new_idom ? intersect(pred, new_idom) : pred;
+            }
+            if (new_idom && idom[block] != new_idom) {
+                idom[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+static void verifyFunction(const VIRModule& module, const std::unordered_map<std::string, const VIRFunction*>& functions,
+                           const VIRFunction& function, std::vector<std::string>& errors) {
+    auto fail = [&](const VIRBlock* block, const VIRInstruction* instruction, const std::string& message) {
+        std::string where = function.name + ": " + blockName(block);
+        if (instruction) where += ": " + valueName(instruction);
+        errors.push_back(where + ": " + message);
+    };
+    if (function.blocks.empty()) {
+        errors.push_back(function.name + ": no entry block");
+        return;
+    }
+
+    // Where each value is defined
+    std::unordered_map<const VIRInstruction*, std::pair<const VIRBlock*, size_t>> definitions;
+    for (const auto& block : function.blocks) {
+        for (size_t i = 0; i < block->instructions.size(); ++i) {
+            definitions[block->instructions[i].get()] = {block.get(), i};
+        }
+    }
+    std::unordered_map<const VIRBlock*, const VIRBlock*> idom = computeDominators(function);
+    auto dominates = [&](const VIRBlock* a, const VIRBlock* b) {
+        if (!idom.count(b)) return true; // Unreachable uses do not matter
+        for (const VIRBlock* block = b;; block = idom[block]) {
+            if (block == a) return true;
+            if (block == idom[block]) return false;
+        }
+    };
+
+    for (const auto& block_ptr : function.blocks) {
+        const VIRBlock* block = block_ptr.get();
+
+        // Predecessors and successors must agree
+        for (const VIRBlock* succ : block->getSuccessors()) {
+            if (std::count(succ->predecessors.begin(), succ->predecessors.end(), block) != 1) {
+                fail(block, nullptr, "is not listed once among the predecessors of " + blockName(succ));
+            }
+        }
+        for (const VIRBlock* pred : block->predecessors) {
+            std::vector<VIRBlock*> succs = pred->getSuccessors();
+            if (std::find(succs.begin(), succs.end(), block) == succs.end()) {
+                fail(block, nullptr, "has predecessor " + blockName(pred) + ", which does not branch to it");
+            }
+        }
+        if (!block->getTerminator()) {
+            fail(block, nullptr, "does not end with a terminator");
+        }
+
+        bool phis_done = false;
+        for (size_t i = 0; i < block->instructions.size(); ++i) {
+            const VIRInstruction* instruction = block->instructions[i].get();
+            const std::string& type = instruction->type;
+            if (instruction->parent != block) fail(block, instruction, "has the wrong parent block");
+            if (instruction->isTerminator() && i + 1 != block->instructions.size()) {
+                fail(block, instruction, "terminator in the middle of the block");
+            }
+            if (instruction->op == VIROp::PHI && phis_done) fail(block, instruction, "phi after other instructions");
+            if (instruction->op != VIROp::PHI && instruction->op != VIROp::PARAM) phis_done = true;
+            if (instruction->op == VIROp::PARAM && block != function.blocks.front().get()) {
+                fail(block, instruction, "parameter outside of the entry block");
+            }
+
+            // Operands are defined, and their definitions dominate their uses
+            bool operands_defined = true;
+            for (size_t j = 0; j < instruction->operands.size(); ++j) {
+                const VIRInstruction* operand = instruction->operands[j];
+                auto def_it = definitions.find(operand);
+                if (!operand || def_it == definitions.end()) {
+                    fail(block, instruction, "operand " + std::to_string(j) + " is not defined in the function");
+                    operands_defined = false;
+                    continue;
+                }
+                const auto& [def_block, def_index] = def_it->second;
+                if (instruction->op == VIROp::PHI) {
+                    if (j < instruction->incoming.size() && !dominates(def_block, instruction->incoming[j])) {
+                        fail(block, instruction, valueName(operand) + " does not dominate the end of "
+                             + blockName(instruction->incoming[j]));
+                    }
+                } else if (def_block == block ? def_index >= i : !dominates(def_block, block)) {
+                    fail(block, instruction, valueName(operand) + " does not dominate its use");
+                }
+            }
+            if (!operands_defined) continue;
+
+            auto expectOperands = [&](size_t count) {
+                if (instruction->operands.size() == count) return true;
+                fail(block, instruction, std::string(getOpName(instruction->op)) + " expects "
+                     + std::to_string(count) + " operands");
+                return false;
+            };
+            auto expectType = [&](const VIRInstruction* value, const std::string& expected, const std::string& what) {
+                if (!typeConforms(module, value->type, expected)) {
+                    fail(block, instruction, what + " is " + value->type + ", expected " + expected);
+                }
+            };
+            auto expectObject = [&](const VIRInstruction* value, const std::string& what) {
+                if (!module.findClass(value->type)) fail(block, instruction, what + " is not an object");
+            };
+            // Arguments of a call to the given function, if the module has it
+            auto checkArguments = [&](const std::string& function_name, size_t first) {
+                auto callee_it = functions.find(function_name);
+                if (callee_it == functions.end()) return;
+                const VIRFunction* callee = callee_it->second;
+                if (callee->params.size() != instruction->operands.size() - first + 1) {
+                    fail(block, instruction, "wrong number of arguments for " + function_name);
+                    return;
+                }
+                for (size_t j = 1; j < callee->params.size(); ++j) {
+                    expectType(instruction->operands[first + j - 1], callee->params[j]->type,
+                               "argument " + std::to_string(j));
+                }
+                std::string result = callee->generator ? "gen<" + callee->return_type + ">" : callee->return_type;
+                expectType(instruction, result, "result");
+            };
+
+            switch (instruction->op) {
+                case VIROp::PARAM:
+                case VIROp::CONST_NULL:
+                    break;
+                case VIROp::CONST_INT:
+                    if (type != "int32") fail(block, instruction, "int32 constant of type " + type);
+                    break;
+                case VIROp::CONST_BOOL:
+                    if (type != "bool") fail(block, instruction, "bool constant of type " + type);
+                    break;
+                case VIROp::CONST_STRING:
+                    if (type != "string") fail(block, instruction, "string constant of type " + type);
+                    break;
+                case VIROp::CONST_UNIT:
+                    if (type != "unit") fail(block, instruction, "unit constant of type " + type);
+                    break;
+                case VIROp::ADD: case VIROp::SUB: case VIROp::MUL: case VIROp::DIV: case VIROp::POW:
+                case VIROp::LT: case VIROp::LE:
+                    if (!expectOperands(2)) break;
+                    expectType(instruction->operands[0], "int32", "left operand");
+                    expectType(instruction->operands[1], "int32", "right operand");
+                    expectType(instruction, instruction->op == VIROp::LT || instruction->op == VIROp::LE
+                               ? "bool" : "int32", "result");
+                    break;
+                case VIROp::AND:
+                    if (!expectOperands(2)) break;
+                    expectType(instruction->operands[0], "bool", "left operand");
+                    expectType(instruction->operands[1], "bool", "right operand");
+                    expectType(instruction, "bool", "result");
+                    break;
+                case VIROp::EQ:
+                    if (!expectOperands(2)) break;
+                    expectType(instruction, "bool", "result");
+                    break;
+                case VIROp::NEG:
+                    if (!expectOperands(1)) break;
+                    expectType(instruction->operands[0], "int32", "operand");
+                    expectType(instruction, "int32", "result");
+                    break;
+                case VIROp::NOT:
+                    if (!expectOperands(1)) break;
+                    expectType(instruction->operands[0], "bool", "operand");
+                    expectType(instruction, "bool", "result");
+                    break;
+                case VIROp::ISNULL:
+                    if (!expectOperands(1)) break;
+                    expectObject(instruction->operands[0], "operand");
+                    expectType(instruction, "bool", "result");
+                    break;
+                case VIROp::NEW:
+                    if (!module.findClass(instruction->class_name)) {
+                        fail(block, instruction, "unknown class " + instruction->class_name);
+                    }
+                    expectType(instruction, instruction->class_name, "result");
+                    break;
+                case VIROp::GETFIELD:
+                case VIROp::SETFIELD: {
+                    if (!expectOperands(instruction->op == VIROp::GETFIELD ? 1 : 2)) break;
+                    expectType(instruction->operands[0], instruction->class_name, "object");
+                    std::string field_type = module.findFieldType(instruction->class_name, instruction->name);
+                    if (field_type.empty()) {
+                        fail(block, instruction, "unknown field " + instruction->class_name + "." + instruction->name);
+                    } else if (instruction->op == VIROp::GETFIELD) {
+                        expectType(instruction, field_type, "result");
+                    } else {
+                        expectType(instruction->operands[1], field_type, "value");
+                    }
+                    break;
+                }
+                case VIROp::VCALL: {
+                    if (instruction->operands.empty()) {
+                        fail(block, instruction, "call without receiver");
+                        break;
+                    }
+                    expectType(instruction->operands[0], instruction->class_name, "receiver");
+                    const VIRClass* vir_class = module.findClass(instruction->class_name);
+                    if (!vir_class || !vir_class->vtable.count(instruction->name)) {
+                        fail(block, instruction, "unknown method " + instruction->class_name + "." + instruction->name);
+                        break;
+                    }
+                    checkArguments(vir_class->vtable.at(instruction->name), 1);
+                    break;
+                }
+                case VIROp::SCALL:
+                    if (instruction->operands.empty()) {
+                        fail(block, instruction, "call without receiver");
+                        break;
+                    }
+                    if (instruction->name.rfind("String__", 0) == 0) {
+                        expectType(instruction->operands[0], "string", "receiver");
+                    } else {
+                        expectObject(instruction->operands[0], "receiver");
+                    }
+                    checkArguments(instruction->name, 1);
+                    break;
+                case VIROp::RESUME:
+                case VIROp::CURRENT:
+                case VIROp::DESTROY: {
+                    if (!expectOperands(1)) break;
+                    std::string yielded = getYieldedType(instruction->operands[0]->type);
+                    if (yielded.empty()) {
+                        fail(block, instruction, "operand is not a generator handle");
+                    } else if (instruction->op == VIROp::CURRENT) {
+                        expectType(instruction, yielded, "result");
+                    }
+                    break;
+                }
+                case VIROp::YIELD:
+                    if (!expectOperands(1)) break;
+                    if (!function.generator) fail(block, instruction, "yield outside of a generator");
+                    else expectType(instruction->operands[0], function.return_type, "yielded value");
+                    break;
+                case VIROp::PHI:
+                    if (instruction->incoming.size() != instruction->operands.size()
+                        || instruction->incoming.size() != block->predecessors.size()) {
+                        fail(block, instruction, "phi does not have one operand per predecessor");
+                        break;
+                    }
+                    for (size_t j = 0; j < instruction->operands.size(); ++j) {
+                        if (std::find(block->predecessors.begin(), block->predecessors.end(), instruction->incoming[j])
+                            == block->predecessors.end()) {
+                            fail(block, instruction, blockName(instruction->incoming[j]) + " is not a predecessor");
+                        }
+                        expectType(instruction->operands[j], type, "incoming value");
+                    }
+                    break;
+                case VIROp::BR:
+                    if (instruction->targets.size() != 1) fail(block, instruction, "br expects 1 target");
+                    break;
+                case VIROp::CONDBR:
+                    if (!expectOperands(1)) break;
+                    expectType(instruction->operands[0], "bool", "condition");
+                    if (instruction->targets.size() != 2) fail(block, instruction, "condbr expects 2 targets");
+                    break;
+                case VIROp::RET:
+                    if (!expectOperands(1)) break;
+                    expectType(instruction->operands[0], function.generator ? "unit" : function.return_type,
+                               "returned value");
+                    break;
+            }
+        }
+    }
+}
+
+std::vector<std::string> verifyVIR(const VIRModule& module) {
+    std::vector<std::string> errors;
+    std::unordered_map<std::string, const VIRFunction*> functions;
+    for (const auto& function : module.functions) {
+        functions[function->name] = function.get();
+    }
+    for (const auto& function : module.functions) {
+        verifyFunction(module, functions, *function, errors);
+    }
+    return errors;
+}
+
+// Passes ---------------------------------------------------------------------
+
+bool VIRPassManager::run(VIRModule& module) {
+    errors.clear();
+    for (const auto& pass : passes) {
+        if (!pass->run(module)) continue;
+        for (const auto& error : verifyVIR(module)) {
+            errors.push_back(std::string("after ") + pass->getName() + ": " + error);
+        }
+        if (!errors.empty()) return false;
+    }
+    return true;
+}
+
+VIRPassManager VIRPassManager::createDefault() {
+    VIRPassManager pass_manager;
+    pass_manager.add(std::make_unique<VIRDevirtualize>());
+    pass_manager.add(std::make_unique<VIRNullCheckElimination>());
+    pass_manager.add(std::make_unique<VIRDeadCodeElimination>());
+    return pass_manager;
+}
+
+bool VIRDevirtualize::run(VIRModule& module) {
+    // (Static type, method) -> the implementation of every class conforming
+    // to the type, or "" if they differ
+    std::map<std::pair<std::string, std::string>, std::string> unique_implementations;
+    auto findUniqueImplementation = [&](const std::string& class_name, const std::string& method_name) {
+        auto unique_it = unique_implementations.find({class_name, method_name});
+        if (unique_it != unique_implementations.end()) return unique_it->second;
+        std::string implementation;
+        for (const auto& vir_class : module.classes) {
+            if (!module.conformsTo(vir_class.name, class_name)) continue;
+            const std::string& class_impl = vir_class.vtable.at(method_name);
+            if (!implementation.empty() && class_impl != implementation) {
+                implementation.clear();
+                break;
+            }
+            implementation = class_impl;
+        }
+        return unique_implementations[{class_name, method_name}] = implementation;
+    };
+
+    bool changed = false;
+    for (const auto& function : module.functions) {
+        for (const auto& block : function->blocks) {
+            for (const auto& instruction : block->instructions) {
+                if (instruction->op != VIROp::VCALL) continue;
+
+                // The receiver's class is known exactly if it was just
+                // created. Otherwise, every class conforming to the static
+                // type must use the same implementation (a library's classes
+                // may have subclasses elsewhere).
+                std::string implementation;
+                const VIRInstruction* receiver = instruction->operands[0];
+                if (receiver->op == VIROp::NEW) {
+                    implementation = module.findClass(receiver->class_name)->vtable.at(instruction->name);
+                } else if (!module.library) {
+                    implementation = findUniqueImplementation(instruction->class_name, instruction->name);
+                }
+                if (implementation.empty()) continue;
+
+                instruction->op = VIROp::SCALL;
+                instruction->name = implementation;
+                instruction->class_name.clear();
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+bool VIRNullCheckElimination::run(VIRModule& module) {
+    bool changed = false;
+    for (const auto& function : module.functions) {
+        for (const auto& block : function->blocks) {
+            for (const auto& instruction : block->instructions) {
+                if (instruction->op != VIROp::ISNULL) continue;
+                const VIRInstruction* operand = instruction->operands[0];
+                bool is_self = !function->params.empty() && operand == function->params[0];
+                if (operand->op != VIROp::NEW && !is_self) continue;
+
+                instruction->op = VIROp::CONST_BOOL;
+                instruction->int_value = 0;
+                instruction->operands.clear();
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// Whether removing the given instruction cannot change what the program does
+// (division may trap, calls and field writes have effects)
+static bool hasNoEffect(const VIRInstruction* instruction) {
+    switch (instruction->op) {
+        case VIROp::CONST_INT: case VIROp::CONST_BOOL: case VIROp::CONST_STRING: case VIROp::CONST_UNIT:
+        case VIROp::CONST_NULL: case VIROp::ADD: case VIROp::SUB: case VIROp::MUL: case VIROp::POW:
+        case VIROp::NEG: case VIROp::NOT: case VIROp::EQ: case VIROp::LT: case VIROp::LE: case VIROp::AND:
+        case VIROp::ISNULL: case VIROp::CURRENT: case VIROp::PHI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool VIRDeadCodeElimination::run(VIRModule& module) {
+    bool changed = false;
+    for (const auto& function : module.functions) {
+        for (bool removed = true; removed;) {
+            removed = false;
+            std::unordered_map<const VIRInstruction*, size_t> uses;
+            for (const auto& block : function->blocks) {
+                for (const auto& instruction : block->instructions) {
+                    for (const VIRInstruction* operand : instruction->operands) ++uses[operand];
+                }
+            }
+            for (const auto& block : function->blocks) {
+                auto& instructions = block->instructions;
+                auto end = std::remove_if(instructions.begin(), instructions.end(), [&](const auto& instruction) {
+                    return hasNoEffect(instruction.get()) && !uses.count(instruction.get());
+                });
+                removed |= end != instructions.end();
+                instructions.erase(end, instructions.end());
+            }
+            changed |= removed;
+        }
+    }
+    return changed;
+}
+
+} // namespace VSOP
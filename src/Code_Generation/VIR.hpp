@@ -0,0 +1,215 @@
+#ifndef VIR_HPP
+#define VIR_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace VSOP {
+
+// VIR: typed SSA intermediate representation between the typed AST and LLVM
+// IR (see VIRGenerator). Unlike LLVM IR, it keeps VSOP's operations and types
+// explicit: values have VSOP types (int32, bool, string, unit, class names,
+// and gen<T> for generator handles), and method calls, object creation and
+// field accesses are single instructions, so that VSOP-level optimizations
+// (devirtualization, escape analysis, null-check elimination) can be written
+// against class information.
+//
+// Local variables are SSA values (with phis at control flow joins). Fields
+// are memory, read and written with getfield and setfield. A function is a
+// method (Class__method) or an initializer (Class___init, which sets the
+// fields of an allocated object, like the generated ___init).
+
+struct VIRBlock;
+
+// Operation of an instruction
+enum class VIROp {
+    // Parameter of the function (self is parameter 0)
+    PARAM,
+
+    // Constants: int32, bool, string and unit literals, and null of a class
+    CONST_INT,
+    CONST_BOOL,
+    CONST_STRING,
+    CONST_UNIT,
+    CONST_NULL,
+
+    // Arithmetic (int32, wrapping) and comparisons
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    POW,
+    NEG,
+    NOT,
+    EQ,     // Any type: strings and objects are compared by address
+    LT,
+    LE,
+    AND,    // Both operands are evaluated
+
+    // Objects
+    NEW,        // Allocate an object of class_name and run its initializers
+    GETFIELD,   // Field name of class_name in operand 0
+    SETFIELD,   // Field name of class_name in operand 0 <- operand 1
+    ISNULL,
+    VCALL,      // Method name of class_name, dispatched on operand 0
+    SCALL,      // Function name, called directly (operand 0 is self, or the
+                // string of a String__ method)
+
+    // Generators: a call of a generator method returns a handle, that the
+    // for loop resumes until it is done
+    RESUME,     // Resume handle operand 0, returns whether it is done
+    CURRENT,    // Value last yielded by handle operand 0
+    DESTROY,    // Free handle operand 0
+    YIELD,      // Hand out operand 0 and suspend
+
+    PHI,        // Operand i comes from incoming[i]
+
+    // Terminators
+    BR,         // To targets[0]
+    CONDBR,     // To targets[0] if operand 0, else targets[1]
+    RET         // Return operand 0
+};
+
+// Instruction, which is also the value it defines (of type unit if it
+// defines none)
+struct VIRInstruction {
+    VIROp op;
+    std::string type;
+    int id = -1;
+    VIRBlock* parent = nullptr;
+
+    std::vector<VIRInstruction*> operands;
+    std::vector<VIRBlock*> incoming;    // PHI: block each operand comes from
+    std::vector<VIRBlock*> targets;     // BR, CONDBR
+
+    // Constant value (CONST_INT, CONST_BOOL) or parameter index (PARAM)
+    int32_t int_value = 0;
+    // CONST_STRING: the string; GETFIELD, SETFIELD: the field; VCALL: the
+    // method; SCALL: the function
+    std::string name;
+    // NEW, GETFIELD, SETFIELD, VCALL: the class
+    std::string class_name;
+
+    VIRInstruction(VIROp op, const std::string& type) : op(op), type(type) {}
+
+    bool isTerminator() const { return op == VIROp::BR || op == VIROp::CONDBR || op == VIROp::RET; }
+};
+
+// Basic block: phis first, then ordinary instructions, then one terminator
+struct VIRBlock {
+    int id = -1;
+    std::vector<std::unique_ptr<VIRInstruction>> instructions;
+    std::vector<VIRBlock*> predecessors;
+
+    VIRInstruction* getTerminator() const;
+    std::vector<VIRBlock*> getSuccessors() const;
+};
+
+// Method or initializer. The first block is the entry.
+struct VIRFunction {
+    std::string name;
+    std::string class_name;
+    std::vector<VIRInstruction*> params;    // self first (PARAM instructions of the entry block)
+    std::string return_type;
+    bool generator = false;                 // return_type is then the type of the yielded values
+    std::vector<std::unique_ptr<VIRBlock>> blocks;
+    int next_id = 0;
+
+    VIRBlock* createBlock();
+
+    // Replace every use of a value by another one
+    void replaceAllUses(VIRInstruction* from, VIRInstruction* to);
+};
+
+// Class of the program or built-in class
+struct VIRClass {
+    std::string name;
+    std::string parent;     // "" for Object
+    bool builtin = false;   // Implemented by the runtime
+    std::vector<std::pair<std::string, std::string>> fields;   // Own fields (name, type), in order
+    std::map<std::string, std::string> vtable;                 // Method -> implementing function
+};
+
+struct VIRModule {
+    // A library's classes may be extended by the programs using it
+    bool library = false;
+    std::vector<VIRClass> classes;  // Parents before children (see addClass())
+    std::vector<std::unique_ptr<VIRFunction>> functions;
+
+    void addClass(const VIRClass& vir_class);
+    const VIRClass* findClass(const std::string& name) const;
+    // Whether class_name is ancestor_name or one of its subclasses
+    bool conformsTo(const std::string& class_name, const std::string& ancestor_name) const;
+    // Type of the given field of objects of the given class ("" if none)
+    std::string findFieldType(const std::string& class_name, const std::string& field_name) const;
+
+private:
+    std::unordered_map<std::string, size_t> class_indices;
+};
+
+// Write the module in its textual form (vsopc --emit-vir)
+void printVIR(const VIRModule& module, std::ostream& os);
+
+// Check the module: blocks end with a terminator, phis match predecessors,
+// every use is dominated by its definition, and operand types are correct.
+// Returns the problems found.
+std::vector<std::string> verifyVIR(const VIRModule& module);
+
+// Transformation of a module
+class VIRPass {
+public:
+    virtual ~VIRPass() = default;
+    virtual const char* getName() const = 0;
+    // Returns whether the module changed
+    virtual bool run(VIRModule& module) = 0;
+};
+
+// Run passes in order, verifying the module after each one that changed it
+class VIRPassManager {
+public:
+    void add(std::unique_ptr<VIRPass> pass) { passes.push_back(std::move(pass)); }
+
+    // Returns false if a pass left the module invalid (see getErrors())
+    bool run(VIRModule& module);
+
+    const std::vector<std::string>& getErrors() const { return errors; }
+
+    // The default pipeline: devirtualization, null-check elimination, then
+    // dead code elimination
+    static VIRPassManager createDefault();
+
+private:
+    std::vector<std::unique_ptr<VIRPass>> passes;
+    std::vector<std::string> errors;
+};
+
+// Calls whose receiver's class is known (created by new) or that no subclass
+// of its static type overrides become direct calls
+class VIRDevirtualize : public VIRPass {
+public:
+    const char* getName() const override { return "devirtualize"; }
+    bool run(VIRModule& module) override;
+};
+
+// isnull of self or of a new object is false
+class VIRNullCheckElimination : public VIRPass {
+public:
+    const char* getName() const override { return "null-check-elimination"; }
+    bool run(VIRModule& module) override;
+};
+
+// Remove unused instructions that have no effect
+class VIRDeadCodeElimination : public VIRPass {
+public:
+    const char* getName() const override { return "dead-code-elimination"; }
+    bool run(VIRModule& module) override;
+};
+
+} // namespace VSOP
+
+#endif // VIR_HPP
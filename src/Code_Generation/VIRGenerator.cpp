@@ -0,0 +1,533 @@
+#include "VIRGenerator.hpp"
+#include <algorithm>
+
+namespace VSOP {
+
+std::unique_ptr<VIRModule> VIRGenerator::generate(std::shared_ptr<Program> program) {
+    if (!program) {
+        errors.push_back("No program to lower");
+        return nullptr;
+    }
+    if (!analyzer.analyze(program)) {
+        errors = analyzer.getErrors();
+        return nullptr;
+    }
+
+    auto vir_module = std::make_unique<VIRModule>();
+    vir_module->library = program->library;
+    module = vir_module.get();
+    for (const auto& vsop_class : program->classes) {
+        if (vsop_class) class_nodes[vsop_class->name] = vsop_class.get();
+    }
+    generateClasses();
+
+    // Imported classes are compiled in their library
+    for (const auto& vsop_class : program->classes) {
+        if (!vsop_class || vsop_class->imported) continue;
+        generateInitializer(*vsop_class);
+        for (const auto& method : vsop_class->methods) {
+            if (method && method->body) generateMethod(*vsop_class, *method);
+        }
+    }
+    module = nullptr;
+    return errors.empty() ? std::move(vir_module) : nullptr;
+}
+
+// Classes, parents first, with their own fields and their vtables (built-in
+// classes have no visible fields, and their methods are the runtime's)
+void VIRGenerator::generateClasses() {
+    const auto& class_defs = analyzer.getClassDefinitions();
+    for (const auto& class_name : analyzer.getClassOrder()) {
+        const ClassDef& class_def = class_defs.at(class_name);
+        VIRClass vir_class;
+        vir_class.name = class_name;
+        vir_class.parent = class_name == "Object" ? "" : class_def.parent.empty() ? "Object" : class_def.parent;
+        vir_class.builtin = analyzer.isBuiltinClass(class_name);
+        if (const VIRClass* parent = module->findClass(vir_class.parent)) {
+            vir_class.vtable = parent->vtable;
+        }
+
+        auto node_it = class_nodes.find(class_name);
+        if (vir_class.builtin || node_it == class_nodes.end()) {
+            for (const auto& method : class_def.methods) {
+                vir_class.vtable[method.first] = class_name + "__" + method.first;
+            }
+        } else {
+            // Declaration order (the ClassDef only keeps the valid ones)
+            for (const auto& field : node_it->second->fields) {
+                if (field && class_def.fields.count(field->name)) {
+                    vir_class.fields.push_back({field->name, field->type});
+                }
+            }
+            for (const auto& method : node_it->second->methods) {
+                if (method && class_def.methods.count(method->name)) {
+                    vir_class.vtable[method->name] = class_name + "__" + method->name;
+                }
+            }
+        }
+        module->addClass(vir_class);
+    }
+}
+
+// Class___init: the parent's initializer, then the fields in order
+void VIRGenerator::generateInitializer(const Class& vsop_class) {
+    beginFunction(vsop_class.name + "___init", vsop_class.name, "unit");
+    VIRInstruction* self = function->params[0];
+
+    const VIRClass* vir_class = module->findClass(vsop_class.name);
+    const VIRClass* parent = module->findClass(vir_class->parent);
+    if (parent && !parent->builtin) {
+        VIRInstruction* init = emit(VIROp::SCALL, "unit", {self});
+        init->name = parent->name + "___init";
+    }
+    for (const auto& [field_name, field_type] : vir_class->fields) {
+        const Field* field = nullptr;
+        for (const auto& candidate : vsop_class.fields) {
+            if (candidate && candidate->name == field_name) field = candidate.get();
+        }
+        VIRInstruction* value = field && field->init_expr ? generateExpression(field->init_expr.get())
+                                                          : emitConstant(field_type);
+        VIRInstruction* set = emit(VIROp::SETFIELD, "unit", {self, value});
+        set->class_name = vsop_class.name;
+        set->name = field_name;
+    }
+    endFunction(emitConstant("unit"));
+}
+
+void VIRGenerator::generateMethod(const Class& vsop_class, const Method& method) {
+    beginFunction(vsop_class.name + "__" + method.name, vsop_class.name, method.return_type);
+    function->generator = method.generator;
+    for (const auto& formal : method.formals) {
+        if (!formal) continue;
+        VIRInstruction* param = emit(VIROp::PARAM, formal->type);
+        param->int_value = function->params.size();
+        function->params.push_back(param);
+        declareVariable(formal->name, formal->type, param);
+    }
+
+    VIRInstruction* result = generateExpression(method.body.get());
+    // A unit method discards the value of its body, and a generator returns
+    // once it has yielded all its values
+    if (method.generator || method.return_type == "unit") {
+        result = emitConstant("unit");
+    }
+    endFunction(result);
+}
+
+void VIRGenerator::beginFunction(const std::string& name, const std::string& class_name,
+                                 const std::string& return_type) {
+    module->functions.push_back(std::make_unique<VIRFunction>());
+    function = module->functions.back().get();
+    function->name = name;
+    function->class_name = class_name;
+    function->return_type = return_type;
+    current_class = class_name;
+
+    scopes.assign(1, {});
+    variable_types.clear();
+    current_defs.clear();
+    incomplete_phis.clear();
+    sealed_blocks.clear();
+
+    block = function->createBlock();
+    sealBlock(block);
+    function->params.push_back(emit(VIROp::PARAM, class_name));
+}
+
+// Return the given value, then number the blocks and values in order
+void VIRGenerator::endFunction(VIRInstruction* result) {
+    emit(VIROp::RET, "unit", {result});
+
+    int next_id = 0;
+    for (size_t i = 0; i < function->blocks.size(); ++i) {
+        function->blocks[i]->id = i;
+        for (const auto& instruction : function->blocks[i]->instructions) {
+            instruction->id = instruction->isTerminator() ? -1 : next_id++;
+        }
+    }
+    function->next_id = next_id;
+    function = nullptr;
+    block = nullptr;
+    removed_phis.clear();
+}
+
+// Instructions and blocks ----------------------------------------------------
+
+VIRInstruction* VIRGenerator::emit(VIROp op, const std::string& type, std::vector<VIRInstruction*> operands) {
+    auto instruction = std::make_unique<VIRInstruction>(op, type);
+    instruction->id = function->next_id++;
+    instruction->parent = block;
+    instruction->operands = std::move(operands);
+    block->instructions.push_back(std::move(instruction));
+    return block->instructions.back().get();
+}
+
+// The default value of the given type (null for objects)
+VIRInstruction* VIRGenerator::emitConstant(const std::string& type) {
+    if (type == "int32") return emit(VIROp::CONST_INT, type);
+    if (type == "bool") return emit(VIROp::CONST_BOOL, type);
+    if (type == "string") return emit(VIROp::CONST_STRING, type);
+    if (type == "unit") return emit(VIROp::CONST_UNIT, type);
+    return emit(VIROp::CONST_NULL, type);
+}
+
+void VIRGenerator::emitBranch(VIRBlock* target) {
+    emit(VIROp::BR, "unit")->targets = {target};
+    target->predecessors.push_back(block);
+}
+
+void VIRGenerator::emitCondBranch(VIRInstruction* condition, VIRBlock* then_block, VIRBlock* else_block) {
+    emit(VIROp::CONDBR, "unit", {condition})->targets = {then_block, else_block};
+    then_block->predecessors.push_back(block);
+    else_block->predecessors.push_back(block);
+}
+
+// Continue in the given block, placed after the ones lowered so far (blocks
+// are created before the code branching to them, so that nested blocks would
+// otherwise come first)
+void VIRGenerator::startBlock(VIRBlock* next_block) {
+    auto& blocks = function->blocks;
+    auto it = std::find_if(blocks.begin(), blocks.end(), [&](const auto& b) { return b.get() == next_block; });
+    std::rotate(it, it + 1, blocks.end());
+    block = next_block;
+}
+
+// An empty phi at the start of the given block
+VIRInstruction* VIRGenerator::createPhi(VIRBlock* phi_block, const std::string& type) {
+    auto phi = std::make_unique<VIRInstruction>(VIROp::PHI, type);
+    phi->id = function->next_id++;
+    phi->parent = phi_block;
+    auto& instructions = phi_block->instructions;
+    auto position = std::find_if(instructions.begin(), instructions.end(), [](const auto& instruction) {
+        return instruction->op != VIROp::PARAM && instruction->op != VIROp::PHI;
+    });
+    return instructions.insert(position, std::move(phi))->get();
+}
+
+// SSA construction -----------------------------------------------------------
+
+int VIRGenerator::declareVariable(const std::string& name, const std::string& type, VIRInstruction* value) {
+    int variable = variable_types.size();
+    variable_types.push_back(type);
+    scopes.back()[name] = variable;
+    writeVariable(variable, block, value);
+    return variable;
+}
+
+// The innermost local variable with the given name, or -1 (a field)
+int VIRGenerator::findVariable(const std::string& name) const {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+        auto variable_it = scope->find(name);
+        if (variable_it != scope->end()) return variable_it->second;
+    }
+    return -1;
+}
+
+void VIRGenerator::writeVariable(int variable, VIRBlock* def_block, VIRInstruction* value) {
+    current_defs[def_block][variable] = value;
+}
+
+VIRInstruction* VIRGenerator::readVariable(int variable, VIRBlock* use_block) {
+    auto def_it = current_defs[use_block].find(variable);
+    if (def_it != current_defs[use_block].end()) return def_it->second;
+
+    VIRInstruction* value;
+    if (!sealed_blocks.count(use_block)) {
+        // More predecessors may come: their operands are added when sealed
+        value = createPhi(use_block, variable_types[variable]);
+        incomplete_phis[use_block][variable] = value;
+    } else if (use_block->predecessors.size() == 1) {
+        value = readVariable(variable, use_block->predecessors[0]);
+    } else {
+        // The phi breaks cycles through loops
+        VIRInstruction* phi = createPhi(use_block, variable_types[variable]);
+        writeVariable(variable, use_block, phi);
+        value = addPhiOperands(variable, phi);
+    }
+    writeVariable(variable, use_block, value);
+    return value;
+}
+
+VIRInstruction* VIRGenerator::addPhiOperands(int variable, VIRInstruction* phi) {
+    for (VIRBlock* pred : phi->parent->predecessors) {
+        phi->operands.push_back(readVariable(variable, pred));
+        phi->incoming.push_back(pred);
+    }
+    return removeTrivialPhi(phi);
+}
+
+// Replace a phi merging a single value (besides itself) by that value, then
+// retry the phis using it. Returns the value replacing it, or the phi.
+VIRInstruction* VIRGenerator::removeTrivialPhi(VIRInstruction* phi) {
+    VIRInstruction* same = nullptr;
+    for (VIRInstruction* operand : phi->operands) {
+        if (operand == same || operand == phi) continue;
+        if (same) return phi;
+        same = operand;
+    }
+    if (!same) return phi; // Only reachable from itself
+
+    std::vector<VIRInstruction*> users;
+    for (const auto& user_block : function->blocks) {
+        for (const auto& user : user_block->instructions) {
+            if (user->op == VIROp::PHI && user.get() != phi
+                && std::count(user->operands.begin(), user->operands.end(), phi)) {
+                users.push_back(user.get());
+            }
+        }
+    }
+    function->replaceAllUses(phi, same);
+    for (auto& [def_block, defs] : current_defs) {
+        for (auto& [variable, value] : defs) {
+            if (value == phi) value = same;
+        }
+    }
+
+    // Removed phis are kept until the end of the function, as the users
+    // retried below may be among them
+    auto& instructions = phi->parent->instructions;
+    auto it = std::find_if(instructions.begin(), instructions.end(), [&](const auto& i) { return i.get() == phi; });
+    removed_phis.push_back(std::move(*it));
+    instructions.erase(it);
+    phi->parent = nullptr;
+
+    for (VIRInstruction* user : users) {
+        if (user->parent) removeTrivialPhi(user);
+    }
+    return same;
+}
+
+void VIRGenerator::sealBlock(VIRBlock* sealed_block) {
+    auto phis = incomplete_phis[sealed_block];
+    incomplete_phis.erase(sealed_block);
+    for (const auto& [variable, phi] : phis) {
+        addPhiOperands(variable, phi);
+    }
+    sealed_blocks.insert(sealed_block);
+}
+
+// Expressions ----------------------------------------------------------------
+
+VIRInstruction* VIRGenerator::generateExpression(const Expression* expr) {
+    if (!expr) {
+        return emitConstant("unit");
+    }
+    if (const IntegerLiteral* literal = dynamic_cast<const IntegerLiteral*>(expr)) {
+        VIRInstruction* constant = emit(VIROp::CONST_INT, "int32");
+        constant->int_value = literal->value;
+        return constant;
+    }
+    if (const BooleanLiteral* literal = dynamic_cast<const BooleanLiteral*>(expr)) {
+        VIRInstruction* constant = emit(VIROp::CONST_BOOL, "bool");
+        constant->int_value = literal->value;
+        return constant;
+    }
+    if (const StringLiteral* literal = dynamic_cast<const StringLiteral*>(expr)) {
+        VIRInstruction* constant = emit(VIROp::CONST_STRING, "string");
+        constant->name = literal->value;
+        return constant;
+    }
+    if (dynamic_cast<const UnitLiteral*>(expr)) {
+        return emitConstant("unit");
+    }
+    if (dynamic_cast<const Self*>(expr)) {
+        return function->params[0];
+    }
+    if (const Identifier* id = dynamic_cast<const Identifier*>(expr)) {
+        int variable = findVariable(id->name);
+        if (variable >= 0) return readVariable(variable, block);
+        VIRInstruction* get = emit(VIROp::GETFIELD, module->findFieldType(current_class, id->name),
+                                   {function->params[0]});
+        get->class_name = current_class;
+        get->name = id->name;
+        return get;
+    }
+    if (const Assign* assign = dynamic_cast<const Assign*>(expr)) {
+        VIRInstruction* value = generateExpression(assign->expr.get());
+        int variable = findVariable(assign->name);
+        if (variable >= 0) {
+            writeVariable(variable, block, value);
+        } else {
+            VIRInstruction* set = emit(VIROp::SETFIELD, "unit", {function->params[0], value});
+            set->class_name = current_class;
+            set->name = assign->name;
+        }
+        return value;
+    }
+    if (const UnaryOp* unop = dynamic_cast<const UnaryOp*>(expr)) {
+        VIRInstruction* operand = generateExpression(unop->expr.get());
+        if (unop->op == "-") return emit(VIROp::NEG, "int32", {operand});
+        if (unop->op == "not") return emit(VIROp::NOT, "bool", {operand});
+        return emit(VIROp::ISNULL, "bool", {operand});
+    }
+    if (const BinaryOp* binop = dynamic_cast<const BinaryOp*>(expr)) {
+        static const std::unordered_map<std::string, std::pair<VIROp, const char*>> binary_ops = {
+            {"+", {VIROp::ADD, "int32"}}, {"-", {VIROp::SUB, "int32"}}, {"*", {VIROp::MUL, "int32"}},
+            {"/", {VIROp::DIV, "int32"}}, {"^", {VIROp::POW, "int32"}}, {"=", {VIROp::EQ, "bool"}},
+            {"<", {VIROp::LT, "bool"}}, {"<=", {VIROp::LE, "bool"}}, {"and", {VIROp::AND, "bool"}}
+        };
+        VIRInstruction* left = generateExpression(binop->left.get());
+        VIRInstruction* right = generateExpression(binop->right.get());
+        const auto& [op, type] = binary_ops.at(binop->op);
+        return emit(op, type, {left, right});
+    }
+    if (const Call* call = dynamic_cast<const Call*>(expr)) {
+        return generateCall(call);
+    }
+    if (const New* new_expr = dynamic_cast<const New*>(expr)) {
+        VIRInstruction* object = emit(VIROp::NEW, new_expr->type_name);
+        object->class_name = new_expr->type_name;
+        return object;
+    }
+    if (const Let* let = dynamic_cast<const Let*>(expr)) {
+        return generateLet(let);
+    }
+    if (const If* if_expr = dynamic_cast<const If*>(expr)) {
+        return generateIf(if_expr);
+    }
+    if (const While* while_expr = dynamic_cast<const While*>(expr)) {
+        return generateWhile(while_expr);
+    }
+    if (const For* for_expr = dynamic_cast<const For*>(expr)) {
+        return generateFor(for_expr);
+    }
+    if (const Yield* yield = dynamic_cast<const Yield*>(expr)) {
+        return emit(VIROp::YIELD, "unit", {generateExpression(yield->expr.get())});
+    }
+    if (const Block* block_expr = dynamic_cast<const Block*>(expr)) {
+        VIRInstruction* value = nullptr;
+        for (const auto& sub_expr : block_expr->expressions) {
+            value = generateExpression(sub_expr.get());
+        }
+        return value ? value : emitConstant("unit");
+    }
+    errors.push_back("Unknown expression");
+    return emitConstant("unit");
+}
+
+// The receiver first (self if implicit), then the arguments. A generator
+// call returns a handle for the enclosing for loop.
+VIRInstruction* VIRGenerator::generateCall(const Call* call) {
+    VIRInstruction* object = call->object ? generateExpression(call->object.get()) : function->params[0];
+    std::vector<VIRInstruction*> operands = {object};
+    for (const auto& arg : call->arguments) {
+        operands.push_back(generateExpression(arg.get()));
+    }
+
+    std::optional<MethodSignature> method_sig = analyzer.findMethodSignature(object->type, call->method_name);
+    if (!method_sig.has_value()) {
+        errors.push_back("Method not found: " + call->method_name + " in class " + object->type);
+        return emitConstant("unit");
+    }
+    std::string type = method_sig->returnType.toString();
+    if (object->type == "string") {
+        // Runtime function taking the string first (string_methods.h)
+        VIRInstruction* result = emit(VIROp::SCALL, type, operands);
+        result->name = "String__" + call->method_name;
+        return result;
+    }
+    VIRInstruction* result = emit(VIROp::VCALL, method_sig->generator ? "gen<" + type + ">" : type, operands);
+    result->class_name = object->type;
+    result->name = call->method_name;
+    return result;
+}
+
+// Both branches jump to a common block, where a phi merges their values (of
+// their common ancestor type)
+VIRInstruction* VIRGenerator::generateIf(const If* if_expr) {
+    VIRInstruction* condition = generateExpression(if_expr->condition.get());
+    VIRBlock* then_block = function->createBlock();
+    VIRBlock* else_block = if_expr->else_expr ? function->createBlock() : nullptr;
+    VIRBlock* merge_block = function->createBlock();
+    emitCondBranch(condition, then_block, else_block ? else_block : merge_block);
+    sealBlock(then_block);
+
+    startBlock(then_block);
+    VIRInstruction* then_value = generateExpression(if_expr->then_expr.get());
+    VIRBlock* then_end = block;
+    emitBranch(merge_block);
+
+    VIRInstruction* else_value = nullptr;
+    VIRBlock* else_end = nullptr;
+    if (else_block) {
+        sealBlock(else_block);
+        startBlock(else_block);
+        else_value = generateExpression(if_expr->else_expr.get());
+        else_end = block;
+        emitBranch(merge_block);
+    }
+
+    sealBlock(merge_block);
+    startBlock(merge_block);
+    if (!else_value || then_value->type == "unit" || else_value->type == "unit") {
+        return emitConstant("unit");
+    }
+    std::string type = analyzer.findCommonAncestor(analyzer.resolveType(then_value->type),
+                                                   analyzer.resolveType(else_value->type)).toString();
+    VIRInstruction* phi = createPhi(merge_block, type);
+    phi->operands = {then_value, else_value};
+    phi->incoming = {then_end, else_end};
+    return removeTrivialPhi(phi);
+}
+
+// The header is sealed once the body, which branches back to it, is lowered
+VIRInstruction* VIRGenerator::generateWhile(const While* while_expr) {
+    VIRBlock* header = function->createBlock();
+    emitBranch(header);
+
+    startBlock(header);
+    VIRInstruction* condition = generateExpression(while_expr->condition.get());
+    VIRBlock* body = function->createBlock();
+    VIRBlock* exit = function->createBlock();
+    emitCondBranch(condition, body, exit);
+    sealBlock(body);
+
+    startBlock(body);
+    generateExpression(while_expr->body.get());
+    emitBranch(header);
+    sealBlock(header);
+
+    sealBlock(exit);
+    startBlock(exit);
+    return emitConstant("unit");
+}
+
+// Resume the generator until it is done, binding the variable to each value
+// in turn, then free it
+VIRInstruction* VIRGenerator::generateFor(const For* for_expr) {
+    VIRInstruction* handle = generateExpression(for_expr->iterable.get());
+    std::string element_type = handle->type.substr(4, handle->type.size() - 5);
+    VIRBlock* header = function->createBlock();
+    emitBranch(header);
+
+    startBlock(header);
+    VIRInstruction* done = emit(VIROp::RESUME, "bool", {handle});
+    VIRBlock* body = function->createBlock();
+    VIRBlock* exit = function->createBlock();
+    emitCondBranch(done, exit, body);
+    sealBlock(body);
+
+    startBlock(body);
+    scopes.emplace_back();
+    declareVariable(for_expr->name, element_type, emit(VIROp::CURRENT, element_type, {handle}));
+    generateExpression(for_expr->body.get());
+    scopes.pop_back();
+    emitBranch(header);
+    sealBlock(header);
+
+    sealBlock(exit);
+    startBlock(exit);
+    emit(VIROp::DESTROY, "unit", {handle});
+    return emitConstant("unit");
+}
+
+VIRInstruction* VIRGenerator::generateLet(const Let* let) {
+    VIRInstruction* value = let->init_expr ? generateExpression(let->init_expr.get()) : emitConstant(let->type);
+    scopes.emplace_back();
+    declareVariable(let->name, let->type, value);
+    VIRInstruction* result = generateExpression(let->scope_expr.get());
+    scopes.pop_back();
+    return result;
+}
+
+} // namespace VSOP
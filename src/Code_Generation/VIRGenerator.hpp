@@ -0,0 +1,85 @@
+#ifndef VIR_GENERATOR_HPP
+#define VIR_GENERATOR_HPP
+
+#include "AST.hpp"
+#include "SemanticAnalyzer.hpp"
+#include "VIR.hpp"
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace VSOP {
+
+// Lower a type-checked program to VIR. Local variables become SSA values as
+// they are lowered (Braun et al., "Simple and Efficient Construction of
+// Static Single Assignment Form", 2013): each block records the last value
+// of each variable, and a variable read in a block without one is looked up
+// in its predecessors, through a phi if there are several. Loop headers are
+// sealed (their predecessors known) once their body is lowered. Phis that
+// merge a single value are removed.
+class VIRGenerator {
+public:
+    // Lower the program (analyzing it first). Returns nullptr if it is not
+    // well-typed (see getErrors()).
+    std::unique_ptr<VIRModule> generate(std::shared_ptr<Program> program);
+
+    const std::vector<std::string>& getErrors() const { return errors; }
+
+private:
+    SemanticAnalyzer analyzer;
+    std::vector<std::string> errors;
+    VIRModule* module = nullptr;
+    std::unordered_map<std::string, const Class*> class_nodes;
+
+    // Function being lowered
+    VIRFunction* function = nullptr;
+    VIRBlock* block = nullptr;
+    std::string current_class;
+
+    // Local variables: the scopes map names to variables, which have a type
+    // and an SSA value per block
+    std::vector<std::unordered_map<std::string, int>> scopes;
+    std::vector<std::string> variable_types;
+    std::map<VIRBlock*, std::map<int, VIRInstruction*>> current_defs;
+    std::map<VIRBlock*, std::map<int, VIRInstruction*>> incomplete_phis;
+    std::set<VIRBlock*> sealed_blocks;
+    std::vector<std::unique_ptr<VIRInstruction>> removed_phis;
+
+    void generateClasses();
+    void generateInitializer(const Class& vsop_class);
+    void generateMethod(const Class& vsop_class, const Method& method);
+    void beginFunction(const std::string& name, const std::string& class_name, const std::string& return_type);
+    void endFunction(VIRInstruction* result);
+
+    // Instructions and blocks
+    VIRInstruction* emit(VIROp op, const std::string& type, std::vector<VIRInstruction*> operands = {});
+    VIRInstruction* emitConstant(const std::string& type);
+    void emitBranch(VIRBlock* target);
+    void emitCondBranch(VIRInstruction* condition, VIRBlock* then_block, VIRBlock* else_block);
+    void startBlock(VIRBlock* next_block);
+    VIRInstruction* createPhi(VIRBlock* phi_block, const std::string& type);
+
+    // SSA construction
+    int declareVariable(const std::string& name, const std::string& type, VIRInstruction* value);
+    int findVariable(const std::string& name) const;
+    void writeVariable(int variable, VIRBlock* def_block, VIRInstruction* value);
+    VIRInstruction* readVariable(int variable, VIRBlock* use_block);
+    VIRInstruction* addPhiOperands(int variable, VIRInstruction* phi);
+    VIRInstruction* removeTrivialPhi(VIRInstruction* phi);
+    void sealBlock(VIRBlock* sealed_block);
+
+    // Expressions
+    VIRInstruction* generateExpression(const Expression* expr);
+    VIRInstruction* generateCall(const Call* call);
+    VIRInstruction* generateIf(const If* if_expr);
+    VIRInstruction* generateWhile(const While* while_expr);
+    VIRInstruction* generateFor(const For* for_expr);
+    VIRInstruction* generateLet(const Let* let);
+};
+
+} // namespace VSOP
+
+#endif // VIR_GENERATOR_HPP
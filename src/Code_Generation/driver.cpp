@@ -14,11 +14,15 @@ using namespace std;
 using namespace VSOP;
  
 // External variable from lexer.lex
-extern location loc;
+extern SourceRange loc;
  
 // Constructor implementation (moved from header)
 Driver::Driver(const std::string &_source_file) 
-    : program(nullptr), current_class(nullptr), source_file(_source_file) {}
+    : program(nullptr), current_class(nullptr), source_file(_source_file), source_files{_source_file} {}
+
+Driver::Driver(const std::vector<std::string> &_source_files)
+    : program(nullptr), current_class(nullptr),
+      source_file(_source_files.empty() ? "" : _source_files.front()), source_files(_source_files) {}
  
 /**
  * @brief Map a token type to a string.
@@ -46,11 +50,13 @@ static const map<Parser::token_type, string> type_to_string = {
     {Parser::token::ELSE, "else"},
     {Parser::token::EXTENDS, "extends"},
     {Parser::token::FALSE, "false"},
+    {Parser::token::FOR, "for"},
     {Parser::token::IF, "if"},
     {Parser::token::IN, "in"},
     {Parser::token::INT32, "int32"},
     {Parser::token::ISNULL, "isnull"},
     {Parser::token::LET, "let"},
+    {Parser::token::MEMO, "memo"},
     {Parser::token::NEW, "new"},
     {Parser::token::NOT, "not"},
     {Parser::token::SELF, "self"},
@@ -59,6 +65,7 @@ static const map<Parser::token_type, string> type_to_string = {
     {Parser::token::TRUE, "true"},
     {Parser::token::UNIT, "unit"},
     {Parser::token::WHILE, "while"},
+    {Parser::token::YIELD, "yield"},
 
     {Parser::token::TYPE_IDENTIFIER, "type-identifier"},
     {Parser::token::OBJECT_IDENTIFIER, "object-identifier"},
@@ -91,10 +98,11 @@ static const map<Parser::token_type, string> type_to_string = {
  * @brief Print the information about a token
  *
  * @param token the token
+ * @param source_file the file it was read from
  */
-static void print_token(Parser::symbol_type token)
+static void print_token(Parser::symbol_type token, const string& source_file)
 {
-    position pos = token.location.begin;
+    SourcePosition pos = resolvePosition(source_file, token.location.begin);
     Parser::token_type type = (Parser::token_type)token.type_get();
 
     cout << pos.line << ","
@@ -171,15 +179,24 @@ int Driver::parse()
     try {
         // Initialize the program
         program = std::make_shared<Program>();
+        program->library = library;
         
-        scan_begin();
-        
-        parser = new Parser(*this);
-        
-        int res = parser->parse();
-        scan_end();
+        // Imported classes come first, as the program's ones may extend them
+        program->classes = imported_classes;
         
-        delete parser;
+        // All the files make up a single program
+        int res = 0;
+        for (const auto& file : source_files) {
+            source_file = file;
+            scan_begin();
+            
+            parser = new Parser(*this);
+            
+            if (parser->parse() != 0) res = 1;
+            scan_end();
+            
+            delete parser;
+        }
         
         return res;
     } catch (const std::exception& e) {
@@ -298,7 +315,7 @@ void Driver::print_tokens()
     try {
         for (auto token_ptr : tokens) {
             Parser::symbol_type* token = reinterpret_cast<Parser::symbol_type*>(token_ptr);
-            print_token(*token);
+            print_token(*token, source_file);
         }
     } catch (const std::exception& e) {
         cerr << "Exception during token printing: " << e.what() << endl;
@@ -342,6 +359,10 @@ void Driver::print_typed_ast()
     }
 }
 
+void Driver::add_interface(const Interface &interface) {
+    imported_classes.insert(imported_classes.end(), interface.classes.begin(), interface.classes.end());
+}
+
 void Driver::add_class(std::shared_ptr<Class> cls) {
     try {
         if (!cls) {
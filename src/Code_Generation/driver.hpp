@@ -7,6 +7,7 @@
 #include <memory>
 #include <cstdio> // For FILE*
 #include "AST.hpp"
+#include "Interface.hpp"
 
 // External declaration for yyin
 extern FILE* yyin;
@@ -15,9 +16,6 @@ extern FILE* yyin;
 namespace VSOP {
     // Forward declaration of Parser to be used
     class Parser;
-    
-    // Forward declaration for location, to be used in Driver
-    class location;
 }
 
 namespace VSOP
@@ -32,6 +30,14 @@ namespace VSOP
          */
         Driver(const std::string &_source_file);
         
+        /**
+         * @brief Construct a new Driver for a program split across files.
+         *
+         * @param _source_files The files containing the source code, parsed
+         *                      in order into a single program.
+         */
+        Driver(const std::vector<std::string> &_source_files);
+        
         /**
          * @brief Get the source file.
          *
@@ -138,12 +144,34 @@ namespace VSOP
          */
         void add_class(std::shared_ptr<Class> cls);
         
+        /**
+         * @brief Import the classes of a compiled library.
+         *
+         * @param interface The interface of the library.
+         */
+        void add_interface(const Interface &interface);
+        
+        /**
+         * @brief Whether the program is a library (no Main class needed).
+         */
+        bool library = false;
+        
     private:
         /**
-         * @brief The source file.
+         * @brief The source file (the one being scanned).
          */
         std::string source_file;
         
+        /**
+         * @brief All the source files of the program.
+         */
+        std::vector<std::string> source_files;
+        
+        /**
+         * @brief The classes declared by imported interfaces.
+         */
+        std::vector<std::shared_ptr<Class>> imported_classes;
+        
         /**
          * @brief The parser.
          */
@@ -9,18 +9,22 @@
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 
 #include "driver.hpp"
 #include "utils.hpp"
 #include "PrettyPrinter.hpp"
 #include "SemanticChecker.hpp"
 #include "CodeGenerator.hpp"
+#include "Interface.hpp"
+#include "Remarks.hpp"
+#include "VIRGenerator.hpp"
 
 using namespace std;
 using namespace VSOP;
 
 // External variable from lexer.lex
-extern location loc;
+extern SourceRange loc;
 
 // Adapted from https://www.gnu.org/software/bison/manual/html_node/A-Complete-C_002b_002b-Example.html
 enum class Mode
@@ -29,6 +33,7 @@ enum class Mode
     PARSE,
     CHECK,
     LLVM_IR,
+    VIR,
     EXECUTABLE
 };
 
@@ -36,7 +41,8 @@ static const map<string, Mode> flag_to_mode = {
     {"-l", Mode::LEX},
     {"-p", Mode::PARSE},
     {"-c", Mode::CHECK},
-    {"-i", Mode::LLVM_IR}
+    {"-i", Mode::LLVM_IR},
+    {"--emit-vir", Mode::VIR}
 };
 
 void segfault_handler(int sig) {
@@ -61,7 +67,14 @@ int main(int argc, char const *argv[])
     signal(SIGSEGV, segfault_handler);
     Mode mode = Mode::EXECUTABLE;  // Default mode is native executable generation
     string source_file;
+    vector<string> source_files;
+    vector<Interface> interfaces;
+    string interface_file;  // --emit-interface: compile a library
     bool extended_mode = false;
+    bool freestanding = false;
+    bool print_report = false;
+    string remarks_file;  // --remarks: write the optimization remarks
+    CodeGeneratorOptions codegen_options;
     
     // Parse arguments
     int arg_index = 1;
@@ -74,28 +87,195 @@ int main(int argc, char const *argv[])
             continue;
         }
         
+        if (arg == "--relative-vtables") {
+            codegen_options.relative_vtables = true;
+            arg_index++;
+            continue;
+        }
+        
+        // Memory management: never free objects (default), or count references
+        if (arg.rfind("--memory=", 0) == 0) {
+            string memory = arg.substr(9);
+            if (memory != "none" && memory != "rc") {
+                cerr << "Unknown memory management " << memory << " (expected none or rc)" << endl;
+                return -1;
+            }
+            codegen_options.reference_counting = memory == "rc";
+            arg_index++;
+            continue;
+        }
+        
+        // Allocate the objects of each new expression from a region of its own
+        if (arg == "--site-heaps") {
+            codegen_options.site_heaps = true;
+            arg_index++;
+            continue;
+        }
+        
+        // Optimization level, -O0 (default) to -O3
+        if (arg.size() == 3 && arg.rfind("-O", 0) == 0 && arg[2] >= '0' && arg[2] <= '3') {
+            codegen_options.optimization_level = arg[2] - '0';
+            arg_index++;
+            continue;
+        }
+        
+        // Compile the methods containing loops again for each of the given
+        // x86-64 levels, picked at load time
+        if (arg.rfind("--multiversion=", 0) == 0) {
+            std::stringstream targets(arg.substr(15));
+            string target;
+            while (std::getline(targets, target, ',')) {
+                if (target != "x86-64-v2" && target != "x86-64-v3" && target != "x86-64-v4") {
+                    cerr << "Unknown multiversion target " << target << " (expected x86-64-v2, x86-64-v3 or x86-64-v4)" << endl;
+                    return -1;
+                }
+                codegen_options.multiversion_targets.push_back(target);
+            }
+            arg_index++;
+            continue;
+        }
+        
+        // Keep one function per identical method body (folded by default at
+        // -O1 and above)
+        if (arg == "--no-fold") {
+            codegen_options.fold_identical_code = false;
+            arg_index++;
+            continue;
+        }
+        
+        // Keep every object field as a pointer to a separate object (objects
+        // are laid out inline in their parent when possible by default at -O1
+        // and above)
+        if (arg == "--no-inline-objects") {
+            codegen_options.inline_objects = false;
+            arg_index++;
+            continue;
+        }
+        
+        // Compile small inherited methods for each subclass
+        if (arg == "--customize") {
+            codegen_options.customize_methods = true;
+            arg_index++;
+            continue;
+        }
+        
+        // Construct Main at compile time
+        if (arg == "--snapshot") {
+            codegen_options.snapshot_main = true;
+            arg_index++;
+            continue;
+        }
+        
+        // Keep the calls of pure methods with constant arguments (evaluated by
+        // default at -O1 and above)
+        if (arg == "--no-partial-eval") {
+            codegen_options.partial_evaluation = false;
+            arg_index++;
+            continue;
+        }
+        
+        // Generate method bodies from their VIR
+        if (arg == "--from-vir") {
+            codegen_options.lower_from_vir = true;
+            arg_index++;
+            continue;
+        }
+        
+        // Count method calls and allocations in the runtime metrics
+        if (arg == "--metrics") {
+            codegen_options.metrics = true;
+            arg_index++;
+            continue;
+        }
+        
+        // Print the optimization report on stderr
+        if (arg == "--report") {
+            print_report = true;
+            arg_index++;
+            continue;
+        }
+        
+        // Write the optimization remarks (YAML optimization records)
+        if (arg.rfind("--remarks=", 0) == 0) {
+            remarks_file = arg.substr(10);
+            if (remarks_file.empty()) {
+                cerr << "Missing remarks file in " << arg << endl;
+                return -1;
+            }
+            codegen_options.remarks = true;
+            arg_index++;
+            continue;
+        }
+        
+        // Compile the sources as a library: write its interface and object
+        if (arg == "--emit-interface") {
+            arg_index++;
+            if (arg_index >= argc) {
+                cerr << "Missing interface file after " << arg << endl;
+                return -1;
+            }
+            interface_file = argv[arg_index];
+            arg_index++;
+            continue;
+        }
+        
+        // Link against the libc-free runtime (static executable, own _start)
+        if (arg == "--freestanding") {
+            freestanding = true;
+            arg_index++;
+            continue;
+        }
+        
         if (flag_to_mode.count(arg) > 0) {
+            // The source files (and interfaces) follow the mode flag
             mode = flag_to_mode.at(arg);
             arg_index++;
             if (arg_index >= argc) {
                 cerr << "Missing source file after " << arg << endl;
                 return -1;
             }
-            source_file = argv[arg_index];
+        } else if (std::filesystem::path(arg).extension() == ".vsopi") {
+            // Interface of a compiled library used by the program
+            Interface interface;
+            string error;
+            if (!readInterface(arg, interface, error)) {
+                cerr << error << endl;
+                return 1;
+            }
+            interfaces.push_back(interface);
             arg_index++;
         } else {
-            // Assume this is the source file
-            source_file = arg;
+            // Assume this is a source file
+            source_files.push_back(arg);
             arg_index++;
         }
     }
     
-    if (source_file.empty()) {
-        cerr << "Usage: " << argv[0] << " [-l|-p|-c|-i] [-e] <source_file>" << endl;
+    if (source_files.empty()) {
+        cerr << "Usage: " << argv[0] << " [-l|-p|-c|-i|--emit-vir] [-e] [-O0|-O1|-O2|-O3] [--multiversion=<level>,...] [--freestanding] [--relative-vtables] [--memory=none|rc] [--site-heaps] [--no-fold] [--no-inline-objects] [--customize] [--snapshot] [--no-partial-eval] [--from-vir] [--metrics] [--report] [--remarks=<file.yaml>]"
+             << " [--emit-interface <lib.vsopi>] [<lib.vsopi>...] <source_file>..." << endl;
+        return -1;
+    }
+    source_file = source_files.front();
+    
+    // The versions are picked by ifunc resolvers, which the dynamic loader
+    // runs, and vtable entries must be addresses
+    if (!codegen_options.multiversion_targets.empty() && (freestanding || codegen_options.relative_vtables)) {
+        cerr << "--multiversion cannot be used with " << (freestanding ? "--freestanding" : "--relative-vtables") << endl;
         return -1;
     }
     
-    VSOP::Driver driver = VSOP::Driver(source_file);
+    // A library's object file sits next to its interface
+    std::string library_object;
+    if (!interface_file.empty()) {
+        library_object = std::filesystem::path(interface_file).replace_extension(".o").string();
+    }
+    
+    VSOP::Driver driver = VSOP::Driver(source_files);
+    driver.library = !interface_file.empty();
+    for (const auto& interface : interfaces) {
+        driver.add_interface(interface);
+    }
     int res;
     
     try {
@@ -128,9 +308,36 @@ int main(int argc, char const *argv[])
             {
                 // Generate LLVM IR
                 CodeGenerator generator(source_file);
-                if (generator.generate(driver.program, true)) {
+                generator.setOptions(codegen_options);
+                for (const auto& interface : interfaces) {
+                    generator.addInterface(interface);
+                }
+                bool generated = generator.generate(driver.program, true);
+                if (print_report) {
+                    for (const auto& line : generator.getReport()) {
+                        cerr << line << endl;
+                    }
+                }
+                if (generated && !remarks_file.empty()) {
+                    string error;
+                    if (!writeRemarks(remarks_file, generator.getRemarks(), error)) {
+                        cerr << error << endl;
+                        return 1;
+                    }
+                }
+                if (generated) {
                     // Print the IR to stdout
                     generator.dumpIR(std::cout);
+                    
+                    if (!interface_file.empty()) {
+                        string error;
+                        Interface interface = generator.getInterface(
+                            std::filesystem::path(library_object).filename().string());
+                        if (!writeInterface(interface_file, interface, error)) {
+                            cerr << error << endl;
+                            return 1;
+                        }
+                    }
                     return 0;
                 } else {
                     // Print errors
@@ -141,6 +348,38 @@ int main(int argc, char const *argv[])
                 }
             }
             
+        case Mode::VIR:
+            // First check the program for errors
+            res = driver.check();
+            if (res != 0) {
+                return res;  // Return if there are semantic errors
+            }
+            
+            {
+                // Lower to VIR, optimized from -O1 on, and print it
+                VIRGenerator vir_generator;
+                std::unique_ptr<VIRModule> vir_module = vir_generator.generate(driver.program);
+                if (!vir_module) {
+                    for (const auto& error : vir_generator.getErrors()) {
+                        cerr << error << endl;
+                    }
+                    return 1;
+                }
+                vector<string> vir_errors = verifyVIR(*vir_module);
+                if (vir_errors.empty() && codegen_options.optimization_level > 0) {
+                    VIRPassManager pass_manager = VIRPassManager::createDefault();
+                    if (!pass_manager.run(*vir_module)) vir_errors = pass_manager.getErrors();
+                }
+                if (!vir_errors.empty()) {
+                    for (const auto& error : vir_errors) {
+                        cerr << "VIR verification failed: " << error << endl;
+                    }
+                    return 1;
+                }
+                printVIR(*vir_module, std::cout);
+                return 0;
+            }
+            
         case Mode::EXECUTABLE:
             // First check the program for errors
             res = driver.check();
@@ -163,7 +402,24 @@ int main(int argc, char const *argv[])
                 
                 // Generate LLVM IR
                 CodeGenerator generator(source_file);
-                if (!generator.generate(driver.program, true)) {
+                generator.setOptions(codegen_options);
+                for (const auto& interface : interfaces) {
+                    generator.addInterface(interface);
+                }
+                bool generated = generator.generate(driver.program, true);
+                if (print_report) {
+                    for (const auto& line : generator.getReport()) {
+                        cerr << line << endl;
+                    }
+                }
+                if (generated && !remarks_file.empty()) {
+                    string error;
+                    if (!writeRemarks(remarks_file, generator.getRemarks(), error)) {
+                        cerr << error << endl;
+                        return 1;
+                    }
+                }
+                if (!generated) {
                     // Print errors
                     for (const auto& error : generator.getErrors()) {
                         cerr << error << endl;
@@ -176,26 +432,80 @@ int main(int argc, char const *argv[])
                 ir_file.close();
                 
                 // Compile IR to object file using clang
-                std::string temp_obj_file = output_file + ".o";
-                std::string compile_cmd = "clang -c " + temp_ir_file + " -o " + temp_obj_file;
+                std::string temp_obj_file = interface_file.empty() ? output_file + ".o" : library_object;
+                std::string compile_cmd = "clang -c -O" + std::to_string(codegen_options.optimization_level)
+                    + " " + temp_ir_file + " -o " + temp_obj_file;
                 if (execute_command(compile_cmd) != 0) {
                     cerr << "Failed to compile IR to object file" << endl;
                     return 1;
                 }
                 
-                // Link with runtime library
-                std::string runtime_lib = "runtime/runtime/object.o";
-                if (!std::filesystem::exists(runtime_lib)) {
+                // A library stops at its object file, described by its interface
+                if (!interface_file.empty()) {
+                    std::filesystem::remove(temp_ir_file);
+                    
+                    string error;
+                    Interface interface = generator.getInterface(
+                        std::filesystem::path(library_object).filename().string());
+                    if (!writeInterface(interface_file, interface, error)) {
+                        cerr << error << endl;
+                        return 1;
+                    }
+                    
+                    cout << "Generated library: " << library_object << " (interface: " << interface_file << ")" << endl;
+                    return 0;
+                }
+                
+                // Link with runtime library: Object, the other built-in
+                // classes, reference counting, metrics, the methods of
+                // strings, CPU detection and the caches of memo methods
+                // (which only need what both variants of object.c provide)
+                std::vector<std::pair<std::string, std::string>> runtime_units = {
+                    {"runtime/runtime/object.c", "runtime/runtime/object.o"},
+                    {"runtime/runtime/stringmap.c", "runtime/runtime/stringmap.o"},
+                    {"runtime/runtime/file.c", "runtime/runtime/file.o"},
+                    {"runtime/runtime/refcount.c", "runtime/runtime/refcount.o"},
+                    {"runtime/runtime/metrics.c", "runtime/runtime/metrics.o"},
+                    {"runtime/runtime/string_methods.c", "runtime/runtime/string_methods.o"},
+                    {"runtime/runtime/cpu.c", "runtime/runtime/cpu.o"},
+                    {"runtime/runtime/memo.c", "runtime/runtime/memo.o"},
+                };
+                std::string runtime_cflags = "";
+                std::string link_flags = "";
+                if (freestanding) {
+                    runtime_units = {
+                        {"runtime/runtime/object_freestanding.c", "runtime/runtime/object_freestanding.o"},
+                        {"runtime/runtime/stringmap.c", "runtime/runtime/stringmap_freestanding.o"},
+                        {"runtime/runtime/file.c", "runtime/runtime/file_freestanding.o"},
+                        {"runtime/runtime/refcount.c", "runtime/runtime/refcount_freestanding.o"},
+                        {"runtime/runtime/metrics.c", "runtime/runtime/metrics_freestanding.o"},
+                        {"runtime/runtime/string_methods.c", "runtime/runtime/string_methods_freestanding.o"},
+                        {"runtime/runtime/cpu.c", "runtime/runtime/cpu_freestanding.o"},
+                        {"runtime/runtime/memo.c", "runtime/runtime/memo_freestanding.o"},
+                    };
+                    runtime_cflags = " -O2 -ffreestanding -fno-builtin -fno-stack-protector";
+                    link_flags = " -static -nostdlib";
+                }
+                for (const auto& [runtime_src, runtime_lib] : runtime_units) {
+                    if (std::filesystem::exists(runtime_lib)) continue;
+                    
                     // Try to compile the runtime if object file doesn't exist
-                    std::string compile_runtime_cmd = "clang -c runtime/runtime/object.c -o " + runtime_lib;
+                    std::string compile_runtime_cmd = "clang -c" + runtime_cflags + " " + runtime_src + " -o " + runtime_lib;
                     if (execute_command(compile_runtime_cmd) != 0) {
                         cerr << "Failed to compile runtime library" << endl;
                         return 1;
                     }
                 }
                 
-                // Link object file with runtime
-                std::string link_cmd = "clang " + temp_obj_file + " " + runtime_lib + " -o " + output_file;
+                // Link object file with the imported libraries and the runtime
+                std::string link_cmd = "clang" + link_flags + " " + temp_obj_file;
+                for (const auto& interface : interfaces) {
+                    link_cmd += " " + interface.object_file;
+                }
+                for (const auto& runtime_unit : runtime_units) {
+                    link_cmd += " " + runtime_unit.second;
+                }
+                link_cmd += " -o " + output_file;
                 if (execute_command(link_cmd) != 0) {
                     cerr << "Failed to link object file with runtime" << endl;
                     return 1;
@@ -22,6 +22,10 @@
 // Allow to use C++ objects as semantic values
 %define api.value.type variant
 
+// Locations are byte offsets, resolved to lines and columns only when a
+// message needs them (see SourceMap.hpp)
+%define api.location.type {VSOP::SourceRange}
+
 // Add some assertions.
 %define parse.assert
 
@@ -31,6 +35,7 @@
     #include <vector>
     #include <memory>
     #include "AST.hpp"
+    #include "SourceMap.hpp"
     
     namespace VSOP
     {
@@ -67,11 +72,13 @@
     ELSE "else"
     EXTENDS "extends"
     FALSE "false"
+    FOR "for"
     IF "if"
     IN "in"
     INT32 "int32"
     ISNULL "isnull"
     LET "let"
+    MEMO "memo"
     NEW "new"
     NOT "not"
     SELF "self"
@@ -80,6 +87,7 @@
     TRUE "true"
     UNIT "unit"
     WHILE "while"
+    YIELD "yield"
     REGULAR_CHAR "regular-char"
     ESCAPED_CHAR "escaped-char"
     ESCAPE_SEQUENCE "escape-sequence"
@@ -115,12 +123,21 @@
 %type <std::shared_ptr<Formal>> formal
 %type <std::vector<std::shared_ptr<Formal>>> formal_list formals
 %type <std::shared_ptr<Expression>> expr
-%type <std::vector<std::shared_ptr<Expression>>> expr_list args
+%type <std::vector<std::shared_ptr<Expression>>> expr_list args arg_list
 %type <std::shared_ptr<Block>> block
 %type <std::string> type
 
 // Precedence and associativity according to VSOP language spec
-// From lowest to highest precedence
+// From lowest to highest precedence.
+// The bodies of if, while, for, yield and let extend as far to the right as
+// possible: the keywords ending their rules come first, so that any operator
+// after the body is shifted into it, and "else" binds to the nearest "if".
+%precedence "then" "do" "in" "yield"
+%precedence "else"
+// The one conflict left, resolved by shifting: "(" expr ")" "." ... is also a
+// call on the parenthesized expr, and both readings build the same Call. Any
+// other conflict fails the build.
+%expect 1
 %right "<-"          // Precedence 9, right-associative
 %left "and"          // Precedence 8, left-associative
 %right "not"         // Precedence 7, right-associative
@@ -158,6 +175,8 @@ class:
         } else {
             cls->name = $2;
         }
+        cls->file = driver.get_source_file();
+        cls->offset = @2.begin;
         
         // Set current_class BEFORE parsing class_body
         driver.current_class = cls;
@@ -208,18 +227,26 @@ field_or_method:
 field:
     OBJECT_IDENTIFIER ":" type ";" {
         $$ = std::make_shared<Field>($1, $3);
+        $$->offset = @1.begin;
     }
   | OBJECT_IDENTIFIER ":" type "<-" expr ";" {
         $$ = std::make_shared<Field>($1, $3, $5);
+        $$->offset = @1.begin;
     }
 ;
 
 method:
     OBJECT_IDENTIFIER "(" formals ")" ":" type block {
         $$ = std::make_shared<Method>($1, $3, $6, $7);
+        $$->offset = @1.begin;
         if (!$$) std::cerr << "WARNING: Method creation failed" << std::endl;
         if (!$7) std::cerr << "WARNING: Method body (block) is null" << std::endl;
     }
+  | "memo" OBJECT_IDENTIFIER "(" formals ")" ":" type block {
+        $$ = std::make_shared<Method>($2, $4, $7, $8);
+        $$->memo = true;
+        $$->offset = @2.begin;
+    }
 ;
 
 formals:
@@ -294,6 +321,14 @@ expr:
   | "while" expr "do" expr {
         $$ = std::make_shared<While>($2, $4);
     }
+  | "for" OBJECT_IDENTIFIER "in" expr "do" expr {
+        $$ = std::make_shared<For>($2, $4, $6);
+        $$->offset = @1.begin;
+    }
+  | "yield" expr {
+        $$ = std::make_shared<Yield>($2);
+        $$->offset = @1.begin;
+    }
   | "let" OBJECT_IDENTIFIER ":" type "<-" expr "in" expr {
         $$ = std::make_shared<Let>($2, $4, $6, $8);
     }
@@ -343,16 +378,20 @@ expr:
   | OBJECT_IDENTIFIER "(" args ")" {
         auto self = std::make_shared<Self>();
         $$ = std::make_shared<Call>(self, $1, $3);
+        $$->offset = @1.begin;
     }
   | expr "." OBJECT_IDENTIFIER "(" args ")" {
         $$ = std::make_shared<Call>($1, $3, $5);
+        $$->offset = @3.begin;
     }
   | "(" expr ")" "." OBJECT_IDENTIFIER "(" args ")" {
         // Handle expressions like (new Cons).init(...)
         $$ = std::make_shared<Call>($2, $5, $7);
+        $$->offset = @5.begin;
     }
   | "new" TYPE_IDENTIFIER {
         $$ = std::make_shared<New>($2);
+        $$->offset = @1.begin;
     }
   | OBJECT_IDENTIFIER {
         $$ = std::make_shared<Identifier>($1);
@@ -387,18 +426,30 @@ args:
     /* empty */ {
         $$ = std::vector<std::shared_ptr<Expression>>();
     }
-  | expr_list {
+  | arg_list {
         $$ = $1;
     }
 ;
 
+// Arguments are separated by commas (expr_list is for blocks)
+arg_list:
+    expr {
+        $$ = std::vector<std::shared_ptr<Expression>>();
+        $$.push_back($1);
+    }
+  | arg_list "," expr {
+        $$ = $1;
+        $$.push_back($3);
+    }
+;
+
 %%
 
 // User code
 void VSOP::Parser::error(const location_type& l, const std::string& m)
 {
-    const position &pos = l.begin;
-    cerr << *(pos.filename) << ":"
+    SourcePosition pos = resolvePosition(driver.get_source_file(), l.begin);
+    cerr << driver.get_source_file() << ":"
          << pos.line << ":" 
          << pos.column << ": "
          << m
@@ -0,0 +1,99 @@
+// Processor detection, see cpu.h.
+//
+// The file needs nothing from the C library, so that it can be linked both
+// with object.c and with object_freestanding.c.
+
+#include "cpu.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+
+// Features -------------------------------------------------------------------
+
+// Leaf 1, ecx
+#define LEAF1_SSE3      (1u << 0)
+#define LEAF1_SSSE3     (1u << 9)
+#define LEAF1_FMA       (1u << 12)
+#define LEAF1_CX16      (1u << 13)
+#define LEAF1_SSE4_1    (1u << 19)
+#define LEAF1_SSE4_2    (1u << 20)
+#define LEAF1_MOVBE     (1u << 22)
+#define LEAF1_POPCNT    (1u << 23)
+#define LEAF1_XSAVE     (1u << 26)
+#define LEAF1_OSXSAVE   (1u << 27)
+#define LEAF1_AVX       (1u << 28)
+#define LEAF1_F16C      (1u << 29)
+
+// Leaf 7, subleaf 0, ebx
+#define LEAF7_BMI1      (1u << 3)
+#define LEAF7_AVX2      (1u << 5)
+#define LEAF7_BMI2      (1u << 8)
+#define LEAF7_AVX512F   (1u << 16)
+#define LEAF7_AVX512DQ  (1u << 17)
+#define LEAF7_AVX512CD  (1u << 28)
+#define LEAF7_AVX512BW  (1u << 30)
+#define LEAF7_AVX512VL  (1u << 31)
+
+// Leaf 0x80000001, ecx
+#define EXT1_LAHF_LM    (1u << 0)
+#define EXT1_LZCNT      (1u << 5)
+
+// Register states the operating system saves (XCR0): SSE and AVX (XMM and
+// YMM), then AVX-512 (opmask, upper halves of ZMM0-15, ZMM16-31)
+#define XCR0_AVX        0x06u
+#define XCR0_AVX512     0xE6u
+
+// Features each level adds to the previous one
+#define LEVEL2_LEAF1    (LEAF1_SSE3 | LEAF1_SSSE3 | LEAF1_CX16 | LEAF1_SSE4_1 | LEAF1_SSE4_2 | LEAF1_POPCNT)
+#define LEVEL2_EXT1     EXT1_LAHF_LM
+#define LEVEL3_LEAF1    (LEAF1_FMA | LEAF1_MOVBE | LEAF1_XSAVE | LEAF1_OSXSAVE | LEAF1_AVX | LEAF1_F16C)
+#define LEVEL3_LEAF7    (LEAF7_BMI1 | LEAF7_AVX2 | LEAF7_BMI2)
+#define LEVEL3_EXT1     EXT1_LZCNT
+#define LEVEL4_LEAF7    (LEAF7_AVX512F | LEAF7_AVX512DQ | LEAF7_AVX512CD | LEAF7_AVX512BW | LEAF7_AVX512VL)
+
+static inline uint32_t read_xcr0(void) {
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return eax;
+}
+#endif
+
+// Level ----------------------------------------------------------------------
+
+int32_t Object___cpu_level(void) {
+#if defined(__x86_64__)
+    unsigned eax, ebx, ecx, edx;
+    unsigned max_leaf = __get_cpuid_max(0, 0);
+    if (max_leaf < 1)
+        return 1;
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    unsigned leaf1 = ecx;
+    unsigned leaf7 = 0;
+    if (max_leaf >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        leaf7 = ebx;
+    }
+    unsigned ext1 = 0;
+    if (__get_cpuid_max(0x80000000, 0) >= 0x80000001) {
+        __cpuid(0x80000001, eax, ebx, ecx, edx);
+        ext1 = ecx;
+    }
+
+    if ((leaf1 & LEVEL2_LEAF1) != LEVEL2_LEAF1 || (ext1 & LEVEL2_EXT1) != LEVEL2_EXT1)
+        return 1;
+    // AVX instructions also need the system to save the YMM registers, which
+    // xgetbv tells once OSXSAVE is known to be set
+    if ((leaf1 & LEVEL3_LEAF1) != LEVEL3_LEAF1 || (leaf7 & LEVEL3_LEAF7) != LEVEL3_LEAF7
+        || (ext1 & LEVEL3_EXT1) != LEVEL3_EXT1)
+        return 2;
+    uint32_t xcr0 = read_xcr0();
+    if ((xcr0 & XCR0_AVX) != XCR0_AVX)
+        return 2;
+    if ((leaf7 & LEVEL4_LEAF7) != LEVEL4_LEAF7 || (xcr0 & XCR0_AVX512) != XCR0_AVX512)
+        return 3;
+    return 4;
+#else
+    return 0;
+#endif
+}
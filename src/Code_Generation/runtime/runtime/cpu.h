@@ -0,0 +1,16 @@
+#ifndef CPU_H_
+#define CPU_H_
+
+#include <stdint.h>
+
+// x86-64 micro-architecture level of the running processor, as defined by the
+// x86-64 psABI: 1 for the baseline, 2 to 4 for x86-64-v2 to x86-64-v4, and 0
+// on other architectures.
+//
+// The methods compiled with vsopc --multiversion are ifuncs whose resolvers
+// call it while the dynamic loader relocates the program, before any
+// constructor has run: it only uses cpuid and xgetbv, without any library
+// function nor global data.
+int32_t Object___cpu_level(void);
+
+#endif // CPU_H_
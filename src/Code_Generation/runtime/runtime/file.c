@@ -0,0 +1,205 @@
+// Built-in File class, see file.h.
+//
+// Besides malloc, memchr, memcpy and strlen, this file only uses a few POSIX
+// calls (open, lseek, mmap, madvise, close, write and exit), which
+// object_freestanding.c also provides, so that it can be linked with either
+// runtime.
+
+#include "file.h"
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Utility functions ----------------------------------------------------------
+
+static bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int digit_value(char c, int base) {
+    int v;
+    if (c >= '0' && c <= '9')
+        v = c - '0';
+    else if (c >= 'a' && c <= 'f')
+        v = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+        v = c - 'A' + 10;
+    else
+        return -1;
+    return v < base ? v : -1;
+}
+
+// Print an error message about the given word (not NUL-terminated) on stderr
+// and exit, like the fprintf/exit pairs in object.c.
+static void fail(const char *word, size_t length, const char *msg)
+    __attribute__((noreturn));
+static void fail(const char *word, size_t length, const char *msg) {
+    static const char prefix[] = "File::nextInt32: `";
+    write(STDERR_FILENO, prefix, sizeof prefix - 1);
+    write(STDERR_FILENO, word, length);
+    write(STDERR_FILENO, "` ", 2);
+    write(STDERR_FILENO, msg, strlen(msg));
+    write(STDERR_FILENO, "\n", 1);
+    exit(EXIT_FAILURE);
+}
+
+// Methods --------------------------------------------------------------------
+
+bool File__open(File *self, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < 0) {
+        close(fd);
+        return false;
+    }
+
+    // An empty file cannot be mapped, but has nothing to read anyway
+    char *data = NULL;
+    if (size > 0) {
+        // Private and writable, so that lines can be NUL-terminated in place
+        data = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        // Lines are read in order: let the kernel read ahead aggressively
+        madvise(data, (size_t) size, MADV_SEQUENTIAL);
+    }
+    close(fd); // The mapping keeps the file alive
+
+    self->_data = data;
+    self->_size = (size_t) size;
+    self->_pos = 0;
+    return true;
+}
+
+char *File__nextLine(File *self) {
+    if (self->_pos >= self->_size)
+        return "";
+
+    char *line = self->_data + self->_pos;
+    size_t left = self->_size - self->_pos;
+    char *eol = memchr(line, '\n', left);
+    if (eol) {
+        // The line is used where it is, in the mapping
+        *eol = '\0';
+        self->_pos += (size_t) (eol - line) + 1;
+        metrics_add(&Object___metrics->bytes_read, (uint64_t) (eol - line) + 1);
+        return line;
+    }
+
+    // The last line has no end-of-line to overwrite, and the mapping may end
+    // right after it, so it is copied
+    self->_pos = self->_size;
+    metrics_add(&Object___metrics->bytes_read, left);
+    char *copy = malloc(left + 1);
+    if (!copy)
+        return "";
+    memcpy(copy, line, left);
+    copy[left] = '\0';
+    return copy;
+}
+
+int32_t File__nextInt32(File *self) {
+    const char *p = self->_data + self->_pos;
+    const char *end = self->_data + self->_size;
+    while (p < end && is_space(*p))
+        ++p;
+
+    // The literal is parsed in place, up to the next white space
+    const char *word = p;
+    const char *word_end = p;
+    while (word_end < end && !is_space(*word_end))
+        ++word_end;
+    size_t length = (size_t) (word_end - word);
+
+    // Also consume the rest of the line if it is blank, so that atEnd()
+    // becomes true after the last integer of a file
+    const char *next = word_end;
+    while (next < end && is_space(*next) && *next != '\n')
+        ++next;
+    size_t pos = (size_t) ((next < end && *next == '\n' ? next + 1 : word_end) - self->_data);
+    metrics_add(&Object___metrics->bytes_read, pos - self->_pos);
+    self->_pos = pos;
+
+    // Same accepted syntax as Object::inputInt32: optional sign, then a
+    // decimal or 0x-prefixed hexadecimal literal (no octal)
+    bool negative = false;
+    if (p < word_end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        ++p;
+    }
+    int base = 10;
+    if (word_end - p > 2 && p[0] == '0' && p[1] == 'x') {
+        base = 16;
+        p += 2;
+    }
+    if (p == word_end)
+        fail(word, length, "is not a valid integer literal!");
+
+    int64_t value = 0;
+    for (; p < word_end; ++p) {
+        int d = digit_value(*p, base);
+        if (d < 0)
+            fail(word, length, "is not a valid integer literal!");
+        value = value * base + d;
+        if (value > (int64_t) INT32_MAX + 1)
+            fail(word, length, "does not fit a 32-bit integer!");
+    }
+    if (negative)
+        value = -value;
+    if (value < INT32_MIN || value > INT32_MAX)
+        fail(word, length, "does not fit a 32-bit integer!");
+
+    return (int32_t) value;
+}
+
+bool File__atEnd(File *self) {
+    return self->_pos >= self->_size;
+}
+
+// Constructor ----------------------------------------------------------------
+
+File *File___new(void) {
+    File *ret = Object___alloc(sizeof (File));
+    return File___init(ret);
+}
+
+File *File___init(File *self) {
+    if (self) {
+        self->_vtable = &File___vtable;
+        self->_refcount = 0;
+        self->_data = NULL;
+        self->_size = 0;
+        self->_pos = 0;
+    }
+    return self;
+}
+
+// The mapping is kept, as lines returned by nextLine() point into it
+void File___drop(Object *self) {
+    Object___free(self, sizeof (File));
+}
+
+// Virtual function table instance --------------------------------------------
+
+const FileVTable File___vtable = {
+    .print = &Object__print,
+    .printBool = &Object__printBool,
+    .printInt32 = &Object__printInt32,
+    .inputLine = &Object__inputLine,
+    .inputBool = &Object__inputBool,
+    .inputInt32 = &Object__inputInt32,
+    ._drop = &File___drop,
+    .open = &File__open,
+    .nextLine = &File__nextLine,
+    .nextInt32 = &File__nextInt32,
+    .atEnd = &File__atEnd
+};
@@ -0,0 +1,77 @@
+#ifndef FILE_H_
+#define FILE_H_
+
+#include "object.h"
+
+#include <stddef.h>
+
+// Forward declarations for mutually recursive types
+typedef struct File File;
+typedef struct FileVTable FileVTable;
+
+// Type for the built-in File class, a read-only input file. Like StringMap,
+// File extends Object and cannot be extended itself.
+//
+// The file is mapped in memory rather than read: nextLine() returns pointers
+// into the mapping, after replacing the end-of-line by a NUL terminator. The
+// mapping is private, so the file itself is left untouched (the kernel copies
+// a page on its first write). Mappings are never unmapped, so the returned
+// strings stay valid for the whole run, like every other VSOP string.
+struct File {
+    // Same layout as Object
+    const FileVTable *_vtable;
+    uint32_t _refcount;
+
+    // Mapped contents (NULL until a non-empty file is opened)
+    char *_data;
+    // Size of the mapping
+    size_t _size;
+    // Offset of the first byte not read yet
+    size_t _pos;
+};
+
+// Type for File's vtable. Starts with Object's methods, in the same order as
+// ObjectVTable, followed by File's own methods.
+struct FileVTable {
+    Object *(*print)(Object *self, const char *s);
+    Object *(*printBool)(Object *self, bool b);
+    Object *(*printInt32)(Object *self, int32_t i);
+    char *(*inputLine)(Object *self);
+    bool (*inputBool)(Object *self);
+    int32_t (*inputInt32)(Object *self);
+    void (*_drop)(Object *self);
+
+    // Opens the file at the given path for reading, from its start. Returns
+    // whether it could be opened. The previously opened file, if any, is not
+    // read anymore.
+    bool (*open)(File *self, const char *path);
+    // Reads a line, with the end-of-line removed. At the end of the file (or
+    // if no file is open), returns the empty string "".
+    char *(*nextLine)(File *self);
+    // Reads a VSOP integer literal (with optional +/- sign). Skips leading
+    // white spaces, and the rest of the line if it is blank. In case of error,
+    // prints an error message and exits the program.
+    int32_t (*nextInt32)(File *self);
+    // Returns whether everything has been read.
+    bool (*atEnd)(File *self);
+};
+
+// File's methods, for static dispatch
+bool File__open(File *self, const char *path);
+char *File__nextLine(File *self);
+int32_t File__nextInt32(File *self);
+bool File__atEnd(File *self);
+
+// File's constructor. Allocates and initialize a new File, with no file open.
+File *File___new(void);
+
+// File's drop, see ObjectVTable.
+void File___drop(Object *self);
+
+// File's initializer. Initializes an allocated File.
+File *File___init(File *self);
+
+// File's vtable instance, shared by all File instances.
+extern const FileVTable File___vtable;
+
+#endif // FILE_H_
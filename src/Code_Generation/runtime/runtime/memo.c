@@ -0,0 +1,110 @@
+// Caches of memo methods, see memo.h.
+//
+// Besides refcount.c, this file only needs malloc, free, memset and memcmp,
+// so that it can be linked both with object.c and with object_freestanding.c
+// (which provides them). Build the freestanding variant with the same flags
+// as object_freestanding.c.
+
+#include "memo.h"
+#include "object.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Table ----------------------------------------------------------------------
+
+// Open addressing with linear probing. A slot is key_size + 2 words: the hash
+// of the key (0 for an empty slot), the result, then the key, so that a probe
+// only compares whole keys whose hash matches, without leaving the slot.
+struct MemoTable {
+    uint32_t key_size;
+    size_t count;
+    size_t mask;            // Capacity - 1, the capacity being a power of two
+    uint64_t *slots;
+};
+
+#define MIN_CAPACITY 64
+
+static inline size_t slot_size(const MemoTable *table) {
+    return table->key_size + 2;
+}
+
+// Never 0, which marks empty slots
+static uint64_t hash_key(const int64_t *key, uint32_t key_size) {
+    uint64_t hash = 0x9E3779B97F4A7C15u;
+    for (uint32_t i = 0; i < key_size; ++i) {
+        hash = (hash ^ (uint64_t) key[i]) * 0xBF58476D1CE4E5B9u;
+        hash ^= hash >> 31;
+    }
+    return hash | 1;
+}
+
+// Slot holding the key, or the empty one where it would go
+static uint64_t *find_slot(const MemoTable *table, const int64_t *key, uint64_t hash) {
+    for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+        uint64_t *slot = table->slots + i * slot_size(table);
+        if (slot[0] == 0 || (slot[0] == hash && memcmp(slot + 2, key, table->key_size * sizeof(int64_t)) == 0))
+            return slot;
+    }
+}
+
+static uint64_t *allocate_slots(const MemoTable *table, size_t capacity) {
+    size_t size = capacity * slot_size(table) * sizeof(uint64_t);
+    uint64_t *slots = malloc(size);
+    memset(slots, 0, size);
+    return slots;
+}
+
+// Double the capacity, moving the slots without hashing their keys again
+static void grow(MemoTable *table) {
+    uint64_t *old_slots = table->slots;
+    size_t old_capacity = table->mask + 1;
+    table->mask = 2 * old_capacity - 1;
+    table->slots = allocate_slots(table, 2 * old_capacity);
+    for (size_t i = 0; i < old_capacity; ++i) {
+        uint64_t *old_slot = old_slots + i * slot_size(table);
+        if (old_slot[0] == 0)
+            continue;
+        uint64_t *slot = find_slot(table, (const int64_t *) (old_slot + 2), old_slot[0]);
+        memcpy(slot, old_slot, slot_size(table) * sizeof(uint64_t));
+    }
+    free(old_slots);
+}
+
+// Methods --------------------------------------------------------------------
+
+bool Object___memo_lookup(MemoTable **table, const int64_t *key, uint32_t key_size, int64_t *result) {
+    if (!*table)
+        return false;
+    uint64_t *slot = find_slot(*table, key, hash_key(key, key_size));
+    if (slot[0] == 0)
+        return false;
+    *result = (int64_t) slot[1];
+    return true;
+}
+
+void Object___memo_store(MemoTable **table, const int64_t *key, uint32_t key_size, int64_t result) {
+    if (!*table) {
+        MemoTable *new_table = malloc(sizeof(MemoTable));
+        new_table->key_size = key_size;
+        new_table->count = 0;
+        new_table->mask = MIN_CAPACITY - 1;
+        new_table->slots = allocate_slots(new_table, MIN_CAPACITY);
+        *table = new_table;
+    }
+
+    // At most half full, so that probes stay short
+    MemoTable *memo = *table;
+    if (2 * (memo->count + 1) > memo->mask + 1)
+        grow(memo);
+
+    uint64_t hash = hash_key(key, key_size);
+    uint64_t *slot = find_slot(memo, key, hash);
+    if (slot[0] == 0) {
+        slot[0] = hash;
+        memcpy(slot + 2, key, key_size * sizeof(int64_t));
+        ++memo->count;
+        Object___retain((Object *) (intptr_t) key[0]);
+    }
+    slot[1] = (uint64_t) result;
+}
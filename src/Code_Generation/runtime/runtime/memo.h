@@ -0,0 +1,23 @@
+#ifndef MEMO_H_
+#define MEMO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Caches of the results of memo methods. The generated code keeps one per
+// method, in a MemoTable pointer starting NULL, which the first store sets.
+//
+// Keys are arrays of key_size 64-bit words (the same for every key of a
+// table): self, then the arguments (int32 sign-extended, bool zero-extended,
+// strings by address, as compared by `=`). The table keeps a reference to
+// self, so that with --memory=rc its address is not reused by another object
+// while cached. Results are 64-bit words too. Entries are never removed.
+typedef struct MemoTable MemoTable;
+
+// Whether the key is in the table, and if so its result
+bool Object___memo_lookup(MemoTable **table, const int64_t *key, uint32_t key_size, int64_t *result);
+
+// Set the result of the key
+void Object___memo_store(MemoTable **table, const int64_t *key, uint32_t key_size, int64_t result);
+
+#endif // MEMO_H_
@@ -0,0 +1,55 @@
+// Runtime metrics, see metrics.h.
+//
+// Like refcount.c, this file only needs malloc, memset, memcpy and strlen, so
+// that it can be linked with either runtime. Publishing the metrics in shared
+// memory is up to object.c.
+
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Counters until (unless) object.c publishes them
+static VsopMetrics private_metrics = {
+    .magic = VSOP_METRICS_MAGIC,
+    .version = VSOP_METRICS_VERSION,
+};
+
+VsopMetrics *Object___metrics = &private_metrics;
+
+uint64_t *Object___call_counts;
+
+VsopMetrics *(*Object___metrics_resize)(size_t size);
+
+void Object___register_calls(const char *const *names, uint32_t count) {
+    size_t names_size = 0;
+    for (uint32_t i = 0; i < count; ++i)
+        names_size += strlen(names[i]) + 1;
+    size_t size = sizeof (VsopMetrics) + count * sizeof (uint64_t) + names_size;
+
+    VsopMetrics *metrics =
+        Object___metrics_resize ? Object___metrics_resize(size) : NULL;
+    if (!metrics) {
+        // Private counters, or publishing failed: the calls are still counted
+        metrics = malloc(size);
+        if (!metrics)
+            return;
+        memset(metrics, 0, size);
+        memcpy(metrics, Object___metrics, sizeof (VsopMetrics));
+    }
+
+    uint64_t *counts = (uint64_t *) (metrics + 1);
+    char *name = (char *) (counts + count);
+    for (uint32_t i = 0; i < count; ++i) {
+        counts[i] = 0;
+        size_t length = strlen(names[i]) + 1;
+        memcpy(name, names[i], length);
+        name += length;
+    }
+    metrics->names_size = (uint32_t) names_size;
+    // Readers trust call_count once they see it, so it comes last
+    __atomic_store_n(&metrics->call_count, count, __ATOMIC_RELEASE);
+
+    Object___metrics = metrics;
+    Object___call_counts = counts;
+}
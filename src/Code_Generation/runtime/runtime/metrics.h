@@ -0,0 +1,60 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Runtime metrics: counters of the running program, which other processes
+// can read while it runs. With VSOP_METRICS=1 in the environment, object.c
+// publishes them in the shared memory file /dev/shm/vsop-<pid> (removed at
+// exit), which vsopstat reads. Otherwise they are counted in private memory.
+//
+// The program is the only writer. Counters are updated with relaxed atomic
+// loads and stores (no locked instruction), so that readers never see a torn
+// value, only one that may be a few updates behind.
+//
+// The file starts with a VsopMetrics header. Programs compiled with
+// vsopc --metrics also count the calls of each of their methods: the header is
+// then followed by call_count 64-bit counters, then by the names of the
+// methods (Class.method, NUL-terminated, in counter order). The file grows
+// when they are registered, call_count being set last.
+
+#define VSOP_METRICS_MAGIC   0x504f5356u    // "VSOP" in memory (little-endian)
+#define VSOP_METRICS_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t pid;
+
+    uint64_t objects_allocated;     // By Object___alloc
+    uint64_t bytes_allocated;
+    uint64_t objects_freed;         // By Object___free (--memory=rc)
+    uint64_t bytes_read;            // inputLine, inputBool, inputInt32, File
+    uint64_t bytes_written;         // print, printBool, printInt32
+
+    uint32_t call_count;            // Number of call counters
+    uint32_t names_size;            // Size of the names after them, in bytes
+} VsopMetrics;
+
+// Metrics of the process (metrics.c)
+extern VsopMetrics *Object___metrics;
+
+// Call counters, set by Object___register_calls()
+extern uint64_t *Object___call_counts;
+
+// Called by main() in programs compiled with vsopc --metrics, before any
+// method, with the names of the methods whose calls are counted
+void Object___register_calls(const char *const *names, uint32_t count);
+
+// Set by object.c when the metrics are published: returns the metrics,
+// remapped with room for the given size in bytes, or NULL on failure
+extern VsopMetrics *(*Object___metrics_resize)(size_t size);
+
+// Add to a counter (single writer, see above)
+static inline void metrics_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+#endif // METRICS_H_
@@ -1,4 +1,8 @@
+// For syscall() with strict -std= flags
+#define _DEFAULT_SOURCE
+
 #include "object.h"
+#include "metrics.h"
 
 #include <ctype.h>
 #include <inttypes.h>
@@ -6,6 +10,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 // Utility functions ----------------------------------------------------------
 
 // Read characters from stdin until EOF is reached, or the given predicate
@@ -21,6 +34,7 @@ static char *read_until(int (*predicate)(int)) {
             if (c != EOF)
                 ungetc(c, stdin);
             buf[i] = '\0';
+            metrics_add(&Object___metrics->bytes_read, i);
             return buf;
         }
         buf[i] = (char) c;
@@ -36,31 +50,222 @@ static char *read_until(int (*predicate)(int)) {
 
 // Removes characters from stdin as long as they match the given predicate.
 static void skip_while(int (*predicate)(int)) {
+    uint64_t skipped = 0;
     int c = getc(stdin);
-    while (c != EOF && predicate(c))
+    while (c != EOF && predicate(c)) {
+        ++skipped;
         c = getc(stdin);
+    }
     if (c != EOF)
         ungetc(c, stdin);
+    metrics_add(&Object___metrics->bytes_read, skipped);
+}
+
+// Count the bytes printed by printf (which returns a negative value on error)
+static void count_written(int n) {
+    if (n > 0)
+        metrics_add(&Object___metrics->bytes_written, (uint64_t) n);
 }
 
 static int is_eol(int c) {
     return c == '\n';
 }
 
+// Performance counters -------------------------------------------------------
+
+// With VSOP_PERF_STAT=1 in the environment, hardware counters are opened
+// before main() and read at exit, and a summary is printed on stderr. Only
+// user-space events of the process itself are counted. In containers and
+// virtual machines, perf_event_open is often forbidden (seccomp,
+// perf_event_paranoid) or the PMU is not virtualized: the counters that cannot
+// be opened are then reported as unavailable, and the program runs normally.
+
+#if defined(__linux__) && defined(SYS_perf_event_open)
+
+typedef struct {
+    const char *name;
+    uint64_t config;
+    int fd;
+} PerfCounter;
+
+static PerfCounter perf_counters[] = {
+    {"cycles", PERF_COUNT_HW_CPU_CYCLES, -1},
+    {"instructions", PERF_COUNT_HW_INSTRUCTIONS, -1},
+    {"branch-misses", PERF_COUNT_HW_BRANCH_MISSES, -1},
+    {"LLC-misses", PERF_COUNT_HW_CACHE_MISSES, -1},
+};
+
+#define PERF_COUNTERS (sizeof perf_counters / sizeof perf_counters[0])
+
+// Read a counter, scaled up if the kernel had to multiplex it with other
+// events. Returns false if it cannot be read or never ran.
+static bool perf_read(const PerfCounter *counter, double *value) {
+    // Layout given by PERF_FORMAT_TOTAL_TIME_ENABLED | _RUNNING
+    uint64_t data[3];
+    if (counter->fd < 0
+            || read(counter->fd, data, sizeof data) != (ssize_t) sizeof data
+            || data[2] == 0)
+        return false;
+    *value = (double) data[0];
+    if (data[2] < data[1])
+        *value *= (double) data[1] / (double) data[2];
+    return true;
+}
+
+static void perf_stat_report(void) {
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        if (perf_counters[i].fd >= 0)
+            ioctl(perf_counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    double values[PERF_COUNTERS];
+    bool valid[PERF_COUNTERS];
+    fprintf(stderr, "\nVSOP_PERF_STAT summary:\n");
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        valid[i] = perf_read(&perf_counters[i], &values[i]);
+        if (valid[i])
+            fprintf(stderr, "  %18.0f  %s\n", values[i], perf_counters[i].name);
+        else
+            fprintf(stderr, "  %18s  %s\n", "<not available>",
+                    perf_counters[i].name);
+        if (perf_counters[i].fd >= 0)
+            close(perf_counters[i].fd);
+    }
+
+    // Indices as in perf_counters
+    if (valid[0] && valid[1] && values[0] > 0)
+        fprintf(stderr, "  %18.2f  instructions per cycle\n",
+                values[1] / values[0]);
+}
+
+// Run before main() (and before the program's own constructors, which have
+// the default priority)
+__attribute__((constructor(101)))
+static void perf_stat_start(void) {
+    const char *option = getenv("VSOP_PERF_STAT");
+    if (!option || strcmp(option, "1") != 0)
+        return;
+
+    bool any = false;
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_counters[i].config;
+        attr.read_format =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // Each counter is opened on its own rather than as a group, so that
+        // one missing event does not prevent counting the others
+        long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                          PERF_FLAG_FD_CLOEXEC);
+        perf_counters[i].fd = (int) fd;
+        any |= fd >= 0;
+    }
+
+    if (!any) {
+        fprintf(stderr, "VSOP_PERF_STAT: performance counters are not "
+                        "available (perf_event_open is not permitted or not "
+                        "supported here)\n");
+        return;
+    }
+
+    // Enabled last, so that opening the counters is not counted
+    for (size_t i = 0; i < PERF_COUNTERS; ++i) {
+        if (perf_counters[i].fd >= 0)
+            ioctl(perf_counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    atexit(perf_stat_report);
+}
+
+#endif
+
+// Shared-memory metrics ------------------------------------------------------
+
+// With VSOP_METRICS=1 in the environment, the counters of metrics.h are
+// published in /dev/shm/vsop-<pid> before main(), much like the JVM's
+// hsperfdata, so that vsopstat can read them while the program runs. The
+// file is removed at exit. If it cannot be created, the program runs
+// normally with private counters.
+
+#if defined(__linux__)
+
+static int metrics_fd = -1;
+static size_t metrics_size;
+static char metrics_path[64];
+
+static VsopMetrics *metrics_map(size_t size) {
+    if (ftruncate(metrics_fd, (off_t) size) != 0)
+        return NULL;
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     metrics_fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+// Grow the file for the call counters (see Object___register_calls)
+static VsopMetrics *metrics_resize(size_t size) {
+    VsopMetrics *metrics = metrics_map(size);
+    if (!metrics)
+        return NULL;
+    munmap(Object___metrics, metrics_size);
+    metrics_size = size;
+    return metrics;
+}
+
+static void metrics_remove(void) {
+    unlink(metrics_path);
+}
+
+// Run before main(), like perf_stat_start
+__attribute__((constructor(101)))
+static void metrics_start(void) {
+    const char *option = getenv("VSOP_METRICS");
+    if (!option || strcmp(option, "1") != 0)
+        return;
+
+    snprintf(metrics_path, sizeof metrics_path, "/dev/shm/vsop-%ld",
+             (long) getpid());
+    metrics_fd = open(metrics_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0600);
+    if (metrics_fd < 0)
+        return;
+    VsopMetrics *metrics = metrics_map(sizeof (VsopMetrics));
+    if (!metrics) {
+        close(metrics_fd);
+        unlink(metrics_path);
+        return;
+    }
+
+    memcpy(metrics, Object___metrics, sizeof (VsopMetrics));
+    metrics->pid = (uint64_t) getpid();
+    metrics_size = sizeof (VsopMetrics);
+    Object___metrics = metrics;
+    Object___metrics_resize = metrics_resize;
+    atexit(metrics_remove);
+}
+
+#endif
+
 // Methods --------------------------------------------------------------------
 
 Object *Object__print(Object *self, const char *s) {
-    printf("%s", s); // Note that printf(s) would allow format-string attacks
+    count_written(printf("%s", s)); // printf(s) would allow format-string attacks
+    Object___retain(self); // New reference for the caller
     return self;
 }
 
 Object *Object__printBool(Object *self, bool b) {
-    printf("%s", b ? "true" : "false");
+    count_written(printf("%s", b ? "true" : "false"));
+    Object___retain(self);
     return self;
 }
 
 Object *Object__printInt32(Object *self, int32_t i) {
-    printf("%" PRId32, i); // PRId32 is the printf sequence for int32_t
+    count_written(printf("%" PRId32, i)); // PRId32 is the sequence for int32_t
+    Object___retain(self);
     return self;
 }
 
@@ -137,13 +342,15 @@ int32_t Object__inputInt32(Object *self __attribute__((unused))) {
 // Constructor ----------------------------------------------------------------
 
 Object *Object___new(void) {
-    Object *ret = malloc(sizeof (Object));
+    Object *ret = Object___alloc(sizeof (Object));
     return Object___init(ret);
 }
 
 Object *Object___init(Object *self) {
-    if (self)
+    if (self) {
         self->_vtable = &Object___vtable;
+        self->_refcount = 0;
+    }
     return self;
 }
 
@@ -155,5 +362,6 @@ const ObjectVTable Object___vtable = {
     .printInt32 = &Object__printInt32,
     .inputLine = &Object__inputLine,
     .inputBool = &Object__inputBool,
-    .inputInt32 = &Object__inputInt32
+    .inputInt32 = &Object__inputInt32,
+    ._drop = &Object___drop
 };
@@ -2,6 +2,7 @@
 #define OBJECT_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // Forward declarations for mutually recursive types
@@ -9,11 +10,14 @@ typedef struct Object Object;
 typedef struct ObjectVTable ObjectVTable;
 
 // Type for Object class. Object has no field per se, just the pointer to its
-// virtual function table (vtable).
+// virtual function table (vtable) and its reference count.
 struct Object {
     // Underscore prevents clash with user-defined field, as VSOP identifiers
     // cannot start with underscore
     const ObjectVTable *_vtable;
+    // Number of references to the object when compiled with --memory=rc, 0
+    // for objects that are not reference counted (see below)
+    uint32_t _refcount;
 };
 
 // Type for Object's vtable. Contains one function pointer per method.
@@ -34,6 +38,9 @@ struct ObjectVTable {
     // leading white spaces. In case of error, prints an error message and
     // exits the program.
     int32_t (*inputInt32)(Object *self);
+    // Releases the references held by the object's fields, then frees it.
+    // Called by Object___release when the last reference goes away.
+    void (*_drop)(Object *self);
 };
 
 // We also declare Object's methods directly to allow for static dispatch
@@ -54,4 +61,39 @@ Object *Object___init(Object *self);
 // Object's vtable instance, shared by all Object instances.
 extern const ObjectVTable Object___vtable;
 
+// Reference counting (refcount.c). With --memory=rc, objects start with a
+// count of 1, the generated code retains and releases them, and the last
+// release drops them. Other objects have a count of 0, which retain and
+// release ignore, so that the runtime works the same in both modes. Methods
+// returning an object return a new reference (e.g. print() retains self).
+void Object___retain(Object *self);
+void Object___release(Object *self);
+
+// Object's drop: frees it (Object has no field).
+void Object___drop(Object *self);
+
+// Allocate and free reference counted objects. Freed blocks are kept and
+// reused for the next allocation of the same size.
+void *Object___alloc(size_t size);
+void Object___free(Object *self, size_t size);
+
+// Bump region of an allocation site (vsopc --site-heaps): one per new
+// expression, and one per class for its ___new, zero-initialized in the
+// generated code. Freed objects of the site are kept on its free list.
+typedef struct {
+    char *next;
+    char *end;
+    void *free;
+} SiteRegion;
+
+// Allocate an object for a site, from its free list or else its region, and
+// free it back to its site. Objects larger than 256 bytes come from
+// Object___alloc and go back to Object___free.
+void *Object___site_alloc(SiteRegion *site, size_t size);
+void Object___site_free(Object *self, size_t size);
+
+// Set at startup by programs compiled with --relative-vtables, so that
+// Object___release can find _drop in their vtables
+extern bool Object___relative_vtables;
+
 #endif // OBJECT_H_
@@ -21,10 +21,16 @@ declare i32 @strncmp(i8*, i8*, i64)
 declare i64 @strtoll(i8*, i8**, i32)
 declare i32 @ungetc(i32, %_IO_FILE*)
 
+; Imports from refcount.c
+
+declare void @Object___retain(%Object*)
+declare void @Object___drop(%Object*)
+declare i8* @Object___alloc(i64)
+
 ; Types for Object instances and vtable
 
-%Object = type { %ObjectVTable* }
-%ObjectVTable = type { %Object* (%Object*, i8*)*, %Object* (%Object*, i1)*, %Object* (%Object*, i32)*, i8* (%Object*)*, i1 (%Object*)*, i32 (%Object*)* }
+%Object = type { %ObjectVTable*, i32 }
+%ObjectVTable = type { %Object* (%Object*, i8*)*, %Object* (%Object*, i1)*, %Object* (%Object*, i32)*, i8* (%Object*)*, i1 (%Object*)*, i32 (%Object*)*, void (%Object*)* }
 
 ; String literals
 
@@ -41,12 +47,13 @@ declare i32 @ungetc(i32, %_IO_FILE*)
 
 ; Object's shared vtable instance
 
-@Object___vtable = constant %ObjectVTable { %Object* (%Object*, i8*)* @Object__print, %Object* (%Object*, i1)* @Object__printBool, %Object* (%Object*, i32)* @Object__printInt32, i8* (%Object*)* @Object__inputLine, i1 (%Object*)* @Object__inputBool, i32 (%Object*)* @Object__inputInt32 }
+@Object___vtable = constant %ObjectVTable { %Object* (%Object*, i8*)* @Object__print, %Object* (%Object*, i1)* @Object__printBool, %Object* (%Object*, i32)* @Object__printInt32, i8* (%Object*)* @Object__inputLine, i1 (%Object*)* @Object__inputBool, i32 (%Object*)* @Object__inputInt32, void (%Object*)* @Object___drop }
 
 ; Object's methods
 
 define %Object* @Object__print(%Object*, i8*) {
   %3 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([3 x i8], [3 x i8]* @.str, i64 0, i64 0), i8* %1)
+  call void @Object___retain(%Object* %0)
   ret %Object* %0
 }
 
@@ -56,11 +63,13 @@ define %Object* @Object__printBool(%Object*, i1 zeroext) {
   %5 = zext i1 %4 to i64
   %6 = select i1 %4, i8* getelementptr inbounds ([5 x i8], [5 x i8]* @.str.1, i64 0, i64 0), i8* getelementptr inbounds ([6 x i8], [6 x i8]* @.str.2, i64 0, i64 0)
   %7 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([3 x i8], [3 x i8]* @.str, i64 0, i64 0), i8* %6)
+  call void @Object___retain(%Object* %0)
   ret %Object* %0
 }
 
 define %Object* @Object__printInt32(%Object*, i32) {
   %3 = call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([3 x i8], [3 x i8]* @.str.3, i64 0, i64 0), i32 %1)
+  call void @Object___retain(%Object* %0)
   ret %Object* %0
 }
 
@@ -246,7 +255,7 @@ define i32 @Object__inputInt32(%Object*) {
 ; Object constructor and initializer
 
 define %Object* @Object___new() {
-  %1 = call i8* @malloc(i64 8)
+  %1 = call i8* @Object___alloc(i64 16)
   %2 = bitcast i8* %1 to %Object*
   %3 = call %Object* @Object___init(%Object* %2)
   ret %Object* %3
@@ -259,6 +268,8 @@ define %Object* @Object___init(%Object*) {
 3:                                                ; preds = %1
   %4 = getelementptr inbounds %Object, %Object* %0, i32 0, i32 0
   store %ObjectVTable* @Object___vtable, %ObjectVTable** %4
+  %refcount = getelementptr inbounds %Object, %Object* %0, i32 0, i32 1
+  store i32 0, i32* %refcount
   br label %5
 
 5:                                                ; preds = %3, %1
@@ -0,0 +1,556 @@
+// Freestanding variant of object.c.
+//
+// Implements the same Object interface as object.c, but without any C library:
+// I/O goes through raw read/write system calls, memory comes from mmap, and
+// the process entry point (_start) is provided here. Programs linked against
+// this file with `-static -nostdlib` do not pay for the dynamic loader, libc
+// initialization or stdio, which is most of the runtime of tiny programs.
+//
+// Build with
+//     clang -c -O2 -ffreestanding -fno-builtin -fno-stack-protector
+//           object_freestanding.c -o object_freestanding.o
+// and link with
+//     clang -static -nostdlib my_app.o object_freestanding.o -o my_app
+
+#include "object.h"
+
+#include <stddef.h>
+
+#if !defined(__linux__) || !(defined(__x86_64__) || defined(__aarch64__))
+#error "object_freestanding.c only supports Linux on x86-64 and AArch64"
+#endif
+
+// System calls ---------------------------------------------------------------
+
+#if defined(__x86_64__)
+#define SYS_read        0
+#define SYS_write       1
+#define SYS_open        2
+#define SYS_close       3
+#define SYS_lseek       8
+#define SYS_mmap        9
+#define SYS_madvise     28
+#define SYS_exit_group  231
+
+static long syscall1(long n, long a) {
+    long ret;
+    __asm__ volatile ("syscall"
+                      : "=a"(ret)
+                      : "a"(n), "D"(a)
+                      : "rcx", "r11", "memory");
+    return ret;
+}
+
+static long syscall3(long n, long a, long b, long c) {
+    long ret;
+    __asm__ volatile ("syscall"
+                      : "=a"(ret)
+                      : "a"(n), "D"(a), "S"(b), "d"(c)
+                      : "rcx", "r11", "memory");
+    return ret;
+}
+
+static long syscall6(long n, long a, long b, long c, long d, long e, long f) {
+    long ret;
+    register long r10 __asm__("r10") = d;
+    register long r8 __asm__("r8") = e;
+    register long r9 __asm__("r9") = f;
+    __asm__ volatile ("syscall"
+                      : "=a"(ret)
+                      : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+                      : "rcx", "r11", "memory");
+    return ret;
+}
+#else
+#define SYS_openat      56
+#define SYS_close       57
+#define SYS_lseek       62
+#define SYS_read        63
+#define SYS_write       64
+#define SYS_mmap        222
+#define SYS_madvise     233
+#define SYS_exit_group  94
+
+static long syscall1(long n, long a) {
+    register long x8 __asm__("x8") = n;
+    register long x0 __asm__("x0") = a;
+    __asm__ volatile ("svc 0" : "+r"(x0) : "r"(x8) : "memory");
+    return x0;
+}
+
+static long syscall3(long n, long a, long b, long c) {
+    register long x8 __asm__("x8") = n;
+    register long x0 __asm__("x0") = a;
+    register long x1 __asm__("x1") = b;
+    register long x2 __asm__("x2") = c;
+    __asm__ volatile ("svc 0" : "+r"(x0) : "r"(x8), "r"(x1), "r"(x2) : "memory");
+    return x0;
+}
+
+static long syscall6(long n, long a, long b, long c, long d, long e, long f) {
+    register long x8 __asm__("x8") = n;
+    register long x0 __asm__("x0") = a;
+    register long x1 __asm__("x1") = b;
+    register long x2 __asm__("x2") = c;
+    register long x3 __asm__("x3") = d;
+    register long x4 __asm__("x4") = e;
+    register long x5 __asm__("x5") = f;
+    __asm__ volatile ("svc 0"
+                      : "+r"(x0)
+                      : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5)
+                      : "memory");
+    return x0;
+}
+#endif
+
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define MAP_PRIVATE     0x02
+#define MAP_ANONYMOUS   0x20
+
+static void sys_exit(int status) __attribute__((noreturn));
+static void sys_exit(int status) {
+    for (;;)
+        syscall1(SYS_exit_group, status);
+}
+
+// Write the whole buffer, retrying on short writes.
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        long n = syscall3(SYS_write, fd, (long) buf, (long) len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= (size_t) n;
+    }
+}
+
+// Functions the compiler may emit calls to, even in freestanding mode --------
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    while (n--)
+        *d++ = *s++;
+    return dst;
+}
+
+void *memmove(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    if (d < s) {
+        while (n--)
+            *d++ = *s++;
+    } else {
+        while (n--)
+            d[n] = s[n];
+    }
+    return dst;
+}
+
+void *memset(void *dst, int c, size_t n) {
+    unsigned char *d = dst;
+    while (n--)
+        *d++ = (unsigned char) c;
+    return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const unsigned char *x = a;
+    const unsigned char *y = b;
+    for (size_t i = 0; i < n; ++i) {
+        if (x[i] != y[i])
+            return x[i] - y[i];
+    }
+    return 0;
+}
+
+static size_t str_len(const char *s) {
+    size_t n = 0;
+    while (s[n])
+        ++n;
+    return n;
+}
+
+void *memchr(const void *s, int c, size_t n) {
+    const unsigned char *p = s;
+    for (size_t i = 0; i < n; ++i) {
+        if (p[i] == (unsigned char) c)
+            return (void *) (p + i);
+    }
+    return NULL;
+}
+
+size_t strlen(const char *s) {
+    return str_len(s);
+}
+
+// Memory allocation ----------------------------------------------------------
+
+// Generated code allocates objects with malloc(), so we provide one. Memory is
+// carved out of large mmap'ed chunks by bumping a pointer. Each block keeps its
+// size in a 16-byte header so that realloc() can copy it. free() is a no-op:
+// the programs this runtime targets are short-lived, and the kernel reclaims
+// everything at exit. With --memory=rc, refcount.c recycles freed objects on
+// its own free lists anyway.
+
+#define CHUNK_SIZE  ((size_t) 1 << 20)
+#define HEADER_SIZE ((size_t) 16)
+
+static char *heap_cur;
+static char *heap_end;
+
+void *malloc(size_t size) {
+    size_t needed = HEADER_SIZE + ((size + 15) & ~(size_t) 15);
+    if ((size_t) (heap_end - heap_cur) < needed) {
+        size_t chunk = needed > CHUNK_SIZE ? needed : CHUNK_SIZE;
+        long p = syscall6(SYS_mmap, 0, (long) chunk, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p < 0 && p > -4096)
+            return NULL;
+        heap_cur = (char *) p;
+        heap_end = heap_cur + chunk;
+    }
+    char *block = heap_cur;
+    heap_cur += needed;
+    *(size_t *) block = size;
+    return block + HEADER_SIZE;
+}
+
+void free(void *ptr __attribute__((unused))) {
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (!ptr)
+        return malloc(size);
+    size_t old_size = *(size_t *) ((char *) ptr - HEADER_SIZE);
+    void *ret = malloc(size);
+    if (ret)
+        memcpy(ret, ptr, old_size < size ? old_size : size);
+    return ret;
+}
+
+// Buffered standard streams --------------------------------------------------
+
+static char out_buf[4096];
+static size_t out_len;
+
+static void flush_stdout(void) {
+    write_all(1, out_buf, out_len);
+    out_len = 0;
+}
+
+static void put_str(const char *s, size_t len) {
+    if (len >= sizeof out_buf) {
+        flush_stdout();
+        write_all(1, s, len);
+        return;
+    }
+    if (out_len + len > sizeof out_buf)
+        flush_stdout();
+    memcpy(out_buf + out_len, s, len);
+    out_len += len;
+}
+
+static char in_buf[4096];
+static size_t in_pos;
+static size_t in_len;
+
+#define IN_EOF (-1)
+
+static int get_char(void) {
+    if (in_pos == in_len) {
+        // Make sure prompts are visible before blocking on input
+        flush_stdout();
+        long n = syscall3(SYS_read, 0, (long) in_buf, sizeof in_buf);
+        if (n <= 0)
+            return IN_EOF;
+        in_pos = 0;
+        in_len = (size_t) n;
+    }
+    return (unsigned char) in_buf[in_pos++];
+}
+
+// Only ever called right after a successful get_char(), so the character is
+// still in the buffer.
+static void unget_char(void) {
+    --in_pos;
+}
+
+// Print an error message on stderr and exit, like the fprintf/exit pairs in
+// object.c.
+static void fail(const char *method, const char *word, const char *msg)
+    __attribute__((noreturn));
+static void fail(const char *method, const char *word, const char *msg) {
+    flush_stdout();
+    write_all(2, method, str_len(method));
+    if (word) {
+        write_all(2, ": `", 3);
+        write_all(2, word, str_len(word));
+        write_all(2, "` ", 2);
+    } else {
+        write_all(2, ": ", 2);
+    }
+    write_all(2, msg, str_len(msg));
+    write_all(2, "\n", 1);
+    sys_exit(1);
+}
+
+// System interface for the built-in classes ---------------------------------
+
+// The built-in classes (e.g. file.c) are written against the usual POSIX
+// calls, so provide the few they use. As in the C library, errors return -1.
+
+static long sys_result(long ret) {
+    return ret < 0 && ret > -4096 ? -1 : ret;
+}
+
+int open(const char *path, int flags, ...) {
+#if defined(__x86_64__)
+    return (int) sys_result(syscall3(SYS_open, (long) path, flags, 0));
+#else
+    return (int) sys_result(syscall6(SYS_openat, -100 /* AT_FDCWD */, (long) path, flags, 0, 0, 0));
+#endif
+}
+
+int close(int fd) {
+    return (int) sys_result(syscall1(SYS_close, fd));
+}
+
+long lseek(int fd, long offset, int whence) {
+    return sys_result(syscall3(SYS_lseek, fd, offset, whence));
+}
+
+long write(int fd, const void *buf, size_t len) {
+    return sys_result(syscall3(SYS_write, fd, (long) buf, (long) len));
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, long offset) {
+    // MAP_FAILED is (void *) -1
+    return (void *) sys_result(syscall6(SYS_mmap, (long) addr, (long) len, prot, flags, fd, offset));
+}
+
+int madvise(void *addr, size_t len, int advice) {
+    return (int) sys_result(syscall3(SYS_madvise, (long) addr, (long) len, advice));
+}
+
+void exit(int status) __attribute__((noreturn));
+void exit(int status) {
+    flush_stdout();
+    sys_exit(status);
+}
+
+// Utility functions ----------------------------------------------------------
+
+static int is_space(int c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int is_eol(int c) {
+    return c == '\n';
+}
+
+// Same contract as read_until() in object.c.
+static char *read_until(int (*predicate)(int)) {
+    size_t n = 1024;
+    char *buf = malloc(n);
+    size_t i = 0;
+    while (buf) {
+        int c = get_char();
+        if (c == IN_EOF || predicate(c)) {
+            if (c != IN_EOF)
+                unget_char();
+            buf[i] = '\0';
+            return buf;
+        }
+        buf[i] = (char) c;
+        if (i == n - 1) {
+            n *= 2;
+            buf = realloc(buf, n);
+        }
+        ++i;
+    }
+    return NULL;
+}
+
+static void skip_while(int (*predicate)(int)) {
+    int c = get_char();
+    while (c != IN_EOF && predicate(c))
+        c = get_char();
+    if (c != IN_EOF)
+        unget_char();
+}
+
+static int digit_value(char c, int base) {
+    int v;
+    if (c >= '0' && c <= '9')
+        v = c - '0';
+    else if (c >= 'a' && c <= 'f')
+        v = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+        v = c - 'A' + 10;
+    else
+        return -1;
+    return v < base ? v : -1;
+}
+
+// Methods --------------------------------------------------------------------
+
+Object *Object__print(Object *self, const char *s) {
+    put_str(s, str_len(s));
+    Object___retain(self); // New reference for the caller
+    return self;
+}
+
+Object *Object__printBool(Object *self, bool b) {
+    if (b)
+        put_str("true", 4);
+    else
+        put_str("false", 5);
+    Object___retain(self);
+    return self;
+}
+
+Object *Object__printInt32(Object *self, int32_t i) {
+    char buf[12];
+    char *p = buf + sizeof buf;
+    // Work on the unsigned magnitude so that INT32_MIN does not overflow
+    uint32_t u = i < 0 ? 0u - (uint32_t) i : (uint32_t) i;
+    do {
+        *--p = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (i < 0)
+        *--p = '-';
+    put_str(p, (size_t) (buf + sizeof buf - p));
+    Object___retain(self);
+    return self;
+}
+
+char *Object__inputLine(Object *self __attribute__((unused))) {
+    char *line = read_until(is_eol);
+    if (!line)
+        line = "";
+    return line;
+}
+
+bool Object__inputBool(Object *self __attribute__((unused))) {
+    skip_while(is_space);
+    char *word = read_until(is_space);
+    if (!word)
+        fail("Object::inputBool", NULL, "cannot read word!");
+
+    size_t len = str_len(word);
+    if (len == 4 && memcmp(word, "true", 4) == 0)
+        return true;
+    if (len == 5 && memcmp(word, "false", 5) == 0)
+        return false;
+    fail("Object::inputBool", word, "is not a valid boolean!");
+}
+
+int32_t Object__inputInt32(Object *self __attribute__((unused))) {
+    skip_while(is_space);
+    char *word = read_until(is_space);
+    if (!word)
+        fail("Object::inputInt32", NULL, "cannot read word!");
+
+    // Same accepted syntax as object.c: optional sign, then a decimal or
+    // 0x-prefixed hexadecimal literal (no octal).
+    const char *p = word;
+    bool negative = false;
+    if (*p == '+' || *p == '-') {
+        negative = *p == '-';
+        ++p;
+    }
+    int base = 10;
+    if (p[0] == '0' && p[1] == 'x' && p[2] != '\0') {
+        base = 16;
+        p += 2;
+    }
+    if (*p == '\0')
+        fail("Object::inputInt32", word, "is not a valid integer literal!");
+
+    int64_t value = 0;
+    for (; *p; ++p) {
+        int d = digit_value(*p, base);
+        if (d < 0)
+            fail("Object::inputInt32", word, "is not a valid integer literal!");
+        value = value * base + d;
+        if (value > (int64_t) INT32_MAX + 1)
+            fail("Object::inputInt32", word, "does not fit a 32-bit integer!");
+    }
+    if (negative)
+        value = -value;
+    if (value < INT32_MIN || value > INT32_MAX)
+        fail("Object::inputInt32", word, "does not fit a 32-bit integer!");
+
+    return (int32_t) value;
+}
+
+// Constructor ----------------------------------------------------------------
+
+Object *Object___new(void) {
+    Object *ret = Object___alloc(sizeof (Object));
+    return Object___init(ret);
+}
+
+Object *Object___init(Object *self) {
+    if (self) {
+        self->_vtable = &Object___vtable;
+        self->_refcount = 0;
+    }
+    return self;
+}
+
+// Virtual function table instance --------------------------------------------
+
+const ObjectVTable Object___vtable = {
+    .print = &Object__print,
+    .printBool = &Object__printBool,
+    .printInt32 = &Object__printInt32,
+    .inputLine = &Object__inputLine,
+    .inputBool = &Object__inputBool,
+    .inputInt32 = &Object__inputInt32,
+    ._drop = &Object___drop
+};
+
+// Process entry point --------------------------------------------------------
+
+// Generated by vsopc: creates a Main instance and returns Main.main()'s result.
+int main(void);
+
+__attribute__((used, noreturn))
+void vsop_start(long *sp __attribute__((unused))) {
+    int status = main();
+    flush_stdout();
+    sys_exit(status);
+}
+
+// The kernel jumps here with the stack pointer on argc. We do not need
+// argc/argv, but we still pass the initial stack pointer along and realign
+// the stack as the ABI requires before calling into C.
+#if defined(__x86_64__)
+__asm__(
+    ".text\n"
+    ".global _start\n"
+    ".type _start, @function\n"
+    "_start:\n"
+    "    xor %rbp, %rbp\n"
+    "    mov %rsp, %rdi\n"
+    "    and $-16, %rsp\n"
+    "    call vsop_start\n"
+    "    hlt\n");
+#else
+__asm__(
+    ".text\n"
+    ".global _start\n"
+    ".type _start, %function\n"
+    "_start:\n"
+    "    mov x29, #0\n"
+    "    mov x30, #0\n"
+    "    mov x0, sp\n"
+    "    and x1, x0, #-16\n"
+    "    mov sp, x1\n"
+    "    bl vsop_start\n"
+    "    brk #0\n");
+#endif
@@ -0,0 +1,158 @@
+// Reference counting support for --memory=rc, see object.h.
+//
+// Like stringmap.c, this file only needs malloc and free, so that it can be
+// linked with either runtime.
+
+#include "object.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+
+bool Object___relative_vtables = false;
+
+// Free lists -----------------------------------------------------------------
+
+// Objects are small and a program allocates many of the same classes, so
+// freed blocks are kept in one list per size (in steps of 8 bytes) and handed
+// out again for the next allocation of that size, without going through
+// malloc. The first word of a free block links to the next one.
+#define SIZE_STEP       8
+#define MAX_CACHED_SIZE 256
+
+static void *free_lists[MAX_CACHED_SIZE / SIZE_STEP + 1];
+
+static size_t size_class(size_t size) {
+    return (size + SIZE_STEP - 1) / SIZE_STEP;
+}
+
+void *Object___alloc(size_t size) {
+    metrics_add(&Object___metrics->objects_allocated, 1);
+    metrics_add(&Object___metrics->bytes_allocated, size);
+    if (size <= MAX_CACHED_SIZE) {
+        size_t index = size_class(size);
+        void *block = free_lists[index];
+        if (block) {
+            free_lists[index] = *(void **) block;
+            return block;
+        }
+        // Allocate the whole size class, so that the block fits any object
+        // of the class when reused
+        return malloc(index * SIZE_STEP);
+    }
+    return malloc(size);
+}
+
+void Object___free(Object *self, size_t size) {
+    metrics_add(&Object___metrics->objects_freed, 1);
+    if (size <= MAX_CACHED_SIZE) {
+        size_t index = size_class(size);
+        *(void **) self = free_lists[index];
+        free_lists[index] = self;
+        return;
+    }
+    free(self);
+}
+
+// Allocation sites -----------------------------------------------------------
+
+// Each site bumps its objects out of chunks of its own, so that the objects
+// created by one new expression (say, the nodes of a list) are contiguous in
+// memory instead of interleaved with everything else the program allocates.
+// A site only creates objects of one class, so it keeps a single free list,
+// reused before bumping: freed objects stay with their site. Chunks are
+// aligned on their size and start with their site, so that
+// Object___site_free finds it from the object's address. They are carved out
+// of larger blocks from malloc, to keep the alignment cheap, and never
+// returned.
+#define SITE_CHUNK_SIZE  (64 * 1024)
+#define SITE_SLAB_CHUNKS 16
+
+typedef struct {
+    SiteRegion *site;
+} SiteChunk;
+
+static char *slab_next, *slab_end;
+
+static SiteChunk *site_chunk(Object *self) {
+    return (SiteChunk *) ((uintptr_t) self & ~(uintptr_t) (SITE_CHUNK_SIZE - 1));
+}
+
+static SiteChunk *new_site_chunk(SiteRegion *site) {
+    if (slab_next == slab_end) {
+        // One more chunk than handed out, to align the first one
+        char *slab = malloc((SITE_SLAB_CHUNKS + 1) * SITE_CHUNK_SIZE);
+        if (!slab)
+            return NULL;
+        slab_next = (char *) site_chunk((Object *) (slab + SITE_CHUNK_SIZE - 1));
+        slab_end = slab_next + SITE_SLAB_CHUNKS * SITE_CHUNK_SIZE;
+    }
+    SiteChunk *chunk = (SiteChunk *) slab_next;
+    slab_next += SITE_CHUNK_SIZE;
+    chunk->site = site;
+    return chunk;
+}
+
+void *Object___site_alloc(SiteRegion *site, size_t size) {
+    if (size > MAX_CACHED_SIZE)
+        return Object___alloc(size);
+    metrics_add(&Object___metrics->objects_allocated, 1);
+    metrics_add(&Object___metrics->bytes_allocated, size);
+    void *block = site->free;
+    if (block) {
+        site->free = *(void **) block;
+        return block;
+    }
+    // Whole size classes, as for Object___alloc. The rest of a chunk too
+    // small for the object is left unused.
+    size_t rounded = size_class(size) * SIZE_STEP;
+    if ((size_t) (site->end - site->next) < rounded) {
+        SiteChunk *chunk = new_site_chunk(site);
+        if (!chunk)
+            return NULL;
+        site->next = (char *) (chunk + 1);
+        site->end = (char *) chunk + SITE_CHUNK_SIZE;
+    }
+    block = site->next;
+    site->next += rounded;
+    return block;
+}
+
+void Object___site_free(Object *self, size_t size) {
+    if (size > MAX_CACHED_SIZE) {
+        Object___free(self, size);
+        return;
+    }
+    metrics_add(&Object___metrics->objects_freed, 1);
+    SiteRegion *site = site_chunk(self)->site;
+    *(void **) self = site->free;
+    site->free = self;
+}
+
+// Counting -------------------------------------------------------------------
+
+// Index of _drop in the vtables (function pointers, or 32-bit offsets with
+// relative vtables)
+#define DROP_SLOT (offsetof(ObjectVTable, _drop) / sizeof (void (*)(void)))
+
+static void (*drop_function(Object *self))(Object *) {
+    if (Object___relative_vtables) {
+        const char *vtable = (const char *) self->_vtable;
+        int32_t offset = ((const int32_t *) vtable)[DROP_SLOT];
+        return (void (*)(Object *)) (vtable + offset);
+    }
+    return self->_vtable->_drop;
+}
+
+void Object___retain(Object *self) {
+    if (self && self->_refcount)
+        ++self->_refcount;
+}
+
+void Object___release(Object *self) {
+    if (self && self->_refcount && --self->_refcount == 0)
+        drop_function(self)(self);
+}
+
+void Object___drop(Object *self) {
+    Object___free(self, sizeof (Object));
+}
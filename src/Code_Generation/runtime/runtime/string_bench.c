@@ -0,0 +1,109 @@
+// Micro-benchmark of the string methods (string_methods.c) against the
+// byte-at-a-time loops they replace. Build with `make string_bench`, and run
+// it without arguments: it uses the kernels the runtime picks for the
+// processor (AVX2 on x86-64-v3 and above, SSE2 otherwise).
+//
+// Each method runs on a 64 KiB string of pseudo-random lowercase letters,
+// with the searched or compared string placed at its very end, and the best
+// of several runs is reported.
+
+#include "string_methods.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TEXT_SIZE  (64 * 1024)
+#define ITERATIONS 2000
+#define RUNS       5
+
+// Naive loops ----------------------------------------------------------------
+
+static int32_t naive_length(const char *s) {
+    int32_t length = 0;
+    while (s[length])
+        ++length;
+    return length;
+}
+
+static int32_t naive_index_of(const char *self, const char *s) {
+    for (int32_t i = 0; self[i]; ++i) {
+        int32_t j = 0;
+        while (s[j] && self[i + j] == s[j])
+            ++j;
+        if (!s[j])
+            return i;
+    }
+    return s[0] ? -1 : 0;
+}
+
+static bool naive_equals(const char *self, const char *s) {
+    while (*self && *self == *s) {
+        ++self;
+        ++s;
+    }
+    return *self == *s;
+}
+
+// Timing ---------------------------------------------------------------------
+
+// Keeps the results alive, so that the calls are not optimized away
+static volatile int64_t sink;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Best time of RUNS runs of ITERATIONS calls, in microseconds per call
+#define BENCH(result, call)                                   \
+    do {                                                      \
+        double best = 1e30;                                   \
+        for (int run = 0; run < RUNS; ++run) {                \
+            double start = now();                             \
+            for (int i = 0; i < ITERATIONS; ++i)              \
+                sink += (int64_t) (call);                     \
+            double elapsed = now() - start;                   \
+            if (elapsed < best)                               \
+                best = elapsed;                               \
+        }                                                     \
+        result = best * 1e6 / ITERATIONS;                     \
+    } while (0)
+
+static void report(const char *name, double naive, double vectorized) {
+    printf("%-8s %10.2f us %10.2f us %8.1fx\n", name, naive, vectorized, naive / vectorized);
+}
+
+int main(void) {
+    char *text = malloc(TEXT_SIZE + 1);
+    char *copy = malloc(TEXT_SIZE + 1);
+    srand(42);
+    for (int i = 0; i < TEXT_SIZE; ++i)
+        text[i] = (char) ('a' + rand() % 26);
+    text[TEXT_SIZE] = '\0';
+    const char *needle = "needle-at-the-end";
+    memcpy(text + TEXT_SIZE - strlen(needle), needle, strlen(needle));
+    memcpy(copy, text, TEXT_SIZE + 1);
+
+    if (String__length(text) != naive_length(text)
+        || String__indexOf(text, needle) != naive_index_of(text, needle)
+        || String__equals(text, copy) != naive_equals(text, copy)) {
+        fprintf(stderr, "string_bench: results differ from the naive loops\n");
+        return 1;
+    }
+
+    printf("%-8s %13s %13s %9s\n", "method", "naive", "vectorized", "speedup");
+    double naive, vectorized;
+    BENCH(naive, naive_length(text));
+    BENCH(vectorized, String__length(text));
+    report("length", naive, vectorized);
+    BENCH(naive, naive_index_of(text, needle));
+    BENCH(vectorized, String__indexOf(text, needle));
+    report("indexOf", naive, vectorized);
+    BENCH(naive, naive_equals(text, copy));
+    BENCH(vectorized, String__equals(text, copy));
+    report("equals", naive, vectorized);
+    return 0;
+}
@@ -0,0 +1,105 @@
+// Kernels of the string methods, see string_methods.c.
+//
+// This file has no include guard: string_methods.c includes it once for each
+// instruction set, after defining
+//   KERNEL(name)     the name of a kernel for that instruction set
+//   KERNEL_TARGET    the attributes of the kernels (e.g. target("avx2"))
+// and, for vector kernels,
+//   VECTOR_SIZE      bytes per vector
+//   VECTOR_ALL       mask of VECTOR_MATCH when all bytes match
+//   vector           the vector type
+//   VECTOR_LOAD(p)   unaligned load of the bytes at p
+//   VECTOR_SPLAT(c)  vector of c bytes
+//   VECTOR_MATCH(a, b)  bit i set if byte i of a equals byte i of b
+//   VECTOR_MIN(a, b) bytewise unsigned minimum (zero if either byte is)
+// Without VECTOR_SIZE, the kernels are plain loops.
+
+// Number of bytes before the terminator of s
+KERNEL_TARGET static size_t KERNEL(string_length)(const char *s) {
+#if defined(VECTOR_SIZE)
+    // The terminator is searched for a whole aligned block at a time. An
+    // aligned block never crosses a page boundary, so reading the bytes of
+    // the first block before s, or of the last one after the terminator, is
+    // safe; the former are shifted out of the mask.
+    size_t offset = (uintptr_t) s % VECTOR_SIZE;
+    const char *block = s - offset;
+    vector zero = VECTOR_SPLAT(0);
+    uint32_t mask = VECTOR_MATCH(VECTOR_LOAD(block), zero) >> offset;
+    if (mask)
+        return (size_t) __builtin_ctz(mask);
+
+    // Then four blocks at a time once aligned on four (as a page holds a
+    // multiple of four blocks, they do not cross a page boundary either),
+    // checking which one holds the terminator only when one does
+    for (block += VECTOR_SIZE; (uintptr_t) block % (4 * VECTOR_SIZE) != 0; block += VECTOR_SIZE) {
+        mask = VECTOR_MATCH(VECTOR_LOAD(block), zero);
+        if (mask)
+            return (size_t) (block - s) + (size_t) __builtin_ctz(mask);
+    }
+    for (;; block += 4 * VECTOR_SIZE) {
+        vector v0 = VECTOR_LOAD(block);
+        vector v1 = VECTOR_LOAD(block + VECTOR_SIZE);
+        vector v2 = VECTOR_LOAD(block + 2 * VECTOR_SIZE);
+        vector v3 = VECTOR_LOAD(block + 3 * VECTOR_SIZE);
+        if (VECTOR_MATCH(VECTOR_MIN(VECTOR_MIN(v0, v1), VECTOR_MIN(v2, v3)), zero) == 0)
+            continue;
+        for (;; block += VECTOR_SIZE) {
+            mask = VECTOR_MATCH(VECTOR_LOAD(block), zero);
+            if (mask)
+                return (size_t) (block - s) + (size_t) __builtin_ctz(mask);
+        }
+    }
+#else
+    size_t length = 0;
+    while (s[length])
+        ++length;
+    return length;
+#endif
+}
+
+// Whether the n bytes at a and b are the same
+KERNEL_TARGET static bool KERNEL(same_bytes)(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+#if defined(VECTOR_SIZE)
+    for (; i + VECTOR_SIZE <= n; i += VECTOR_SIZE) {
+        if (VECTOR_MATCH(VECTOR_LOAD(a + i), VECTOR_LOAD(b + i)) != VECTOR_ALL)
+            return false;
+    }
+#endif
+    for (; i < n; ++i) {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+// Position of the first occurrence of the m bytes of s in the n bytes of
+// self, -1 if none (0 < m <= n)
+KERNEL_TARGET static int32_t KERNEL(index_of)(const char *self, size_t n, const char *s, size_t m) {
+    size_t i = 0;
+#if defined(VECTOR_SIZE)
+    // Candidate positions are the ones where both the first and the last
+    // byte of s match: two comparisons test a whole block of positions, and
+    // the other bytes of s are only compared at the candidates, which are
+    // rare unless s starts and ends with common bytes (W. Muła, "SIMD-friendly
+    // algorithms for substring searching", 2016). Blocks stop where the last
+    // byte would be read past the end of self.
+    vector first = VECTOR_SPLAT(s[0]);
+    vector last = VECTOR_SPLAT(s[m - 1]);
+    for (; i + m - 1 + VECTOR_SIZE <= n; i += VECTOR_SIZE) {
+        uint32_t mask = VECTOR_MATCH(VECTOR_LOAD(self + i), first)
+                      & VECTOR_MATCH(VECTOR_LOAD(self + i + m - 1), last);
+        while (mask) {
+            size_t candidate = i + (size_t) __builtin_ctz(mask);
+            if (m <= 2 || KERNEL(same_bytes)(self + candidate + 1, s + 1, m - 2))
+                return (int32_t) candidate;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + m <= n; ++i) {
+        if (self[i] == s[0] && KERNEL(same_bytes)(self + i, s, m))
+            return (int32_t) i;
+    }
+    return -1;
+}
@@ -0,0 +1,151 @@
+// Methods of the string type, see string_methods.h.
+//
+// Like stringmap.c, this file only needs malloc and memcpy (and cpu.c), so that
+// it can be linked both with object.c and with object_freestanding.c (which
+// provides them). Build the freestanding variant with the same flags as
+// object_freestanding.c.
+
+#include "string_methods.h"
+#include "cpu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Kernels --------------------------------------------------------------------
+
+// The kernels (string_kernels.h) are compiled for each instruction set the
+// runtime can use, whatever the flags of this file: SSE2, which every x86-64
+// processor has, and AVX2, whose kernels carry target("avx2") and only run
+// where Object___cpu_level() reports x86-64-v3. Elsewhere, they are plain
+// loops.
+typedef struct {
+    size_t (*string_length)(const char *s);
+    bool (*same_bytes)(const char *a, const char *b, size_t n);
+    int32_t (*index_of)(const char *self, size_t n, const char *s, size_t m);
+} StringKernels;
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+#define KERNEL(name)        name##_sse2
+#define KERNEL_TARGET
+#define VECTOR_SIZE         16
+#define VECTOR_ALL          0xFFFFu
+#define vector              __m128i
+#define VECTOR_LOAD(p)      _mm_loadu_si128((const __m128i *) (p))
+#define VECTOR_SPLAT(c)     _mm_set1_epi8(c)
+#define VECTOR_MATCH(a, b)  ((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)))
+#define VECTOR_MIN(a, b)    _mm_min_epu8(a, b)
+#include "string_kernels.h"
+#undef KERNEL
+#undef KERNEL_TARGET
+#undef VECTOR_SIZE
+#undef VECTOR_ALL
+#undef vector
+#undef VECTOR_LOAD
+#undef VECTOR_SPLAT
+#undef VECTOR_MATCH
+#undef VECTOR_MIN
+
+#define KERNEL(name)        name##_avx2
+#define KERNEL_TARGET       __attribute__((target("avx2")))
+#define VECTOR_SIZE         32
+#define VECTOR_ALL          0xFFFFFFFFu
+#define vector              __m256i
+#define VECTOR_LOAD(p)      _mm256_loadu_si256((const __m256i *) (p))
+#define VECTOR_SPLAT(c)     _mm256_set1_epi8(c)
+#define VECTOR_MATCH(a, b)  ((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)))
+#define VECTOR_MIN(a, b)    _mm256_min_epu8(a, b)
+#include "string_kernels.h"
+#undef KERNEL
+#undef KERNEL_TARGET
+#undef VECTOR_SIZE
+#undef VECTOR_ALL
+#undef vector
+#undef VECTOR_LOAD
+#undef VECTOR_SPLAT
+#undef VECTOR_MATCH
+#undef VECTOR_MIN
+
+static const StringKernels sse2_kernels = {string_length_sse2, same_bytes_sse2, index_of_sse2};
+static const StringKernels avx2_kernels = {string_length_avx2, same_bytes_avx2, index_of_avx2};
+#else
+#define KERNEL(name)        name##_scalar
+#define KERNEL_TARGET
+#include "string_kernels.h"
+#undef KERNEL
+#undef KERNEL_TARGET
+
+static const StringKernels scalar_kernels = {string_length_scalar, same_bytes_scalar, index_of_scalar};
+#endif
+
+// The kernels for the running processor, chosen by the first string method
+// called (the freestanding runtime runs no constructors)
+static const StringKernels *kernels;
+
+static const StringKernels *string_kernels(void) {
+    if (!kernels) {
+#if defined(__x86_64__)
+        kernels = Object___cpu_level() >= 3 ? &avx2_kernels : &sse2_kernels;
+#else
+        kernels = &scalar_kernels;
+#endif
+    }
+    return kernels;
+}
+
+static size_t string_length(const char *s) {
+    return string_kernels()->string_length(s);
+}
+
+// Copy of the n bytes at s, terminated
+static char *copy_bytes(const char *s, size_t n) {
+    char *copy = malloc(n + 1);
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    return copy;
+}
+
+// Methods --------------------------------------------------------------------
+
+int32_t String__length(const char *self) {
+    return (int32_t) string_length(self);
+}
+
+char *String__concat(const char *self, const char *s) {
+    size_t self_length = string_length(self);
+    size_t s_length = string_length(s);
+    char *result = malloc(self_length + s_length + 1);
+    memcpy(result, self, self_length);
+    memcpy(result + self_length, s, s_length + 1);
+    return result;
+}
+
+char *String__substr(const char *self, int32_t start, int32_t length) {
+    size_t self_length = string_length(self);
+    size_t begin = start < 0 ? 0 : (size_t) start;
+    if (begin > self_length)
+        begin = self_length;
+    size_t count = length < 0 ? 0 : (size_t) length;
+    if (count > self_length - begin)
+        count = self_length - begin;
+    return copy_bytes(self + begin, count);
+}
+
+int32_t String__indexOf(const char *self, const char *s) {
+    size_t n = string_length(self);
+    size_t m = string_length(s);
+    if (m == 0)
+        return 0;
+    if (m > n)
+        return -1;
+
+    return string_kernels()->index_of(self, n, s, m);
+}
+
+bool String__equals(const char *self, const char *s) {
+    if (self == s)
+        return true;
+    size_t length = string_length(self);
+    return length == string_length(s) && string_kernels()->same_bytes(self, s, length);
+}
@@ -0,0 +1,36 @@
+#ifndef STRING_METHODS_H_
+#define STRING_METHODS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Methods of VSOP's string type. Strings are NUL-terminated byte strings, and
+// methods are functions taking the string as first argument, called directly
+// by the generated code (e.g. s.indexOf("x") is String__indexOf(s, "x")).
+// Lengths and positions count bytes. Strings are never modified: concat and
+// substr return new ones, which are never freed.
+//
+// The kernels work on 16 bytes at a time with SSE2 on x86-64, and 32 with AVX2
+// on the processors that have it (chosen when the first method runs), with
+// plain loops elsewhere. Like stringmap.c, this file only needs malloc and
+// memcpy (and cpu.c), so that it can be linked both with object.c and with
+// object_freestanding.c.
+
+// Number of bytes of self
+int32_t String__length(const char *self);
+
+// self followed by s
+char *String__concat(const char *self, const char *s);
+
+// The length bytes of self starting at start, both clamped to self (a
+// negative start counts as 0, and so does a negative length)
+char *String__substr(const char *self, int32_t start, int32_t length);
+
+// Position of the first occurrence of s in self, -1 if none (0 if s is
+// empty)
+int32_t String__indexOf(const char *self, const char *s);
+
+// Whether self and s hold the same bytes
+bool String__equals(const char *self, const char *s);
+
+#endif // STRING_METHODS_H_
@@ -0,0 +1,306 @@
+// Built-in StringMap class, see stringmap.h.
+//
+// Besides refcount.c, this file only needs malloc, free, memset and memcmp,
+// so that it can be linked both with object.c and with object_freestanding.c
+// (which provides them). Build the freestanding variant with the same flags
+// as object_freestanding.c.
+
+#include "stringmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Control bytes --------------------------------------------------------------
+
+// A control byte is negative for empty and deleted slots, and holds the low 7
+// bits of the key's hash (0 to 127) for used slots.
+#define CTRL_EMPTY   ((int8_t) -128)
+#define CTRL_DELETED ((int8_t) -2)
+
+// Slots are probed by groups of GROUP_SIZE consecutive control bytes
+#define GROUP_SIZE 16
+#define MIN_CAPACITY GROUP_SIZE
+
+// Bit i of the result is set if control byte i of the group equals the given
+// byte.
+static inline uint32_t group_match(const int8_t *group, int8_t byte) {
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; ++i)
+        mask |= (uint32_t) (group[i] == byte) << i;
+    return mask;
+#endif
+}
+
+// Bit i of the result is set if slot i of the group is empty or deleted,
+// i.e. if its control byte is negative.
+static inline uint32_t group_match_free(const int8_t *group) {
+#if defined(__SSE2__)
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; ++i)
+        mask |= (uint32_t) (group[i] < 0) << i;
+    return mask;
+#endif
+}
+
+// Hashing --------------------------------------------------------------------
+
+// FNV-1a over the bytes of the key, followed by a final mix so that the low 7
+// bits (stored in the control bytes) and the high bits (used to pick the
+// first group) are both well distributed. Also returns the key's length, to
+// avoid a separate strlen().
+static uint64_t hash_key(const char *key, size_t *length) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const unsigned char *p = (const unsigned char *) key;
+    while (*p) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    *length = (size_t) (p - (const unsigned char *) key);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline int8_t hash_ctrl(uint64_t hash) {
+    return (int8_t) (hash & 0x7f);
+}
+
+// Index of the first group to probe
+static inline uint32_t hash_group(uint64_t hash, uint32_t group_mask) {
+    return (uint32_t) (hash >> 7) & group_mask;
+}
+
+// Table management -----------------------------------------------------------
+
+// At most 7/8 of the slots are used (by keys or tombstones)
+static uint32_t max_load(uint32_t capacity) {
+    return capacity - capacity / 8;
+}
+
+// Allocate empty storage for the given capacity. Returns false if out of
+// memory, leaving the map unchanged.
+static bool allocate(StringMap *self, uint32_t capacity) {
+    int8_t *ctrl = malloc(capacity);
+    StringMapSlot *slots = malloc(capacity * sizeof (StringMapSlot));
+    if (!ctrl || !slots) {
+        free(ctrl);
+        free(slots);
+        return false;
+    }
+    memset(ctrl, CTRL_EMPTY, capacity);
+
+    self->_ctrl = ctrl;
+    self->_slots = slots;
+    self->_capacity = capacity;
+    self->_growth_left = max_load(capacity);
+    return true;
+}
+
+// Index of the slot holding the given key, or -1 if it is not in the map.
+static int64_t find(const StringMap *self, const char *key, uint64_t hash,
+                    size_t length) {
+    if (self->_capacity == 0)
+        return -1;
+
+    uint32_t group_mask = self->_capacity / GROUP_SIZE - 1;
+    uint32_t group = hash_group(hash, group_mask);
+    int8_t ctrl = hash_ctrl(hash);
+
+    // Triangular probing visits every group once as the number of groups is a
+    // power of two
+    for (uint32_t step = 1; step <= group_mask + 1; ++step) {
+        const int8_t *group_ctrl = self->_ctrl + group * GROUP_SIZE;
+        for (uint32_t match = group_match(group_ctrl, ctrl); match;
+             match &= match - 1) {
+            uint32_t index = group * GROUP_SIZE + (uint32_t) __builtin_ctz(match);
+            const StringMapSlot *slot = &self->_slots[index];
+            if (slot->hash == hash && slot->length == length
+                && (slot->key == key || memcmp(slot->key, key, length) == 0))
+                return index;
+        }
+        // An empty slot ends the probe sequence of every key
+        if (group_match(group_ctrl, CTRL_EMPTY))
+            return -1;
+        group = (group + step) & group_mask;
+    }
+    return -1;
+}
+
+// Index of the first empty or deleted slot along the probe sequence of the
+// given hash. The table must have at least one such slot.
+static uint32_t find_free(const StringMap *self, uint64_t hash) {
+    uint32_t group_mask = self->_capacity / GROUP_SIZE - 1;
+    uint32_t group = hash_group(hash, group_mask);
+    for (uint32_t step = 1;; ++step) {
+        uint32_t match = group_match_free(self->_ctrl + group * GROUP_SIZE);
+        if (match)
+            return group * GROUP_SIZE + (uint32_t) __builtin_ctz(match);
+        group = (group + step) & group_mask;
+    }
+}
+
+// Move all keys to new storage of the given capacity, dropping tombstones.
+// The cached hashes are reused. Returns false if out of memory.
+static bool resize(StringMap *self, uint32_t capacity) {
+    int8_t *old_ctrl = self->_ctrl;
+    StringMapSlot *old_slots = self->_slots;
+    uint32_t old_capacity = self->_capacity;
+
+    if (!allocate(self, capacity))
+        return false;
+
+    for (uint32_t i = 0; i < old_capacity; ++i) {
+        if (old_ctrl[i] < 0)
+            continue;
+        uint32_t index = find_free(self, old_slots[i].hash);
+        self->_ctrl[index] = old_ctrl[i];
+        self->_slots[index] = old_slots[i];
+    }
+    self->_growth_left -= self->_size;
+
+    free(old_ctrl);
+    free(old_slots);
+    return true;
+}
+
+// Make room for one more key. When most of the used slots are tombstones,
+// the table is rebuilt at the same size instead of growing.
+static bool reserve_one(StringMap *self) {
+    if (self->_growth_left > 0)
+        return true;
+    if (self->_capacity == 0)
+        return allocate(self, MIN_CAPACITY);
+    uint32_t capacity = self->_capacity;
+    if (self->_size >= max_load(capacity) / 2)
+        capacity *= 2;
+    return resize(self, capacity);
+}
+
+// Methods --------------------------------------------------------------------
+
+Object *StringMap__get(StringMap *self, const char *key) {
+    size_t length;
+    uint64_t hash = hash_key(key, &length);
+    int64_t index = find(self, key, hash, length);
+    if (index < 0)
+        return NULL;
+    // New reference for the caller (see object.h)
+    Object___retain(self->_slots[index].value);
+    return self->_slots[index].value;
+}
+
+StringMap *StringMap__put(StringMap *self, const char *key, Object *value) {
+    size_t length;
+    uint64_t hash = hash_key(key, &length);
+    int64_t index = find(self, key, hash, length);
+    // The map holds a reference to its values, and put() returns a new
+    // reference to self
+    Object___retain(value);
+    Object___retain((Object *) self);
+    if (index >= 0) {
+        Object___release(self->_slots[index].value);
+        self->_slots[index].value = value;
+        return self;
+    }
+
+    // Keys are VSOP strings, which are immutable, so they are not copied. If
+    // the table cannot grow (out of memory), the binding is dropped.
+    if (!reserve_one(self)) {
+        Object___release(value);
+        return self;
+    }
+    uint32_t free_index = find_free(self, hash);
+    if (self->_ctrl[free_index] == CTRL_EMPTY)
+        --self->_growth_left;
+    self->_ctrl[free_index] = hash_ctrl(hash);
+    self->_slots[free_index] = (StringMapSlot) {key, hash, length, value};
+    ++self->_size;
+    return self;
+}
+
+bool StringMap__contains(StringMap *self, const char *key) {
+    size_t length;
+    uint64_t hash = hash_key(key, &length);
+    return find(self, key, hash, length) >= 0;
+}
+
+bool StringMap__remove(StringMap *self, const char *key) {
+    size_t length;
+    uint64_t hash = hash_key(key, &length);
+    int64_t index = find(self, key, hash, length);
+    if (index < 0)
+        return false;
+
+    // A tombstone keeps the probe sequences going through this slot intact
+    self->_ctrl[index] = CTRL_DELETED;
+    Object___release(self->_slots[index].value);
+    self->_slots[index].value = NULL;
+    --self->_size;
+    return true;
+}
+
+int32_t StringMap__size(StringMap *self) {
+    return (int32_t) self->_size;
+}
+
+// Constructor ----------------------------------------------------------------
+
+StringMap *StringMap___new(void) {
+    StringMap *ret = Object___alloc(sizeof (StringMap));
+    return StringMap___init(ret);
+}
+
+StringMap *StringMap___init(StringMap *self) {
+    if (self) {
+        self->_vtable = &StringMap___vtable;
+        self->_refcount = 0;
+        // Storage is allocated on the first put()
+        self->_ctrl = NULL;
+        self->_slots = NULL;
+        self->_capacity = 0;
+        self->_size = 0;
+        self->_growth_left = 0;
+    }
+    return self;
+}
+
+// Releases the values, then frees the table and the map
+void StringMap___drop(Object *self) {
+    StringMap *map = (StringMap *) self;
+    for (uint32_t i = 0; i < map->_capacity; ++i) {
+        if (map->_ctrl[i] >= 0)
+            Object___release(map->_slots[i].value);
+    }
+    free(map->_ctrl);
+    free(map->_slots);
+    Object___free(self, sizeof (StringMap));
+}
+
+// Virtual function table instance --------------------------------------------
+
+const StringMapVTable StringMap___vtable = {
+    .print = &Object__print,
+    .printBool = &Object__printBool,
+    .printInt32 = &Object__printInt32,
+    .inputLine = &Object__inputLine,
+    .inputBool = &Object__inputBool,
+    .inputInt32 = &Object__inputInt32,
+    ._drop = &StringMap___drop,
+    .get = &StringMap__get,
+    .put = &StringMap__put,
+    .contains = &StringMap__contains,
+    .remove = &StringMap__remove,
+    .size = &StringMap__size
+};
@@ -0,0 +1,93 @@
+#ifndef STRINGMAP_H_
+#define STRINGMAP_H_
+
+#include "object.h"
+
+#include <stddef.h>
+
+// Forward declarations for mutually recursive types
+typedef struct StringMap StringMap;
+typedef struct StringMapVTable StringMapVTable;
+typedef struct StringMapSlot StringMapSlot;
+
+// Type for the built-in StringMap class, a hash table from strings to
+// objects. StringMap extends Object and cannot be extended itself, so the
+// compiler calls its methods directly, without going through the vtable.
+//
+// The table uses open addressing. Next to the slots, it keeps one control
+// byte per slot: either empty, deleted (a tombstone) or the low 7 bits of the
+// hash of the key stored in the slot. Lookups probe the control bytes a group
+// of 16 at a time (one SSE2 comparison on x86), and only compare keys of the
+// slots whose control byte matches.
+struct StringMap {
+    // Same layout as Object
+    const StringMapVTable *_vtable;
+    uint32_t _refcount;
+
+    // Control bytes (capacity of them), see above
+    int8_t *_ctrl;
+    // Slots (capacity of them)
+    StringMapSlot *_slots;
+    // Number of slots, a power of two and a multiple of the group size
+    uint32_t _capacity;
+    // Number of keys in the map
+    uint32_t _size;
+    // Number of empty slots that can still be used before growing
+    uint32_t _growth_left;
+};
+
+// Key/value pair stored in a slot. The hash and the length of the key are
+// cached, so that growing never hashes keys again and most mismatches are
+// found without reading the keys.
+struct StringMapSlot {
+    const char *key;
+    uint64_t hash;
+    size_t length;
+    Object *value;
+};
+
+// Type for StringMap's vtable. Starts with Object's methods, in the same order
+// as ObjectVTable, followed by StringMap's own methods.
+struct StringMapVTable {
+    Object *(*print)(Object *self, const char *s);
+    Object *(*printBool)(Object *self, bool b);
+    Object *(*printInt32)(Object *self, int32_t i);
+    char *(*inputLine)(Object *self);
+    bool (*inputBool)(Object *self);
+    int32_t (*inputInt32)(Object *self);
+    void (*_drop)(Object *self);
+
+    // Returns the value bound to the given key, or null (test with isnull) if
+    // there is none.
+    Object *(*get)(StringMap *self, const char *key);
+    // Binds the given key to the given value, replacing any previous binding.
+    // Returns self, so that calls can be chained.
+    StringMap *(*put)(StringMap *self, const char *key, Object *value);
+    // Returns whether the given key is bound.
+    bool (*contains)(StringMap *self, const char *key);
+    // Removes the binding of the given key. Returns whether there was one.
+    bool (*remove)(StringMap *self, const char *key);
+    // Returns the number of keys in the map.
+    int32_t (*size)(StringMap *self);
+};
+
+// StringMap's methods, for static dispatch
+Object *StringMap__get(StringMap *self, const char *key);
+StringMap *StringMap__put(StringMap *self, const char *key, Object *value);
+bool StringMap__contains(StringMap *self, const char *key);
+bool StringMap__remove(StringMap *self, const char *key);
+int32_t StringMap__size(StringMap *self);
+
+// StringMap's constructor. Allocates and initialize a new, empty StringMap.
+StringMap *StringMap___new(void);
+
+// StringMap's drop, see ObjectVTable.
+void StringMap___drop(Object *self);
+
+// StringMap's initializer. Initializes an allocated StringMap.
+StringMap *StringMap___init(StringMap *self);
+
+// StringMap's vtable instance, shared by all StringMap instances.
+extern const StringMapVTable StringMap___vtable;
+
+#endif // STRINGMAP_H_
@@ -0,0 +1,180 @@
+// vsopstat: print the metrics of running VSOP programs (see metrics.h).
+//
+//   vsopstat                     one line per program publishing metrics
+//   vsopstat <pid> [<seconds>]   all the metrics of a program, every given
+//                                number of seconds until it exits
+//
+// Programs publish their metrics when run with VSOP_METRICS=1. Reading them
+// does not stop nor slow down the program.
+
+#define _DEFAULT_SOURCE
+
+#include "metrics.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_DIR    "/dev/shm"
+#define SHM_PREFIX "vsop-"
+
+// Snapshot of a metrics file
+typedef struct {
+    VsopMetrics header;
+    uint64_t *calls;        // header.call_count of them
+    const char **names;
+    char *names_data;
+} Snapshot;
+
+static uint64_t load(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// Read the metrics file of the given process. Returns false if it has none
+// (or not one of this version).
+static bool read_snapshot(long pid, Snapshot *snapshot) {
+    char path[64];
+    snprintf(path, sizeof path, SHM_DIR "/" SHM_PREFIX "%ld", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof (VsopMetrics)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t) st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const VsopMetrics *metrics = map;
+    memset(snapshot, 0, sizeof *snapshot);
+    if (metrics->magic != VSOP_METRICS_MAGIC
+            || metrics->version != VSOP_METRICS_VERSION) {
+        munmap(map, size);
+        return false;
+    }
+    snapshot->header.magic = metrics->magic;
+    snapshot->header.version = metrics->version;
+    snapshot->header.pid = metrics->pid;
+    snapshot->header.objects_allocated = load(&metrics->objects_allocated);
+    snapshot->header.bytes_allocated = load(&metrics->bytes_allocated);
+    snapshot->header.objects_freed = load(&metrics->objects_freed);
+    snapshot->header.bytes_read = load(&metrics->bytes_read);
+    snapshot->header.bytes_written = load(&metrics->bytes_written);
+
+    // The call counters are only there once registered, and only if the
+    // mapping (taken from the size seen above) covers them
+    uint32_t count = __atomic_load_n(&metrics->call_count, __ATOMIC_ACQUIRE);
+    uint32_t names_size = metrics->names_size;
+    const uint64_t *calls = (const uint64_t *) (metrics + 1);
+    if (count > 0
+            && sizeof (VsopMetrics) + count * sizeof (uint64_t) + names_size
+               <= size) {
+        snapshot->calls = malloc(count * sizeof (uint64_t));
+        snapshot->names = malloc(count * sizeof (const char *));
+        snapshot->names_data = malloc(names_size);
+        if (snapshot->calls && snapshot->names && snapshot->names_data) {
+            memcpy(snapshot->names_data, calls + count, names_size);
+            const char *name = snapshot->names_data;
+            for (uint32_t i = 0; i < count; ++i) {
+                snapshot->calls[i] = load(&calls[i]);
+                snapshot->names[i] = name;
+                name += strlen(name) + 1;
+            }
+            snapshot->header.call_count = count;
+        }
+    }
+    munmap(map, size);
+    return true;
+}
+
+static void free_snapshot(Snapshot *snapshot) {
+    free(snapshot->calls);
+    free(snapshot->names);
+    free(snapshot->names_data);
+}
+
+// List the programs publishing metrics
+static int list_programs(void) {
+    DIR *dir = opendir(SHM_DIR);
+    if (!dir) {
+        perror(SHM_DIR);
+        return EXIT_FAILURE;
+    }
+    printf("%8s %14s %14s %14s %14s %14s %8s\n", "PID", "objects",
+           "bytes alloc", "freed", "bytes read", "bytes written", "alive");
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strncmp(entry->d_name, SHM_PREFIX, strlen(SHM_PREFIX)) != 0)
+            continue;
+        long pid = strtol(entry->d_name + strlen(SHM_PREFIX), NULL, 10);
+        Snapshot snapshot;
+        if (pid <= 0 || !read_snapshot(pid, &snapshot))
+            continue;
+        const VsopMetrics *m = &snapshot.header;
+        // A program that crashed leaves its file behind
+        bool alive = kill((pid_t) pid, 0) == 0;
+        printf("%8ld %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64
+               " %14" PRIu64 " %8s\n", pid, m->objects_allocated,
+               m->bytes_allocated, m->objects_freed, m->bytes_read,
+               m->bytes_written, alive ? "yes" : "no");
+        free_snapshot(&snapshot);
+    }
+    closedir(dir);
+    return EXIT_SUCCESS;
+}
+
+static void print_snapshot(const Snapshot *snapshot) {
+    const VsopMetrics *m = &snapshot->header;
+    printf("pid %" PRIu64 "\n", m->pid);
+    printf("  %16" PRIu64 "  objects allocated\n", m->objects_allocated);
+    printf("  %16" PRIu64 "  bytes allocated\n", m->bytes_allocated);
+    printf("  %16" PRIu64 "  objects freed\n", m->objects_freed);
+    printf("  %16" PRIu64 "  bytes read\n", m->bytes_read);
+    printf("  %16" PRIu64 "  bytes written\n", m->bytes_written);
+    for (uint32_t i = 0; i < m->call_count; ++i)
+        printf("  %16" PRIu64 "  calls of %s\n", snapshot->calls[i],
+               snapshot->names[i]);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    if (argc == 1)
+        return list_programs();
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [<pid> [<seconds>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    long pid = strtol(argv[1], NULL, 10);
+    unsigned interval = argc == 3 ? (unsigned) strtoul(argv[2], NULL, 10) : 0;
+    Snapshot snapshot;
+    if (!read_snapshot(pid, &snapshot)) {
+        fprintf(stderr, "%s: no metrics for process %ld (run it with "
+                        "VSOP_METRICS=1)\n", argv[0], pid);
+        return EXIT_FAILURE;
+    }
+    print_snapshot(&snapshot);
+    free_snapshot(&snapshot);
+
+    // The file disappears when the program exits
+    while (interval > 0) {
+        sleep(interval);
+        if (!read_snapshot(pid, &snapshot))
+            break;
+        print_snapshot(&snapshot);
+        free_snapshot(&snapshot);
+    }
+    return EXIT_SUCCESS;
+}